@@ -0,0 +1,378 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs the streaming and capture paths of the daemon against bench cameras, one path and one
+ * camera configuration at a time, and reports the frame rate, the latency percentiles of the
+ * last stage of the pipeline, the CPU use and the memory of the process for each:
+ *
+ *   dcm-bench -d 10 -m rtsp,udp "cam:size=1280x720,fps=60" "cam:size=1920x1080,format=uyvy"
+ *
+ * Nothing but the bench CameraDevice is simulated, the components are the ones of the daemon.
+ */
+
+#include <atomic>
+#include <getopt.h>
+#include <gst/gst.h>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "CameraComponent.h"
+#include "CameraDeviceBench.h"
+#include "StageStats.h"
+#include "glib_mainloop.h"
+#include "log.h"
+#include "mainloop.h"
+#include "util.h"
+
+#define DEFAULT_DURATION_S 10
+#define DEFAULT_WARMUP_S 2
+#define DEFAULT_OUTPUT_DIR "/tmp/dcm-bench/"
+
+enum Mode { MODE_RTSP = 0, MODE_UDP, MODE_IMAGE, MODE_VIDEO, MODES };
+static const char *sModeNames[MODES] = {"rtsp", "udp", "image", "video"};
+
+struct options {
+    unsigned int duration;
+    unsigned int warmup;
+    bool modes[MODES];
+    std::string outputDir;
+    std::vector<std::string> specs;
+};
+
+struct Sample {
+    usec_t wall;
+    usec_t cpu; /* user and system time of the process */
+};
+
+static void help(FILE *fp)
+{
+    fprintf(fp,
+            "%s [OPTIONS...] [SPEC...]\n\n"
+            "  -d --duration <sec>    Time each configuration is measured, default %d\n"
+            "  -w --warmup <sec>      Time each configuration runs before, default %d\n"
+            "  -m --modes <list>      Comma separated paths to run: rtsp, udp, image, video\n"
+            "  -o --output <dir/>     Where images and videos are written, default %s\n"
+            "  -h --help              Print this message\n\n"
+            "A SPEC is camera:size=WxH,format=grey|yuv420|nv12|uyvy|yuyv|rgb24,fps=N,\n"
+            "jitter_ms=N,drop_pct=N, all optional. The default is a single 640x360 yuv420\n"
+            "camera at 30fps.\n",
+            program_invocation_short_name, DEFAULT_DURATION_S, DEFAULT_WARMUP_S,
+            DEFAULT_OUTPUT_DIR);
+}
+
+static int parse_modes(const char *list, bool *modes)
+{
+    std::string s = list;
+    size_t pos = 0;
+
+    memset(modes, 0, sizeof(bool) * MODES);
+    while (pos <= s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos)
+            end = s.size();
+        std::string name = s.substr(pos, end - pos);
+        pos = end + 1;
+
+        int m = 0;
+        while (m < MODES && name != sModeNames[m])
+            m++;
+        if (m == MODES) {
+            log_error("Unknown mode %s", name.c_str());
+            return -EINVAL;
+        }
+        modes[m] = true;
+    }
+
+    return 0;
+}
+
+static int parse_argv(int argc, char *argv[], struct options &opt)
+{
+    static const struct option options[] = {{"duration", required_argument, NULL, 'd'},
+                                            {"warmup", required_argument, NULL, 'w'},
+                                            {"modes", required_argument, NULL, 'm'},
+                                            {"output", required_argument, NULL, 'o'},
+                                            {"help", no_argument, NULL, 'h'},
+                                            {}};
+    int c;
+
+    while ((c = getopt_long(argc, argv, "d:w:m:o:h", options, NULL)) >= 0) {
+        switch (c) {
+        case 'd':
+            opt.duration = atoi(optarg);
+            break;
+        case 'w':
+            opt.warmup = atoi(optarg);
+            break;
+        case 'm':
+            if (parse_modes(optarg, opt.modes))
+                return -EINVAL;
+            break;
+        case 'o':
+            opt.outputDir = optarg;
+            if (opt.outputDir.back() != '/')
+                opt.outputDir += '/';
+            break;
+        case 'h':
+            help(stdout);
+            return 0;
+        default:
+            help(stderr);
+            return -EINVAL;
+        }
+    }
+
+    if (!opt.duration) {
+        log_error("Duration must be at least a second");
+        return -EINVAL;
+    }
+
+    for (int i = optind; i < argc; i++)
+        opt.specs.push_back(argv[i]);
+    if (opt.specs.empty())
+        opt.specs.push_back("bench");
+
+    return 2;
+}
+
+static Sample sample()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    Sample s;
+    s.wall = now_usec();
+    s.cpu = ru.ru_utime.tv_sec * USEC_PER_SEC + ru.ru_utime.tv_usec
+        + ru.ru_stime.tv_sec * USEC_PER_SEC + ru.ru_stime.tv_usec;
+    return s;
+}
+
+static unsigned long rss_kb()
+{
+    unsigned long pages = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (fp) {
+        if (fscanf(fp, "%*s %lu", &pages) != 1)
+            pages = 0;
+        fclose(fp);
+    }
+
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static bool quit_cb(void *data)
+{
+    Mainloop::get_mainloop()->quit();
+    return false;
+}
+
+static void run_for(unsigned int sec)
+{
+    Mainloop::get_mainloop()->add_timeout(sec * MSEC_PER_SEC, quit_cb, nullptr);
+    Mainloop::get_mainloop()->loop();
+}
+
+/* client of the RTSP stream, so that the media is prepared and frames are pulled */
+static GstElement *start_rtsp_client(const VideoStreamInfo &info)
+{
+    std::string launch = "rtspsrc location=rtsp://127.0.0.1:" + std::to_string(info.port)
+        + info.path + " latency=0 ! fakesink sync=false";
+
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(launch.c_str(), &error);
+    if (!pipeline) {
+        log_error("Error in creating RTSP client: %s", error ? error->message : "unknown");
+        if (error)
+            g_error_free(error);
+        return nullptr;
+    }
+    if (error)
+        g_error_free(error);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    return pipeline;
+}
+
+static int start_mode(Mode mode, CameraComponent &comp, uint32_t fps, GstElement **client,
+                      std::atomic<uint64_t> &shots)
+{
+    switch (mode) {
+    case MODE_RTSP: {
+        if (comp.startVideoStream(false))
+            return -1;
+        VideoStreamInfo info;
+        comp.getVideoStreamInfo(info);
+        *client = start_rtsp_client(info);
+        return *client ? 0 : -1;
+    }
+    case MODE_UDP:
+        return comp.startVideoStream(true);
+    case MODE_IMAGE:
+        /* a shot per frame, the interval is in ms */
+        return comp.startImageCapture(std::max<uint32_t>(1, 1000 / fps), 0,
+                                      [&shots](int result, int seq_num, uint64_t timestamp) {
+                                          if (!result)
+                                              shots++;
+                                      });
+    case MODE_VIDEO:
+        return comp.startVideoCapture(0);
+    default:
+        return -1;
+    }
+}
+
+static void stop_mode(Mode mode, CameraComponent &comp, GstElement *client)
+{
+    if (client) {
+        gst_element_set_state(client, GST_STATE_NULL);
+        gst_object_unref(client);
+    }
+
+    switch (mode) {
+    case MODE_RTSP:
+    case MODE_UDP:
+        comp.stopVideoStream();
+        break;
+    case MODE_IMAGE:
+        comp.stopImageCapture();
+        break;
+    case MODE_VIDEO:
+        comp.stopVideoCapture();
+        break;
+    default:
+        break;
+    }
+}
+
+static void report(const std::string &spec, Mode mode, const StageStats &stats, uint64_t shots,
+                   const Sample &start, const Sample &end)
+{
+    double sec = (double)(end.wall - start.wall) / USEC_PER_SEC;
+
+    /* the last stage of the path run is where its frames end up */
+    StageStats::Stage last = StageStats::READ;
+    for (int i = StageStats::STAGES - 1; i > 0; i--) {
+        if (stats.getHistogram((StageStats::Stage)i).getCount()) {
+            last = (StageStats::Stage)i;
+            break;
+        }
+    }
+
+    LatencyHistogram::Summary s;
+    stats.getHistogram(last).summarize(s);
+    uint64_t out = mode == MODE_IMAGE ? shots : s.count;
+
+    printf("%-40s %-5s %7.1f %7.1f %6llu %-9s %7.2f %7.2f %7.2f %6.1f %8lu\n", spec.c_str(),
+           sModeNames[mode], stats.getFrameCount() / sec, out / sec,
+           (unsigned long long)stats.getDropCount(), StageStats::getStageName(last),
+           s.p50 / 1000.0, s.p90 / 1000.0, s.p99 / 1000.0,
+           100.0 * (end.cpu - start.cpu) / (end.wall - start.wall), rss_kb());
+    fflush(stdout);
+}
+
+static int run(const struct options &opt, const std::string &spec, Mode mode, int index)
+{
+    std::string id;
+    BenchSettings settings;
+    if (!CameraDeviceBench::parseSpec(spec, id, settings))
+        return -EINVAL;
+
+    /* a camera of its own for each run, so the statistics start from nothing */
+    id += "-" + std::to_string(index);
+
+    /* outlives the component, whose capture threads report to it */
+    std::atomic<uint64_t> shots(0);
+    std::shared_ptr<CameraDevice> device = std::make_shared<CameraDeviceBench>(id, settings);
+    std::unique_ptr<CameraComponent> comp(new CameraComponent(device));
+    comp->setImageCaptureLocation(opt.outputDir);
+    comp->setVideoCaptureLocation(opt.outputDir);
+    if (comp->start()) {
+        log_error("Error in starting camera component %s", id.c_str());
+        return -1;
+    }
+
+    GstElement *client = nullptr;
+    int ret = start_mode(mode, *comp, settings.frameRate, &client, shots);
+    if (ret) {
+        log_error("Error in starting %s on %s", sModeNames[mode], id.c_str());
+        stop_mode(mode, *comp, client);
+        comp->stop();
+        return -1;
+    }
+
+    StageStats *stats = StageStats::get(id);
+    if (opt.warmup)
+        run_for(opt.warmup);
+    stats->reset();
+    shots = 0;
+    Sample start = sample();
+
+    run_for(opt.duration);
+
+    Sample end = sample();
+    report(spec, mode, *stats, shots, start, end);
+
+    stop_mode(mode, *comp, client);
+    comp->stop();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct options opt = {};
+    opt.duration = DEFAULT_DURATION_S;
+    opt.warmup = DEFAULT_WARMUP_S;
+    opt.outputDir = DEFAULT_OUTPUT_DIR;
+    for (bool &m : opt.modes)
+        m = true;
+
+    Log::open();
+    Log::set_max_level(Log::Level::WARNING);
+    gst_init(&argc, &argv);
+    GlibMainloop mainloop;
+
+    int ret = parse_argv(argc, argv, opt);
+    if (ret != 2) {
+        Log::close();
+        return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    mkdir(opt.outputDir.c_str(), 0755);
+
+    printf("%-40s %-5s %7s %7s %6s %-9s %7s %7s %7s %6s %8s\n", "config", "mode", "cam_fps",
+           "out_fps", "drops", "stage", "p50_ms", "p90_ms", "p99_ms", "cpu%", "rss_kb");
+
+    int index = 0, failed = 0;
+    for (const std::string &spec : opt.specs) {
+        for (int m = 0; m < MODES; m++) {
+            if (opt.modes[m] && run(opt, spec, (Mode)m, index++))
+                failed++;
+        }
+    }
+
+    Log::close();
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -16,15 +16,16 @@
  * limitations under the License.
  */
 
+#include <cerrno>
 #include <cstring>
 #include <iostream>
 #include <linux/videodev2.h>
-#include <malloc.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 #include "CameraDeviceAeroAtomIsp.h"
 #include "log.h"
+#include "util.h"
 #include "v4l2_interface.h"
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
@@ -33,19 +34,20 @@
 #define AERO_DEFAULT_HEIGHT 480
 #define AERO_DEFAULT_FRAME_RATE 30
 #define AERO_DEFAULT_BUFFER_COUNT 4
+#define AERO_MIN_BUFFER_COUNT 2
 
 CameraDeviceAeroAtomIsp::CameraDeviceAeroAtomIsp(std::string device)
     : mDeviceId(device)
     , mState(State::STATE_IDLE)
     , mWidth(AERO_DEFAULT_WIDTH)
     , mHeight(AERO_DEFAULT_HEIGHT)
+    , mStride(0)
     , mPixelFormat(CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY)
     , mMode(CameraParameters::Mode::MODE_VIDEO)
     , mFrmRate(AERO_DEFAULT_FRAME_RATE)
     , mCamDefUri{}
     , mFd(-1)
-    , mFrameBuffer(nullptr)
-    , mFrameBufferSize(0)
+    , mRing(nullptr)
     , mFrameBufferCnt(AERO_DEFAULT_BUFFER_COUNT)
 {
     log_info("%s path:%s", __func__, mDeviceId.c_str());
@@ -156,12 +158,7 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::init()
         goto error;
 
     /* Set Image Format */
-    ret = v4l2_set_pixformat(mFd, mWidth, mHeight, V4L2_PIX_FMT_UYVY);
-    if (ret)
-        goto error;
-
-    /* Allocate User buffer */
-    ret = allocFrameBuffer(mFrameBufferCnt, mWidth * mHeight * 2);
+    ret = v4l2_set_pixformat(mFd, mWidth, mHeight, V4L2_PIX_FMT_UYVY, mStride);
     if (ret)
         goto error;
 
@@ -182,13 +179,13 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::uninit()
     if (getState() != State::STATE_IDLE)
         return Status::INVALID_STATE;
 
+    /* Buffers still held by consumers are freed when they are released */
+    mRing.reset();
+
     /* Close the Camera Device */
     v4l2_close(mFd);
     mFd = -1;
 
-    /* Free User buffer */
-    freeFrameBuffer();
-
     setState(State::STATE_INIT);
     return Status::SUCCESS;
 }
@@ -206,22 +203,44 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::start()
 
     int ret = 0;
 
-    /* request buffer */
-    ret = v4l2_buf_req(mFd, 4);
-    if (ret)
-        return Status::ERROR_UNKNOWN;
+    /* the ring of a previous start is kept, the driver can not free buffers held by consumers */
+    if (!mRing) {
+        /* request buffers, driver allocated if possible else user allocated */
+        uint32_t count = mFrameBufferCnt;
+        ret = allocMmapBuffers(count);
+        if (ret == -EINVAL) {
+            log_info("MMAP not supported, using user pointer buffers");
+            count = mFrameBufferCnt;
+            ret = allocUserBuffers(count, mWidth * mHeight * 2);
+        }
+        if (ret) {
+            log_error("Unable to allocate %u buffers: %s", mFrameBufferCnt, strerror(-ret));
+            return Status::NO_MEMORY;
+        }
 
-    struct v4l2_buffer buf;
-    CLEAR(buf);
-    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_USERPTR;
-    for (uint8_t i = 0; i < 4; i++) {
-        buf.index = i;
-        buf.m.userptr = (unsigned long)mFrameBuffer[i];
-        buf.length = mFrameBufferSize;
-        ret = v4l2_buf_q(mFd, &buf);
-        if (ret)
-            return Status::ERROR_UNKNOWN;
+        if (count != mFrameBufferCnt)
+            log_warning("Driver allocated %u buffers instead of %u", count, mFrameBufferCnt);
+    }
+
+    {
+        std::lock_guard<std::mutex> ringLock(mRing->lock);
+        for (uint32_t i = 0; i < mRing->addr.size(); i++) {
+            /* queued when the consumer releases it */
+            if (mRing->out[i])
+                continue;
+
+            if (mRing->memory == V4L2_MEMORY_USERPTR)
+                ret = v4l2_buf_q(mFd, i, (unsigned long)mRing->addr[i], mRing->length[i]);
+            else
+                ret = v4l2_buf_q(mFd, i, mRing->memory);
+            if (ret) {
+                /* take back the buffers queued so far */
+                v4l2_streamoff(mFd);
+                return Status::ERROR_UNKNOWN;
+            }
+            mRing->queued++;
+        }
+        mRing->active = true;
     }
 
     ret = v4l2_streamon(mFd);
@@ -244,8 +263,17 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::stop()
      * Undo whatever was done in start() call.
      */
 
+    {
+        std::lock_guard<std::mutex> ringLock(mRing->lock);
+        mRing->active = false;
+    }
     v4l2_streamoff(mFd);
 
+    log_info("%s buffers:%zu queued:%llu dequeued:%llu held:%u dropped:%llu", mDeviceId.c_str(),
+             mRing->addr.size(), (unsigned long long)mRing->queued.load(),
+             (unsigned long long)mRing->dequeued.load(), mRing->held.load(),
+             (unsigned long long)mRing->dropped.load());
+
     setState(State::STATE_INIT);
     return Status::SUCCESS;
 }
@@ -270,21 +298,31 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::read(CameraData &data)
 
     /* dequeue buffer */
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = V4L2_MEMORY_USERPTR;
+    buf.memory = mRing->memory;
     ret = v4l2_buf_dq(mFd, &buf);
     if (ret) {
         log_error("Error in dq buffer");
         return Status::ERROR_UNKNOWN;
     }
 
-    if (!buf.m.userptr) {
-        log_error("Null buffer returned");
+    if (buf.index >= mRing->addr.size()) {
+        log_error("Invalid buffer returned");
         return Status::ERROR_UNKNOWN;
     }
 
+    /* driver skips sequence numbers for frames it had no free buffer for */
+    if (mRing->dequeued && buf.sequence > mRing->lastSequence + 1)
+        mRing->dropped += buf.sequence - mRing->lastSequence - 1;
+    mRing->lastSequence = buf.sequence;
+    mRing->dequeued++;
+    mRing->held++;
+    {
+        std::lock_guard<std::mutex> ringLock(mRing->lock);
+        mRing->out[buf.index] = true;
+    }
+
     /* TODO:: Check if buffer valid */
     /* TODO:: Check if there is need to change format or size */
-    /* TODO:: Use v4l2 buffer timestamp instead for more accuracy */
 
     struct timeval timeofday;
     gettimeofday(&timeofday, NULL);
@@ -293,16 +331,24 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::read(CameraData &data)
     data.nsec = timeofday.tv_usec * 1000;
     data.width = mWidth;
     data.height = mHeight;
-    data.stride = mWidth * 2; /* TODO :: Dependent on pixformat */
-    data.buf = (void *)buf.m.userptr;
+    data.format = mPixelFormat;
+    /* lines padded by the ISP are read in place */
+    data.setPlanes(mStride);
+    data.buf = mRing->addr[buf.index];
     data.bufSize = buf.bytesused;
-
-    /* queue buffer for refill */
-    ret = v4l2_buf_q(mFd, &buf);
-    if (ret) {
-        log_error("Error in enq buffer");
-        return Status::ERROR_UNKNOWN;
-    }
+    data.fd = mRing->dmabuf[buf.index];
+    data.seq = buf.sequence;
+    /* driver stamps the buffer when capture starts, use it if on the monotonic clock */
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+        data.timestamp
+            = buf.timestamp.tv_sec * NSEC_PER_SEC + buf.timestamp.tv_usec * NSEC_PER_USEC;
+    else
+        data.timestamp = now_usec() * NSEC_PER_USEC;
+
+    /* buffer is queued for refill once the consumer is done with it */
+    std::shared_ptr<BufferRing> ring = mRing;
+    uint32_t index = buf.index;
+    data.release = [ring, index]() { ring->requeue(index); };
 
     return Status::SUCCESS;
 }
@@ -440,6 +486,13 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::setFrameRate(const uint32_t fps)
      * 1. Set the frame rate of the camera device.
      */
 
+    if (getState() == State::STATE_RUN)
+        return Status::INVALID_STATE;
+
+    if (fps == 0)
+        return Status::INVALID_ARGUMENT;
+
+    mFrmRate = fps;
     return Status::SUCCESS;
 }
 
@@ -449,6 +502,7 @@ CameraDevice::Status CameraDeviceAeroAtomIsp::getFrameRate(uint32_t &fps) const
      * 1. Get the frame rate of the camera device.
      */
 
+    fps = mFrmRate;
     return Status::SUCCESS;
 }
 
@@ -487,6 +541,46 @@ std::string CameraDeviceAeroAtomIsp::getCameraDefinitionUri() const
     return mCamDefUri;
 }
 
+CameraDevice::Status CameraDeviceAeroAtomIsp::setBufferCount(const uint32_t count)
+{
+    /*
+     * 1. Set the depth of the V4L2 buffer ring, takes effect on next start.
+     */
+
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (getState() == State::STATE_RUN)
+        return Status::INVALID_STATE;
+
+    if (count < AERO_MIN_BUFFER_COUNT)
+        return Status::INVALID_ARGUMENT;
+
+    /* a new ring is allocated on next start */
+    if (count != mFrameBufferCnt)
+        mRing.reset();
+
+    mFrameBufferCnt = count;
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceAeroAtomIsp::getBufferStats(BufferStats &stats) const
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    stats = BufferStats();
+    if (!mRing) {
+        stats.count = mFrameBufferCnt;
+        return Status::SUCCESS;
+    }
+
+    stats.count = mRing->addr.size();
+    stats.queued = mRing->queued;
+    stats.dequeued = mRing->dequeued;
+    stats.held = mRing->held;
+    stats.dropped = mRing->dropped;
+    return Status::SUCCESS;
+}
+
 CameraDevice::Status CameraDeviceAeroAtomIsp::setState(const CameraDevice::State state)
 {
     Status ret = Status::SUCCESS;
@@ -536,55 +630,113 @@ CameraDevice::State CameraDeviceAeroAtomIsp::getState() const
     return mState;
 }
 
-int CameraDeviceAeroAtomIsp::allocFrameBuffer(int bufCnt, size_t bufSize)
+int CameraDeviceAeroAtomIsp::allocMmapBuffers(uint32_t &bufCnt)
 {
     log_debug("%s count:%d", __func__, bufCnt);
 
-    int ret = -1;
+    int ret = v4l2_buf_req(mFd, bufCnt, V4L2_MEMORY_MMAP);
+    if (ret)
+        return ret;
+
+    std::shared_ptr<BufferRing> ring = std::make_shared<BufferRing>();
+    ring->fd = mFd;
+    ring->memory = V4L2_MEMORY_MMAP;
+    for (uint32_t i = 0; i < bufCnt; i++) {
+        struct v4l2_buffer buf;
+        ret = v4l2_query_buf(mFd, i, V4L2_MEMORY_MMAP, buf);
+        if (ret)
+            return -EIO;
+
+        void *addr = v4l2_buf_mmap(mFd, buf);
+        if (!addr)
+            return -EIO;
+
+        ring->addr.push_back(addr);
+        ring->length.push_back(buf.length);
+        /* export as dmabuf so that consumers can import the buffer without a copy */
+        ring->dmabuf.push_back(v4l2_buf_export(mFd, i));
+        ring->out.push_back(false);
+    }
+
+    mRing = ring;
+    return 0;
+}
+
+int CameraDeviceAeroAtomIsp::allocUserBuffers(uint32_t &bufCnt, size_t bufSize)
+{
+    log_debug("%s count:%d", __func__, bufCnt);
 
     /* Check for valid input */
     if (!bufCnt || !bufSize)
+        return -EINVAL;
+
+    /* page-aligned as the driver needs, the pool may give fewer buffers to fit its cap */
+    std::shared_ptr<FramePool> pool = FramePool::create(mDeviceId, bufSize, bufCnt);
+    if (!pool) {
+        log_error("Frame buffer allocation failure");
+        return -ENOMEM;
+    }
+    bufCnt = pool->getCount();
+
+    int ret = v4l2_buf_req(mFd, bufCnt, V4L2_MEMORY_USERPTR);
+    if (ret)
         return ret;
 
-    int pageSize = getpagesize();
-    size_t bufLen = (bufSize + pageSize - 1) & ~(pageSize - 1);
-    log_debug("pagesize=%i buffer_len=%li", pageSize, bufLen);
-
-    mFrameBuffer = (void **)calloc(bufCnt, sizeof(void *));
-    for (int i = 0; i < bufCnt; i++) {
-        mFrameBuffer[i] = memalign(pageSize, bufLen);
-        if (!mFrameBuffer[i]) {
-            log_error("memalign failure");
-            while (i) {
-                i--;
-                free(mFrameBuffer[i]);
-                mFrameBuffer[i] = NULL;
-            }
-            break;
+    std::shared_ptr<BufferRing> ring = std::make_shared<BufferRing>();
+    ring->fd = mFd;
+    ring->memory = V4L2_MEMORY_USERPTR;
+    for (uint32_t i = 0; i < bufCnt; i++) {
+        /* the driver may ask for more buffers than the pool has, or a previous ring still holds
+         * some of them */
+        std::shared_ptr<uint8_t> buf = pool->acquire();
+        if (!buf) {
+            log_error("Frame buffer pool gave %u of %u buffers", i, bufCnt);
+            uint32_t none = 0;
+            v4l2_buf_req(mFd, none, V4L2_MEMORY_USERPTR);
+            return -ENOMEM;
         }
-
-        ret = 0;
+        ring->addr.push_back(buf.get());
+        ring->length.push_back(bufSize);
+        ring->dmabuf.push_back(-1);
+        ring->userBufs.push_back(buf);
+        ring->out.push_back(false);
     }
 
-    mFrameBufferSize = bufLen;
+    mRing = ring;
     log_debug("%s Exit", __func__);
-    return ret;
+    return 0;
 }
 
-int CameraDeviceAeroAtomIsp::freeFrameBuffer()
+CameraDeviceAeroAtomIsp::BufferRing::~BufferRing()
 {
-    log_debug("%s", __func__);
-
-    if (!mFrameBuffer)
-        return 0;
+    for (size_t i = 0; i < addr.size(); i++) {
+        /* user pointer buffers go back to the pool with userBufs */
+        if (memory == V4L2_MEMORY_MMAP)
+            v4l2_buf_munmap(addr[i], length[i]);
 
-    for (uint8_t i = 0; i < mFrameBufferCnt; i++) {
-        free(mFrameBuffer[i]);
+        if (dmabuf[i] >= 0)
+            close(dmabuf[i]);
     }
-    free(mFrameBuffer);
-    mFrameBuffer = NULL;
+}
 
-    return 0;
+void CameraDeviceAeroAtomIsp::BufferRing::requeue(uint32_t index)
+{
+    std::lock_guard<std::mutex> locker(lock);
+
+    held--;
+    out[index] = false;
+
+    /* the driver has taken back all the buffers on stream off */
+    if (!active)
+        return;
+
+    int ret;
+    if (memory == V4L2_MEMORY_USERPTR)
+        ret = v4l2_buf_q(fd, index, (unsigned long)addr[index], length[index]);
+    else
+        ret = v4l2_buf_q(fd, index, memory);
+    if (!ret)
+        queued++;
 }
 
 int CameraDeviceAeroAtomIsp::pollCamera(int fd)
@@ -612,13 +764,11 @@ int CameraDeviceAeroAtomIsp::pollCamera(int fd)
             break;
         }
 
-        if (0 == r && mState == State::STATE_RUN) {
+        if (0 == r) {
+            /* all the buffers may be held by consumers, let the caller retry */
             log_error("select timeout");
-            stop();
-            uninit();
-            init();
-            start();
-            continue;
+            ret = -1;
+            break;
         }
 
         ret = 0;
@@ -17,12 +17,14 @@
  */
 #pragma once
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 
 #include "CameraDevice.h"
 #include "CameraParameters.h"
+#include "FramePool.h"
 
 class CameraDeviceAeroAtomIsp final : public CameraDevice {
 public:
@@ -53,25 +55,51 @@ public:
     Status getSupportedFrameRates(uint32_t &minFps, uint32_t &maxFps) const;
     Status setCameraDefinitionUri(const std::string uri);
     std::string getCameraDefinitionUri() const;
+    Status setBufferCount(const uint32_t count);
+    Status getBufferStats(BufferStats &stats) const;
 
 private:
+    /*
+     * Buffers shared with the driver. A dequeued buffer goes back to the driver only when the
+     * consumer releases it. The ring is kept across stop and start, and outlives the device for
+     * buffers still held by consumers.
+     */
+    struct BufferRing {
+        ~BufferRing();
+        void requeue(uint32_t index);
+        std::mutex lock;
+        int fd = -1;
+        uint32_t memory = 0;
+        bool active = false; /* buffers may be given back to the driver */
+        std::vector<void *> addr;
+        std::vector<size_t> length;
+        std::vector<int> dmabuf;
+        std::vector<std::shared_ptr<uint8_t>> userBufs; /* user pointer buffers from the pool */
+        std::vector<bool> out; /* dequeued and not released by the consumer yet */
+        std::atomic<uint64_t> queued{0};
+        std::atomic<uint64_t> dequeued{0};
+        std::atomic<uint32_t> held{0};
+        std::atomic<uint64_t> dropped{0};
+        uint32_t lastSequence = 0; /* only used by the reading thread */
+    };
+
     CameraDevice::Status init();
     Status setState(const CameraDevice::State state);
     CameraDevice::State getState() const;
-    int allocFrameBuffer(int bufCnt, size_t bufSize);
-    int freeFrameBuffer();
+    int allocMmapBuffers(uint32_t &bufCnt);
+    int allocUserBuffers(uint32_t &bufCnt, size_t bufSize);
     int pollCamera(int fd);
     std::string mDeviceId;
     std::atomic<CameraDevice::State> mState;
     uint32_t mWidth;
     uint32_t mHeight;
+    uint32_t mStride; /* Bytes per line of the frames, as set by the driver */
     CameraParameters::PixelFormat mPixelFormat;
     CameraParameters::Mode mMode;
     uint32_t mFrmRate;
     std::string mCamDefUri;
-    std::mutex mLock;
+    mutable std::mutex mLock;
     int mFd;
-    void **mFrameBuffer;
-    size_t mFrameBufferSize;
+    std::shared_ptr<BufferRing> mRing;
     uint32_t mFrameBufferCnt;
 };
@@ -25,6 +25,14 @@ static PluginAeroAtomIsp aero;
 
 PluginAeroAtomIsp::PluginAeroAtomIsp()
     : PluginBase()
+{
+}
+
+PluginAeroAtomIsp::~PluginAeroAtomIsp()
+{
+}
+
+void PluginAeroAtomIsp::init()
 {
     /*
      * 1. Discover the list of camera devices for this Plugin Class
@@ -34,10 +42,6 @@ PluginAeroAtomIsp::PluginAeroAtomIsp()
     discoverCameras(mCamList);
 }
 
-PluginAeroAtomIsp::~PluginAeroAtomIsp()
-{
-}
-
 std::vector<std::string> PluginAeroAtomIsp::getCameraDevices()
 {
     return mCamList;
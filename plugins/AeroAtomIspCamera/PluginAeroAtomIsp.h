@@ -28,6 +28,7 @@ public:
     PluginAeroAtomIsp();
     ~PluginAeroAtomIsp();
 
+    void init();
     std::vector<std::string> getCameraDevices();
     std::shared_ptr<CameraDevice> createCameraDevice(std::string);
 
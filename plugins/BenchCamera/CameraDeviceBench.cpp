@@ -0,0 +1,469 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <chrono>
+#include <cstring>
+#include <stdlib.h>
+#include <thread>
+
+#include "CameraDeviceBench.h"
+#include "log.h"
+
+#define MAX_FRAME_RATE 240
+#define BARS 8
+
+/* white, yellow, cyan, green, magenta, red, blue, black */
+static const uint8_t sBarsRgb[BARS][3] = {{235, 235, 235}, {235, 235, 16}, {16, 235, 235},
+                                          {16, 235, 16},   {235, 16, 235}, {235, 16, 16},
+                                          {16, 16, 235},   {16, 16, 16}};
+
+static const struct {
+    const char *name;
+    CameraParameters::PixelFormat format;
+} sFormats[] = {
+    {"grey", CameraParameters::PixelFormat::PIXEL_FORMAT_GREY},
+    {"yuv420", CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420},
+    {"uyvy", CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY},
+    {"nv12", CameraParameters::PixelFormat::PIXEL_FORMAT_NV12},
+    {"yuyv", CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV},
+    {"rgb24", CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24},
+};
+
+/* BT.601 */
+static void rgbToYuv(const uint8_t *rgb, uint8_t &y, uint8_t &u, uint8_t &v)
+{
+    int r = rgb[0], g = rgb[1], b = rgb[2];
+
+    y = (uint8_t)(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+    u = (uint8_t)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+    v = (uint8_t)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+}
+
+CameraDeviceBench::CameraDeviceBench(std::string device, const BenchSettings &settings)
+    : mDeviceId(device)
+    , mState(State::STATE_IDLE)
+    , mSettings(settings)
+    , mMode(CameraParameters::Mode::MODE_VIDEO)
+    , mCamDefUri{}
+    , mSeq(0)
+    , mNextFrame(0)
+    , mRandom(std::hash<std::string>()(device))
+{
+    log_info("%s path:%s %ux%u@%u jitter:%ums drop:%.1f%%", __func__, mDeviceId.c_str(),
+             mSettings.width, mSettings.height, mSettings.frameRate, mSettings.jitterMs,
+             mSettings.dropPct);
+}
+
+CameraDeviceBench::~CameraDeviceBench()
+{
+    stop();
+    uninit();
+}
+
+std::string CameraDeviceBench::getDeviceId() const
+{
+    return mDeviceId;
+}
+
+CameraDevice::Status CameraDeviceBench::getInfo(CameraInfo &camInfo) const
+{
+    strcpy((char *)camInfo.vendorName, "Bench");
+    strcpy((char *)camInfo.modelName, "Bench-Camera");
+    camInfo.firmware_version = 1;
+    camInfo.focal_length = 0;
+    camInfo.sensor_size_h = 0;
+    camInfo.sensor_size_v = 0;
+    camInfo.resolution_h = mSettings.width;
+    camInfo.resolution_v = mSettings.height;
+    camInfo.lens_id = 0;
+    camInfo.flags = ~0u;
+    camInfo.cam_definition_version = 1;
+    if (!mCamDefUri.empty()) {
+        if (sizeof(camInfo.cam_definition_uri) > mCamDefUri.size()) {
+            strcpy((char *)camInfo.cam_definition_uri, mCamDefUri.c_str());
+        } else {
+            log_error("URI length bigger than permitted");
+        }
+    }
+    return CameraDevice::Status::SUCCESS;
+}
+
+bool CameraDeviceBench::isGstV4l2Src() const
+{
+    return false;
+}
+
+CameraDevice::Status CameraDeviceBench::init(CameraParameters &camParam)
+{
+    camParam.setParameter(CameraParameters::CAMERA_MODE, (uint32_t)mMode);
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::uninit()
+{
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::start()
+{
+    if (mState == State::STATE_RUN)
+        return Status::INVALID_STATE;
+
+    /* rendered here so the size and format may change while idle */
+    renderPatterns();
+    mNextFrame = now_usec();
+    mState = State::STATE_RUN;
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::stop()
+{
+    mState = State::STATE_IDLE;
+    return Status::SUCCESS;
+}
+
+size_t CameraDeviceBench::getFrameSize() const
+{
+    size_t pixels = (size_t)mSettings.width * mSettings.height;
+
+    switch (mSettings.pixelFormat) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return pixels;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        return pixels * 2;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        return pixels * 3;
+    default:
+        return pixels * 3 / 2;
+    }
+}
+
+/* color bars moving by a 1/PATTERNS of the width at each frame */
+void CameraDeviceBench::renderPatterns()
+{
+    const uint32_t w = mSettings.width, h = mSettings.height;
+    uint8_t y[BARS], u[BARS], v[BARS];
+
+    for (int b = 0; b < BARS; b++)
+        rgbToYuv(sBarsRgb[b], y[b], u[b], v[b]);
+
+    mPatterns.clear();
+    for (int i = 0; i < PATTERNS; i++) {
+        std::shared_ptr<Pattern> p = std::make_shared<Pattern>(getFrameSize());
+        uint8_t *data = p->data();
+        uint32_t offset = i * w / PATTERNS;
+        std::vector<uint8_t> bars(w);
+        for (uint32_t x = 0; x < w; x++)
+            bars[x] = ((x + offset) % w) * BARS / w;
+
+        switch (mSettings.pixelFormat) {
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+            for (uint32_t x = 0; x < w; x++)
+                data[x] = y[bars[x]];
+            for (uint32_t row = 1; row < h; row++)
+                memcpy(data + row * w, data, w);
+            break;
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+            for (uint32_t x = 0; x + 1 < w; x += 2) {
+                data[x * 2] = u[bars[x]];
+                data[x * 2 + 1] = y[bars[x]];
+                data[x * 2 + 2] = v[bars[x]];
+                data[x * 2 + 3] = y[bars[x + 1]];
+            }
+            for (uint32_t row = 1; row < h; row++)
+                memcpy(data + row * w * 2, data, w * 2);
+            break;
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+            for (uint32_t x = 0; x + 1 < w; x += 2) {
+                data[x * 2] = y[bars[x]];
+                data[x * 2 + 1] = u[bars[x]];
+                data[x * 2 + 2] = y[bars[x + 1]];
+                data[x * 2 + 3] = v[bars[x]];
+            }
+            for (uint32_t row = 1; row < h; row++)
+                memcpy(data + row * w * 2, data, w * 2);
+            break;
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12: {
+            /* Y plane, then U and V interleaved at half the resolution */
+            uint8_t *uvPlane = data + w * h;
+            for (uint32_t x = 0; x < w; x++)
+                data[x] = y[bars[x]];
+            for (uint32_t x = 0; x + 1 < w; x += 2) {
+                uvPlane[x] = u[bars[x]];
+                uvPlane[x + 1] = v[bars[x]];
+            }
+            for (uint32_t row = 1; row < h; row++)
+                memcpy(data + row * w, data, w);
+            for (uint32_t row = 1; row < h / 2; row++)
+                memcpy(uvPlane + row * w, uvPlane, w);
+            break;
+        }
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+            for (uint32_t x = 0; x < w; x++)
+                memcpy(data + x * 3, sBarsRgb[bars[x]], 3);
+            for (uint32_t row = 1; row < h; row++)
+                memcpy(data + row * w * 3, data, w * 3);
+            break;
+        default: {
+            /* I420: Y plane, then U and V at half the resolution */
+            uint8_t *uPlane = data + w * h;
+            uint8_t *vPlane = uPlane + (w / 2) * (h / 2);
+            for (uint32_t x = 0; x < w; x++)
+                data[x] = y[bars[x]];
+            for (uint32_t x = 0; x < w / 2; x++) {
+                uPlane[x] = u[bars[x * 2]];
+                vPlane[x] = v[bars[x * 2]];
+            }
+            for (uint32_t row = 1; row < h; row++)
+                memcpy(data + row * w, data, w);
+            for (uint32_t row = 1; row < h / 2; row++) {
+                memcpy(uPlane + row * (w / 2), uPlane, w / 2);
+                memcpy(vPlane + row * (w / 2), vPlane, w / 2);
+            }
+            break;
+        }
+        }
+        mPatterns.push_back(p);
+    }
+}
+
+CameraDevice::Status CameraDeviceBench::read(CameraData &data)
+{
+    if (mState != State::STATE_RUN || mPatterns.empty())
+        return Status::INVALID_STATE;
+
+    const usec_t period = USEC_PER_SEC / mSettings.frameRate;
+    std::uniform_real_distribution<float> pct(0, 100);
+
+    /* a dropped frame is still counted, as a gap in the device sequence */
+    usec_t capture = mNextFrame;
+    while (mSettings.dropPct > 0 && pct(mRandom) < mSettings.dropPct) {
+        capture += period;
+        mSeq++;
+    }
+
+    usec_t delay = 0;
+    if (mSettings.jitterMs)
+        delay = std::uniform_int_distribution<usec_t>(0, mSettings.jitterMs * USEC_PER_MSEC)(
+            mRandom);
+
+    usec_t now = now_usec();
+    if (capture + delay > now)
+        std::this_thread::sleep_for(std::chrono::microseconds(capture + delay - now));
+
+    /* a consumer slower than the frame rate misses frames, it does not get them late */
+    now = now_usec();
+    mNextFrame = capture + period;
+    if (mNextFrame + period < now)
+        mNextFrame = now - (now - capture) % period + period;
+
+    std::shared_ptr<const Pattern> pattern = mPatterns[mSeq % PATTERNS];
+    data.width = mSettings.width;
+    data.height = mSettings.height;
+    data.format = mSettings.pixelFormat;
+    data.setPlanes();
+    data.buf = const_cast<uint8_t *>(pattern->data());
+    data.bufSize = pattern->size();
+    data.seq = mSeq++;
+    data.timestamp = capture * NSEC_PER_USEC;
+    data.sec = capture / USEC_PER_SEC;
+    data.nsec = (capture % USEC_PER_SEC) * NSEC_PER_USEC;
+    /* patterns are never written, consumers keep a reference instead of a copy */
+    data.release = [pattern]() {};
+
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::setSize(const uint32_t width, const uint32_t height)
+{
+    if (mState == State::STATE_RUN)
+        return Status::INVALID_STATE;
+    if (!width || !height || width % 2 || height % 2)
+        return Status::INVALID_ARGUMENT;
+
+    mSettings.width = width;
+    mSettings.height = height;
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::getSize(uint32_t &width, uint32_t &height) const
+{
+    width = mSettings.width;
+    height = mSettings.height;
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::getSupportedSizes(std::vector<Size> &sizes) const
+{
+    sizes = {{320, 240}, {640, 360}, {640, 480}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::setPixelFormat(const CameraParameters::PixelFormat format)
+{
+    if (mState == State::STATE_RUN)
+        return Status::INVALID_STATE;
+
+    for (const auto &f : sFormats) {
+        if (f.format == format) {
+            mSettings.pixelFormat = format;
+            return Status::SUCCESS;
+        }
+    }
+    return Status::NOT_SUPPORTED;
+}
+
+CameraDevice::Status CameraDeviceBench::getPixelFormat(CameraParameters::PixelFormat &format) const
+{
+    format = mSettings.pixelFormat;
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::getSupportedPixelFormats(
+    std::vector<CameraParameters::PixelFormat> &formats) const
+{
+    formats.clear();
+    for (const auto &f : sFormats)
+        formats.push_back(f.format);
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::setMode(const CameraParameters::Mode mode)
+{
+    mMode = mode;
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::getMode(CameraParameters::Mode &mode) const
+{
+    mode = mMode;
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status
+CameraDeviceBench::getSupportedModes(std::vector<CameraParameters::Mode> &modes) const
+{
+    modes = {CameraParameters::Mode::MODE_STILL, CameraParameters::Mode::MODE_VIDEO};
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::setFrameRate(const uint32_t fps)
+{
+    if (fps == 0 || fps > MAX_FRAME_RATE)
+        return Status::INVALID_ARGUMENT;
+
+    mSettings.frameRate = fps;
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::getFrameRate(uint32_t &fps) const
+{
+    fps = mSettings.frameRate;
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::getSupportedFrameRates(uint32_t &minFps,
+                                                               uint32_t &maxFps) const
+{
+    minFps = 1;
+    maxFps = MAX_FRAME_RATE;
+    return Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceBench::setCameraDefinitionUri(const std::string uri)
+{
+    if (uri.empty())
+        return Status::INVALID_ARGUMENT;
+
+    mCamDefUri = uri;
+    return Status::SUCCESS;
+}
+
+std::string CameraDeviceBench::getCameraDefinitionUri() const
+{
+    return mCamDefUri;
+}
+
+std::string CameraDeviceBench::getOverlayText() const
+{
+    return mDeviceId;
+}
+
+bool CameraDeviceBench::parseSpec(const std::string &spec, std::string &id,
+                                  BenchSettings &settings)
+{
+    size_t colon = spec.find(':');
+    id = spec.substr(0, colon);
+    if (id.empty())
+        return false;
+    if (colon == std::string::npos)
+        return true;
+
+    std::string opts = spec.substr(colon + 1);
+    size_t pos = 0;
+    while (pos <= opts.size()) {
+        size_t end = opts.find(',', pos);
+        if (end == std::string::npos)
+            end = opts.size();
+        std::string opt = opts.substr(pos, end - pos);
+        pos = end + 1;
+        if (opt.empty())
+            continue;
+
+        size_t eq = opt.find('=');
+        if (eq == std::string::npos) {
+            log_error("Bench camera %s: no value for %s", id.c_str(), opt.c_str());
+            return false;
+        }
+        std::string key = opt.substr(0, eq);
+        const char *value = opt.c_str() + eq + 1;
+        bool ok = true;
+
+        if (key == "size") {
+            ok = sscanf(value, "%ux%u", &settings.width, &settings.height) == 2
+                && settings.width > 0 && settings.height > 0 && !(settings.width % 2)
+                && !(settings.height % 2);
+        } else if (key == "format") {
+            ok = false;
+            for (const auto &f : sFormats) {
+                if (!strcmp(f.name, value)) {
+                    settings.pixelFormat = f.format;
+                    ok = true;
+                }
+            }
+        } else if (key == "fps") {
+            ok = sscanf(value, "%u", &settings.frameRate) == 1 && settings.frameRate > 0
+                && settings.frameRate <= MAX_FRAME_RATE;
+        } else if (key == "jitter_ms") {
+            ok = sscanf(value, "%u", &settings.jitterMs) == 1;
+        } else if (key == "drop_pct") {
+            ok = sscanf(value, "%f", &settings.dropPct) == 1 && settings.dropPct >= 0
+                && settings.dropPct < 100;
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            log_error("Bench camera %s: invalid option %s", id.c_str(), opt.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,101 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CameraDevice.h"
+#include "CameraParameters.h"
+#include "util.h"
+
+/* Frame generator of a bench camera, set from its spec in DCM_BENCH */
+struct BenchSettings {
+    uint32_t width = 640;
+    uint32_t height = 360;
+    CameraParameters::PixelFormat pixelFormat = CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420;
+    uint32_t frameRate = 30;
+    uint32_t jitterMs = 0; // Max random delay of a frame after its capture time
+    float dropPct = 0;     // Share of the frames lost, as a sensor missing its readout would
+};
+
+/*
+ * Synthetic camera for load tests of the streaming paths without hardware. Frames are moving
+ * color bars, rendered once when the camera starts, so read() costs a sleep until the next frame
+ * time and nothing else: what is measured is the daemon, not the generator.
+ */
+class CameraDeviceBench final : public CameraDevice {
+public:
+    CameraDeviceBench(std::string device, const BenchSettings &settings);
+    ~CameraDeviceBench();
+    std::string getDeviceId() const;
+    Status getInfo(CameraInfo &camInfo) const;
+    bool isGstV4l2Src() const;
+    Status init(CameraParameters &camParam);
+    Status uninit();
+    Status start();
+    Status stop();
+    Status read(CameraData &data);
+    Status setSize(const uint32_t width, const uint32_t height);
+    Status getSize(uint32_t &width, uint32_t &height) const;
+    Status getSupportedSizes(std::vector<Size> &sizes) const;
+    Status setPixelFormat(const CameraParameters::PixelFormat format);
+    Status getPixelFormat(CameraParameters::PixelFormat &format) const;
+    Status getSupportedPixelFormats(std::vector<CameraParameters::PixelFormat> &formats) const;
+    Status setMode(const CameraParameters::Mode mode);
+    Status getMode(CameraParameters::Mode &mode) const;
+    Status getSupportedModes(std::vector<CameraParameters::Mode> &modes) const;
+    Status setFrameRate(const uint32_t fps);
+    Status getFrameRate(uint32_t &fps) const;
+    Status getSupportedFrameRates(uint32_t &minFps, uint32_t &maxFps) const;
+    Status setCameraDefinitionUri(const std::string uri);
+    std::string getCameraDefinitionUri() const;
+    std::string getOverlayText() const;
+
+    /**
+     *  Parse the spec of a bench camera, as in "bench0:size=1280x720,format=uyvy,fps=60".
+     *
+     *  @param[in] spec Camera Id, then optional comma separated size, format (grey, yuv420, nv12,
+     *  uyvy, yuyv, rgb24), fps, jitter_ms and drop_pct.
+     *  @param[out] id Camera Id.
+     *  @param[out] settings Generator settings, defaults for the keys not given.
+     *
+     *  @return True if the spec is valid.
+     */
+    static bool parseSpec(const std::string &spec, std::string &id, BenchSettings &settings);
+
+    static const int PATTERNS = 16; // Frames rendered, played in a loop
+
+private:
+    typedef std::vector<uint8_t> Pattern;
+    void renderPatterns();
+    size_t getFrameSize() const;
+    std::string mDeviceId;
+    std::atomic<CameraDevice::State> mState;
+    BenchSettings mSettings;
+    CameraParameters::Mode mMode;
+    std::string mCamDefUri;
+    /* Frames still held by consumers keep their pattern alive */
+    std::vector<std::shared_ptr<const Pattern>> mPatterns;
+    uint32_t mSeq;
+    usec_t mNextFrame; // Capture time of the next frame
+    std::minstd_rand mRandom;
+};
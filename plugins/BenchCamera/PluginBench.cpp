@@ -0,0 +1,88 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "CameraDeviceBench.h"
+#include "PluginBench.h"
+#include "log.h"
+
+#define DEFAULT_CAMERA "bench"
+
+static PluginBench bench;
+
+PluginBench::PluginBench()
+    : PluginBase()
+{
+}
+
+PluginBench::~PluginBench()
+{
+}
+
+void PluginBench::init()
+{
+    discoverCameras();
+}
+
+std::vector<std::string> PluginBench::getCameraDevices()
+{
+    std::vector<std::string> camList;
+    for (auto const &camera : mCameras)
+        camList.push_back(camera.first);
+    return camList;
+}
+
+std::shared_ptr<CameraDevice> PluginBench::createCameraDevice(std::string deviceID)
+{
+    auto it = mCameras.find(deviceID);
+    if (it == mCameras.end()) {
+        log_error("Camera Device not found : %s", deviceID.c_str());
+        return nullptr;
+    }
+
+    return std::make_shared<CameraDeviceBench>(deviceID, it->second);
+}
+
+void PluginBench::discoverCameras()
+{
+    const char *env = getenv("DCM_BENCH");
+    if (!env) {
+        mCameras[DEFAULT_CAMERA] = BenchSettings();
+        return;
+    }
+
+    std::string specs = env;
+    size_t pos = 0;
+    while (pos <= specs.size()) {
+        size_t end = specs.find(';', pos);
+        if (end == std::string::npos)
+            end = specs.size();
+        std::string spec = specs.substr(pos, end - pos);
+        pos = end + 1;
+        if (spec.empty())
+            continue;
+
+        std::string id;
+        BenchSettings settings;
+        if (CameraDeviceBench::parseSpec(spec, id, settings))
+            mCameras[id] = settings;
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+#include "CameraDevice.h"
+#include "CameraDeviceBench.h"
+#include "PluginBase.h"
+
+/*
+ * Bench cameras are listed in the DCM_BENCH environment variable, as semicolon separated specs
+ * parsed by CameraDeviceBench::parseSpec(). A single "bench" camera with the default settings
+ * is exported if the variable is not set.
+ */
+class PluginBench final : public PluginBase {
+public:
+    PluginBench();
+    ~PluginBench();
+
+    void init();
+    std::vector<std::string> getCameraDevices();
+    std::shared_ptr<CameraDevice> createCameraDevice(std::string);
+
+private:
+    std::map<std::string, BenchSettings> mCameras;
+    void discoverCameras();
+};
@@ -340,6 +340,10 @@ CameraDevice::Status CameraDeviceCustom::setFrameRate(const uint32_t fps)
      * 1. Set the frame rate of the camera device.
      */
 
+    if (fps == 0)
+        return Status::INVALID_ARGUMENT;
+
+    mFrmRate = fps;
     return Status::SUCCESS;
 }
 
@@ -349,6 +353,7 @@ CameraDevice::Status CameraDeviceCustom::getFrameRate(uint32_t &fps) const
      * 1. Get the frame rate of the camera device.
      */
 
+    fps = mFrmRate;
     return Status::SUCCESS;
 }
 
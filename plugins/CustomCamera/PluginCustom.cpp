@@ -26,6 +26,14 @@ static PluginCustom custom;
 
 PluginCustom::PluginCustom()
     : PluginBase()
+{
+}
+
+PluginCustom::~PluginCustom()
+{
+}
+
+void PluginCustom::init()
 {
     /*
      * 1. Discover the list of camera devices for this Plugin Class
@@ -35,10 +43,6 @@ PluginCustom::PluginCustom()
     discoverCameras(mCamList);
 }
 
-PluginCustom::~PluginCustom()
-{
-}
-
 std::vector<std::string> PluginCustom::getCameraDevices()
 {
     return mCamList;
@@ -20,10 +20,17 @@
 #include <gazebo/gazebo_client.hh>
 #include <gazebo/msgs/msgs.hh>
 
+#include <chrono>
 #include <iostream>
 #include <sys/time.h>
 
 #include "CameraDeviceGazebo.h"
+#include "util.h"
+
+/* Time to wait in read for gazebo to publish a new frame */
+#define READ_TIMEOUT_MS 1000
+/* Upper limit of frame buffers, the pool only grows while readers hold on to frames */
+#define MAX_FRAME_BUFFERS 8
 
 const char CameraDeviceGazebo::PARAMETER_CUSTOM_UINT8[] = "custom-uint8";
 const int CameraDeviceGazebo::ID_PARAMETER_CUSTOM_UINT8 = 101;
@@ -43,6 +50,10 @@ CameraDeviceGazebo::CameraDeviceGazebo(std::string device)
     , mHeight(360)
     , mMode(CameraParameters::Mode::MODE_VIDEO)
     , mPixelFormat(CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24)
+    , mFrameSeq(0)
+    , mReadSeq(0)
+    , mFrameTime(0)
+    , mFrontSize(0)
     , mOvText(device)
 {
     log_info("%s path:%s", __func__, mDeviceId.c_str());
@@ -124,38 +135,51 @@ CameraDevice::Status CameraDeviceGazebo::start()
     mNode.reset(new gazebo::transport::Node());
     mNode->Init();
 
-    // TODO:: Get the number of buffers that gazebo camera has
-    // TODO:: Initialize size of mFrameBuffer based on that
-
     // Listen to Gazebo <device> topic
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mReadSeq = mFrameSeq;
+        mState = State::STATE_RUN;
+    }
     mSub = mNode->Subscribe(mDeviceId, &CameraDeviceGazebo::cbOnImages, this);
-    mState = State::STATE_RUN;
     return CameraDevice::Status::SUCCESS;
 }
 
 CameraDevice::Status CameraDeviceGazebo::stop()
 {
-    std::lock_guard<std::mutex> locker(mLock);
-    if (mState != State::STATE_RUN)
-        return Status::INVALID_STATE;
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        if (mState != State::STATE_RUN)
+            return Status::INVALID_STATE;
+        mState = State::STATE_INIT;
+    }
+    // Wake up the reader waiting for a frame
+    mFrameCond.notify_all();
+
     // Make sure to shut everything down.
     gazebo::client::shutdown();
-    mState = State::STATE_INIT;
     return CameraDevice::Status::SUCCESS;
 }
 
 CameraDevice::Status CameraDeviceGazebo::read(CameraData &data)
 {
-    // TODO :: Remove the sleep once the read call is blocking
-    usleep(40000);
+    std::unique_lock<std::mutex> locker(mLock);
 
-    std::lock_guard<std::mutex> locker(mLock);
+    // Block until gazebo publishes a frame not yet returned
+    bool ready = mFrameCond.wait_for(locker, std::chrono::milliseconds(READ_TIMEOUT_MS), [this] {
+        return mState != State::STATE_RUN || mFrameSeq != mReadSeq;
+    });
     if (mState != State::STATE_RUN)
         return Status::INVALID_STATE;
 
-    if (mFrameBuffer.empty())
+    if (!ready)
+        return Status::TIMED_OUT;
+
+    if (!mFrontBuffer || !mFrontSize)
         return Status::ERROR_UNKNOWN;
 
+    mReadSeq = mFrameSeq;
+
     struct timeval timeofday;
     gettimeofday(&timeofday, NULL);
 
@@ -163,9 +187,15 @@ CameraDevice::Status CameraDeviceGazebo::read(CameraData &data)
     data.nsec = timeofday.tv_usec * 1000;
     data.width = mWidth;
     data.height = mHeight;
-    data.stride = mWidth; // TODO :: Dependent on pixformat
-    data.buf = &mFrameBuffer[0];
-    data.bufSize = mFrameBuffer.size();
+    data.format = mPixelFormat;
+    data.setPlanes();
+    data.buf = mFrontBuffer.get();
+    data.bufSize = mFrontSize;
+    data.seq = mFrameSeq;
+    data.timestamp = mFrameTime;
+    // The reference keeps the buffer out of the pool until the reader releases the frame
+    std::shared_ptr<uint8_t> ref = mFrontBuffer;
+    data.release = [ref]() mutable { ref.reset(); };
 
     return Status::SUCCESS;
 }
@@ -290,12 +320,23 @@ std::string CameraDeviceGazebo::getOverlayText() const
 
 void CameraDeviceGazebo::cbOnImages(ConstImagesStampedPtr &_msg)
 {
-    std::lock_guard<std::mutex> locker(mLock);
-
-    // log_debug("Image Count: %d", _msg->image_size());
-    for (int i = 0; i < _msg->image_size(); ++i) {
-        getImage(_msg->image(i));
+    bool updated = false;
+
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+
+        // log_debug("Image Count: %d", _msg->image_size());
+        for (int i = 0; i < _msg->image_size(); ++i) {
+            if (!getImage(_msg->image(i))) {
+                mFrameTime = now_usec() * NSEC_PER_USEC;
+                mFrameSeq++;
+                updated = true;
+            }
+        }
     }
+
+    if (updated)
+        mFrameCond.notify_all();
 }
 
 int CameraDeviceGazebo::getImage(const gazebo::msgs::Image &_msg)
@@ -332,11 +373,27 @@ int CameraDeviceGazebo::getImage(const gazebo::msgs::Image &_msg)
     // log_debug("Image Size: %lu Format:%d", _msg.data().size(), _msg.pixel_format());
     const char *buffer = (const char *)_msg.data().c_str();
     uint buffer_size = _msg.data().size();
-    mFrameBuffer = std::vector<uint8_t>(buffer, buffer + buffer_size);
+    // Pool is allocated for the first frame, again only if the image size changes. Buffers of the
+    // previous pool still held by readers return to it, and it is freed with the last of them.
+    if (!mFramePool || mFramePool->getFrameSize() != buffer_size) {
+        mFramePool = FramePool::create(mDeviceId, buffer_size, MAX_FRAME_BUFFERS);
+        if (!mFramePool) {
+            log_error("Unable to allocate frame buffers");
+            return failure;
+        }
+    }
+    std::shared_ptr<uint8_t> backBuffer = mFramePool->acquire();
+    if (!backBuffer) {
+        log_warning("All frame buffers in use, dropping frame");
+        return failure;
+    }
+    memcpy(backBuffer.get(), buffer, buffer_size);
+    mFrontBuffer = backBuffer;
+    mFrontSize = buffer_size;
 
 #if 0
     std::ofstream fout("imgframe.rgb", std::ios::binary);
-    fout.write(reinterpret_cast<char*>(&mFrameBuffer[0]), mFrameBuffer.size() * sizeof(mFrameBuffer[0]));
+    fout.write(reinterpret_cast<char*>(mFrontBuffer.get()), mFrontSize);
     fout.close();
     std::cout<<"\nsaved";
 #endif
@@ -18,10 +18,14 @@
 #pragma once
 #include <gazebo/msgs/msgs.hh>
 #include <gazebo/transport/transport.hh>
+#include <condition_variable>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "CameraDevice.h"
 #include "CameraParameters.h"
+#include "FramePool.h"
 
 class CameraDeviceGazebo final : public CameraDevice {
 public:
@@ -73,6 +77,13 @@ private:
     gazebo::transport::NodePtr mNode;
     gazebo::transport::SubscriberPtr mSub;
     std::mutex mLock;
-    std::vector<uint8_t> mFrameBuffer = {};
+    std::condition_variable mFrameCond; /* Signalled when a new frame is received */
+    uint32_t mFrameSeq;                 /* Sequence number of the frame in mFrontBuffer */
+    uint32_t mReadSeq;                  /* Sequence number of the frame last returned by read */
+    uint64_t mFrameTime;                /* Monotonic time the frame was received */
+    /* Frame buffers reused across frames, a buffer is in use while a reader holds a reference */
+    std::shared_ptr<FramePool> mFramePool;
+    std::shared_ptr<uint8_t> mFrontBuffer; /* Latest complete frame */
+    size_t mFrontSize;                     /* Size of the frame in mFrontBuffer */
     std::string mOvText;
 };
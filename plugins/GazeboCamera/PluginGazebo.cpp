@@ -32,13 +32,17 @@ static PluginGazebo gzb;
 PluginGazebo::PluginGazebo()
     : PluginBase()
 {
-    discoverCameras(mCamList);
 }
 
 PluginGazebo::~PluginGazebo()
 {
 }
 
+void PluginGazebo::init()
+{
+    discoverCameras(mCamList);
+}
+
 std::vector<std::string> PluginGazebo::getCameraDevices()
 {
     return mCamList;
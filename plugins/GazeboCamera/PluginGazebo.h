@@ -27,6 +27,7 @@ public:
     PluginGazebo();
     ~PluginGazebo();
 
+    void init();
     std::vector<std::string> getCameraDevices();
     std::shared_ptr<CameraDevice> createCameraDevice(std::string);
 
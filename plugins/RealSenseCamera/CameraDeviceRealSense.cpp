@@ -18,15 +18,23 @@
 
 #include <cstring>
 #include <iostream>
+#include <mutex>
 #include <sys/time.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
 #include "CameraDeviceRealSense.h"
 
 #define RS_DEFAULT_WIDTH 640
 #define RS_DEFAULT_HEIGHT 480
 #define RS_DEFAULT_FRAME_RATE 60
-
-int CameraDeviceRealSense::sStrmCnt = 0;
+/* Time to wait for the session to deliver a frame of the stream */
+#define RS_READ_TIMEOUT_MS 1000
+/* Frames that can be in use by consumers at the same time */
+#define RS_FRAME_BUFFERS 4
 
 static void rainbow_scale(double value, uint8_t rgb[])
 {
@@ -52,6 +60,65 @@ static void rainbow_scale(double value, uint8_t rgb[])
     }
 }
 
+/* Color of every possible depth value, built once from rainbow_scale */
+static uint8_t sDepthLut[UINT16_MAX + 1][3];
+static std::once_flag sDepthLutOnce;
+
+static void build_depth_lut()
+{
+    for (uint32_t i = 0; i <= UINT16_MAX; i++)
+        rainbow_scale((double)i, sDepthLut[i]);
+}
+
+static void depth_to_rgb(const uint16_t *depth, uint8_t *rgb, size_t count)
+{
+    for (size_t i = 0; i < count; i++, rgb += 3) {
+        const uint8_t *color = sDepthLut[depth[i]];
+        rgb[0] = color[0];
+        rgb[1] = color[1];
+        rgb[2] = color[2];
+    }
+}
+
+static void grey_to_rgb_scalar(const uint8_t *grey, uint8_t *rgb, size_t count)
+{
+    for (size_t i = 0; i < count; i++, rgb += 3)
+        rgb[0] = rgb[1] = rgb[2] = grey[i];
+}
+
+#ifdef HAVE_X86_SIMD
+/* Expand 16 grey pixels into 48 bytes of RGB per iteration with three byte shuffles */
+__attribute__((target("ssse3"))) static void grey_to_rgb_ssse3(const uint8_t *grey, uint8_t *rgb,
+                                                                size_t count)
+{
+    const __m128i shuf0 = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i shuf1 = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+    const __m128i shuf2 = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15,
+                                        15, 15);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16, rgb += 48) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(grey + i));
+        _mm_storeu_si128((__m128i *)rgb, _mm_shuffle_epi8(in, shuf0));
+        _mm_storeu_si128((__m128i *)(rgb + 16), _mm_shuffle_epi8(in, shuf1));
+        _mm_storeu_si128((__m128i *)(rgb + 32), _mm_shuffle_epi8(in, shuf2));
+    }
+
+    grey_to_rgb_scalar(grey + i, rgb, count - i);
+}
+#endif
+
+typedef void (*grey_to_rgb_fn)(const uint8_t *grey, uint8_t *rgb, size_t count);
+
+static grey_to_rgb_fn get_grey_to_rgb()
+{
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("ssse3"))
+        return grey_to_rgb_ssse3;
+#endif
+    return grey_to_rgb_scalar;
+}
+
 CameraDeviceRealSense::CameraDeviceRealSense(std::string device)
     : mDeviceId(device)
     , mState(State::STATE_IDLE)
@@ -61,11 +128,9 @@ CameraDeviceRealSense::CameraDeviceRealSense(std::string device)
     , mMode(CameraParameters::Mode::MODE_VIDEO)
     , mFrmRate(RS_DEFAULT_FRAME_RATE)
     , mCamDefUri{}
-    , mFrameBuffer(nullptr)
-    , mFrameBufferSize(0)
-    , mRSDev(nullptr)
-    , mRSCtx(nullptr)
     , mRSStream(-1)
+    , mFrameSeq(0)
+    , mGreyToRgb(get_grey_to_rgb())
 {
     log_info("%s path:%s", __func__, mDeviceId.c_str());
     if (device == "rsdepth")
@@ -165,52 +230,39 @@ CameraDevice::Status CameraDeviceRealSense::start()
      * Start the camera device to capture images.
      */
 
-    /* librealsense */
-    rs_error *e = 0;
-    mRSCtx = rs_create_context(RS_API_VERSION, &e);
-    if (e) {
-        log_error("rs_error was raised when calling %s(%s): %s", rs_get_failed_function(e),
-                  rs_get_failed_args(e), rs_get_error_message(e));
-        log_error("Current librealsense api version %d", rs_get_api_version(NULL));
-        log_error("Compiled for librealsense api version %d", RS_API_VERSION);
+    /* librealsense device is shared by all streams */
+    mRSSession = RealSenseSession::getInstance();
+    if (!mRSSession)
         return Status::ERROR_UNKNOWN;
-    }
-
-    mRSDev = rs_get_device(mRSCtx, 0, NULL);
-    if (!mRSDev) {
-        log_error("Unable to access realsense device");
-        rs_delete_context(mRSCtx, NULL);
-        return Status::ERROR_UNKNOWN;
-    }
-
-    /* Configure all streams to run at VGA resolution at 60 frames per second */
-    if (mRSStream == RS_STREAM_INFRARED || mRSStream == RS_STREAM_INFRARED2) {
-        rs_enable_stream(mRSDev, (rs_stream)mRSStream, mWidth, mHeight, RS_FORMAT_Y8, mFrmRate, &e);
-    } else {
-        rs_enable_stream(mRSDev, RS_STREAM_DEPTH, mWidth, mHeight, RS_FORMAT_Z16, mFrmRate, NULL);
-    }
 
-    sStrmCnt++;
+    if (mRSStream == RS_STREAM_DEPTH)
+        std::call_once(sDepthLutOnce, build_depth_lut);
 
-    if (sStrmCnt == 3) {
-        /* start once all rs streams are enabled*/
-        rs_start_device(mRSDev, NULL);
-
-        if (rs_device_supports_option(mRSDev, RS_OPTION_R200_EMITTER_ENABLED, NULL))
-            rs_set_device_option(mRSDev, RS_OPTION_R200_EMITTER_ENABLED, 1, NULL);
-        if (rs_device_supports_option(mRSDev, RS_OPTION_R200_LR_AUTO_EXPOSURE_ENABLED, NULL))
-            rs_set_device_option(mRSDev, RS_OPTION_R200_LR_AUTO_EXPOSURE_ENABLED, 1, NULL);
-    }
-
-    mFrameBufferSize = mWidth * mHeight * 3;
-    mFrameBuffer = new uint8_t[mFrameBufferSize];
-    if (!mFrameBuffer) {
+    size_t frameSize = mWidth * mHeight;
+    if (mPixelFormat != CameraParameters::PixelFormat::PIXEL_FORMAT_GREY)
+        frameSize *= 3;
+    mFramePool = FramePool::create(mDeviceId, frameSize, RS_FRAME_BUFFERS);
+    if (!mFramePool) {
         log_error("Memory alloc for frame buf failed");
-        mFrameBufferSize = 0;
-        rs_delete_context(mRSCtx, NULL);
+        mRSSession.reset();
         return Status::NO_MEMORY;
     }
 
+    /* Configure the stream to run at VGA resolution at 60 frames per second */
+    Status ret;
+    if (mRSStream == RS_STREAM_INFRARED || mRSStream == RS_STREAM_INFRARED2)
+        ret = mRSSession->startStream((rs_stream)mRSStream, mWidth, mHeight, RS_FORMAT_Y8,
+                                      mFrmRate);
+    else
+        ret = mRSSession->startStream(RS_STREAM_DEPTH, mWidth, mHeight, RS_FORMAT_Z16, mFrmRate);
+    if (ret != Status::SUCCESS) {
+        log_error("Unable to start realsense stream %d", mRSStream);
+        mFramePool.reset();
+        mRSSession.reset();
+        return ret;
+    }
+    mFrameSeq = 0;
+
     setState(State::STATE_RUN);
     return Status::SUCCESS;
 }
@@ -226,9 +278,10 @@ CameraDevice::Status CameraDeviceRealSense::stop()
      * Undo whatever was done in start() call.
      */
 
-    rs_delete_context(mRSCtx, NULL);
-    delete[] mFrameBuffer;
-    mFrameBufferSize = 0;
+    mRSSession->stopStream((rs_stream)mRSStream);
+    mRSSession.reset();
+    /* buffers still held by consumers keep the pool alive */
+    mFramePool.reset();
 
     setState(State::STATE_INIT);
     return Status::SUCCESS;
@@ -245,38 +298,45 @@ CameraDevice::Status CameraDeviceRealSense::read(CameraData &data)
      * Fill the CameraData with frame and its meta-data.
      */
 
-    rs_wait_for_frames(mRSDev, NULL);
+    /* consumers hold frames for a while, every frame gets its own buffer */
+    std::shared_ptr<uint8_t> buffer = mFramePool->acquire();
+    if (!buffer) {
+        log_warning("All frame buffers in use, dropping frame");
+        return Status::NO_MEMORY;
+    }
+    uint8_t *frameBuffer = buffer.get();
+    size_t frameSize = mFramePool->getFrameSize();
 
-    rs_error *e = 0;
+    uint32_t bpp = 3;
+    uint64_t timestamp = 0;
+    Status ret;
     if (mRSStream == RS_STREAM_INFRARED || mRSStream == RS_STREAM_INFRARED2) {
-        uint8_t *ir = (uint8_t *)rs_get_frame_data(mRSDev, (rs_stream)mRSStream, &e);
-        if (!ir) {
-            log_error("rs_error was raised when calling %s(%s): %s", rs_get_failed_function(e),
-                      rs_get_failed_args(e), rs_get_error_message(e));
+        ret = mRSSession->readFrame(
+            (rs_stream)mRSStream, mFrameSeq, timestamp,
+            [this, &bpp, frameBuffer, frameSize](const uint8_t *ir, size_t size) {
+                if (mPixelFormat == CameraParameters::PixelFormat::PIXEL_FORMAT_GREY) {
+                    // Y8 is passed on as is
+                    memcpy(frameBuffer, ir, frameSize);
+                    bpp = 1;
+                } else {
+                    mGreyToRgb(ir, frameBuffer, mWidth * mHeight);
+                }
+            },
+            RS_READ_TIMEOUT_MS);
+        if (ret != Status::SUCCESS) {
             log_error("No infrared data. Not building frame");
-
-            return Status::ERROR_UNKNOWN;
-        }
-
-        for (int i = 0, end = mWidth * mHeight; i < end; ++i) {
-            mFrameBuffer[3 * i] = ir[i];
-            mFrameBuffer[3 * i + 1] = ir[i];
-            mFrameBuffer[3 * i + 2] = ir[i];
+            return ret;
         }
     } else {
-        uint16_t *depth = (uint16_t *)rs_get_frame_data(mRSDev, RS_STREAM_DEPTH, NULL);
-        if (!depth) {
+        ret = mRSSession->readFrame(RS_STREAM_DEPTH, mFrameSeq, timestamp,
+                                    [this, frameBuffer](const uint8_t *depth, size_t size) {
+                                        depth_to_rgb((const uint16_t *)depth, frameBuffer,
+                                                     mWidth * mHeight);
+                                    },
+                                    RS_READ_TIMEOUT_MS);
+        if (ret != Status::SUCCESS) {
             log_error("No depth data. Not building frame");
-            return Status::ERROR_UNKNOWN;
-        }
-
-        for (int i = 0, end = mWidth * mHeight; i < end; ++i) {
-            uint8_t rainbow[3];
-            rainbow_scale((double)depth[i], rainbow);
-
-            mFrameBuffer[3 * i] = rainbow[0];
-            mFrameBuffer[3 * i + 1] = rainbow[1];
-            mFrameBuffer[3 * i + 2] = rainbow[2];
+            return ret;
         }
     }
 
@@ -287,9 +347,14 @@ CameraDevice::Status CameraDeviceRealSense::read(CameraData &data)
     data.nsec = timeofday.tv_usec * 1000;
     data.width = mWidth;
     data.height = mHeight;
-    data.stride = mWidth * 3; // TODO :: Dependent on pixformat
-    data.buf = mFrameBuffer;
-    data.bufSize = mFrameBufferSize;
+    data.format = mPixelFormat;
+    data.setPlanes(mWidth * bpp);
+    data.buf = frameBuffer;
+    data.bufSize = frameSize;
+    data.seq = mFrameSeq;
+    data.timestamp = timestamp;
+    // The buffer goes back to the pool once the reader releases the frame
+    data.release = [buffer]() mutable { buffer.reset(); };
 
     return Status::SUCCESS;
 }
@@ -362,6 +427,24 @@ CameraDeviceRealSense::setPixelFormat(const CameraParameters::PixelFormat format
      * 4. Pixel format conversion logic can be added to support more formats
      */
 
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (getState() == State::STATE_RUN)
+        return Status::INVALID_STATE;
+
+    switch (format) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        /* infrared is delivered as Y8 by the camera, depth needs colorizing */
+        if (mRSStream != RS_STREAM_INFRARED && mRSStream != RS_STREAM_INFRARED2)
+            return Status::NOT_SUPPORTED;
+        break;
+    default:
+        return Status::NOT_SUPPORTED;
+    }
+
+    mPixelFormat = format;
     return Status::SUCCESS;
 }
 
@@ -386,6 +469,10 @@ CameraDevice::Status CameraDeviceRealSense::getSupportedPixelFormats(
      * 3. At times, the pixel format and resolution is interdependent
      */
 
+    formats.push_back(CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24);
+    if (mRSStream == RS_STREAM_INFRARED || mRSStream == RS_STREAM_INFRARED2)
+        formats.push_back(CameraParameters::PixelFormat::PIXEL_FORMAT_GREY);
+
     return Status::SUCCESS;
 }
 
@@ -426,6 +513,13 @@ CameraDevice::Status CameraDeviceRealSense::setFrameRate(const uint32_t fps)
      * 1. Set the frame rate of the camera device.
      */
 
+    if (getState() == State::STATE_RUN)
+        return Status::INVALID_STATE;
+
+    if (fps == 0)
+        return Status::INVALID_ARGUMENT;
+
+    mFrmRate = fps;
     return Status::SUCCESS;
 }
 
@@ -435,6 +529,7 @@ CameraDevice::Status CameraDeviceRealSense::getFrameRate(uint32_t &fps) const
      * 1. Get the frame rate of the camera device.
      */
 
+    fps = mFrmRate;
     return Status::SUCCESS;
 }
 
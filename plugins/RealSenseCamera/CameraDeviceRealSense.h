@@ -25,6 +25,8 @@
 
 #include "CameraDevice.h"
 #include "CameraParameters.h"
+#include "FramePool.h"
+#include "RealSenseSession.h"
 
 class CameraDeviceRealSense final : public CameraDevice {
 public:
@@ -68,10 +70,10 @@ private:
     uint32_t mFrmRate;
     std::string mCamDefUri;
     std::mutex mLock;
-    uint8_t *mFrameBuffer;
-    size_t mFrameBufferSize;
-    rs_device *mRSDev;
-    rs_context *mRSCtx;
+    std::shared_ptr<FramePool> mFramePool;
+    std::shared_ptr<RealSenseSession> mRSSession;
     int mRSStream;
-    static int sStrmCnt;
+    uint32_t mFrameSeq; /* Sequence number of the last frame read from the session */
+    /* Grey to RGB24 expansion, picked at runtime from the CPU features */
+    void (*mGreyToRgb)(const uint8_t *grey, uint8_t *rgb, size_t count);
 };
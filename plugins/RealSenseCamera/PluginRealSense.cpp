@@ -26,6 +26,14 @@ static PluginRealSense rs;
 
 PluginRealSense::PluginRealSense()
     : PluginBase()
+{
+}
+
+PluginRealSense::~PluginRealSense()
+{
+}
+
+void PluginRealSense::init()
 {
     /*
      * 1. Discover the list of camera devices for this Plugin Class
@@ -35,10 +43,6 @@ PluginRealSense::PluginRealSense()
     discoverCameras(mCamList);
 }
 
-PluginRealSense::~PluginRealSense()
-{
-}
-
 std::vector<std::string> PluginRealSense::getCameraDevices()
 {
     return mCamList;
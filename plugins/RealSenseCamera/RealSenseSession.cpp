@@ -0,0 +1,240 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <chrono>
+#include <cstring>
+
+#include "RealSenseSession.h"
+#include "log.h"
+#include "util.h"
+
+static void log_rs_error(rs_error *e)
+{
+    log_error("rs_error was raised when calling %s(%s): %s", rs_get_failed_function(e),
+              rs_get_failed_args(e), rs_get_error_message(e));
+    rs_free_error(e);
+}
+
+static size_t get_bytes_per_pixel(rs_format format)
+{
+    switch (format) {
+    case RS_FORMAT_Z16:
+        return 2;
+    case RS_FORMAT_Y8:
+        return 1;
+    default:
+        return 3;
+    }
+}
+
+std::shared_ptr<RealSenseSession> RealSenseSession::getInstance()
+{
+    static std::mutex sInstanceLock;
+    static std::weak_ptr<RealSenseSession> sInstance;
+
+    std::lock_guard<std::mutex> locker(sInstanceLock);
+    std::shared_ptr<RealSenseSession> session = sInstance.lock();
+    if (session)
+        return session;
+
+    rs_error *e = 0;
+    rs_context *ctx = rs_create_context(RS_API_VERSION, &e);
+    if (e) {
+        log_rs_error(e);
+        log_error("Current librealsense api version %d", rs_get_api_version(NULL));
+        log_error("Compiled for librealsense api version %d", RS_API_VERSION);
+        return nullptr;
+    }
+
+    rs_device *dev = rs_get_device(ctx, 0, NULL);
+    if (!dev) {
+        log_error("Unable to access realsense device");
+        rs_delete_context(ctx, NULL);
+        return nullptr;
+    }
+
+    session = std::shared_ptr<RealSenseSession>(new RealSenseSession(ctx, dev));
+    sInstance = session;
+    return session;
+}
+
+RealSenseSession::RealSenseSession(rs_context *ctx, rs_device *dev)
+    : mRSCtx(ctx)
+    , mRSDev(dev)
+    , mRunning(false)
+{
+    log_info("%s", __func__);
+}
+
+RealSenseSession::~RealSenseSession()
+{
+    {
+        std::lock_guard<std::mutex> locker(mDeviceLock);
+        stopDevice();
+    }
+    rs_delete_context(mRSCtx, NULL);
+}
+
+CameraDevice::Status RealSenseSession::startStream(rs_stream stream, uint32_t width,
+                                                   uint32_t height, rs_format format, uint32_t fps)
+{
+    std::lock_guard<std::mutex> locker(mDeviceLock);
+    rs_error *e = 0;
+
+    if (stream < 0 || stream >= RS_STREAM_COUNT)
+        return CameraDevice::Status::INVALID_ARGUMENT;
+
+    /* streams can only be enabled while the device is stopped */
+    stopDevice();
+
+    rs_enable_stream(mRSDev, stream, width, height, format, fps, &e);
+    if (e) {
+        log_rs_error(e);
+        startDevice();
+        return CameraDevice::Status::ERROR_UNKNOWN;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        StreamSlot &slot = mSlots[stream];
+        slot.enabled = true;
+        slot.size = width * height * get_bytes_per_pixel(format);
+        slot.data.resize(slot.size);
+    }
+
+    if (startDevice())
+        return CameraDevice::Status::ERROR_UNKNOWN;
+
+    return CameraDevice::Status::SUCCESS;
+}
+
+void RealSenseSession::stopStream(rs_stream stream)
+{
+    std::lock_guard<std::mutex> locker(mDeviceLock);
+
+    if (stream < 0 || stream >= RS_STREAM_COUNT)
+        return;
+
+    stopDevice();
+
+    rs_disable_stream(mRSDev, stream, NULL);
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        mSlots[stream].enabled = false;
+    }
+    mFrameCond.notify_all();
+
+    startDevice();
+}
+
+CameraDevice::Status RealSenseSession::readFrame(
+    rs_stream stream, uint32_t &seq, uint64_t &timestamp,
+    const std::function<void(const uint8_t *data, size_t size)> &process, int timeoutMs)
+{
+    if (stream < 0 || stream >= RS_STREAM_COUNT)
+        return CameraDevice::Status::INVALID_ARGUMENT;
+
+    std::unique_lock<std::mutex> lock(mLock);
+    StreamSlot &slot = mSlots[stream];
+
+    bool ready = mFrameCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&slot, seq] {
+        return !slot.enabled || slot.seq != seq;
+    });
+    if (!slot.enabled)
+        return CameraDevice::Status::INVALID_STATE;
+    if (!ready)
+        return CameraDevice::Status::TIMED_OUT;
+
+    process(slot.data.data(), slot.size);
+    seq = slot.seq;
+    timestamp = slot.timestamp;
+
+    return CameraDevice::Status::SUCCESS;
+}
+
+int RealSenseSession::startDevice()
+{
+    bool enabled = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        for (const StreamSlot &slot : mSlots)
+            enabled |= slot.enabled;
+    }
+    if (!enabled)
+        return 0;
+
+    rs_error *e = 0;
+    rs_start_device(mRSDev, &e);
+    if (e) {
+        log_rs_error(e);
+        return -1;
+    }
+
+    if (rs_device_supports_option(mRSDev, RS_OPTION_R200_EMITTER_ENABLED, NULL))
+        rs_set_device_option(mRSDev, RS_OPTION_R200_EMITTER_ENABLED, 1, NULL);
+    if (rs_device_supports_option(mRSDev, RS_OPTION_R200_LR_AUTO_EXPOSURE_ENABLED, NULL))
+        rs_set_device_option(mRSDev, RS_OPTION_R200_LR_AUTO_EXPOSURE_ENABLED, 1, NULL);
+
+    mRunning = true;
+    mThread = std::thread(&RealSenseSession::captureThread, this);
+    return 0;
+}
+
+void RealSenseSession::stopDevice()
+{
+    if (!mThread.joinable())
+        return;
+
+    /* the capture thread returns after the next frame set */
+    mRunning = false;
+    mThread.join();
+
+    rs_stop_device(mRSDev, NULL);
+}
+
+void RealSenseSession::captureThread()
+{
+    while (mRunning) {
+        rs_error *e = 0;
+        rs_wait_for_frames(mRSDev, &e);
+        if (e) {
+            log_rs_error(e);
+            mRunning = false;
+            break;
+        }
+
+        uint64_t now = now_usec() * NSEC_PER_USEC;
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            for (int i = 0; i < RS_STREAM_COUNT; i++) {
+                StreamSlot &slot = mSlots[i];
+                if (!slot.enabled)
+                    continue;
+
+                const void *data = rs_get_frame_data(mRSDev, (rs_stream)i, NULL);
+                if (!data)
+                    continue;
+
+                memcpy(slot.data.data(), data, slot.size);
+                slot.timestamp = now;
+                slot.seq++;
+            }
+        }
+        mFrameCond.notify_all();
+    }
+}
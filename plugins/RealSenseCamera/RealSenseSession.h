@@ -0,0 +1,104 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <librealsense/rs.h>
+
+#include "CameraDevice.h"
+
+/**
+ *  The RealSenseSession class owns the librealsense context and device shared by the depth and
+ *  infrared camera devices. Streams are enabled as they are started and a single capture thread
+ *  waits for the frames of all enabled streams, making each of them available to its reader.
+ */
+class RealSenseSession {
+public:
+    ~RealSenseSession();
+
+    /**
+     *  Get the session of the RealSense device, creating it if no camera device holds it.
+     *
+     *  @return Session object or nullptr if the device can not be accessed.
+     */
+    static std::shared_ptr<RealSenseSession> getInstance();
+
+    /**
+     *  Enable a stream and (re)start the device with all enabled streams.
+     *
+     *  @param[in] stream Stream to enable.
+     *  @param[in] width Width of the images.
+     *  @param[in] height Height of the images.
+     *  @param[in] format Format of the images delivered by the device.
+     *  @param[in] fps Frame rate of the stream.
+     *
+     *  @return Status of request.
+     */
+    CameraDevice::Status startStream(rs_stream stream, uint32_t width, uint32_t height,
+                                     rs_format format, uint32_t fps);
+
+    /**
+     *  Disable a stream. The device keeps running while other streams are enabled.
+     *
+     *  @param[in] stream Stream to disable.
+     */
+    void stopStream(rs_stream stream);
+
+    /**
+     *  Wait for an image of the stream newer than seq and hand it to the callback. The image data
+     *  is only valid while the callback runs.
+     *
+     *  @param[in] stream Stream to read.
+     *  @param[in,out] seq Sequence number of the last image read, updated on success.
+     *  @param[out] timestamp Monotonic time the image was received in nano sec.
+     *  @param[in] process Callback to consume the image data.
+     *  @param[in] timeoutMs Time to wait for a new image in milliseconds.
+     *
+     *  @return Status of request.
+     */
+    CameraDevice::Status
+    readFrame(rs_stream stream, uint32_t &seq, uint64_t &timestamp,
+              const std::function<void(const uint8_t *data, size_t size)> &process, int timeoutMs);
+
+private:
+    RealSenseSession(rs_context *ctx, rs_device *dev);
+    struct StreamSlot {
+        bool enabled = false;
+        uint32_t seq = 0;          /* Sequence number of the image in data */
+        uint64_t timestamp = 0;    /* Monotonic time the image was received */
+        size_t size = 0;           /* Size of an image of the stream */
+        std::vector<uint8_t> data; /* Latest image of the stream */
+    };
+    void captureThread();
+    void stopDevice();
+    int startDevice();
+    rs_context *mRSCtx;
+    rs_device *mRSDev;
+    std::mutex mLock;       /* Protects the stream slots */
+    std::mutex mDeviceLock; /* Serializes device configuration */
+    std::condition_variable mFrameCond;
+    StreamSlot mSlots[RS_STREAM_COUNT];
+    std::atomic<bool> mRunning;
+    std::thread mThread;
+};
@@ -17,9 +17,11 @@
  */
 #include <cstring>
 #include <linux/videodev2.h>
+#include <map>
 #include <sys/ioctl.h>
 
 #include "CameraDeviceV4l2.h"
+#include "V4l2CapCache.h"
 #include "v4l2_interface.h"
 
 CameraDeviceV4l2::CameraDeviceV4l2(std::string device)
@@ -28,6 +30,7 @@ CameraDeviceV4l2::CameraDeviceV4l2(std::string device)
     , mDriverName("v4l2-drv")
     , mCamDefURI{}
     , mMode(CameraParameters::Mode::MODE_VIDEO)
+    , mPixelFormat(CameraParameters::PixelFormat::PIXEL_FORMAT_MIN)
 {
     log_info("%s Node: %s", __func__, mDeviceId.c_str());
     int ret = initInfo();
@@ -127,6 +130,45 @@ CameraDevice::Status CameraDeviceV4l2::setParam(CameraParameters &camParam, std:
         return CameraDevice::Status::SUCCESS;
 }
 
+CameraDevice::Status CameraDeviceV4l2::setParams(CameraParameters &camParam,
+                                                 const std::vector<ParamValue> &params)
+{
+    std::vector<struct v4l2_ext_control> ctrls;
+    std::map<int, size_t> index; /* Control ID -> position in ctrls */
+
+    for (const auto &p : params) {
+        int cid = getV4l2ControlId(camParam.getParameterID(p.name));
+        if (cid <= 0 || p.type != CameraParameters::PARAM_TYPE_INT32) {
+            // Not a plain V4L2 control, the batch cannot be applied in one go
+            return CameraDevice::setParams(camParam, params);
+        }
+
+        log_info("Parameter: %s Value: %d", p.name.c_str(), p.value.param_int32);
+        // A control may be listed only once, the last value wins
+        auto it = index.find(cid);
+        if (it != index.end()) {
+            ctrls[it->second].value = p.value.param_int32;
+            continue;
+        }
+        struct v4l2_ext_control ctrl = {0};
+        ctrl.id = cid;
+        ctrl.value = p.value.param_int32;
+        index[cid] = ctrls.size();
+        ctrls.push_back(ctrl);
+    }
+
+    if (ctrls.empty())
+        return CameraDevice::Status::SUCCESS;
+
+    if (setV4l2Controls(ctrls))
+        return CameraDevice::Status::ERROR_UNKNOWN;
+
+    for (const auto &p : params)
+        camParam.setParameter(p.name, p.value.param_int32);
+
+    return CameraDevice::Status::SUCCESS;
+}
+
 CameraDevice::Status CameraDeviceV4l2::resetParams(CameraParameters &camParam)
 {
     log_info("%s", __func__);
@@ -146,8 +188,32 @@ CameraDevice::Status CameraDeviceV4l2::setSize(const uint32_t width, const uint3
     return CameraDevice::Status::SUCCESS;
 }
 
+/* v4l2src negotiates raw frames, only a compressed capture format has to be asked for */
 CameraDevice::Status CameraDeviceV4l2::setPixelFormat(const CameraParameters::PixelFormat format)
 {
+    if (format != CameraParameters::PixelFormat::PIXEL_FORMAT_MJPEG
+        && format != CameraParameters::PixelFormat::PIXEL_FORMAT_H264
+        && format != CameraParameters::PixelFormat::PIXEL_FORMAT_MIN)
+        return CameraDevice::Status::NOT_SUPPORTED;
+
+    mPixelFormat = format;
+    return CameraDevice::Status::SUCCESS;
+}
+
+CameraDevice::Status CameraDeviceV4l2::getPixelFormat(CameraParameters::PixelFormat &format) const
+{
+    format = mPixelFormat;
+    return CameraDevice::Status::SUCCESS;
+}
+
+/* UVC H.264 cameras encode on board, their stream is passed through */
+CameraDevice::Status
+CameraDeviceV4l2::getEncodedFormat(CameraParameters::VIDEO_CODING_FORMAT &codec) const
+{
+    if (mPixelFormat != CameraParameters::PixelFormat::PIXEL_FORMAT_H264)
+        return CameraDevice::Status::NOT_SUPPORTED;
+
+    codec = CameraParameters::VIDEO_CODING_AVC;
     return CameraDevice::Status::SUCCESS;
 }
 
@@ -229,21 +295,79 @@ int CameraDeviceV4l2::declareParams(CameraParameters &camParam)
     return ret;
 }
 
+std::shared_ptr<const V4l2Caps> CameraDeviceV4l2::getCaps(int camFd)
+{
+    // Query again, the node may be another device since it was created
+    struct v4l2_capability vCap;
+    if (v4l2_query_cap(camFd, vCap)) {
+        log_error("Error in Query Capability : Error:%d", errno);
+        return nullptr;
+    }
+
+    return V4l2CapCache::get().lookup(camFd, vCap);
+}
+
+/* Controls that hold a single value readable with the others in one ioctl */
+static bool is_value_control(const struct v4l2_queryctrl &qctrl)
+{
+    if (qctrl.flags & (V4L2_CTRL_FLAG_DISABLED | V4L2_CTRL_FLAG_WRITE_ONLY))
+        return false;
+
+    switch (qctrl.type) {
+    case V4L2_CTRL_TYPE_INTEGER:
+    case V4L2_CTRL_TYPE_BOOLEAN:
+    case V4L2_CTRL_TYPE_MENU:
+    case V4L2_CTRL_TYPE_INTEGER_MENU:
+    case V4L2_CTRL_TYPE_BITMASK:
+        return true;
+    default:
+        return false;
+    }
+}
+
 int CameraDeviceV4l2::declareV4l2Params(CameraParameters &camParam)
 {
     int ret = 0;
     int value;
     int camFd = v4l2_open(mDeviceId);
+    if (camFd < 0)
+        return -1;
 
-    const unsigned next_fl = V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND;
-    struct v4l2_queryctrl qctrl = {0};
-    struct v4l2_control ctrl = {0};
+    std::shared_ptr<const V4l2Caps> caps = getCaps(camFd);
+    if (!caps) {
+        v4l2_close(camFd);
+        return -1;
+    }
 
-    qctrl.id = next_fl;
-    while (v4l2_ioctl(camFd, VIDIOC_QUERYCTRL, &qctrl) == 0) {
+    std::vector<struct v4l2_ext_control> values;
+    for (const auto &qctrl : caps->controls) {
+        if (!is_value_control(qctrl))
+            continue;
+        struct v4l2_ext_control ctrl = {0};
         ctrl.id = qctrl.id;
-        if (v4l2_ioctl(camFd, VIDIOC_G_CTRL, &ctrl) == 0)
-            value = ctrl.value;
+        values.push_back(ctrl);
+    }
+
+    // Current values, one ioctl for all controls unless the driver rejects the batch
+    std::map<uint32_t, int32_t> current;
+    if (v4l2_get_controls(camFd, values) == 0) {
+        for (const auto &ctrl : values)
+            current[ctrl.id] = ctrl.value;
+    } else {
+        struct v4l2_control ctrl = {0};
+        for (const auto &v : values) {
+            ctrl.id = v.id;
+            if (v4l2_ioctl(camFd, VIDIOC_G_CTRL, &ctrl) == 0)
+                current[ctrl.id] = ctrl.value;
+        }
+    }
+
+    v4l2_close(camFd);
+
+    for (const auto &qctrl : caps->controls) {
+        auto it = current.find(qctrl.id);
+        if (it != current.end())
+            value = it->second;
         else
             value = qctrl.default_value;
 
@@ -251,12 +375,8 @@ int CameraDeviceV4l2::declareV4l2Params(CameraParameters &camParam)
         camParam.setParameterIdType(getParamName(qctrl.id), getParamId(qctrl.id),
                                     getParamType((v4l2_ctrl_type)qctrl.type));
         camParam.setParameter(getParamName(qctrl.id), (int32_t)value);
-
-        qctrl.id |= next_fl;
     }
 
-    v4l2_close(camFd);
-
     return ret;
 }
 
@@ -268,36 +388,54 @@ int CameraDeviceV4l2::resetV4l2Params(CameraParameters &camParam)
     std::string param;
 
     int camFd = v4l2_open(mDeviceId);
+    if (camFd < 0)
+        return -1;
 
-    const unsigned next_fl = V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND;
-    struct v4l2_queryctrl qctrl = {0};
+    std::shared_ptr<const V4l2Caps> caps = getCaps(camFd);
+    if (!caps) {
+        v4l2_close(camFd);
+        return -1;
+    }
 
-    qctrl.id = next_fl;
-    while (v4l2_ioctl(camFd, VIDIOC_QUERYCTRL, &qctrl) == 0) {
+    std::vector<std::pair<const struct v4l2_queryctrl *, bool>> resets; /* Control, in batch */
+    std::vector<struct v4l2_ext_control> ctrls;
+    for (const auto &qctrl : caps->controls) {
         if (qctrl.flags & V4L2_CTRL_FLAG_DISABLED) {
             log_warning("V4L2 Control %s ID:%d disabled", qctrl.name, qctrl.id);
-            qctrl.id |= next_fl;
             continue;
         }
 
-        param = getParamName(qctrl.id);
-        if (param.empty()) {
-            qctrl.id |= next_fl;
+        if (getParamName(qctrl.id).empty())
             continue;
+
+        bool inBatch = is_value_control(qctrl) && !(qctrl.flags & V4L2_CTRL_FLAG_READ_ONLY);
+        resets.push_back(std::make_pair(&qctrl, inBatch));
+        if (inBatch) {
+            struct v4l2_ext_control ctrl = {0};
+            ctrl.id = qctrl.id;
+            ctrl.value = qctrl.default_value;
+            ctrls.push_back(ctrl);
         }
+    }
 
-        value = (int32_t)qctrl.default_value;
-        log_info("resetV4l2Params Id:%d Value:%d", qctrl.id, value);
-        ret = v4l2_set_control(camFd, qctrl.id, value);
+    // All defaults in one ioctl, so that the image changes once
+    bool batched = !ctrls.empty() && v4l2_set_controls(camFd, ctrls) == 0;
+    if (!batched && !ctrls.empty())
+        log_debug("Batch reset of V4L2 controls rejected, reset one at a time");
+
+    for (const auto &reset : resets) {
+        const struct v4l2_queryctrl *qctrl = reset.first;
+        param = getParamName(qctrl->id);
+        value = (int32_t)qctrl->default_value;
+        log_info("resetV4l2Params Id:%d Value:%d", qctrl->id, value);
+        ret = batched && reset.second ? 0 : v4l2_set_control(camFd, qctrl->id, value);
         if (!ret) {
             if (camParam.setParameter(param, (int32_t)value))
                 status = 0;
             else
                 log_error("Error in saving v4l2 param :%s", param.c_str());
         } else
-            log_error("Error in setting %s to default", qctrl.name);
-
-        qctrl.id |= next_fl;
+            log_error("Error in setting %s to default", qctrl->name);
     }
 
     v4l2_close(camFd);
@@ -562,3 +700,19 @@ int CameraDeviceV4l2::setV4l2Control(int ctrl_id, int value)
     v4l2_close(fd);
     return ret;
 }
+
+int CameraDeviceV4l2::setV4l2Controls(std::vector<struct v4l2_ext_control> &ctrls)
+{
+    int fd = v4l2_open(mDeviceId);
+    if (fd < 0)
+        return -1;
+
+    // Validate the whole batch first, so that a bad value leaves the device untouched
+    int ret = v4l2_try_controls(fd, ctrls);
+    if (!ret)
+        ret = v4l2_set_controls(fd, ctrls);
+    if (ret)
+        log_error("Error in setting %zu controls Error:%d", ctrls.size(), errno);
+    v4l2_close(fd);
+    return ret;
+}
@@ -17,11 +17,15 @@
  */
 #pragma once
 #include <linux/videodev2.h>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "CameraDevice.h"
 #include "CameraParameters.h"
 
+struct V4l2Caps;
+
 class CameraDeviceV4l2 final : public CameraDevice {
 public:
     CameraDeviceV4l2(std::string device);
@@ -35,9 +39,12 @@ public:
     Status stop();
     Status setParam(CameraParameters &camParam, const std::string param, const char *param_value,
                     const size_t value_size, const int param_type);
+    Status setParams(CameraParameters &camParam, const std::vector<ParamValue> &params);
     Status resetParams(CameraParameters &camParam);
     Status setSize(const uint32_t width, const uint32_t height);
     Status setPixelFormat(const CameraParameters::PixelFormat format);
+    Status getPixelFormat(CameraParameters::PixelFormat &format) const;
+    Status getEncodedFormat(CameraParameters::VIDEO_CODING_FORMAT &codec) const;
     Status setMode(const CameraParameters::Mode mode);
     Status getMode(CameraParameters::Mode &mode) const;
     Status setCameraDefinitionUri(const std::string uri);
@@ -50,14 +57,17 @@ private:
     std::string mCamDefURI;
     uint32_t mVersion;
     CameraParameters::Mode mMode;
+    CameraParameters::PixelFormat mPixelFormat; /* Captured format, MIN for raw as negotiated */
     int initInfo();
     int initParams(CameraParameters &camParam);
     int declareParams(CameraParameters &camParam);
     int resetV4l2Params(CameraParameters &camParam);
     int declareV4l2Params(CameraParameters &camParam);
+    std::shared_ptr<const V4l2Caps> getCaps(int camFd);
     std::string getParamName(int cid);
     int getParamId(int cid);
     CameraParameters::param_type getParamType(v4l2_ctrl_type type);
     int getV4l2ControlId(int paramId);
     int setV4l2Control(int ctrl_id, int value);
+    int setV4l2Controls(std::vector<struct v4l2_ext_control> &ctrls);
 };
@@ -26,13 +26,17 @@ static PluginV4l2 v4l2;
 PluginV4l2::PluginV4l2()
     : PluginBase()
 {
-    v4l2_list_devices(mCamList);
 }
 
 PluginV4l2::~PluginV4l2()
 {
 }
 
+void PluginV4l2::init()
+{
+    v4l2_list_devices(mCamList);
+}
+
 std::vector<std::string> PluginV4l2::getCameraDevices()
 {
     return mCamList;
@@ -48,3 +52,19 @@ std::shared_ptr<CameraDevice> PluginV4l2::createCameraDevice(std::string deviceI
 
     return std::make_shared<CameraDeviceV4l2>(deviceID);
 }
+
+bool PluginV4l2::addCameraDevice(const std::string &deviceID)
+{
+    if (deviceID.compare(0, sizeof(V4L2_VIDEO_PREFIX) - 1, V4L2_VIDEO_PREFIX))
+        return false;
+
+    if (std::find(mCamList.begin(), mCamList.end(), deviceID) == mCamList.end())
+        mCamList.push_back(deviceID);
+
+    return true;
+}
+
+void PluginV4l2::removeCameraDevice(const std::string &deviceID)
+{
+    mCamList.erase(std::remove(mCamList.begin(), mCamList.end(), deviceID), mCamList.end());
+}
@@ -28,8 +28,11 @@ public:
     PluginV4l2();
     ~PluginV4l2();
 
+    void init();
     std::vector<std::string> getCameraDevices();
     std::shared_ptr<CameraDevice> createCameraDevice(std::string);
+    bool addCameraDevice(const std::string &deviceID);
+    void removeCameraDevice(const std::string &deviceID);
 
 private:
     std::vector<std::string> mCamList;
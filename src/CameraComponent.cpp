@@ -18,6 +18,8 @@
 #include <cstring>
 
 #include "CameraComponent.h"
+#include "CaptureGroup.h"
+#include "FileWriter.h"
 #include "ImageCaptureGst.h"
 #include "VideoCaptureGst.h"
 #include "VideoStreamRtsp.h"
@@ -28,14 +30,27 @@
 #include "util.h"
 #include <algorithm>
 
+/* Where images are written when no location is configured, as in ImageCaptureGst */
+#define DEFAULT_IMAGE_PATH "/tmp/"
+
 CameraComponent::CameraComponent(std::shared_ptr<CameraDevice> device)
     : mCamDev(device)
+    , mVidCodec(CameraParameters::VIDEO_CODING_MIN)
+    , mVidBitRate(0)
+    , mSettingsGen(0)
+    , mStorageGen(0)
+    , mDeviceInit(false)
 {
     mCamDevName = mCamDev->getDeviceId();
 
     // Get info from the camera device
     mCamDev->getInfo(mCamInfo);
 
+    // Frames of devices not read by v4l2src are shared between streaming and capture,
+    // the capture thread only runs while someone subscribes
+    mFrameHub = std::make_shared<FrameHub>(mCamDev);
+    mFrameHub->setInitCallback([this]() { return initDevice(); });
+
     initStorageInfo(mStoreInfo);
 }
 
@@ -43,6 +58,9 @@ CameraComponent::~CameraComponent()
 {
     log_debug("%s::%s", __func__, mCamDev->getDeviceId().c_str());
 
+    if (mCaptureGroup)
+        mCaptureGroup->removeComponent(this);
+
     if (mVidCap) {
         mVidCap->stop();
         mVidCap->uninit();
@@ -61,6 +79,10 @@ CameraComponent::~CameraComponent()
         mVidStream.reset();
     }
 
+    // stop reading frames before the device goes away
+    mFrameHub->setInitCallback(nullptr);
+    mFrameHub.reset();
+
     // stop the camera device
     mCamDev->stop();
 
@@ -72,18 +94,49 @@ CameraComponent::~CameraComponent()
 
 int CameraComponent::start()
 {
-    CameraDevice::Status ret;
+    // The camera device is initialized on first use, recordings with pre-event time encode from
+    // now on though. Grouped cameras start together only.
+    if (!mCaptureGroup && VideoCaptureGst::isPrerollEnabled()) {
+        if (initDevice())
+            return -1;
+        if (startVideoPreroll())
+            log_error("Error in starting pre-event recording");
+    }
+
+    return 0;
+}
+
+/* Parameters are read from the device, and the device started, by the first request that needs
+ * them instead of at start, so that the camera is announced without waiting for slow devices */
+int CameraComponent::initDevice()
+{
+    std::lock_guard<std::mutex> locker(mInitLock);
+    if (mDeviceInit)
+        return 0;
+
+    usec_t start = now_usec();
 
     // Get list of Parameters supported & its default value
-    ret = mCamDev->init(mCamParam);
-    if (ret != CameraDevice::Status::SUCCESS)
+    CameraDevice::Status ret = mCamDev->init(mCamParam);
+    if (ret != CameraDevice::Status::SUCCESS) {
+        log_error("Error in initializing camera device %s", mCamDevName.c_str());
         return -1;
+    }
 
-    // start the camera device
-    ret = mCamDev->start();
-    if (ret != CameraDevice::Status::SUCCESS)
-        return -1;
+    // Devices read by v4l2src are opened by the gstreamer pipeline, others are started by the
+    // frame hub when the first consumer subscribes
+    if (mCamDev->isGstV4l2Src()) {
+        // start the camera device
+        ret = mCamDev->start();
+        if (ret != CameraDevice::Status::SUCCESS) {
+            mCamDev->uninit();
+            return -1;
+        }
+    }
 
+    mDeviceInit = true;
+    log_info("Camera device %s initialized in %llu ms", mCamDevName.c_str(),
+             (unsigned long long)(now_usec() - start) / USEC_PER_MSEC);
     return 0;
 }
 
@@ -107,63 +160,116 @@ int CameraComponent::stop()
         mVidStream.reset();
     }
 
+    // stop reading frames now instead of after the linger time
+    mFrameHub->stop();
+
     // stop the camera device
     mCamDev->stop();
 
     // Uninit the camera device
     mCamDev->uninit();
 
+    std::lock_guard<std::mutex> locker(mInitLock);
+    mDeviceInit = false;
+
     return 0;
 }
 
+const std::string &CameraComponent::getDeviceId() const
+{
+    return mCamDevName;
+}
+
 const CameraInfo &CameraComponent::getCameraInfo() const
 {
     return mCamInfo;
 }
 
-const StorageInfo &CameraComponent::getStorageInfo() const
+/* space and speed of the storage the images are written to, as of now */
+const StorageInfo &CameraComponent::getStorageInfo()
 {
+    std::string path = mImgPath.empty() ? DEFAULT_IMAGE_PATH : mImgPath;
+    float total = 0, available = 0;
+    if (FileWriter::getSpace(path, total, available)) {
+        mStoreInfo.status = 0; /*not available*/
+        mStoreInfo.total_capacity = 0;
+        mStoreInfo.used_capacity = 0;
+        mStoreInfo.available_capacity = 0;
+    } else {
+        mStoreInfo.status = 2; /*formatted*/
+        mStoreInfo.total_capacity = total;
+        mStoreInfo.used_capacity = total - available;
+        mStoreInfo.available_capacity = available;
+    }
+    mStoreInfo.write_speed = FileWriter::getWriteSpeed();
+
     return mStoreInfo;
 }
 
-const std::map<std::string, std::string> &CameraComponent::getParamList() const
+uint32_t CameraComponent::getSettingsGeneration() const
 {
-    return mCamParam.getParameterList();
+    return mSettingsGen;
+}
+
+uint32_t CameraComponent::getStorageGeneration() const
+{
+    return mStorageGen;
+}
+
+int CameraComponent::getBufferStats(BufferStats &stats) const
+{
+    if (mCamDev->getBufferStats(stats) != CameraDevice::Status::SUCCESS)
+        return -1;
+
+    return 0;
+}
+
+const std::vector<CameraParameters::Parameter> &CameraComponent::getParamList()
+{
+    initDevice();
+    return mCamParam.getParameterTable();
+}
+
+size_t CameraComponent::getParamCount()
+{
+    initDevice();
+    return mCamParam.getParameterCount();
 }
 
 void CameraComponent::initStorageInfo(struct StorageInfo &storeInfo)
 {
-    // TODO:: Fill storage details with real values
+    // capacity and write speed are filled as the storage is queried, read speed is not measured
     storeInfo.storage_id = 1;
     storeInfo.storage_count = 1;
-    storeInfo.status = 2; /*formatted*/
-    storeInfo.total_capacity = 50.0;
-    storeInfo.used_capacity = 0.0;
-    storeInfo.available_capacity = 50.0;
-    storeInfo.read_speed = 128;
-    storeInfo.write_speed = 128;
+    storeInfo.status = 0;
+    storeInfo.total_capacity = 0;
+    storeInfo.used_capacity = 0;
+    storeInfo.available_capacity = 0;
+    storeInfo.read_speed = 0;
+    storeInfo.write_speed = 0;
 }
 
 int CameraComponent::getParamType(const char *param_id, size_t id_size)
 {
-    if (!param_id)
+    if (!param_id || initDevice())
         return 0;
 
-    return mCamParam.getParameterType(toString(param_id, id_size));
+    const CameraParameters::Parameter *param = mCamParam.findParameter(param_id, id_size);
+    return param ? param->type : -1;
 }
 
 int CameraComponent::getParam(const char *param_id, size_t id_size, char *param_value,
                               size_t value_size)
 {
     // query the value set in the map and fill the output, return appropriate value
-    if (!param_id || !param_value || value_size == 0)
+    if (!param_id || !param_value || value_size == 0 || initDevice())
         return 1;
 
-    std::string value = mCamParam.getParameter(toString(param_id, id_size));
-    if (value.empty())
+    const CameraParameters::Parameter *param = mCamParam.findParameter(param_id, id_size);
+    if (!param || !param->isSet || !param->len)
         return 1;
 
-    mem_cpy(param_value, value_size, value.data(), value.size(), value_size);
+    mem_cpy(param_value, value_size, param->value.bytes, param->len, value_size);
     return 0;
 }
 
@@ -171,17 +277,94 @@ int CameraComponent::setParam(const char *param_name, size_t id_size, const char
                               size_t value_size, int param_type)
 {
     CameraDevice::Status ret;
+    if (initDevice())
+        return -1;
+
     std::string param = toString(param_name, id_size);
+    int streamRet = setStreamParam(param, param_value, value_size);
+    if (streamRet != 1)
+        return streamRet;
+
     ret = mCamDev->setParam(mCamParam, param, param_value, value_size, param_type);
-    if (ret == CameraDevice::Status::SUCCESS)
+    if (ret == CameraDevice::Status::SUCCESS) {
+        mSettingsGen++;
         return 0;
+    }
     else
         return -1;
 }
 
+/* Parameters of the stream rather than the camera, 1 if param is not one of them */
+int CameraComponent::setStreamParam(const std::string &param, const char *param_value,
+                                    size_t value_size)
+{
+    uint32_t value;
+    if (value_size < sizeof(value))
+        return 1;
+    memcpy(&value, param_value, sizeof(value));
+
+    if (param == CameraParameters::VIDEO_SIZE)
+        return setVideoSize(value);
+    if (param == CameraParameters::VIDEO_FRAME_FORMAT)
+        return setVideoFrameFormat(value);
+    if (param == CameraParameters::VIDEO_BITRATE)
+        return setVideoBitRate(value);
+
+    return 1;
+}
+
+int CameraComponent::setParams(const std::vector<CameraDevice::ParamValue> &params)
+{
+    if (initDevice())
+        return -1;
+
+    /* the parameters of the stream are applied here, the others by the camera as a batch */
+    int streamRet = 0;
+    std::vector<CameraDevice::ParamValue> devParams;
+    for (const auto &p : params) {
+        int r = setStreamParam(p.name, (const char *)p.value.bytes, sizeof(p.value.bytes));
+        if (r == 1)
+            devParams.push_back(p);
+        else if (r)
+            streamRet = -1;
+    }
+    if (devParams.empty())
+        return streamRet;
+
+    CameraDevice::Status ret = mCamDev->setParams(mCamParam, devParams);
+    /* some of the parameters may be set even on error */
+    mSettingsGen++;
+    return ret == CameraDevice::Status::SUCCESS ? streamRet : -1;
+}
+
+/* The stream, and the sensor, keep running across a mode switch. Only the still capture is made
+ * ready on entering still mode, and let go on leaving it, so that the switch takes milliseconds */
 int CameraComponent::setCameraMode(CameraParameters::Mode mode)
 {
+    usec_t start = now_usec();
+    CameraParameters::Mode prev = getCameraMode();
+
     mCamDev->setMode(mode);
+    mSettingsGen++;
+    if (mode == prev)
+        return 0;
+
+    if (mode == CameraParameters::Mode::MODE_STILL) {
+        if (initDevice())
+            return -1;
+        if (!mImgCap && createImageCapture())
+            log_error("Error in creating image capture of camera %s", mCamDevName.c_str());
+        else if (mImgCap->prepare())
+            log_error("Error in preparing image capture of camera %s", mCamDevName.c_str());
+    } else if (mImgCap) {
+        mImgCap->release();
+    }
+
+    uint64_t elapsed = now_usec() - start;
+    mModeSwitch.record(elapsed);
+    log_info("Camera %s switched to %s mode in %llu ms", mCamDevName.c_str(),
+             mode == CameraParameters::Mode::MODE_STILL ? "still" : "video",
+             (unsigned long long)elapsed / USEC_PER_MSEC);
     return 0;
 }
 
@@ -195,15 +378,24 @@ CameraParameters::Mode CameraComponent::getCameraMode()
 
 int CameraComponent::resetCameraSettings()
 {
+    if (initDevice())
+        return -1;
+
     CameraDevice::Status ret = mCamDev->resetParams(mCamParam);
-    if (ret != CameraDevice::Status::SUCCESS)
+    mSettingsGen++;
+    if (ret != CameraDevice::Status::SUCCESS) {
         log_debug("Error in reset of camera parameters. Could not open the device.");
-    return -1;
+        return -1;
+    }
+    return 0;
 }
 
 int CameraComponent::setImageCaptureLocation(std::string imgPath)
 {
     mImgPath = imgPath;
+    mStorageGen++;
+    if (mImgCap)
+        mImgCap->setLocation(mImgPath);
     return 0;
 }
 
@@ -215,6 +407,13 @@ int CameraComponent::setImageCaptureSettings(ImageSettings &imgSetting)
     mImgSetting = std::make_shared<ImageSettings>();
     *mImgSetting = imgSetting;
 
+    // still pipeline is rebuilt with the new settings on next capture
+    if (mImgCap) {
+        mImgCap->setResolution(mImgSetting->width, mImgSetting->height);
+        mImgCap->setFormat(mImgSetting->fileFormat);
+        mImgCap->setQuality(mImgSetting->quality);
+    }
+
     return 0;
 }
 
@@ -259,32 +458,29 @@ int CameraComponent::startImageCapture(int interval, int count, capture_callback
 
     mImgCapCB = cb;
 
-    // Delete imgCap instance if already exists
-    // This could be because of no StopImageCapture call after done
-    // Or new startImageCapture call while prev call is still not done
-    if (mImgCap)
-        mImgCap.reset();
-
-    // check if settings are available
-    if (mImgSetting)
-        mImgCap = std::make_shared<ImageCaptureGst>(mCamDev, *mImgSetting);
-    else
-        mImgCap = std::make_shared<ImageCaptureGst>(mCamDev);
-
-    if (!mImgPath.empty())
-        mImgCap->setLocation(mImgPath);
-
-    ret = mImgCap->init();
-    if (!ret) {
-        ret = mImgCap->start(interval, count,
-                             std::bind(&CameraComponent::cbImageCaptured, this,
-                                       std::placeholders::_1, std::placeholders::_2));
-        if (ret) {
+    // The imgCap instance, and its still pipeline, is kept between captures. Stop the previous
+    // capture if still not done, and start over if it ended in error
+    if (mImgCap) {
+        mImgCap->stop();
+        if (mImgCap->getState() != ImageCapture::STATE_INIT) {
             mImgCap->uninit();
             mImgCap.reset();
         }
     }
 
+    if (!mImgCap) {
+        ret = createImageCapture();
+        if (ret)
+            return ret;
+        // started over, a camera in still mode keeps it ready again
+        if (getCameraMode() == CameraParameters::Mode::MODE_STILL)
+            mImgCap->prepare();
+    }
+
+    ret = mImgCap->start(interval, count,
+                         std::bind(&CameraComponent::cbImageCaptured, this, std::placeholders::_1,
+                                   std::placeholders::_2, std::placeholders::_3));
+
     return ret;
 }
 
@@ -293,19 +489,20 @@ int CameraComponent::stopImageCapture()
     if (!mImgCap)
         return 0;
 
+    // keep the still pipeline for the next capture, no interval is reported while idle
     mImgCap->stop();
-    mImgCap->uninit();
-    mImgCap.reset();
+    mImgCap->setInterval(0);
 
     return 0;
 }
 
-void CameraComponent::cbImageCaptured(int result, int seq_num)
+void CameraComponent::cbImageCaptured(int result, int seq_num, uint64_t timestamp)
 {
     log_debug("%s result:%d sequenc:%d", __func__, result, seq_num);
     // TODO :: Get the file path of the image and host it via http
+    mStorageGen++;
     if (mImgCapCB)
-        mImgCapCB(result, seq_num);
+        mImgCapCB(result, seq_num, timestamp);
 }
 
 int CameraComponent::setVideoCaptureLocation(std::string vidPath)
@@ -314,6 +511,33 @@ int CameraComponent::setVideoCaptureLocation(std::string vidPath)
     return 0;
 }
 
+int CameraComponent::setVideoStreamTransport(RtspTransport &transport)
+{
+    if (mRtspTransport)
+        mRtspTransport.reset();
+
+    mRtspTransport = std::make_shared<RtspTransport>();
+    *mRtspTransport = transport;
+
+    return 0;
+}
+
+int CameraComponent::setVideoStreamFormat(CameraParameters::VIDEO_CODING_FORMAT codec)
+{
+    mVidCodec = codec;
+    return 0;
+}
+
+/* the region is kept for the streams started later */
+int CameraComponent::setVideoStreamRoi(const VideoRoi &roi)
+{
+    mVidRoi = roi;
+    if (!mVidStream)
+        return 0;
+
+    return mVidStream->setRegionOfInterest(roi);
+}
+
 int CameraComponent::setVideoCaptureSettings(VideoSettings &vidSetting)
 {
     if (mVidSetting)
@@ -325,23 +549,87 @@ int CameraComponent::setVideoCaptureSettings(VideoSettings &vidSetting)
     return 0;
 }
 
-int CameraComponent::startVideoCapture(int status_freq)
+int CameraComponent::createImageCapture()
 {
-    int ret = 0;
+    // check if settings are available
+    if (mImgSetting)
+        mImgCap = std::make_shared<ImageCaptureGst>(mCamDev, *mImgSetting, mFrameHub);
+    else
+        mImgCap = std::make_shared<ImageCaptureGst>(mCamDev, mFrameHub);
 
-    if (mVidCap)
-        mVidCap.reset();
+    if (!mImgPath.empty())
+        mImgCap->setLocation(mImgPath);
 
-    // TODO :: Check if video capture or video streaming is running
+    int ret = mImgCap->init();
+    if (ret)
+        mImgCap.reset();
+
+    return ret;
+}
+
+std::shared_ptr<VideoCapture> CameraComponent::createVideoCapture()
+{
+    std::shared_ptr<VideoCaptureGst> vidCap;
 
     // check if settings are available
     if (mVidSetting)
-        mVidCap = std::make_shared<VideoCaptureGst>(mCamDev, *mVidSetting);
+        vidCap = std::make_shared<VideoCaptureGst>(mCamDev, *mVidSetting, mFrameHub);
     else
-        mVidCap = std::make_shared<VideoCaptureGst>(mCamDev);
+        vidCap = std::make_shared<VideoCaptureGst>(mCamDev, mFrameHub);
 
     if (!mVidPath.empty())
-        mVidCap->setLocation(mVidPath);
+        vidCap->setLocation(mVidPath);
+
+    if (mCaptureGroup)
+        vidCap->setCaptureGroup(mCaptureGroup);
+
+    return vidCap;
+}
+
+int CameraComponent::startVideoPreroll()
+{
+    mVidCap = createVideoCapture();
+
+    int ret = mVidCap->init();
+    if (!ret) {
+        ret = mVidCap->startPreroll();
+        if (ret)
+            mVidCap->uninit();
+    }
+    if (ret)
+        mVidCap.reset();
+
+    return ret;
+}
+
+int CameraComponent::startVideoCapture(int status_freq)
+{
+    if (mCaptureGroup)
+        return mCaptureGroup->startVideoCapture();
+
+    return startLocalVideoCapture();
+}
+
+int CameraComponent::startLocalVideoCapture()
+{
+    int ret = 0;
+
+    // the pre-event ring is written out first
+    if (mVidCap && mVidCap->isPrerolling()) {
+        ret = mVidCap->start();
+        if (ret) {
+            mVidCap->uninit();
+            mVidCap.reset();
+        }
+        return ret;
+    }
+
+    if (mVidCap)
+        mVidCap.reset();
+
+    // TODO :: Check if video capture or video streaming is running
+
+    mVidCap = createVideoCapture();
 
     ret = mVidCap->init();
     if (!ret) {
@@ -356,13 +644,29 @@ int CameraComponent::startVideoCapture(int status_freq)
 }
 
 int CameraComponent::stopVideoCapture()
+{
+    if (mCaptureGroup)
+        return mCaptureGroup->stopVideoCapture();
+
+    return stopLocalVideoCapture();
+}
+
+int CameraComponent::stopLocalVideoCapture()
 {
     int ret = 0;
 
+    // the recording took space
+    mStorageGen++;
+
     if (!mVidCap)
         return 0;
 
     mVidCap->stop();
+
+    // keep encoding for the pre-event time of the next recording
+    if (mVidCap->isPrerolling())
+        return 0;
+
     mVidCap->uninit();
     mVidCap.reset();
 
@@ -395,13 +699,69 @@ uint8_t CameraComponent::getVideoCaptureStatus()
     return ret;
 }
 
+int CameraComponent::getVideoCaptureStats(VideoCaptureStats &stats)
+{
+    if (!mVidCap)
+        return -1;
+
+    return mVidCap->getStats(stats);
+}
+
+void CameraComponent::setCaptureGroup(std::shared_ptr<CaptureGroup> group)
+{
+    if (mCaptureGroup)
+        mCaptureGroup->removeComponent(this);
+
+    mCaptureGroup = group;
+    if (mCaptureGroup)
+        mCaptureGroup->addComponent(this);
+}
+
 int CameraComponent::setVideoSize(uint32_t param_value)
 {
+    /* width and height of the CameraParameters::ID_VIDEO_SIZE_* values, from 1 on */
+    static const uint16_t sizes[][2]
+        = {{1920, 1080}, {1920, 1080}, {1280, 720}, {1280, 720}, {960, 540}, {960, 540},
+           {848, 480},   {848, 480},   {640, 480},  {640, 480},  {640, 480}, {640, 360},
+           {640, 360},   {424, 240},   {424, 240},  {320, 240},  {320, 240}, {320, 240},
+           {320, 180},   {320, 180}};
+
+    if (param_value < 1 || param_value > sizeof(sizes) / sizeof(sizes[0]))
+        return -1;
+
+    /* a running stream is scaled without the clients reconnecting */
+    if (mVidStream
+        && mVidStream->setResolution(sizes[param_value - 1][0], sizes[param_value - 1][1]))
+        return -1;
+
+    mCamParam.setParameter(CameraParameters::VIDEO_SIZE, param_value);
+    mSettingsGen++;
+    return 0;
+}
+
+/* the value is in kbps, applied to the running stream at once and kept for the next ones */
+int CameraComponent::setVideoBitRate(uint32_t param_value)
+{
+    if (mVidStream && mVidStream->setBitRate(param_value))
+        return -1;
+
+    mVidBitRate = param_value;
+    mCamParam.setParameter(CameraParameters::VIDEO_BITRATE, param_value);
+    mSettingsGen++;
     return 0;
 }
 
+/* the value is a CameraParameters::VIDEO_CODING_FORMAT, kept for the streams started later */
 int CameraComponent::setVideoFrameFormat(uint32_t param_value)
 {
+    CameraParameters::VIDEO_CODING_FORMAT codec
+        = static_cast<CameraParameters::VIDEO_CODING_FORMAT>(param_value);
+    if (mVidStream && mVidStream->setFormat(codec))
+        return -1;
+
+    mVidCodec = codec;
+    mCamParam.setParameter(CameraParameters::VIDEO_FRAME_FORMAT, param_value);
+    mSettingsGen++;
     return 0;
 }
 
@@ -409,21 +769,29 @@ int CameraComponent::startVideoStream(const bool isUdp)
 {
     int ret = 0;
 
-    // TODO :: Check if image/video capture is running
-    // If yes, video streaming may work by adding a tee element
-    // in the gstreamer pipeline. Currently conncurent use cases
-    // not supported
+    // Image/video capture may run at the same time, frames of appsrc based
+    // devices are shared through the frame hub
 
     // Close previous instance of video streaming if exist
     if (mVidStream)
         mVidStream.reset();
 
     if (isUdp)
-        mVidStream = std::make_shared<VideoStreamUdp>(mCamDev);
+        mVidStream = std::make_shared<VideoStreamUdp>(mCamDev, mFrameHub);
     else {
-        mVidStream = std::make_shared<VideoStreamRtsp>(mCamDev);
+        std::shared_ptr<VideoStreamRtsp> rtsp
+            = std::make_shared<VideoStreamRtsp>(mCamDev, mFrameHub);
+        if (mRtspTransport)
+            rtsp->setTransport(*mRtspTransport);
+        mVidStream = rtsp;
     }
 
+    if (mVidCodec != CameraParameters::VIDEO_CODING_MIN && mVidStream->setFormat(mVidCodec))
+        log_warning("Streaming %s in the default video coding format", mCamDevName.c_str());
+    if (mVidBitRate && mVidStream->setBitRate(mVidBitRate))
+        log_warning("Streaming %s at the default bitrate", mCamDevName.c_str());
+    mVidStream->setRegionOfInterest(mVidRoi);
+
     ret = mVidStream->init();
     if (!ret) {
         ret = mVidStream->start();
@@ -483,6 +851,29 @@ uint8_t CameraComponent::getVideoStreamStatus() const
     return ret;
 }
 
+int CameraComponent::getVideoStreamInfo(VideoStreamInfo &info) const
+{
+    info = VideoStreamInfo();
+    info.status = getVideoStreamStatus();
+    if (!mVidStream)
+        return 0;
+
+    mVidStream->getResolution(info.width, info.height);
+    info.bitRate = std::max(0, mVidStream->getBitRate());
+    info.codec = mVidStream->getFormat();
+    info.path = mVidStream->getPath();
+    info.clients = std::max(0, mVidStream->getClientCount());
+    info.port = mVidStream->getPort();
+    if (info.path.empty())
+        info.address = mVidStream->getAddress();
+
+    // streams run at the frame rate of the camera
+    if (mCamDev->getFrameRate(info.frameRate) != CameraDevice::Status::SUCCESS)
+        info.frameRate = 0;
+
+    return 0;
+}
+
 /* Input string can be either null-terminated or not */
 std::string CameraComponent::toString(const char *buf, size_t buf_size)
 {
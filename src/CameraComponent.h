@@ -16,15 +16,19 @@
  * limitations under the License.
  */
 #pragma once
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <functional>
 
 #include "CameraDevice.h"
 #include "CameraParameters.h"
+#include "FrameHub.h"
 #include "ImageCapture.h"
+#include "StageStats.h"
 #include "VideoCapture.h"
 #include "VideoStream.h"
 #include "log.h"
@@ -41,6 +45,7 @@ struct StorageInfo {
 };
 
 class CameraDevice;
+class CaptureGroup;
 
 class CameraComponent {
 public:
@@ -48,31 +53,51 @@ public:
     virtual ~CameraComponent();
     int start();
     int stop();
+    const std::string &getDeviceId() const;
     const CameraInfo &getCameraInfo() const;
-    const StorageInfo &getStorageInfo() const;
-    const std::map<std::string, std::string> &getParamList() const;
+    const StorageInfo &getStorageInfo();
+    // change counts, for responses encoded from the settings or the storage to be reused
+    uint32_t getSettingsGeneration() const;
+    uint32_t getStorageGeneration() const;
+    int getBufferStats(BufferStats &stats) const;
+    const std::vector<CameraParameters::Parameter> &getParamList();
+    size_t getParamCount();
     int getParamType(const char *param_id, size_t id_size);
     virtual int getParam(const char *param_id, size_t id_size, char *param_value,
                          size_t value_size);
     virtual int setParam(const char *param_id, size_t id_size, const char *param_value,
                          size_t value_size, int param_type);
+    // all at once, in a single frame if the device can
+    virtual int setParams(const std::vector<CameraDevice::ParamValue> &params);
     virtual int setCameraMode(CameraParameters::Mode mode);
     virtual CameraParameters::Mode getCameraMode();
-    typedef std::function<void(int result, int seq_num)> capture_callback_t;
+    // time taken by setCameraMode() to switch modes
+    const LatencyHistogram &getModeSwitchLatency() const { return mModeSwitch; }
+    typedef ImageCapture::result_callback_t capture_callback_t;
     int setImageCaptureLocation(std::string imgPath);
     int setImageCaptureSettings(ImageSettings &imgSetting);
+    // interval in ms
     void getImageCaptureStatus(uint8_t &status, int &interval);
     virtual int startImageCapture(int interval, int count, capture_callback_t cb);
     virtual int stopImageCapture();
-    void cbImageCaptured(int result, int seq_num);
+    void cbImageCaptured(int result, int seq_num, uint64_t timestamp);
     int setVideoCaptureLocation(std::string vidPath);
     int setVideoCaptureSettings(VideoSettings &vidSetting);
+    int setVideoStreamTransport(RtspTransport &transport);
+    int setVideoStreamFormat(CameraParameters::VIDEO_CODING_FORMAT codec);
+    int setVideoStreamRoi(const VideoRoi &roi);
     virtual int startVideoCapture(int status_freq);
     virtual int stopVideoCapture();
     virtual uint8_t getVideoCaptureStatus();
+    int getVideoCaptureStats(VideoCaptureStats &stats);
+    void setCaptureGroup(std::shared_ptr<CaptureGroup> group);
+    // recording of this camera alone, for the capture group
+    int startLocalVideoCapture();
+    int stopLocalVideoCapture();
     int startVideoStream(const bool isUdp);
     int stopVideoStream();
     uint8_t getVideoStreamStatus() const;
+    int getVideoStreamInfo(VideoStreamInfo &info) const;
     int resetCameraSettings(void);
 
 private:
@@ -81,17 +106,34 @@ private:
     StorageInfo mStoreInfo;                /* Storage Information Structure */
     CameraParameters mCamParam;            /* Camera Parameters Object */
     std::shared_ptr<CameraDevice> mCamDev; /* Camera Device Object */
+    std::shared_ptr<FrameHub> mFrameHub;   /* Frame distribution to all consumers */
     std::shared_ptr<ImageCapture> mImgCap; /* Image Capture Object */
-    std::function<void(int result, int seq_num)> mImgCapCB;
+    capture_callback_t mImgCapCB;
     std::string mImgPath;
     std::shared_ptr<ImageSettings> mImgSetting; /* Image Setting Structure */
     std::shared_ptr<VideoCapture> mVidCap; /* Video Capture Object */
     std::string mVidPath;
     std::shared_ptr<VideoSettings> mVidSetting; /* Video Setting Structure */
     std::shared_ptr<VideoStream> mVidStream; /* Video Streaming Object*/
+    std::shared_ptr<RtspTransport> mRtspTransport; /* RTSP Transport Policy */
+    CameraParameters::VIDEO_CODING_FORMAT mVidCodec; /* Codec of the stream, MIN for default */
+    uint32_t mVidBitRate;                            /* Stream bitrate in kbps, 0 for default */
+    VideoRoi mVidRoi;                                /* Region the stream encoder favors */
+    std::shared_ptr<CaptureGroup> mCaptureGroup;   /* Cameras recorded together */
+    std::atomic<uint32_t> mSettingsGen;            /* Bumped on parameter or mode change */
+    std::atomic<uint32_t> mStorageGen;             /* Bumped when files are written */
+    std::mutex mInitLock;                          /* Serializes init of camera device */
+    bool mDeviceInit;                              /* Camera device initialized */
+    LatencyHistogram mModeSwitch;                  /* Time of mode switches */
 
+    int initDevice();
+    int createImageCapture();
     void initStorageInfo(struct StorageInfo &storeInfo);
+    std::shared_ptr<VideoCapture> createVideoCapture();
+    int startVideoPreroll();
     int setVideoFrameFormat(uint32_t param_value);
     int setVideoSize(uint32_t param_value);
+    int setVideoBitRate(uint32_t param_value);
+    int setStreamParam(const std::string &param, const char *param_value, size_t value_size);
     std::string toString(const char *buf, size_t buf_size);
 };
@@ -18,6 +18,7 @@
 #pragma once
 //#include "CameraComponent.h"
 #include <functional>
+#include <utility>
 #include <vector>
 
 #include "CameraParameters.h"
@@ -40,19 +41,151 @@ struct CameraInfo {
     char cam_definition_uri[140];    /**< Camera Definition file URI address */
 };
 
+#define CAMERA_MAX_PLANES 4
+
+/**
+ *  The CameraPlane structure describes where a plane of an image lies in the frame buffer.
+ */
+struct CameraPlane {
+    size_t offset = 0;   /**< offset of the plane from the start of the buffer. */
+    uint32_t stride = 0; /**< bytes from a line of the plane to the next. */
+};
+
 /**
  *  The CameraData structure is used to hold the camera image data and its
- * meta-data.
+ * meta-data. It owns the image buffer: it can be moved but not copied, and the buffer is given
+ * back to the device once the structure holding it is reset or destroyed.
  */
 struct CameraData {
+    CameraData() {}
+    CameraData(const CameraData &) = delete;
+    CameraData &operator=(const CameraData &) = delete;
+    CameraData(CameraData &&other) { *this = std::move(other); }
+    CameraData &operator=(CameraData &&other)
+    {
+        if (this == &other)
+            return *this;
+
+        reset();
+        sec = other.sec;
+        nsec = other.nsec;
+        width = other.width;
+        height = other.height;
+        format = other.format;
+        planes = other.planes;
+        for (uint32_t i = 0; i < CAMERA_MAX_PLANES; i++)
+            plane[i] = other.plane[i];
+        buf = other.buf;
+        bufSize = other.bufSize;
+        fd = other.fd;
+        seq = other.seq;
+        timestamp = other.timestamp;
+        release = std::move(other.release);
+        /* the buffer has a single owner */
+        other.release = nullptr;
+        other.buf = nullptr;
+        other.bufSize = 0;
+        other.fd = -1;
+        return *this;
+    }
+    ~CameraData() { reset(); }
+
+    /**
+     *  Give the buffer back to the device now. The image data is not valid afterwards.
+     */
+    void reset()
+    {
+        if (release) {
+            std::function<void()> done = std::move(release);
+            release = nullptr;
+            done();
+        }
+        buf = nullptr;
+        bufSize = 0;
+        fd = -1;
+    }
+
+    /**
+     *  Describe the planes of the image as laid out by its format, each line of the first plane
+     *  taking stride bytes. Chroma planes are padded in proportion. width, height and format are
+     *  to be set before, compressed formats have no planes.
+     *
+     *  @param[in] stride Bytes per line of the first plane, 0 for lines without padding.
+     */
+    void setPlanes(uint32_t stride = 0)
+    {
+        uint32_t h2 = (height + 1) / 2;
+
+        planes = 1;
+        plane[0].offset = 0;
+        switch (format) {
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+            plane[0].stride = stride ? stride : width;
+            break;
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+            plane[0].stride = stride ? stride : width * 2;
+            break;
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+            plane[0].stride = stride ? stride : width * 3;
+            break;
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB32:
+            plane[0].stride = stride ? stride : width * 4;
+            break;
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+            planes = 2;
+            plane[0].stride = stride ? stride : width;
+            plane[1].offset = (size_t)plane[0].stride * height;
+            plane[1].stride = plane[0].stride;
+            break;
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420:
+        case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV422P: {
+            /* 4:2:2 keeps the chroma lines of every luma line */
+            uint32_t chromaLines
+                = format == CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420 ? h2 : height;
+            planes = 3;
+            plane[0].stride = stride ? stride : width;
+            plane[1].offset = (size_t)plane[0].stride * height;
+            plane[1].stride = (plane[0].stride + 1) / 2;
+            plane[2].offset = plane[1].offset + (size_t)plane[1].stride * chromaLines;
+            plane[2].stride = plane[1].stride;
+            break;
+        }
+        default:
+            planes = 0;
+        }
+    }
+
     uint32_t sec = 0;    /**< system time in sec. */
     uint32_t nsec = 0;   /**< system time in nano sec. */
     uint32_t width = 0;  /**< width of the image. */
     uint32_t height = 0; /**< height of the image. */
-    uint32_t stride = 0; /**< stride. */
-    //    CameraDevice::PixelFormat pixFmt = 0; /**< pixel format of the image. */
+    /** pixel format of the image, PIXEL_FORMAT_MIN if not given by the device. */
+    CameraParameters::PixelFormat format = CameraParameters::PixelFormat::PIXEL_FORMAT_MIN;
+    uint32_t planes = 0; /**< planes described, 0 if laid out without padding by the format. */
+    CameraPlane plane[CAMERA_MAX_PLANES]; /**< layout of the planes, see setPlanes(). */
     void *buf = nullptr; /**< buffer address. */
     size_t bufSize = 0;  /**< buffer size. */
+    int fd = -1;         /**< dmabuf fd of the buffer, -1 if not exported. */
+    uint32_t seq = 0;    /**< frame sequence number, as counted by the device. */
+    uint64_t timestamp = 0; /**< monotonic capture time in nano sec, 0 if unknown. */
+    /**
+     *  Returns the buffer to the device, called once by reset() or the destructor. If set, buf
+     *  stays valid until it is called, otherwise buf is only valid until the next read.
+     */
+    std::function<void()> release = nullptr;
+};
+
+/**
+ *  The BufferStats structure is used to hold the counters of the capture buffer queue of a
+ * camera device.
+ */
+struct BufferStats {
+    uint32_t count = 0;    /**< Number of buffers in the queue. */
+    uint64_t queued = 0;   /**< Buffers given to the device for capture. */
+    uint64_t dequeued = 0; /**< Buffers filled by the device. */
+    uint32_t held = 0;     /**< Buffers currently held by consumers. */
+    uint64_t dropped = 0;  /**< Frames dropped by the device, detected from sequence gaps. */
 };
 
 /**
@@ -179,7 +312,8 @@ public:
     /**
      *  Read camera images from camera device.
      *
-     *  @param[out] data CameraData to hold image and meta-data.
+     *  @param[out] data Empty CameraData to hold image and meta-data. The caller owns the image
+     *  until the CameraData, or the one it is moved to, is reset or destroyed.
      *
      *  @return Status of request.
      */
@@ -202,6 +336,36 @@ public:
         return Status::NOT_SUPPORTED;
     }
 
+    /**
+     *  Parameter and value of a batch given to setParams().
+     */
+    struct ParamValue {
+        std::string name;                          /**< Name of the parameter. */
+        CameraParameters::cam_param_union_t value; /**< Value of the parameter. */
+        int type;                                  /**< Type of the parameter. */
+    };
+
+    /**
+     *  Set several parameters of the camera device at once. Devices able to apply a batch in one
+     *  go, so that it lands in a single frame, override this. Others get the parameters one at a
+     *  time.
+     *
+     *  @param[in,out] camParam Camera Parameters.
+     *  @param[in] params Parameters and their values, in the order to be set.
+     *
+     *  @return Status of request. On error, the parameters before the failed one may be set.
+     */
+    virtual Status setParams(CameraParameters &camParam, const std::vector<ParamValue> &params)
+    {
+        for (const auto &p : params) {
+            Status ret = setParam(camParam, p.name, (const char *)p.value.bytes,
+                                  sizeof(p.value.bytes), p.type);
+            if (ret != Status::SUCCESS)
+                return ret;
+        }
+        return Status::SUCCESS;
+    }
+
     /**
      *  Reset parameters of the camera device to default.
      *
@@ -286,6 +450,20 @@ public:
         return Status::NOT_SUPPORTED;
     }
 
+    /**
+     *  Get the coding format of the frames of a camera device that encodes them on board. Its
+     *  frames are then access units of the encoded stream, they are streamed and recorded without
+     *  being encoded again.
+     *
+     *  @param[out] codec Video coding format of the frames.
+     *
+     *  @return Status of request, NOT_SUPPORTED if the frames are not encoded.
+     */
+    virtual Status getEncodedFormat(CameraParameters::VIDEO_CODING_FORMAT &codec) const
+    {
+        return Status::NOT_SUPPORTED;
+    }
+
     /**
      *  Set mode of the camera device.
      *
@@ -394,4 +572,23 @@ public:
      *  @return string GStreamer RTSP Pipeline.
      */
     virtual std::string getGstRTSPPipeline() const { return mCamGstRTSPPipeline; };
+
+    /**
+     *  Set the number of buffers in the capture queue of the camera device.
+     *  More buffers absorb longer consumer stalls at the cost of memory and latency.
+     *
+     *  @param[in] count Number of buffers
+     *
+     *  @return Status of request.
+     */
+    virtual Status setBufferCount(const uint32_t count) { return Status::NOT_SUPPORTED; }
+
+    /**
+     *  Get the counters of the capture buffer queue of the camera device.
+     *
+     *  @param[out] stats Buffer queue counters
+     *
+     *  @return Status of request.
+     */
+    virtual Status getBufferStats(BufferStats &stats) const { return Status::NOT_SUPPORTED; }
 };
@@ -15,6 +15,7 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <assert.h>
 #include <cstring>
 #include <sstream>
@@ -45,6 +46,7 @@ const char CameraParameters::PIXEL_FORMAT[] = "pixel-format";
 const char CameraParameters::SCENE_MODE[] = "scene-mode";
 const char CameraParameters::VIDEO_SIZE[] = "video-size";
 const char CameraParameters::VIDEO_FRAME_FORMAT[] = "video-format";
+const char CameraParameters::VIDEO_BITRATE[] = "video-bitrate";
 const char CameraParameters::IMAGE_CAPTURE[] = "img-capture";
 const char CameraParameters::VIDEO_CAPTURE[] = "vid-capture";
 const char CameraParameters::VIDEO_SNAPSHOT[] = "vid-snapshot";
@@ -64,6 +66,7 @@ const char CameraParameters::WHITE_BALANCE_SHADE[] = "shade";
 /* --Need to check if required-- */
 
 CameraParameters::CameraParameters()
+    : mSetCount(0)
 {
     // initParamIdType();
 }
@@ -72,12 +75,81 @@ CameraParameters::~CameraParameters()
 {
 }
 
+/* same order as std::string, param is not null terminated */
+static int compareName(const char *name, const char *param, size_t len)
+{
+    size_t nameLen = strlen(name);
+    int ret = memcmp(name, param, std::min(nameLen, len));
+    if (ret)
+        return ret;
+
+    return nameLen < len ? -1 : nameLen > len ? 1 : 0;
+}
+
+const CameraParameters::Parameter *CameraParameters::findParameter(const char *param,
+                                                                   size_t len) const
+{
+    if (!param)
+        return nullptr;
+
+    len = strnlen(param, std::min(len, (size_t)CAM_PARAM_ID_LEN));
+    auto it = std::lower_bound(mParams.begin(), mParams.end(), len,
+                               [param](const Parameter &p, size_t l) {
+                                   return compareName(p.name, param, l) < 0;
+                               });
+    if (it == mParams.end() || compareName(it->name, param, len))
+        return nullptr;
+
+    return &*it;
+}
+
+const CameraParameters::Parameter *CameraParameters::findParameter(int paramId) const
+{
+    if (paramId < 0 || (size_t)paramId >= mIndexById.size() || mIndexById[paramId] < 0)
+        return nullptr;
+
+    return &mParams[mIndexById[paramId]];
+}
+
+/* entry of the parameter, added if new */
+CameraParameters::Parameter *CameraParameters::getEntry(const std::string &param)
+{
+    if (param.empty() || param.size() > CAM_PARAM_ID_LEN)
+        return nullptr;
+
+    auto it = std::lower_bound(mParams.begin(), mParams.end(), param,
+                               [](const Parameter &p, const std::string &name) {
+                                   return compareName(p.name, name.data(), name.size()) < 0;
+                               });
+    if (it != mParams.end() && !compareName(it->name, param.data(), param.size()))
+        return &*it;
+
+    Parameter entry = {};
+    memcpy(entry.name, param.data(), param.size());
+    entry.id = -1;
+    entry.type = -1;
+    it = mParams.insert(it, entry);
+
+    // entries after the new one moved
+    mIndexById.assign(mIndexById.size(), -1);
+    for (size_t i = 0; i < mParams.size(); i++) {
+        if (mParams[i].id >= 0)
+            mIndexById[mParams[i].id] = i;
+    }
+
+    return &*it;
+}
+
 bool CameraParameters::setParameterValuesSupported(std::string param, std::string value)
 {
     if (param.size() > CAM_PARAM_ID_LEN || value.size() > CAM_PARAM_VALUE_LEN)
         return false;
 
-    paramValuesSupported[param] = value;
+    Parameter *entry = getEntry(param);
+    if (!entry)
+        return false;
+
+    entry->valuesSupported = value;
     return true;
 }
 
@@ -91,107 +163,119 @@ bool CameraParameters::setParameterIdType(std::string param, int paramId, int pa
         return false;
     }
 
-    paramIdType[param] = std::make_pair(paramId, paramType);
+    Parameter *entry = getEntry(param);
+    if (!entry) {
+        log_error("Invalid Argument");
+        return false;
+    }
+
+    entry->id = paramId;
+    entry->type = paramType;
+
+    if ((size_t)paramId >= mIndexById.size())
+        mIndexById.resize(paramId + 1, -1);
+    mIndexById[paramId] = entry - mParams.data();
+
     return true;
 }
 
 int CameraParameters::getParameterID(std::string param)
 {
-    int ret = -1;
-    std::map<std::string, std::pair<int, int>>::iterator it = paramIdType.find(param);
-    if (it != paramIdType.end()) {
-        ret = it->second.first;
-    } else
-        ret = -1;
-    return ret;
+    const Parameter *entry = findParameter(param.data(), param.size());
+    return entry ? entry->id : -1;
 }
 
 int CameraParameters::getParameterType(std::string param)
 {
-    int ret = -1;
-    std::map<std::string, std::pair<int, int>>::iterator it = paramIdType.find(param);
-    if (it != paramIdType.end()) {
-        ret = it->second.second;
-    } else
-        ret = -1;
-    return ret;
+    const Parameter *entry = findParameter(param.data(), param.size());
+    return entry ? entry->type : -1;
 }
 
-bool CameraParameters::setParameter(std::string key, std::string value)
+bool CameraParameters::setValue(const std::string &param, const void *value, size_t len)
 {
-    if (key.size() > CAM_PARAM_ID_LEN || value.size() > CAM_PARAM_VALUE_LEN)
+    if (param.size() > CAM_PARAM_ID_LEN || len > CAM_PARAM_VALUE_LEN)
+        return false;
+
+    Parameter *entry = getEntry(param);
+    if (!entry)
         return false;
 
-    paramValue[key] = value;
+    if (!entry->isSet)
+        mSetCount++;
+    entry->isSet = true;
+    memset(entry->value.bytes, 0, sizeof(entry->value.bytes));
+    memcpy(entry->value.bytes, value, len);
+    entry->value.type = entry->type < 0 ? 0 : entry->type;
+    entry->len = len;
     return true;
 }
 
+bool CameraParameters::setParameter(std::string key, std::string value)
+{
+    return setValue(key, value.data(), value.size());
+}
+
 bool CameraParameters::setParameter(std::string param_id, float param_value)
 {
-    cam_param_union_t u;
+    cam_param_union_t u = {};
     u.param_float = param_value;
-    std::string str(reinterpret_cast<char const *>(u.bytes), CAM_PARAM_VALUE_LEN);
-    return setParameter(param_id, str);
+    return setValue(param_id, u.bytes, CAM_PARAM_VALUE_LEN);
 }
 bool CameraParameters::setParameter(std::string param_id, uint32_t param_value)
 {
-    cam_param_union_t u;
+    cam_param_union_t u = {};
     u.param_uint32 = param_value;
-    std::string str(reinterpret_cast<char const *>(u.bytes), CAM_PARAM_VALUE_LEN);
-    return setParameter(param_id, str);
+    return setValue(param_id, u.bytes, CAM_PARAM_VALUE_LEN);
 }
 bool CameraParameters::setParameter(std::string param_id, int32_t param_value)
 {
-    cam_param_union_t u;
+    cam_param_union_t u = {};
     u.param_int32 = param_value;
-    std::string str(reinterpret_cast<char const *>(u.bytes), CAM_PARAM_VALUE_LEN);
-    return setParameter(param_id, str);
+    return setValue(param_id, u.bytes, CAM_PARAM_VALUE_LEN);
 }
 bool CameraParameters::setParameter(std::string param_id, uint8_t param_value)
 {
-    cam_param_union_t u;
+    cam_param_union_t u = {};
     u.param_uint8 = param_value;
-    std::string str(reinterpret_cast<char const *>(u.bytes), CAM_PARAM_VALUE_LEN);
-    return setParameter(param_id, str);
+    return setValue(param_id, u.bytes, CAM_PARAM_VALUE_LEN);
 }
 
 std::string CameraParameters::getParameter(std::string key)
 {
-    if (paramValue.find(key) == paramValue.end())
+    const Parameter *entry = findParameter(key.data(), key.size());
+    if (!entry || !entry->isSet)
         return std::string();
     else
-        return paramValue[key];
+        return std::string((const char *)entry->value.bytes, entry->len);
 }
 
 void CameraParameters::initParamIdType()
 {
-    paramIdType[CAMERA_MODE] = std::make_pair(PARAM_ID_CAMERA_MODE, PARAM_TYPE_UINT32);
-    paramIdType[BRIGHTNESS] = std::make_pair(PARAM_ID_BRIGHTNESS, PARAM_TYPE_UINT32);
-    paramIdType[CONTRAST] = std::make_pair(PARAM_ID_CONTRAST, PARAM_TYPE_UINT32);
-    paramIdType[SATURATION] = std::make_pair(PARAM_ID_SATURATION, PARAM_TYPE_UINT32);
-    paramIdType[HUE] = std::make_pair(PARAM_ID_HUE, PARAM_TYPE_INT32);
-    paramIdType[WHITE_BALANCE_MODE]
-        = std::make_pair(PARAM_ID_WHITE_BALANCE_MODE, PARAM_TYPE_UINT32);
-    paramIdType[GAMMA] = std::make_pair(PARAM_ID_GAMMA, PARAM_TYPE_UINT32);
-    paramIdType[GAIN] = std::make_pair(PARAM_ID_GAIN, PARAM_TYPE_UINT32);
-    paramIdType[POWER_LINE_FREQ_MODE]
-        = std::make_pair(PARAM_ID_POWER_LINE_FREQ_MODE, PARAM_TYPE_UINT32);
-    paramIdType[WHITE_BALANCE_TEMPERATURE]
-        = std::make_pair(PARAM_ID_WHITE_BALANCE_TEMPERATURE, PARAM_TYPE_UINT32);
-    paramIdType[SHARPNESS] = std::make_pair(PARAM_ID_SHARPNESS, PARAM_TYPE_UINT32);
-    paramIdType[BACKLIGHT_COMPENSATION]
-        = std::make_pair(PARAM_ID_BACKLIGHT_COMPENSATION, PARAM_TYPE_UINT32);
-    paramIdType[EXPOSURE_MODE] = std::make_pair(PARAM_ID_EXPOSURE_MODE, PARAM_TYPE_UINT32);
-    paramIdType[EXPOSURE_ABSOLUTE] = std::make_pair(PARAM_ID_EXPOSURE_ABSOLUTE, PARAM_TYPE_UINT32);
-    paramIdType[IMAGE_SIZE] = std::make_pair(PARAM_ID_IMAGE_SIZE, PARAM_TYPE_UINT32);
-    paramIdType[IMAGE_FORMAT] = std::make_pair(PARAM_ID_IMAGE_FORMAT, PARAM_TYPE_UINT32);
-    paramIdType[PIXEL_FORMAT] = std::make_pair(PARAM_ID_PIXEL_FORMAT, PARAM_TYPE_UINT32);
-    paramIdType[SCENE_MODE] = std::make_pair(PARAM_ID_SCENE_MODE, PARAM_TYPE_UINT32);
-    paramIdType[VIDEO_SIZE] = std::make_pair(PARAM_ID_VIDEO_SIZE, PARAM_TYPE_UINT32);
-    paramIdType[VIDEO_FRAME_FORMAT]
-        = std::make_pair(PARAM_ID_VIDEO_FRAME_FORMAT, PARAM_TYPE_UINT32);
-    paramIdType[IMAGE_CAPTURE] = std::make_pair(PARAM_ID_IMAGE_CAPTURE, PARAM_TYPE_UINT32);
-    paramIdType[VIDEO_CAPTURE] = std::make_pair(PARAM_ID_VIDEO_CAPTURE, PARAM_TYPE_UINT32);
-    paramIdType[VIDEO_SNAPSHOT] = std::make_pair(PARAM_ID_VIDEO_SNAPSHOT, PARAM_TYPE_UINT32);
-    paramIdType[IMAGE_VIDEOSHOT] = std::make_pair(PARAM_ID_IMAGE_VIDEOSHOT, PARAM_TYPE_UINT32);
+    setParameterIdType(CAMERA_MODE, PARAM_ID_CAMERA_MODE, PARAM_TYPE_UINT32);
+    setParameterIdType(BRIGHTNESS, PARAM_ID_BRIGHTNESS, PARAM_TYPE_UINT32);
+    setParameterIdType(CONTRAST, PARAM_ID_CONTRAST, PARAM_TYPE_UINT32);
+    setParameterIdType(SATURATION, PARAM_ID_SATURATION, PARAM_TYPE_UINT32);
+    setParameterIdType(HUE, PARAM_ID_HUE, PARAM_TYPE_INT32);
+    setParameterIdType(WHITE_BALANCE_MODE, PARAM_ID_WHITE_BALANCE_MODE, PARAM_TYPE_UINT32);
+    setParameterIdType(GAMMA, PARAM_ID_GAMMA, PARAM_TYPE_UINT32);
+    setParameterIdType(GAIN, PARAM_ID_GAIN, PARAM_TYPE_UINT32);
+    setParameterIdType(POWER_LINE_FREQ_MODE, PARAM_ID_POWER_LINE_FREQ_MODE, PARAM_TYPE_UINT32);
+    setParameterIdType(WHITE_BALANCE_TEMPERATURE, PARAM_ID_WHITE_BALANCE_TEMPERATURE,
+                       PARAM_TYPE_UINT32);
+    setParameterIdType(SHARPNESS, PARAM_ID_SHARPNESS, PARAM_TYPE_UINT32);
+    setParameterIdType(BACKLIGHT_COMPENSATION, PARAM_ID_BACKLIGHT_COMPENSATION,
+                       PARAM_TYPE_UINT32);
+    setParameterIdType(EXPOSURE_MODE, PARAM_ID_EXPOSURE_MODE, PARAM_TYPE_UINT32);
+    setParameterIdType(EXPOSURE_ABSOLUTE, PARAM_ID_EXPOSURE_ABSOLUTE, PARAM_TYPE_UINT32);
+    setParameterIdType(IMAGE_SIZE, PARAM_ID_IMAGE_SIZE, PARAM_TYPE_UINT32);
+    setParameterIdType(IMAGE_FORMAT, PARAM_ID_IMAGE_FORMAT, PARAM_TYPE_UINT32);
+    setParameterIdType(PIXEL_FORMAT, PARAM_ID_PIXEL_FORMAT, PARAM_TYPE_UINT32);
+    setParameterIdType(SCENE_MODE, PARAM_ID_SCENE_MODE, PARAM_TYPE_UINT32);
+    setParameterIdType(VIDEO_SIZE, PARAM_ID_VIDEO_SIZE, PARAM_TYPE_UINT32);
+    setParameterIdType(VIDEO_FRAME_FORMAT, PARAM_ID_VIDEO_FRAME_FORMAT, PARAM_TYPE_UINT32);
+    setParameterIdType(VIDEO_BITRATE, PARAM_ID_VIDEO_BITRATE, PARAM_TYPE_UINT32);
+    setParameterIdType(IMAGE_CAPTURE, PARAM_ID_IMAGE_CAPTURE, PARAM_TYPE_UINT32);
+    setParameterIdType(VIDEO_CAPTURE, PARAM_ID_VIDEO_CAPTURE, PARAM_TYPE_UINT32);
+    setParameterIdType(VIDEO_SNAPSHOT, PARAM_ID_VIDEO_SNAPSHOT, PARAM_TYPE_UINT32);
+    setParameterIdType(IMAGE_VIDEOSHOT, PARAM_ID_IMAGE_VIDEOSHOT, PARAM_TYPE_UINT32);
 }
@@ -16,7 +16,6 @@
  * limitations under the License.
  */
 #pragma once
-#include <map>
 #include <string>
 #include <vector>
 
@@ -29,7 +28,6 @@ class CameraParameters {
 public:
     CameraParameters();
     virtual ~CameraParameters();
-    const std::map<std::string, std::string> &getParameterList() const { return paramValue; }
     bool setParameterValuesSupported(std::string param, std::string value);
     bool setParameterIdType(std::string param, int paramId, int paramType);
     int getParameterType(std::string param);
@@ -55,6 +53,54 @@ public:
         uint8_t type;
     } cam_param_union_t;
 
+    /**
+     *  Entry of the parameter table. Values are kept as the bytes of a MAVLink PARAM_EXT value.
+     */
+    struct Parameter {
+        char name[CAM_PARAM_ID_LEN + 1]; /* Parameter id string, null terminated */
+        int id;                          /* Parameter ID, -1 if not declared */
+        int type;                        /* PARAM_TYPE_*, -1 if not declared */
+        bool isSet;                      /* A value was set */
+        size_t len;                      /* Size of the value in bytes */
+        cam_param_union_t value;
+        std::string valuesSupported;
+    };
+
+    /**
+     *  Get the table of all parameters, sorted by parameter id string. Entries not set yet
+     *  (isSet false) are not parameters of the camera.
+     *
+     *  @return Parameter table.
+     */
+    const std::vector<Parameter> &getParameterTable() const { return mParams; }
+
+    /**
+     *  Get the number of parameters set.
+     *
+     *  @return Number of entries of the table with a value.
+     */
+    size_t getParameterCount() const { return mSetCount; }
+
+    /**
+     *  Look a parameter up by its id string, as received in a MAVLink message. The id is not
+     *  copied, so that lookups do no allocation.
+     *
+     *  @param[in] param Parameter id string, null terminated if shorter than len.
+     *  @param[in] len Size of param, at most CAM_PARAM_ID_LEN are used.
+     *
+     *  @return Table entry, valid until a parameter is added, or nullptr if not found.
+     */
+    const Parameter *findParameter(const char *param, size_t len) const;
+
+    /**
+     *  Look a parameter up by its parameter ID.
+     *
+     *  @param[in] paramId Parameter ID given to setParameterIdType().
+     *
+     *  @return Table entry, valid until a parameter is added, or nullptr if not found.
+     */
+    const Parameter *findParameter(int paramId) const;
+
     enum param_type {
         PARAM_TYPE_UINT8 = 1,
         PARAM_TYPE_INT8,
@@ -100,6 +146,7 @@ public:
     static const char SCENE_MODE[];
     static const char VIDEO_SIZE[];
     static const char VIDEO_FRAME_FORMAT[];
+    static const char VIDEO_BITRATE[];
     static const char IMAGE_CAPTURE[];
     static const char VIDEO_CAPTURE[];
     static const char VIDEO_SNAPSHOT[];
@@ -142,6 +189,7 @@ public:
     static const int PARAM_ID_IMAGE_VIDEOSHOT = 24;
     static const int PARAM_ID_EXPOSURE_AUTO_PRIORITY = 25;
     static const int PARAM_ID_EXPOSURE = 26;
+    static const int PARAM_ID_VIDEO_BITRATE = 27;
 
     // ID for image sizes
     static const int ID_IMAGE_SIZE_3264x2448 = 1;
@@ -201,6 +249,10 @@ public:
         PIXEL_FORMAT_UYVY,    /* 16 bpp YUV 4:2:2 */
         PIXEL_FORMAT_RGB24,   /* 24 bpp RGB 8:8:8 */
         PIXEL_FORMAT_RGB32,   /* 32 bpp RGB 8:8:8:8 */
+        PIXEL_FORMAT_NV12,    /* 12 bpp YUV 4:2:0, Y plane then interleaved UV plane */
+        PIXEL_FORMAT_YUYV,    /* 16 bpp YUV 4:2:2 */
+        PIXEL_FORMAT_MJPEG,   /* Motion JPEG, compressed */
+        PIXEL_FORMAT_H264,    /* H.264 access units in byte-stream, encoded */
         PIXEL_FORMAT_MAX = 99
     };
 
@@ -223,6 +275,7 @@ public:
         VIDEO_FILE_WMV, /* Windows Media Video */
         VIDEO_FILE_FLV, /* Flash Video Format */
         VIDEO_FILE_MOV, /* Apple QuickTime Movie */
+        VIDEO_FILE_MKV, /* Matroska */
         VIDEO_FILE_MAX = 99
     } VIDEO_FILE_FORMAT;
 
@@ -233,13 +286,16 @@ public:
         VIDEO_CODING_AVC,   /* H.264/AVC */
         VIDEO_CODING_MJPEG, /* Motion JPEG */
         VIDEO_CODING_WMV,   /* Windows Media Video */
+        VIDEO_CODING_HEVC,  /* H.265/HEVC */
         VIDEO_CODING_MAX = 99
     } VIDEO_CODING_FORMAT;
 
     // TODO :: Make exhaustive list of parameters and its possible values
 private:
     void initParamIdType();
-    std::map<std::string, std::string> paramValue;
-    std::map<std::string, std::string> paramValuesSupported;
-    std::map<std::string, std::pair<int, int>> paramIdType; /*Key->ID,Type*/
+    Parameter *getEntry(const std::string &param);
+    bool setValue(const std::string &param, const void *value, size_t len);
+    std::vector<Parameter> mParams; /* Sorted by name */
+    std::vector<int> mIndexById;    /* Parameter ID -> index in mParams, -1 if none */
+    size_t mSetCount;
 };
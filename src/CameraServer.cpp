@@ -16,15 +16,48 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <set>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
 
 #include "CameraServer.h"
+#include "CaptureGroup.h"
+#include "EncoderRegistry.h"
+#include "FileWriter.h"
+#include "FrameHub.h"
+#include "FramePool.h"
+#include "FramePusher.h"
+#include "ImageCaptureGst.h"
+#include "RateController.h"
+#include "StageStats.h"
+#include "V4l2CapCache.h"
+#include "VideoCaptureGst.h"
+#include "VideoStreamRtsp.h"
+#include "VideoStreamUdp.h"
+#include "gst_frame.h"
+#include "v4l2_interface.h"
 #include "log.h"
+#include "mainloop.h"
 #include "util.h"
 
 #define DEFAULT_SERVICE_PORT 8554
+
+/* Defaults of the constrained memory profile */
+#define CONSTRAINED_FRAMEPOOL_KB (16 * 1024)
+#define CONSTRAINED_QUEUE_FRAMES 1
+#define CONSTRAINED_MAX_VARIANTS 1
+#define CONSTRAINED_ENCODE_WORKERS 1
 #define DEFAULT_SERVICE_TYPE "_rtsp._udp"
+#define SERVICE_REFRESH_MS 1000
+#define STARTUP_MAX_WORKERS 4 /* Cameras started at once, encoders beyond are rarely free */
+#define SERVICE_TXT_MAX 255 /* Bytes of a TXT string */
+#define DEFAULT_V4L2_CAP_CACHE "/var/cache/dronecode-camera-manager/v4l2-caps"
 
 #ifdef ENABLE_GAZEBO
 #define GAZEBO_STRING "gazebo"
@@ -35,87 +68,333 @@ CameraServer::CameraServer(const ConfFile &conf)
 #ifdef ENABLE_MAVLINK
     , mMavlinkServer(conf)
 #endif
+    , mIsMetrics(false)
+    , mConf(&conf)
+    , mIsHotplug(false)
 {
-    std::string confDeviceId;
-    // Read image capture settings/destination
-    ImageSettings imgSetting;
-    bool isImgCapSetting = readImgCapSettings(conf, imgSetting);
-    std::string imgPath = readImgCapLocation(conf);
+    // Read the memory profile first, the settings below override its defaults
+    readMemoryProfile(conf);
 
-    // Read video capture settings/destination
-    VideoSettings vidSetting;
-    bool isVidCapSetting = readVidCapSettings(conf, vidSetting);
-    std::string vidPath = readVidCapLocation(conf);
+    // Read image capture tuning, the settings are read for each camera
+    int workers = readImgCapWorkers(conf);
+    if (workers > 0)
+        ImageCaptureGst::setEncodeWorkers(workers);
+    int syncBatch = readImgCapSyncBatch(conf);
+    if (syncBatch > 0)
+        FileWriter::setSyncBatch(syncBatch);
+    int rawFileMb = readImgCapRawFileSize(conf);
+    if (rawFileMb > 0)
+        ImageCaptureGst::setRawFileSize((uint64_t)rawFileMb * 1024 * 1024);
 
     // Read blacklisted camera devices
-    std::set<std::string> blackList = readBlacklistDevices(conf);
+    mBlackList = readBlacklistDevices(conf);
+
+    // Read the settings shared by the cameras, the rest is compiled for each camera
+    readCameraDefaults(conf);
+
+    // Read key frame interval of the video encoders
+    int gop = readKeyFrameInterval(conf);
+    if (gop >= 0)
+        EncoderRegistry::setKeyFrameInterval(gop);
+
+    // Read the bitrate limits of the streams
+    readBitrateLimits(conf);
+
+    // Read max encode variants per RTSP mount
+    int variants = readMaxVariants(conf);
+    if (variants > 0)
+        VideoStreamRtsp::setMaxVariants(variants);
+    VideoStreamRtsp::setPrewarm(readRtspPrewarm(conf));
+
+    // Read the placement of the mainloop thread
+    ThreadPolicy::set("mainloop", readThreadPolicy(conf, "mainloop"));
+
+    // Read whether the RTSP streams show the overlay text of the cameras
+    VideoStreamRtsp::setOverlay(readRtspOverlay(conf));
+
+    // Read whether recordings take the encoded RTSP stream
+    VideoCaptureGst::setShareStream(readVidCapShareStream(conf));
+
+    // Read the time recordings hold before they are started
+    readVidCapPreroll(conf);
+
+    // Read tuning of the UDP stream
+    UdpStreamSettings udpSettings;
+    if (readUdpSettings(conf, udpSettings))
+        VideoStreamUdp::setSettings(udpSettings);
+
+    // Read the bound of the appsrc queues of the streams
+    readQueuePolicy(conf);
+
+    // Read the memory limits of the camera frame buffers
+    readFramePoolLimits(conf);
+
+    // Read time cameras keep running without consumer
+    int linger = readLingerTime(conf);
+    if (linger >= 0)
+        FrameHub::setLingerTime(linger);
 
-    std::vector<std::string> deviceList = mPluginManager.listCameraDevices();
-    for (auto deviceID : deviceList) {
+    // Read where the frame pipeline latencies go besides the log
+    StageStats::setTraceMarker(readTraceMarker(conf));
+    gst_frame_set_latency_stamp(readLatencyStamp(conf));
+
+    // Read where per camera metrics are served
+    mIsMetrics = readMetricsSettings(conf, mMetricsSettings);
+
+    // Read where the probed V4L2 device capabilities are kept across restarts
+    V4l2CapCache::get().load(readV4l2CapCache(conf));
+
+    std::vector<std::string> deviceList;
+    for (auto deviceID : mPluginManager.listCameraDevices()) {
         log_debug("Camera Device : %s", deviceID.c_str());
 
         // TODO :: check if max camera count reached
 
         // check if blacklisted
-        if (blackList.find(deviceID) != blackList.end()) {
+        if (mBlackList.find(deviceID) != mBlackList.end()) {
             log_info("Device is black listed : %s", deviceID.c_str());
             continue;
         }
+        deviceList.push_back(deviceID);
+    }
 
-        // create camera device
-        std::shared_ptr<CameraDevice> device = mPluginManager.createCameraDevice(deviceID);
-        if (!device) {
-            log_error("Error in creating device : %s", deviceID.c_str());
+    // create camera devices, each probed from a thread of its own as opening a device may block
+    usec_t start = now_usec();
+    std::vector<std::shared_ptr<CameraDevice>> devices(deviceList.size());
+    std::vector<std::thread> probes;
+    for (size_t i = 0; i < deviceList.size(); i++) {
+        probes.push_back(std::thread([this, &deviceList, &devices, i]() {
+            devices[i] = mPluginManager.createCameraDevice(deviceList[i]);
+        }));
+    }
+    for (auto &t : probes)
+        t.join();
+    log_info("Startup: %zu camera devices probed in %llu ms", deviceList.size(),
+             (unsigned long long)(now_usec() - start) / USEC_PER_MSEC);
+
+    start = now_usec();
+    for (size_t i = 0; i < deviceList.size(); i++) {
+        if (!devices[i]) {
+            log_error("Error in creating device : %s", deviceList[i].c_str());
             continue;
         }
+        addCamera(deviceList[i], devices[i]);
+    }
+    log_info("Startup: %zu camera components created in %llu ms", compList.size(),
+             (unsigned long long)(now_usec() - start) / USEC_PER_MSEC);
 
-        // save camera device details in a table
-        addCameraInformation(device);
+    // Read whether cameras plugged in later are picked up
+    mIsHotplug = readHotplug(conf);
 
-        confDeviceId = deviceID;
+    logMemoryBudget();
+}
+
+/* Memory the process holds now, from the kernel page counts */
+static uint64_t residentBytes()
+{
+    unsigned long size = 0, resident = 0;
+
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+    if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+
+    return (uint64_t)resident * getpagesize();
+}
+
+void CameraServer::logMemoryBudget() const
+{
+    size_t poolKb = FramePool::getMaxBytes() / 1024;
+    log_info("Memory budget: frame pool %s%zu KiB per camera, %u frame appsrc queues, "
+             "%u encode variants per RTSP mount, %u still encoders; %zu KiB of frames, %llu KiB "
+             "resident",
+             poolKb ? "" : "uncapped, ", poolKb, gst_frame_get_queue_frames(),
+             VideoStreamRtsp::getMaxVariants(), ImageCaptureGst::getEncodeWorkers(),
+             FramePool::getAllocatedBytes() / 1024, (unsigned long long)residentBytes() / 1024);
+}
+
+/* Read the settings shared by all cameras, once per conf file instead of once per camera */
+void CameraServer::readCameraDefaults(const ConfFile &conf)
+{
+    CameraConf defaults;
+
+    // Read image capture settings/destination
+    defaults.isImgCap = readImgCapSettings(conf, defaults.img);
+    defaults.imgPath = readImgCapLocation(conf);
+
+    // Read video capture settings/destination
+    defaults.isVidCap = readVidCapSettings(conf, defaults.vid);
+    defaults.vidPath = readVidCapLocation(conf);
+
+    // Read the GStreamer RTSP pipeline
+    defaults.rtspPipeline = readRTSPPipeline(conf, {});
+    mDefaultConf = defaults;
+
+    // Read camera devices captured in a compressed format
+    mCaptureFormats = readCaptureFormats(conf);
+
+    // Read the cameras recorded together
+    mSyncDevices = readVidCapSyncDevices(conf);
+    if (mSyncDevices.size() > 1 && !mCaptureGroup)
+        mCaptureGroup = std::make_shared<CaptureGroup>();
+}
+
+/* Compile the settings of a camera, the conf file is not looked up again while it runs */
+CameraServer::CameraConf CameraServer::readCameraConf(const ConfFile &conf,
+                                                      const std::string &deviceID)
+{
+    CameraConf cc = mDefaultConf;
+    std::string confDeviceId = deviceID;
 
 #ifdef ENABLE_GAZEBO
-        // The ID of gazebo device used in conf file is "gazebo" instead
-        // of the topic name being used as deviceID in CameraDevice
-        if (deviceID.find(GAZEBO_STRING) != std::string::npos) {
-            confDeviceId = GAZEBO_STRING;
-        }
+    // The ID of gazebo device used in conf file is "gazebo" instead
+    // of the topic name being used as deviceID in CameraDevice
+    if (deviceID.find(GAZEBO_STRING) != std::string::npos) {
+        confDeviceId = GAZEBO_STRING;
+    }
 #endif
 
-        // Set the URI read from conf file
-        device->setCameraDefinitionUri(readURI(conf, confDeviceId));
+    cc.uri = readURI(conf, confDeviceId);
+    cc.bufCount = readBufferCount(conf, confDeviceId);
+    cc.threads = readThreadPolicy(conf, confDeviceId);
+
+    auto format = mCaptureFormats.find(deviceID);
+    if (format != mCaptureFormats.end()) {
+        cc.hasFormat = true;
+        cc.format = format->second;
+    }
+
+    cc.isTransport = readRtspTransport(conf, confDeviceId, cc.transport);
+    uint16_t port = cc.transport.port ? cc.transport.port : DEFAULT_SERVICE_PORT;
+    cc.maxClients = readRtspMaxClients(conf, port);
+    cc.codec = readStreamCodec(conf, confDeviceId);
+    cc.synced = mCaptureGroup && mSyncDevices.find(confDeviceId) != mSyncDevices.end();
+
+    return cc;
+}
+
+/* Names of the settings that differ, comma separated, empty if the camera runs unchanged */
+std::string CameraServer::diffCameraConf(const CameraConf &prev, const CameraConf &next)
+{
+    std::string diff;
+    auto changed = [&diff](bool differ, const char *name) {
+        if (!differ)
+            return;
+        if (!diff.empty())
+            diff += ", ";
+        diff += name;
+    };
+
+    changed(prev.uri != next.uri, "uri");
+    changed(prev.rtspPipeline != next.rtspPipeline, "rtsp pipeline");
+    changed(prev.bufCount != next.bufCount, "buffers");
+    changed(prev.threads.cpus != next.threads.cpus || prev.threads.priority != next.threads.priority
+                || prev.threads.nice != next.threads.nice,
+            "threads");
+    changed(prev.hasFormat != next.hasFormat || prev.format != next.format, "capture format");
 
-        // Set the GStreamer RTSP pipeline from conf file
-        device->setGstRTSPPipeline(readRTSPPipeline(conf, confDeviceId));
+    const RtspTransport &pt = prev.transport, &nt = next.transport;
+    changed(prev.isTransport != next.isTransport || pt.protocols != nt.protocols
+                || pt.mcastMin != nt.mcastMin || pt.mcastMax != nt.mcastMax
+                || pt.mcastPortMin != nt.mcastPortMin || pt.mcastPortMax != nt.mcastPortMax
+                || pt.mcastTtl != nt.mcastTtl || pt.port != nt.port || pt.path != nt.path,
+            "rtsp transport");
+    changed(prev.maxClients != next.maxClients, "max clients");
+    changed(prev.codec != next.codec, "stream codec");
 
-        // create camera component with camera device
-        CameraComponent *comp = new CameraComponent(device);
+    changed(prev.isImgCap != next.isImgCap || prev.img.width != next.img.width
+                || prev.img.height != next.img.height || prev.img.fileFormat != next.img.fileFormat
+                || prev.img.quality != next.img.quality || prev.imgPath != next.imgPath,
+            "imgcap");
+    changed(prev.isVidCap != next.isVidCap || prev.vid.width != next.vid.width
+                || prev.vid.height != next.vid.height || prev.vid.frameRate != next.vid.frameRate
+                || prev.vid.bitRate != next.vid.bitRate || prev.vid.encoder != next.vid.encoder
+                || prev.vid.fileFormat != next.vid.fileFormat
+                || prev.vid.segmentTime != next.vid.segmentTime
+                || prev.vid.segmentSize != next.vid.segmentSize || prev.vidPath != next.vidPath,
+            "vidcap");
+    changed(prev.synced != next.synced, "sync");
 
-        // configure camera component with settings
-        if (isImgCapSetting)
-            comp->setImageCaptureSettings(imgSetting);
+    return diff;
+}
+
+/* Create the component of a camera device, with the settings of the conf file */
+CameraComponent *CameraServer::addCamera(const std::string &deviceID,
+                                         std::shared_ptr<CameraDevice> device)
+{
+    const CameraConf &cc = mCameraConfs[deviceID] = readCameraConf(*mConf, deviceID);
 
-        if (!imgPath.empty())
-            comp->setImageCaptureLocation(imgPath);
+    // save camera device details in a table
+    addCameraInformation(device);
 
-        if (isVidCapSetting)
-            comp->setVideoCaptureSettings(vidSetting);
+    // Set the URI read from conf file
+    device->setCameraDefinitionUri(cc.uri);
 
-        if (!vidPath.empty())
-            comp->setVideoCaptureLocation(vidPath);
+    // Set the GStreamer RTSP pipeline from conf file
+    device->setGstRTSPPipeline(cc.rtspPipeline);
+
+    // Set the depth of the capture buffer queue from conf file
+    if (cc.bufCount > 0 && device->setBufferCount(cc.bufCount) != CameraDevice::Status::SUCCESS)
+        log_warning("Buffer count %d not applied to %s", cc.bufCount, deviceID.c_str());
+
+    // Place the capture and encode threads of the camera
+    ThreadPolicy::set(deviceID, cc.threads);
+
+    // Capture in a compressed format the cameras listed in conf file
+    if (cc.hasFormat && device->setPixelFormat(cc.format) != CameraDevice::Status::SUCCESS)
+        log_warning("Capture format %d not supported by %s", cc.format, deviceID.c_str());
+
+    // create camera component with camera device
+    CameraComponent *comp = new CameraComponent(device);
+
+    // configure camera component with settings
+    if (cc.isImgCap) {
+        ImageSettings imgSetting = cc.img;
+        comp->setImageCaptureSettings(imgSetting);
+    }
+
+    if (!cc.imgPath.empty())
+        comp->setImageCaptureLocation(cc.imgPath);
+
+    if (cc.isVidCap) {
+        VideoSettings vidSetting = cc.vid;
+        comp->setVideoCaptureSettings(vidSetting);
+    }
+
+    if (!cc.vidPath.empty())
+        comp->setVideoCaptureLocation(cc.vidPath);
+
+    if (cc.isTransport) {
+        RtspTransport transport = cc.transport;
+        comp->setVideoStreamTransport(transport);
+    }
+
+    // Limit the clients of the RTSP server the camera is on
+    if (cc.maxClients > 0)
+        VideoStreamRtsp::setMaxClients(
+            cc.transport.port ? cc.transport.port : DEFAULT_SERVICE_PORT, cc.maxClients);
+
+    if (cc.codec != CameraParameters::VIDEO_CODING_MIN)
+        comp->setVideoStreamFormat(cc.codec);
+
+    if (cc.synced) {
+        log_info("Recording of %s synchronized", deviceID.c_str());
+        comp->setCaptureGroup(mCaptureGroup);
+    }
 
 // add to mavlink server
 #ifdef ENABLE_MAVLINK
-        if (mMavlinkServer.addCameraComponent(comp) == -1) {
-            log_error("Error in adding Camera Component");
-            // TODO :: delete component and break
-        }
+    if (mMavlinkServer.addCameraComponent(comp) == -1) {
+        log_error("Error in adding Camera Component");
+        // TODO :: delete component and break
+    }
 #endif
 
-        // Add component to the list
-        compList.push_back(comp);
-
-    }
+    // Add component to the list
+    compList.push_back(comp);
+    return comp;
 }
 
 CameraServer::~CameraServer()
@@ -128,28 +407,338 @@ CameraServer::~CameraServer()
     }
 }
 
-void CameraServer::start()
+/* Cameras plugged in or out, from the device monitor on the mainloop */
+void CameraServer::deviceChanged(const std::string &deviceID, bool added)
 {
-    log_info("CAMERA SERVER START");
+    if (added) {
+        // an attribute change of a camera in use, or not a camera at all
+        auto it = std::find_if(compList.begin(), compList.end(), [&deviceID](CameraComponent *c) {
+            return c->getDeviceId() == deviceID;
+        });
+        if (it != compList.end() || mBlackList.find(deviceID) != mBlackList.end()
+            || !mPluginManager.addCameraDevice(deviceID))
+            return;
+
+        log_info("Camera device plugged in: %s", deviceID.c_str());
+        if (startCamera(deviceID))
+            mPluginManager.removeCameraDevice(deviceID);
+    } else {
+        mPluginManager.removeCameraDevice(deviceID);
+        if (releaseCamera(deviceID, nullptr))
+            log_info("Camera device unplugged: %s", deviceID.c_str());
+    }
+
+    publishCameras();
+}
+
+/* Create the component of a camera known to the plugins and start its stream */
+int CameraServer::startCamera(const std::string &deviceID)
+{
+    std::shared_ptr<CameraDevice> device = mPluginManager.createCameraDevice(deviceID);
+    if (!device) {
+        log_error("Error in creating device : %s", deviceID.c_str());
+        return -1;
+    }
+
+    CameraComponent *comp = addCamera(deviceID, device);
+    if (comp->start())
+        log_error("Error in starting camera component");
+    comp->startVideoStream(false);
+    return 0;
+}
+
+/*
+ * Remove the component of a camera, false if there is none. released is called on the mainloop
+ * once the component is deleted, with its device and streams.
+ */
+bool CameraServer::releaseCamera(const std::string &deviceID, std::function<void()> released)
+{
+    auto it = std::find_if(compList.begin(), compList.end(), [&deviceID](CameraComponent *c) {
+        return c->getDeviceId() == deviceID;
+    });
+    if (it == compList.end())
+        return false;
+
+    CameraComponent *comp = *it;
+    compList.erase(it);
+    mCamInfoMap.erase("/" + deviceID);
+    mCamCaps.erase("/" + deviceID);
+    mCameraConfs.erase(deviceID);
+
+    // the streams of the other cameras go on, this one is deleted once no command uses it
+#ifdef ENABLE_MAVLINK
+    mMavlinkServer.removeCameraComponent(comp, [comp, released]() {
+        delete comp;
+        if (released)
+            released();
+    });
+#else
+    delete comp;
+    if (released)
+        released();
+#endif
+    return true;
+}
+
+/*
+ * The component of a camera is created again with the new settings, the device stays known to
+ * its plugin: most plugins only list their cameras once and would not take it back.
+ */
+void CameraServer::reconfigureCamera(const std::string &deviceID)
+{
+    bool found = releaseCamera(deviceID, [this, deviceID]() {
+        // the camera may have been unplugged, or plugged in again, meanwhile
+        auto it = std::find_if(compList.begin(), compList.end(),
+                               [&deviceID](CameraComponent *c) {
+                                   return c->getDeviceId() == deviceID;
+                               });
+        if (it == compList.end() && !startCamera(deviceID))
+            publishCameras();
+    });
+    if (found)
+        publishCameras();
+}
+
+void CameraServer::publishCameras()
+{
+#ifdef ENABLE_AVAHI
+    if (mAvahiPublisher) {
+        updateCameraInformation();
+        mAvahiPublisher->update();
+    }
+#endif
+}
+
+/* Conf files parsed again, on the mainloop */
+void CameraServer::reload(const ConfFile &conf)
+{
+    usec_t start = now_usec();
+    mConf = &conf;
+    readCameraDefaults(conf);
+
+    std::vector<std::string> changed;
+    size_t count = compList.size();
     for (auto camComp : compList) {
-        if (camComp->start())
-            log_error("Error in starting camera component");
+        const std::string &deviceID = camComp->getDeviceId();
+        std::string diff = diffCameraConf(mCameraConfs[deviceID], readCameraConf(conf, deviceID));
+        if (diff.empty())
+            continue;
+
+        log_info("Reload: settings of %s changed: %s", deviceID.c_str(), diff.c_str());
+        changed.push_back(deviceID);
+    }
+
+    // the components of the cameras are created again, the others keep streaming. The new
+    // component waits for the old one to free the device and the RTSP path
+    for (auto &deviceID : changed)
+        reconfigureCamera(deviceID);
+
+    log_info("Reload: %zu of %zu cameras reconfigured in %llu ms", changed.size(), count,
+             (unsigned long long)(now_usec() - start) / USEC_PER_MSEC);
+}
+
+#ifdef ENABLE_AVAHI
+/* The records of the streams changed meanwhile are updated in place */
+bool CameraServer::refreshServices(void *data)
+{
+    CameraServer *server = (CameraServer *)data;
+    server->updateCameraInformation();
+    server->mAvahiPublisher->update();
+    return true;
+}
+#endif
+
+static bool dumpStats(void *data)
+{
+    StageStats::dump();
+    return true;
+}
+
+static std::string cameraLabel(const std::string &camera)
+{
+    return "camera=\"" + MetricsServer::escapeLabel(camera) + "\"";
+}
+
+/* runs on the mainloop, where the components and the MAVLink server are used */
+void CameraServer::collectMetrics(std::string &out)
+{
+    static const struct {
+        const char *name;
+        const char *help;
+        uint64_t (*get)(const StageStats &stats);
+    } counters[] = {
+        {"dcm_frames_captured_total", "Frames read from the camera.",
+         [](const StageStats &s) { return s.getFrameCount(); }},
+        {"dcm_frames_encoded_total", "Frames out of the stream encoders.",
+         [](const StageStats &s) { return s.getHistogram(StageStats::ENCODED).getCount(); }},
+        {"dcm_frames_sent_total", "Frames payloaded into RTP packets.",
+         [](const StageStats &s) { return s.getHistogram(StageStats::PAYLOADED).getCount(); }},
+        {"dcm_frames_dropped_total", "Frames dropped because an encoder fell behind.",
+         [](const StageStats &s) { return s.getDropCount(); }},
+        {"dcm_encoded_bytes_total", "Bytes out of the stream encoders, rate() is the bitrate.",
+         [](const StageStats &s) { return s.getEncodedBytes(); }},
+    };
+
+    for (const auto &c : counters) {
+        MetricsServer::appendHeader(out, c.name, "counter", c.help);
+        StageStats::forEach([&](const StageStats &stats) {
+            MetricsServer::appendSample(out, c.name, cameraLabel(stats.getCamera()),
+                                        c.get(stats));
+        });
+    }
+
+    MetricsServer::appendHeader(out, "dcm_appsrc_queue_bytes", "gauge",
+                                "Bytes waiting in the appsrc queue after the last push.");
+    StageStats::forEach([&](const StageStats &stats) {
+        MetricsServer::appendSample(out, "dcm_appsrc_queue_bytes", cameraLabel(stats.getCamera()),
+                                    stats.getQueueLevel());
+    });
+
+    MetricsServer::appendHeader(out, "dcm_stage_latency_seconds", "summary",
+                                "Time from the capture of a frame to each pipeline stage.");
+    StageStats::forEach([&](const StageStats &stats) {
+        for (int i = 0; i < StageStats::STAGES; i++) {
+            LatencyHistogram::Summary s;
+            stats.getHistogram((StageStats::Stage)i).summarize(s);
+            if (!s.count)
+                continue;
+
+            std::string labels = cameraLabel(stats.getCamera()) + ",stage=\""
+                + StageStats::getStageName((StageStats::Stage)i) + "\"";
+            const struct {
+                const char *quantile;
+                uint64_t value;
+            } quantiles[] = {{"0.5", s.p50}, {"0.9", s.p90}, {"0.99", s.p99}, {"1", s.max}};
+            for (const auto &q : quantiles)
+                MetricsServer::appendSample(out, "dcm_stage_latency_seconds",
+                                            labels + ",quantile=\"" + q.quantile + "\"",
+                                            (double)q.value / USEC_PER_SEC);
+            MetricsServer::appendSample(out, "dcm_stage_latency_seconds_sum", labels,
+                                        (double)s.sum / USEC_PER_SEC);
+            MetricsServer::appendSample(out, "dcm_stage_latency_seconds_count", labels, s.count);
+        }
+    });
+
+    std::vector<VideoStreamInfo> streams(compList.size());
+    for (size_t i = 0; i < compList.size(); i++)
+        compList[i]->getVideoStreamInfo(streams[i]);
+
+    MetricsServer::appendHeader(out, "dcm_resident_bytes", "gauge",
+                                "Memory the daemon holds in RAM.");
+    MetricsServer::appendSample(out, "dcm_resident_bytes", "", residentBytes());
+    MetricsServer::appendHeader(out, "dcm_framepool_bytes", "gauge",
+                                "Memory mapped by the camera frame pools.");
+    MetricsServer::appendSample(out, "dcm_framepool_bytes", "", FramePool::getAllocatedBytes());
+    MetricsServer::appendHeader(out, "dcm_framepool_budget_bytes", "gauge",
+                                "Max memory of the frame pool of a camera, 0 for no cap.");
+    MetricsServer::appendSample(out, "dcm_framepool_budget_bytes", "", FramePool::getMaxBytes());
+
+    MetricsServer::appendHeader(out, "dcm_stream_bitrate_kbps", "gauge",
+                                "Bitrate the stream encoder is set to, 0 for its default.");
+    for (size_t i = 0; i < compList.size(); i++)
+        MetricsServer::appendSample(out, "dcm_stream_bitrate_kbps",
+                                    cameraLabel(compList[i]->getDeviceId()), streams[i].bitRate);
+
+    MetricsServer::appendHeader(out, "dcm_rtsp_clients", "gauge",
+                                "RTSP sessions on the stream of the camera.");
+    for (size_t i = 0; i < compList.size(); i++)
+        MetricsServer::appendSample(out, "dcm_rtsp_clients",
+                                    cameraLabel(compList[i]->getDeviceId()), streams[i].clients);
+
+    MetricsServer::appendHeader(out, "dcm_mode_switch_seconds", "summary",
+                                "Time taken to switch between still and video mode.");
+    for (size_t i = 0; i < compList.size(); i++) {
+        LatencyHistogram::Summary s;
+        compList[i]->getModeSwitchLatency().summarize(s);
+        if (!s.count)
+            continue;
 
-        camComp->startVideoStream(false);
+        std::string labels = cameraLabel(compList[i]->getDeviceId());
+        MetricsServer::appendSample(out, "dcm_mode_switch_seconds", labels + ",quantile=\"0.5\"",
+                                    (double)s.p50 / USEC_PER_SEC);
+        MetricsServer::appendSample(out, "dcm_mode_switch_seconds", labels + ",quantile=\"1\"",
+                                    (double)s.max / USEC_PER_SEC);
+        MetricsServer::appendSample(out, "dcm_mode_switch_seconds_sum", labels,
+                                    (double)s.sum / USEC_PER_SEC);
+        MetricsServer::appendSample(out, "dcm_mode_switch_seconds_count", labels, s.count);
     }
 
+#ifdef ENABLE_MAVLINK
+    MetricsServer::appendHeader(out, "dcm_mavlink_messages_received_total", "counter",
+                                "MAVLink messages received, by message ID.");
+    for (const auto &count : mMavlinkServer.getMessageCounts())
+        MetricsServer::appendSample(out, "dcm_mavlink_messages_received_total",
+                                    "msgid=\"" + std::to_string(count.first) + "\"",
+                                    count.second);
+#endif
+}
+
+void CameraServer::start()
+{
+    log_info("CAMERA SERVER START");
+    Mainloop::get_mainloop()->add_signal(SIGUSR1, dumpStats, nullptr);
+
+    // cameras are announced first, their devices are initialized on first use
+    usec_t start = now_usec();
 #ifdef ENABLE_MAVLINK
     mMavlinkServer.start();
+    log_info("Startup: MAVLink server started in %llu ms",
+             (unsigned long long)(now_usec() - start) / USEC_PER_MSEC);
+    start = now_usec();
 #endif
 
+    // pipelines of the cameras are built on a few threads, a slow or broken camera holds up its
+    // own thread only
+    std::atomic<size_t> next(0);
+    auto startCameras = [this, &next]() {
+        for (size_t i = next++; i < compList.size(); i = next++) {
+            CameraComponent *camComp = compList[i];
+            usec_t camStart = now_usec();
+
+            if (camComp->start())
+                log_error("Error in starting camera component %s",
+                          camComp->getDeviceId().c_str());
+
+            if (camComp->startVideoStream(false))
+                log_error("Error in starting video stream of %s", camComp->getDeviceId().c_str());
+
+            log_info("Startup: %s started in %llu ms", camComp->getDeviceId().c_str(),
+                     (unsigned long long)(now_usec() - camStart) / USEC_PER_MSEC);
+        }
+    };
+
+    size_t workers = std::min<size_t>(compList.size(), STARTUP_MAX_WORKERS);
+    std::vector<std::thread> starts;
+    for (size_t i = 0; i < workers; i++)
+        starts.push_back(std::thread(startCameras));
+    for (auto &t : starts)
+        t.join();
+    log_info("Startup: %zu camera components started in %llu ms on %zu threads", compList.size(),
+             (unsigned long long)(now_usec() - start) / USEC_PER_MSEC, workers);
+
+    if (mIsHotplug)
+        mDeviceMonitor.start(V4L2_DEVICE_PATH, [this](const std::string &node, bool added) {
+            deviceChanged(node, added);
+        });
+
+    if (mIsMetrics) {
+        int ret = mMetricsSettings.socketPath.empty()
+            ? mMetricsServer.listen(mMetricsSettings.address.c_str(), mMetricsSettings.port)
+            : mMetricsServer.listen(mMetricsSettings.socketPath.c_str());
+        if (!ret)
+            mMetricsServer.addCollector([this](std::string &out) { collectMetrics(out); });
+    }
+
 #ifdef ENABLE_AVAHI
     /* create avahi publisher */
     mAvahiPublisher = std::unique_ptr<AvahiPublisher>(
         new AvahiPublisher(mCamInfoMap, DEFAULT_SERVICE_PORT, DEFAULT_SERVICE_TYPE));
 
     /* start avahi publisher */
+    updateCameraInformation();
     mAvahiPublisher->start();
-
+    mServiceTimeout
+        = Mainloop::get_mainloop()->add_timeout(SERVICE_REFRESH_MS, refreshServices, this);
 #endif
 }
 
@@ -157,6 +746,10 @@ void CameraServer::stop()
 {
 
 #ifdef ENABLE_AVAHI
+    if (mServiceTimeout)
+        Mainloop::get_mainloop()->del_timeout(mServiceTimeout);
+    mServiceTimeout = 0;
+
     /* stop avahi publisher */
     mAvahiPublisher->stop();
 
@@ -164,10 +757,14 @@ void CameraServer::stop()
     mAvahiPublisher.reset();
 #endif
 
+    mDeviceMonitor.stop();
+
 #ifdef ENABLE_MAVLINK
     mMavlinkServer.stop();
 #endif
 
+    mMetricsServer.stop();
+
     for (auto camComp : compList) {
         camComp->stopVideoStream();
         camComp->stop();
@@ -175,6 +772,38 @@ void CameraServer::stop()
 
 }
 
+static const char *codecName(CameraParameters::VIDEO_CODING_FORMAT codec)
+{
+    switch (codec) {
+    case CameraParameters::VIDEO_CODING_AVC:
+        return "h264";
+    case CameraParameters::VIDEO_CODING_HEVC:
+        return "h265";
+    case CameraParameters::VIDEO_CODING_MJPEG:
+        return "mjpeg";
+    case CameraParameters::VIDEO_CODING_MPEG4:
+        return "mpeg4";
+    case CameraParameters::VIDEO_CODING_H263:
+        return "h263";
+    default:
+        return nullptr;
+    }
+}
+
+/* Add a comma separated item to a TXT string, false if the string would get too long */
+static bool appendTxtItem(std::string &txt, const std::string &item)
+{
+    bool first = txt.back() == '=';
+    if (txt.size() + item.size() + (first ? 0 : 1) > SERVICE_TXT_MAX)
+        return false;
+
+    if (!first)
+        txt += ",";
+    txt += item;
+    return true;
+}
+
+/* What a camera can stream, published once as it does not change while the camera is there */
 void CameraServer::addCameraInformation(const std::shared_ptr<CameraDevice> &device)
 {
     std::string name = "/" + device->getDeviceId();
@@ -190,11 +819,69 @@ void CameraServer::addCameraInformation(const std::shared_ptr<CameraDevice> &dev
     std::string model
         = "model=" + std::string(reinterpret_cast<const char *>(camInfo.modelName), 32);
     txtList.push_back(model);
-    /* TODO:: Fill more details like supported sizes, formats etc*/
 
+    std::vector<CameraDevice::Size> sizes;
+    if (device->getSupportedSizes(sizes) == CameraDevice::Status::SUCCESS && !sizes.empty()) {
+        std::string res = "resolutions=";
+        for (auto &size : sizes) {
+            if (!appendTxtItem(res, std::to_string(size.width) + "x" + std::to_string(size.height)))
+                break;
+        }
+        if (res.back() != '=')
+            txtList.push_back(res);
+    }
+
+    uint32_t minFps = 0, maxFps = 0;
+    if (device->getSupportedFrameRates(minFps, maxFps) == CameraDevice::Status::SUCCESS
+        && maxFps)
+        txtList.push_back("fps=" + std::to_string(minFps) + "-" + std::to_string(maxFps));
+
+    std::string codecs = "codecs=";
+    for (auto codec : {CameraParameters::VIDEO_CODING_AVC, CameraParameters::VIDEO_CODING_HEVC}) {
+        if (!EncoderRegistry::getEncoderName(codec).empty()
+            && !EncoderRegistry::getPayloaderName(codec).empty())
+            appendTxtItem(codecs, codecName(codec));
+    }
+    if (codecs.back() != '=')
+        txtList.push_back(codecs);
+
+    mCamCaps[name] = txtList;
     mCamInfoMap[name] = txtList;
+}
+
+/*
+ * The TXT records carry the stream as it runs, for the clients to pick a camera without opening
+ * an RTSP session to each. The publisher only announces the records that changed.
+ */
+void CameraServer::updateCameraInformation()
+{
+    for (auto camComp : compList) {
+        std::string name = "/" + camComp->getDeviceId();
+        std::vector<std::string> txtList = mCamCaps[name];
+
+        VideoStreamInfo info;
+        camComp->getVideoStreamInfo(info);
+        if (info.status) {
+            // the mount may be on another server than the one the service is published with
+            if (!info.path.empty())
+                txtList.push_back("path=" + info.path);
+            if (info.port)
+                txtList.push_back("port=" + std::to_string(info.port));
+            if (info.width && info.height)
+                txtList.push_back("resolution=" + std::to_string(info.width) + "x"
+                                  + std::to_string(info.height));
+            if (info.frameRate)
+                txtList.push_back("framerate=" + std::to_string(info.frameRate));
+            const char *codec
+                = codecName(static_cast<CameraParameters::VIDEO_CODING_FORMAT>(info.codec));
+            if (codec)
+                txtList.push_back(std::string("codec=") + codec);
+            if (info.bitRate)
+                txtList.push_back("bitrate=" + std::to_string(info.bitRate));
+        }
 
-    return;
+        mCamInfoMap[name] = txtList;
+    }
 }
 
 std::set<std::string> CameraServer::readBlacklistDevices(const ConfFile &conf) const
@@ -207,6 +894,28 @@ std::set<std::string> CameraServer::readBlacklistDevices(const ConfFile &conf) c
     return blacklist;
 }
 
+std::map<std::string, CameraParameters::PixelFormat>
+CameraServer::readCaptureFormats(const ConfFile &conf) const
+{
+    std::set<std::string> mjpeg;
+    std::set<std::string> h264;
+    static const ConfFile::OptionsTable mjpeg_table[] = {
+        {"mjpeg", false, ConfFile::parse_stl_set, 0, 0},
+    };
+    static const ConfFile::OptionsTable h264_table[] = {
+        {"h264", false, ConfFile::parse_stl_set, 0, 0},
+    };
+    conf.extract_options("v4l2", mjpeg_table, 1, (void *)&mjpeg);
+    conf.extract_options("v4l2", h264_table, 1, (void *)&h264);
+
+    std::map<std::string, CameraParameters::PixelFormat> formats;
+    for (const std::string &device : mjpeg)
+        formats[device] = CameraParameters::PixelFormat::PIXEL_FORMAT_MJPEG;
+    for (const std::string &device : h264)
+        formats[device] = CameraParameters::PixelFormat::PIXEL_FORMAT_H264;
+    return formats;
+}
+
 std::string CameraServer::readURI(const ConfFile &conf, std::string deviceID)
 {
     char *uriAddr = 0;
@@ -229,6 +938,557 @@ std::string CameraServer::readRTSPPipeline(const ConfFile &conf, std::string dev
         return {};
 }
 
+int CameraServer::readBufferCount(const ConfFile &conf, std::string deviceID) const
+{
+    char *count = 0;
+    int ret = 0;
+    if (!conf.extract_options("buffers", deviceID.c_str(), &count)) {
+        if (safe_atoi(count, &ret) || ret <= 0) {
+            log_error("Invalid buffer count for %s: %s", deviceID.c_str(), count);
+            ret = 0;
+        }
+        free(count);
+    }
+
+    return ret;
+}
+
+ThreadPolicy CameraServer::readThreadPolicy(const ConfFile &conf, std::string owner) const
+{
+    struct options {
+        char cpus[64];
+        int priority;
+        int nice;
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"cpus", false, ConfFile::parse_str_buf, OPTIONS_TABLE_STRUCT_FIELD(options, cpus)},
+        {"priority", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, priority)},
+        {"nice", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, nice)},
+    };
+
+    // Threads of each camera are placed in section [threads <camera-device-id>]
+    ThreadPolicy policy;
+    std::string section = "threads " + owner;
+    if (conf.extract_options(section.c_str(), option_table, ARRAY_SIZE(option_table),
+                             (void *)&opt))
+        return policy;
+
+    if (ThreadPolicy::parseCpus(opt.cpus, policy.cpus) < 0)
+        log_error("Invalid CPU list for %s: %s", owner.c_str(), opt.cpus);
+
+    if (opt.priority < 0 || opt.priority > 99)
+        log_error("Invalid thread priority for %s: %d", owner.c_str(), opt.priority);
+    else
+        policy.priority = opt.priority;
+
+    if (opt.nice < -20 || opt.nice > 19)
+        log_error("Invalid nice level for %s: %d", owner.c_str(), opt.nice);
+    else
+        policy.nice = opt.nice;
+
+    return policy;
+}
+
+void CameraServer::readMemoryProfile(const ConfFile &conf) const
+{
+    struct options {
+        char profile[32];
+        char plugins[256];
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"profile", false, ConfFile::parse_str_buf, OPTIONS_TABLE_STRUCT_FIELD(options, profile)},
+        {"plugins", false, ConfFile::parse_str_buf, OPTIONS_TABLE_STRUCT_FIELD(options, plugins)},
+    };
+
+    if (conf.extract_options("memory", option_table, ARRAY_SIZE(option_table), (void *)&opt))
+        return;
+
+    // gstreamer only loads the plugins of these packages, set before it is initialized
+    if (opt.plugins[0])
+        setenv("GST_PLUGIN_LOADING_WHITELIST", opt.plugins, 0);
+
+    std::string profile = opt.profile;
+    if (profile.empty() || profile == "default")
+        return;
+    if (profile != "constrained") {
+        log_error("Invalid memory profile: %s", opt.profile);
+        return;
+    }
+
+    log_info("Constrained memory profile");
+    FramePool::setLimits(CONSTRAINED_FRAMEPOOL_KB * 1024, false);
+    gst_frame_set_queue_policy(CONSTRAINED_QUEUE_FRAMES, GST_FRAME_LEAK_OLDEST);
+    VideoStreamRtsp::setMaxVariants(CONSTRAINED_MAX_VARIANTS);
+    ImageCaptureGst::setEncodeWorkers(CONSTRAINED_ENCODE_WORKERS);
+    FrameHub::setLingerTime(0);
+}
+
+int CameraServer::readKeyFrameInterval(const ConfFile &conf) const
+{
+    char *interval = 0;
+    int ret = -1;
+    if (!conf.extract_options("encoder", "keyframe_interval", &interval)) {
+        if (safe_atoi(interval, &ret) || ret < 0) {
+            log_error("Invalid key frame interval: %s", interval);
+            ret = -1;
+        }
+        free(interval);
+    }
+
+    return ret;
+}
+
+void CameraServer::readBitrateLimits(const ConfFile &conf) const
+{
+    struct options {
+        int minBitrate;
+        int maxBitrate;
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"min_bitrate", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, minBitrate)},
+        {"max_bitrate", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, maxBitrate)},
+    };
+
+    conf.extract_options("encoder", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+    if (opt.minBitrate < 0 || opt.maxBitrate < 0) {
+        log_error("Invalid bitrate limits: %d-%d kbps", opt.minBitrate, opt.maxBitrate);
+        return;
+    }
+
+    if (opt.maxBitrate)
+        log_info("Stream bitrate adapted to the link: %d-%d kbps", opt.minBitrate, opt.maxBitrate);
+    RateController::setLimits(opt.minBitrate, opt.maxBitrate);
+}
+
+/* parse "first-last" or a single value into a range */
+static bool parseRange(const char *str, std::string &first, std::string &last)
+{
+    std::string range = str;
+    size_t sep = range.find('-');
+
+    first = range.substr(0, sep);
+    last = sep == std::string::npos ? first : range.substr(sep + 1);
+    return !first.empty() && !last.empty();
+}
+
+CameraParameters::VIDEO_CODING_FORMAT CameraServer::readStreamCodec(const ConfFile &conf,
+                                                                    std::string deviceID) const
+{
+    struct options {
+        char codec[16];
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"codec", false, ConfFile::parse_str_buf, OPTIONS_TABLE_STRUCT_FIELD(options, codec)},
+    };
+
+    // Codec of each mount is in section [rtsp <camera-device-id>]
+    std::string section = "rtsp " + deviceID;
+    conf.extract_options(section.c_str(), option_table, ARRAY_SIZE(option_table), (void *)&opt);
+
+    std::string codec = opt.codec;
+    if (codec.empty())
+        return CameraParameters::VIDEO_CODING_MIN;
+    if (codec == "h264")
+        return CameraParameters::VIDEO_CODING_AVC;
+    if (codec == "h265")
+        return CameraParameters::VIDEO_CODING_HEVC;
+
+    log_error("Invalid stream codec for %s: %s", deviceID.c_str(), codec.c_str());
+    return CameraParameters::VIDEO_CODING_MIN;
+}
+
+bool CameraServer::readRtspTransport(const ConfFile &conf, std::string deviceID,
+                                     RtspTransport &transport) const
+{
+    struct options {
+        char protocols[64];
+        char address[64];
+        char port[16];
+        int ttl;
+        int serverPort;
+        char path[64];
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"protocols", false, ConfFile::parse_str_buf,
+         OPTIONS_TABLE_STRUCT_FIELD(options, protocols)},
+        {"multicast_address", false, ConfFile::parse_str_buf,
+         OPTIONS_TABLE_STRUCT_FIELD(options, address)},
+        {"multicast_port", false, ConfFile::parse_str_buf,
+         OPTIONS_TABLE_STRUCT_FIELD(options, port)},
+        {"multicast_ttl", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, ttl)},
+        {"port", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, serverPort)},
+        {"path", false, ConfFile::parse_str_buf, OPTIONS_TABLE_STRUCT_FIELD(options, path)},
+    };
+
+    // Transport of each mount is in section [rtsp <camera-device-id>]
+    std::string section = "rtsp " + deviceID;
+    if (conf.extract_options(section.c_str(), option_table, ARRAY_SIZE(option_table),
+                             (void *)&opt))
+        return false;
+
+    std::string protocols = opt.protocols;
+    size_t i = 0;
+    while (i < protocols.size()) {
+        size_t j = protocols.find(',', i);
+        std::string proto = protocols.substr(i, j == std::string::npos ? j : j - i);
+        if (proto == "udp")
+            transport.protocols |= RtspTransport::PROTO_UDP;
+        else if (proto == "udp-mcast")
+            transport.protocols |= RtspTransport::PROTO_UDP_MCAST;
+        else if (proto == "tcp")
+            transport.protocols |= RtspTransport::PROTO_TCP;
+        else
+            log_error("Invalid RTSP protocol for %s: %s", deviceID.c_str(), proto.c_str());
+        if (j == std::string::npos)
+            break;
+        i = j + 1;
+    }
+
+    if (opt.address[0] && !parseRange(opt.address, transport.mcastMin, transport.mcastMax)) {
+        log_error("Invalid multicast address for %s: %s", deviceID.c_str(), opt.address);
+        transport.mcastMin.clear();
+    }
+
+    std::string first, last;
+    int portMin = 0, portMax = 0;
+    if (opt.port[0]
+        && (!parseRange(opt.port, first, last) || safe_atoi(first.c_str(), &portMin)
+            || safe_atoi(last.c_str(), &portMax) || portMin <= 0 || portMax > UINT16_MAX
+            || portMin > portMax)) {
+        log_error("Invalid multicast port for %s: %s", deviceID.c_str(), opt.port);
+        portMin = portMax = 0;
+    }
+    transport.mcastPortMin = portMin;
+    transport.mcastPortMax = portMax;
+
+    if (opt.ttl < 0 || opt.ttl > UINT8_MAX)
+        log_error("Invalid multicast TTL for %s: %d", deviceID.c_str(), opt.ttl);
+    else if (opt.ttl)
+        transport.mcastTtl = opt.ttl;
+
+    if (opt.serverPort < 0 || opt.serverPort > UINT16_MAX)
+        log_error("Invalid RTSP port for %s: %d", deviceID.c_str(), opt.serverPort);
+    else
+        transport.port = opt.serverPort;
+    transport.path = opt.path;
+
+    return transport.protocols || !transport.mcastMin.empty() || transport.port
+        || !transport.path.empty();
+}
+
+int CameraServer::readRtspMaxClients(const ConfFile &conf, uint16_t port) const
+{
+    char *count = 0;
+    int ret = 0;
+
+    // Limits of each server are in section [rtsp-server <port>]
+    std::string section = "rtsp-server " + std::to_string(port);
+    if (!conf.extract_options(section.c_str(), "max_clients", &count)) {
+        if (safe_atoi(count, &ret) || ret <= 0) {
+            log_error("Invalid max clients for RTSP port %u: %s", port, count);
+            ret = 0;
+        }
+        free(count);
+    }
+
+    return ret;
+}
+
+int CameraServer::readMaxVariants(const ConfFile &conf) const
+{
+    char *count = 0;
+    int ret = 0;
+    if (!conf.extract_options("rtsp", "max_variants", &count)) {
+        if (safe_atoi(count, &ret) || ret <= 0) {
+            log_error("Invalid max variants: %s", count);
+            ret = 0;
+        }
+        free(count);
+    }
+
+    return ret;
+}
+
+bool CameraServer::readUdpSettings(const ConfFile &conf, UdpStreamSettings &settings) const
+{
+    struct options {
+        bool lowLatency;
+        int mtu;
+        int configInterval;
+    } opt = {};
+    opt.configInterval = settings.configInterval;
+    static const ConfFile::OptionsTable option_table[] = {
+        {"low_latency", false, ConfFile::parse_bool,
+         OPTIONS_TABLE_STRUCT_FIELD(options, lowLatency)},
+        {"mtu", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, mtu)},
+        {"config_interval", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, configInterval)},
+    };
+
+    if (conf.extract_options("udp", option_table, ARRAY_SIZE(option_table), (void *)&opt))
+        return false;
+
+    if (opt.mtu < 0 || opt.configInterval < -1) {
+        log_error("Invalid UDP stream settings: mtu=%d config_interval=%d", opt.mtu,
+                  opt.configInterval);
+        return false;
+    }
+
+    settings.lowLatency = opt.lowLatency;
+    settings.mtu = opt.mtu;
+    settings.configInterval = opt.configInterval;
+    return true;
+}
+
+void CameraServer::readQueuePolicy(const ConfFile &conf) const
+{
+    struct options {
+        int frames;
+        char leak[16];
+        char fallback[16];
+        int stallMs;
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"queue_frames", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, frames)},
+        {"leak", false, ConfFile::parse_str_buf, OPTIONS_TABLE_STRUCT_FIELD(options, leak)},
+        {"fallback", false, ConfFile::parse_str_buf, OPTIONS_TABLE_STRUCT_FIELD(options, fallback)},
+        {"stall_ms", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, stallMs)},
+    };
+
+    if (conf.extract_options("appsrc", option_table, ARRAY_SIZE(option_table), (void *)&opt))
+        return;
+
+    std::string fallback = opt.fallback;
+    if (fallback == "repeat")
+        gst_frame_set_fallback(GST_FRAME_FALLBACK_REPEAT);
+    else if (!fallback.empty() && fallback != "blank")
+        log_error("Invalid appsrc fallback frame: %s", opt.fallback);
+
+    if (opt.stallMs < 0)
+        log_error("Invalid appsrc stall time: %d", opt.stallMs);
+    else
+        FramePusher::setStallTime(opt.stallMs);
+
+    if (!opt.frames && !opt.leak[0])
+        return;
+
+    GstFrameLeak leak = GST_FRAME_LEAK_OLDEST;
+    std::string policy = opt.leak;
+    if (policy == "newest")
+        leak = GST_FRAME_LEAK_NEWEST;
+    else if (policy == "block")
+        leak = GST_FRAME_LEAK_BLOCK;
+    else if (!policy.empty() && policy != "oldest")
+        log_error("Invalid appsrc leak policy: %s", opt.leak);
+
+    if (opt.frames < 0) {
+        log_error("Invalid appsrc queue depth: %d", opt.frames);
+        opt.frames = 0;
+    }
+
+    gst_frame_set_queue_policy(opt.frames ? opt.frames : gst_frame_get_queue_frames(), leak);
+}
+
+bool CameraServer::readHotplug(const ConfFile &conf) const
+{
+    struct options {
+        bool hotplug;
+    } opt = {true};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"hotplug", false, ConfFile::parse_bool, OPTIONS_TABLE_STRUCT_FIELD(options, hotplug)},
+    };
+
+    conf.extract_options("v4l2", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+    return opt.hotplug;
+}
+
+std::string CameraServer::readV4l2CapCache(const ConfFile &conf) const
+{
+    char *path = 0;
+    std::string ret = DEFAULT_V4L2_CAP_CACHE;
+    if (!conf.extract_options("v4l2", "cap_cache", &path)) {
+        ret = std::string(path);
+        free(path);
+    }
+
+    if (ret == "none")
+        ret = {};
+
+    return ret;
+}
+
+int CameraServer::readLingerTime(const ConfFile &conf) const
+{
+    char *time = 0;
+    int ret = -1;
+    if (!conf.extract_options("power", "linger_ms", &time)) {
+        if (safe_atoi(time, &ret) || ret < 0) {
+            log_error("Invalid linger time: %s", time);
+            ret = -1;
+        }
+        free(time);
+    }
+
+    return ret;
+}
+
+void CameraServer::readFramePoolLimits(const ConfFile &conf) const
+{
+    struct options {
+        int max_memory_kb;
+        bool hugepages;
+    } opt = {-1, false};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"max_memory_kb", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, max_memory_kb)},
+        {"hugepages", false, ConfFile::parse_bool, OPTIONS_TABLE_STRUCT_FIELD(options, hugepages)},
+    };
+
+    if (conf.extract_options("framepool", option_table, ARRAY_SIZE(option_table), (void *)&opt))
+        return;
+
+    // the cap of the memory profile is kept when none is given
+    size_t maxBytes = FramePool::getMaxBytes();
+    if (opt.max_memory_kb < -1)
+        log_error("Invalid frame pool memory cap: %d", opt.max_memory_kb);
+    else if (opt.max_memory_kb >= 0)
+        maxBytes = (size_t)opt.max_memory_kb * 1024;
+
+    FramePool::setLimits(maxBytes, opt.hugepages);
+}
+
+bool CameraServer::readTraceMarker(const ConfFile &conf) const
+{
+    struct options {
+        bool trace_marker;
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"trace_marker", false, ConfFile::parse_bool,
+         OPTIONS_TABLE_STRUCT_FIELD(options, trace_marker)},
+    };
+
+    conf.extract_options("trace", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+    return opt.trace_marker;
+}
+
+bool CameraServer::readLatencyStamp(const ConfFile &conf) const
+{
+    struct options {
+        bool latency_stamp;
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"latency_stamp", false, ConfFile::parse_bool,
+         OPTIONS_TABLE_STRUCT_FIELD(options, latency_stamp)},
+    };
+
+    conf.extract_options("trace", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+    return opt.latency_stamp;
+}
+
+bool CameraServer::readMetricsSettings(const ConfFile &conf, MetricsSettings &settings) const
+{
+    struct options {
+        int port;
+        char address[64];
+        char *socketPath;
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"port", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, port)},
+        {"address", false, ConfFile::parse_str_buf, OPTIONS_TABLE_STRUCT_FIELD(options, address)},
+        {"socket_path", false, ConfFile::parse_str_dup,
+         OPTIONS_TABLE_STRUCT_FIELD(options, socketPath)},
+    };
+
+    if (conf.extract_options("metrics", option_table, ARRAY_SIZE(option_table), (void *)&opt))
+        return false;
+
+    if (opt.socketPath) {
+        settings.socketPath = opt.socketPath;
+        free(opt.socketPath);
+    }
+    if (opt.address[0])
+        settings.address = opt.address;
+
+    if (opt.port < 0 || opt.port > 65535) {
+        log_error("Invalid metrics port: %d", opt.port);
+        return false;
+    }
+    settings.port = opt.port;
+
+    return settings.port > 0 || !settings.socketPath.empty();
+}
+
+bool CameraServer::readRtspPrewarm(const ConfFile &conf) const
+{
+    struct options {
+        bool prewarm;
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"prewarm", false, ConfFile::parse_bool, OPTIONS_TABLE_STRUCT_FIELD(options, prewarm)},
+    };
+
+    conf.extract_options("rtsp", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+    return opt.prewarm;
+}
+
+bool CameraServer::readRtspOverlay(const ConfFile &conf) const
+{
+    struct options {
+        bool overlay;
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"overlay", false, ConfFile::parse_bool, OPTIONS_TABLE_STRUCT_FIELD(options, overlay)},
+    };
+
+    conf.extract_options("rtsp", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+    return opt.overlay;
+}
+
+bool CameraServer::readVidCapShareStream(const ConfFile &conf) const
+{
+    struct options {
+        bool share_stream;
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"share_stream", false, ConfFile::parse_bool,
+         OPTIONS_TABLE_STRUCT_FIELD(options, share_stream)},
+    };
+
+    conf.extract_options("vidcap", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+    return opt.share_stream;
+}
+
+void CameraServer::readVidCapPreroll(const ConfFile &conf) const
+{
+    struct options {
+        int preroll_time;
+        int preroll_memory_kb;
+    } opt = {};
+    static const ConfFile::OptionsTable option_table[] = {
+        {"preroll_time", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, preroll_time)},
+        {"preroll_memory_kb", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, preroll_memory_kb)},
+    };
+
+    conf.extract_options("vidcap", option_table, ARRAY_SIZE(option_table), (void *)&opt);
+    if (opt.preroll_time <= 0)
+        return;
+
+    size_t maxBytes = opt.preroll_memory_kb > 0 ? (size_t)opt.preroll_memory_kb * 1024 : 0;
+    VideoCaptureGst::setPreroll(opt.preroll_time, maxBytes);
+}
+
+std::set<std::string> CameraServer::readVidCapSyncDevices(const ConfFile &conf) const
+{
+    std::set<std::string> devices;
+    static const ConfFile::OptionsTable option_table[] = {
+        {"sync_devices", false, ConfFile::parse_stl_set, 0, 0},
+    };
+    conf.extract_options("vidcap", option_table, 1, (void *)&devices);
+    return devices;
+}
+
 bool CameraServer::readImgCapSettings(const ConfFile &conf, ImageSettings &imgSetting) const
 {
     int ret = 0;
@@ -237,6 +1497,7 @@ bool CameraServer::readImgCapSettings(const ConfFile &conf, ImageSettings &imgSe
         int width;
         int height;
         int format;
+        int quality;
     } opt = {};
 
     // All the settings must be available else default value for all will be used
@@ -244,6 +1505,7 @@ bool CameraServer::readImgCapSettings(const ConfFile &conf, ImageSettings &imgSe
         {"width", true, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, width)},
         {"height", true, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, height)},
         {"format", true, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, format)},
+        {"quality", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, quality)},
     };
     ret = conf.extract_options("imgcap", option_table, ARRAY_SIZE(option_table), (void *)&opt);
     if (ret)
@@ -252,12 +1514,58 @@ bool CameraServer::readImgCapSettings(const ConfFile &conf, ImageSettings &imgSe
     imgSetting.width = opt.width;
     imgSetting.height = opt.height;
     imgSetting.fileFormat = static_cast<CameraParameters::IMAGE_FILE_FORMAT>(opt.format);
-    log_info("Image Capture Width=%d Height=%d format=%d", imgSetting.width, imgSetting.height,
-             imgSetting.fileFormat);
+    imgSetting.quality = opt.quality >= 0 && opt.quality <= 100 ? opt.quality : 0;
+    log_info("Image Capture Width=%d Height=%d format=%d quality=%d", imgSetting.width,
+             imgSetting.height, imgSetting.fileFormat, imgSetting.quality);
 
     return true;
 }
 
+int CameraServer::readImgCapWorkers(const ConfFile &conf) const
+{
+    char *workers = 0;
+    int ret = -1;
+    if (!conf.extract_options("imgcap", "encode_workers", &workers)) {
+        if (safe_atoi(workers, &ret) || ret <= 0) {
+            log_error("Invalid image encode worker count: %s", workers);
+            ret = -1;
+        }
+        free(workers);
+    }
+
+    return ret;
+}
+
+int CameraServer::readImgCapRawFileSize(const ConfFile &conf) const
+{
+    char *size = 0;
+    int ret = -1;
+    if (!conf.extract_options("imgcap", "raw_file_mb", &size)) {
+        if (safe_atoi(size, &ret) || ret <= 0) {
+            log_error("Invalid raw image file size: %s", size);
+            ret = -1;
+        }
+        free(size);
+    }
+
+    return ret;
+}
+
+int CameraServer::readImgCapSyncBatch(const ConfFile &conf) const
+{
+    char *batch = 0;
+    int ret = -1;
+    if (!conf.extract_options("imgcap", "sync_batch", &batch)) {
+        if (safe_atoi(batch, &ret) || ret <= 0) {
+            log_error("Invalid image sync batch: %s", batch);
+            ret = -1;
+        }
+        free(batch);
+    }
+
+    return ret;
+}
+
 std::string CameraServer::readImgCapLocation(const ConfFile &conf) const
 {
     // Location must start and end with "/"
@@ -287,6 +1595,8 @@ bool CameraServer::readVidCapSettings(const ConfFile &conf, VideoSettings &vidSe
         int bitrate;
         int encoder;
         int format;
+        int segment_time;
+        int segment_size;
     } opt = {};
 
     // All the settings must be available else default value for all will be used
@@ -297,6 +1607,10 @@ bool CameraServer::readVidCapSettings(const ConfFile &conf, VideoSettings &vidSe
         {"bitrate", true, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, bitrate)},
         {"encoder", true, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, encoder)},
         {"format", true, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, format)},
+        {"segment_time", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, segment_time)},
+        {"segment_size", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, segment_size)},
     };
     ret = conf.extract_options("vidcap", option_table, ARRAY_SIZE(option_table), (void *)&opt);
     if (ret)
@@ -308,9 +1622,14 @@ bool CameraServer::readVidCapSettings(const ConfFile &conf, VideoSettings &vidSe
     vidSetting.bitRate = opt.bitrate;
     vidSetting.encoder = static_cast<CameraParameters::VIDEO_CODING_FORMAT>(opt.encoder);
     vidSetting.fileFormat = static_cast<CameraParameters::VIDEO_FILE_FORMAT>(opt.format);
+    vidSetting.segmentTime = opt.segment_time > 0 ? opt.segment_time : 0;
+    vidSetting.segmentSize = opt.segment_size > 0 ? opt.segment_size : 0;
     log_info("Video Capture Width=%d Height=%d framerate=%d, bitrate=%dkbps, encoder=%d, format=%d",
              vidSetting.width, vidSetting.height, vidSetting.frameRate, vidSetting.bitRate,
              vidSetting.encoder, vidSetting.fileFormat);
+    if (vidSetting.segmentTime || vidSetting.segmentSize)
+        log_info("Video Capture segments of %ds, %dMB", vidSetting.segmentTime,
+                 vidSetting.segmentSize);
 
     return true;
 }
@@ -16,6 +16,7 @@
  * limitations under the License.
  */
 #pragma once
+#include <functional>
 #include <set>
 #include <string>
 #include <vector>
@@ -29,7 +30,13 @@
 #endif
 
 #include "CameraComponent.h"
+#include "DeviceMonitor.h"
+#include "MetricsServer.h"
 #include "PluginManager.h"
+#include "ThreadPolicy.h"
+
+class CaptureGroup;
+struct UdpStreamSettings;
 
 class CameraServer {
 public:
@@ -38,14 +45,89 @@ public:
     void start();
     void stop();
 
+    /**
+     *  Take the settings of a conf file parsed again, on SIGHUP. The settings of each camera are
+     *  compiled and compared with the ones it runs with, only the cameras whose settings changed
+     *  are created again. Settings of the whole daemon need a restart.
+     *
+     *  @param[in] conf Conf file, kept for the cameras plugged in later.
+     */
+    void reload(const ConfFile &conf);
+
 private:
+    /* Settings of a camera from the conf file, compiled once when the camera is added */
+    struct CameraConf {
+        std::string uri;
+        std::string rtspPipeline;
+        int bufCount = 0;
+        ThreadPolicy threads;
+        bool hasFormat = false;
+        CameraParameters::PixelFormat format = CameraParameters::PixelFormat::PIXEL_FORMAT_MIN;
+        bool isTransport = false;
+        RtspTransport transport;
+        int maxClients = 0;
+        CameraParameters::VIDEO_CODING_FORMAT codec = CameraParameters::VIDEO_CODING_MIN;
+        bool isImgCap = false;
+        ImageSettings img = {};
+        std::string imgPath;
+        bool isVidCap = false;
+        VideoSettings vid = {};
+        std::string vidPath;
+        bool synced = false;
+    };
+
+    CameraConf readCameraConf(const ConfFile &conf, const std::string &deviceID);
+    static std::string diffCameraConf(const CameraConf &prev, const CameraConf &next);
+    void readCameraDefaults(const ConfFile &conf);
+    CameraComponent *addCamera(const std::string &deviceID, std::shared_ptr<CameraDevice> device);
+    void deviceChanged(const std::string &deviceID, bool added);
+    int startCamera(const std::string &deviceID);
+    bool releaseCamera(const std::string &deviceID, std::function<void()> released);
+    void reconfigureCamera(const std::string &deviceID);
+    void publishCameras();
     void addCameraInformation(const std::shared_ptr<CameraDevice> &device);
+    void updateCameraInformation();
+#ifdef ENABLE_AVAHI
+    static bool refreshServices(void *data);
+#endif
     std::set<std::string> readBlacklistDevices(const ConfFile &conf) const;
+    std::map<std::string, CameraParameters::PixelFormat>
+    readCaptureFormats(const ConfFile &conf) const;
     std::string readURI(const ConfFile &conf, std::string deviceID);
     std::string readRTSPPipeline(const ConfFile &conf, std::string deviceID);
+    int readBufferCount(const ConfFile &conf, std::string deviceID) const;
+    ThreadPolicy readThreadPolicy(const ConfFile &conf, std::string owner) const;
+    int readKeyFrameInterval(const ConfFile &conf) const;
+    int readMaxVariants(const ConfFile &conf) const;
+    bool readRtspTransport(const ConfFile &conf, std::string deviceID,
+                           RtspTransport &transport) const;
+    CameraParameters::VIDEO_CODING_FORMAT readStreamCodec(const ConfFile &conf,
+                                                          std::string deviceID) const;
+    void readBitrateLimits(const ConfFile &conf) const;
+    bool readRtspPrewarm(const ConfFile &conf) const;
+    bool readRtspOverlay(const ConfFile &conf) const;
+    int readRtspMaxClients(const ConfFile &conf, uint16_t port) const;
+    bool readTraceMarker(const ConfFile &conf) const;
+    bool readLatencyStamp(const ConfFile &conf) const;
+    bool readMetricsSettings(const ConfFile &conf, MetricsSettings &settings) const;
+    void collectMetrics(std::string &out);
+    bool readHotplug(const ConfFile &conf) const;
+    std::string readV4l2CapCache(const ConfFile &conf) const;
+    int readLingerTime(const ConfFile &conf) const;
+    void readMemoryProfile(const ConfFile &conf) const;
+    void logMemoryBudget() const;
+    void readFramePoolLimits(const ConfFile &conf) const;
+    void readQueuePolicy(const ConfFile &conf) const;
+    bool readUdpSettings(const ConfFile &conf, UdpStreamSettings &settings) const;
     bool readImgCapSettings(const ConfFile &conf, ImageSettings &imgSetting) const;
     std::string readImgCapLocation(const ConfFile &conf) const;
+    int readImgCapWorkers(const ConfFile &conf) const;
+    int readImgCapSyncBatch(const ConfFile &conf) const;
+    int readImgCapRawFileSize(const ConfFile &conf) const;
     bool readVidCapSettings(const ConfFile &conf, VideoSettings &vidSetting) const;
+    bool readVidCapShareStream(const ConfFile &conf) const;
+    void readVidCapPreroll(const ConfFile &conf) const;
+    std::set<std::string> readVidCapSyncDevices(const ConfFile &conf) const;
     std::string readVidCapLocation(const ConfFile &conf) const;
     std::string readGazeboCamTopic(const ConfFile &conf) const;
     PluginManager mPluginManager;
@@ -55,8 +137,22 @@ private:
 #endif
 #ifdef ENABLE_AVAHI
     std::unique_ptr<AvahiPublisher> mAvahiPublisher;
+    unsigned int mServiceTimeout = 0;
 #endif
+    MetricsServer mMetricsServer;
+    MetricsSettings mMetricsSettings;
+    bool mIsMetrics;
+    const ConfFile *mConf; /* Kept for the cameras plugged in later */
+    CameraConf mDefaultConf; /* Settings shared by the cameras */
+    std::map<std::string, CameraConf> mCameraConfs;
+    DeviceMonitor mDeviceMonitor;
+    bool mIsHotplug;
+    std::set<std::string> mBlackList;
+    std::map<std::string, CameraParameters::PixelFormat> mCaptureFormats;
+    std::set<std::string> mSyncDevices;
+    std::shared_ptr<CaptureGroup> mCaptureGroup;
 
     std::map<std::string, std::vector<std::string>> mCamInfoMap;
+    std::map<std::string, std::vector<std::string>> mCamCaps; /* TXT records fixed per camera */
     std::vector<CameraComponent *> compList;
 };
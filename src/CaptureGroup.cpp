@@ -0,0 +1,99 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+
+#include "CameraComponent.h"
+#include "CaptureGroup.h"
+#include "log.h"
+
+CaptureGroup::CaptureGroup()
+    : mClock(nullptr)
+    , mBaseTime(0)
+{
+    /* monotonic like the capture time of the devices, for frames stamped from their age */
+    /* a clock of its own, the system clock is shared by all the pipelines of the process */
+    mClock = GST_CLOCK(g_object_new(GST_TYPE_SYSTEM_CLOCK, "name", "CaptureGroupClock",
+                                    "clock-type", GST_CLOCK_TYPE_MONOTONIC, NULL));
+    gst_object_ref_sink(mClock);
+}
+
+CaptureGroup::~CaptureGroup()
+{
+    gst_object_unref(mClock);
+}
+
+void CaptureGroup::addComponent(CameraComponent *comp)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    if (std::find(mComponents.begin(), mComponents.end(), comp) == mComponents.end())
+        mComponents.push_back(comp);
+}
+
+void CaptureGroup::removeComponent(CameraComponent *comp)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    mComponents.erase(std::remove(mComponents.begin(), mComponents.end(), comp),
+                      mComponents.end());
+}
+
+int CaptureGroup::startVideoCapture()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    log_info("%s::%s cameras:%zu", typeid(this).name(), __func__, mComponents.size());
+
+    /* the running time of all pipelines starts now, whenever each of them gets to PLAYING */
+    mBaseTime = gst_clock_get_time(mClock);
+
+    std::vector<CameraComponent *> started;
+    for (CameraComponent *comp : mComponents) {
+        if (comp->startLocalVideoCapture()) {
+            log_error("Error in starting recording of %s, stopping the group",
+                      (const char *)comp->getCameraInfo().modelName);
+            for (CameraComponent *s : started)
+                s->stopLocalVideoCapture();
+            return -1;
+        }
+        started.push_back(comp);
+    }
+
+    return 0;
+}
+
+int CaptureGroup::stopVideoCapture()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    log_info("%s::%s", typeid(this).name(), __func__);
+
+    int ret = 0;
+    for (CameraComponent *comp : mComponents) {
+        if (comp->stopLocalVideoCapture())
+            ret = -1;
+    }
+
+    return ret;
+}
+
+GstClock *CaptureGroup::getClock() const
+{
+    return mClock;
+}
+
+GstClockTime CaptureGroup::getBaseTime() const
+{
+    return mBaseTime;
+}
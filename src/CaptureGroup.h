@@ -0,0 +1,89 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <gst/gst.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class CameraComponent;
+
+/**
+ *  The CaptureGroup class records several cameras as one, to get frames that line up across
+ *  devices (RGB, depth and IR of a RealSense, stereo pairs). All pipelines of the group run on the
+ *  same clock with the same base time, so the running time, and with it every frame timestamp,
+ *  is taken from one timeline. Recording is started and stopped for all members together: a
+ *  start that fails on one camera stops the ones already started.
+ *
+ *  Starting or stopping the recording of any member does it for the whole group.
+ */
+class CaptureGroup {
+public:
+    CaptureGroup();
+    ~CaptureGroup();
+
+    /**
+     *  Add a camera to the group. The group does not own the component, it must be removed
+     *  before the component goes away.
+     *
+     *  @param[in] comp Camera component.
+     */
+    void addComponent(CameraComponent *comp);
+
+    /**
+     *  Remove a camera from the group.
+     *
+     *  @param[in] comp Camera component.
+     */
+    void removeComponent(CameraComponent *comp);
+
+    /**
+     *  Start recording on all cameras of the group with a new common base time.
+     *
+     *  @return 0 if all cameras record, -1 otherwise (none records then).
+     */
+    int startVideoCapture();
+
+    /**
+     *  Stop recording on all cameras of the group.
+     *
+     *  @return 0 if successful, -1 if a camera failed to stop.
+     */
+    int stopVideoCapture();
+
+    /**
+     *  Get the clock shared by the pipelines of the group.
+     *
+     *  @return Clock, owned by the group.
+     */
+    GstClock *getClock() const;
+
+    /**
+     *  Get the base time of the current recording, to be set on every pipeline of the group.
+     *
+     *  @return Base time on the group clock.
+     */
+    GstClockTime getBaseTime() const;
+
+private:
+    std::mutex mLock; /* Serializes start and stop of the group */
+    std::vector<CameraComponent *> mComponents;
+    GstClock *mClock;
+    GstClockTime mBaseTime;
+};
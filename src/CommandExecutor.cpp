@@ -0,0 +1,154 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "CommandExecutor.h"
+#include "ThreadPolicy.h"
+#include "log.h"
+#include "mainloop.h"
+
+CommandExecutor::CommandExecutor()
+    : mStopped(false)
+{
+}
+
+CommandExecutor::~CommandExecutor()
+{
+    stop();
+}
+
+bool CommandExecutor::submit(int key, std::function<int()> work, std::function<void(int)> done)
+{
+    std::shared_ptr<Worker> worker;
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        if (mStopped)
+            return false;
+        std::shared_ptr<Worker> &w = mWorkers[key];
+        if (!w) {
+            w = std::make_shared<Worker>();
+            w->thread = std::thread(&CommandExecutor::run, w);
+        }
+        worker = w;
+    }
+
+    {
+        std::lock_guard<std::mutex> locker(worker->lock);
+        if (worker->stopped)
+            return false;
+        // a request queued while busy runs the blocking part of itself in its reply
+        if (worker->replying)
+            worker->jobs.insert(worker->jobs.begin() + worker->inserted++, {work, done});
+        else
+            worker->jobs.push_back({work, done});
+    }
+    worker->cond.notify_all();
+    return true;
+}
+
+bool CommandExecutor::isBusy(int key)
+{
+    std::shared_ptr<Worker> worker;
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        auto it = mWorkers.find(key);
+        if (it == mWorkers.end())
+            return false;
+        worker = it->second;
+    }
+
+    std::lock_guard<std::mutex> locker(worker->lock);
+    return worker->busy || !worker->jobs.empty();
+}
+
+void CommandExecutor::stop()
+{
+    std::map<int, std::shared_ptr<Worker>> workers;
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mStopped = true;
+        workers.swap(mWorkers);
+    }
+
+    for (auto &x : workers) {
+        {
+            std::lock_guard<std::mutex> locker(x.second->lock);
+            x.second->stopped = true;
+            x.second->jobs.clear();
+        }
+        x.second->cond.notify_all();
+        if (x.second->thread.joinable())
+            x.second->thread.join();
+    }
+}
+
+void CommandExecutor::run(std::shared_ptr<Worker> worker)
+{
+    ThreadPolicy::reset("cmd");
+
+    std::unique_lock<std::mutex> lock(worker->lock);
+
+    while (true) {
+        worker->cond.wait(lock, [worker] { return worker->stopped || !worker->jobs.empty(); });
+        if (worker->stopped)
+            break;
+
+        Job job = worker->jobs.front();
+        worker->jobs.pop_front();
+        worker->busy = true;
+        lock.unlock();
+
+        int result = job.work ? job.work() : 0;
+
+        // reply from the mainloop, the next job waits for it to keep replies in order
+        Reply *reply = new Reply{worker, job.done, result};
+        Mainloop::get_mainloop()->add_timeout(0, replyCb, reply);
+
+        lock.lock();
+        worker->cond.wait(lock, [worker] { return worker->stopped || !worker->busy; });
+        if (worker->stopped)
+            break;
+    }
+}
+
+/* runs on the mainloop */
+bool CommandExecutor::replyCb(void *data)
+{
+    Reply *reply = (Reply *)data;
+    bool stopped;
+
+    {
+        std::lock_guard<std::mutex> locker(reply->worker->lock);
+        stopped = reply->worker->stopped;
+        reply->worker->replying = true;
+        reply->worker->inserted = 0;
+    }
+
+    if (!stopped && reply->done)
+        reply->done(reply->result);
+    else if (stopped)
+        log_debug("Reply of stopped command dropped");
+
+    {
+        std::lock_guard<std::mutex> locker(reply->worker->lock);
+        reply->worker->replying = false;
+        reply->worker->busy = false;
+    }
+    reply->worker->cond.notify_all();
+
+    delete reply;
+    return false;
+}
@@ -0,0 +1,97 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ *  The CommandExecutor class runs requests that may block (device calls, pipelines going to
+ *  PLAYING) away from the mainloop. Each key, a camera component, has a queue of its own served by
+ *  one worker thread, so requests to a camera run one at a time and in the order given while
+ *  other cameras and the mainloop go on.
+ *
+ *  A request has a part run on the worker thread and a part run on the mainloop with its result,
+ *  to reply from. The next request of the key only starts once that reply ran.
+ */
+class CommandExecutor {
+public:
+    CommandExecutor();
+    ~CommandExecutor();
+
+    /**
+     *  Queue a request.
+     *
+     *  @param[in] key Queue the request is serialized on.
+     *  @param[in] work Part run on the worker thread, returning the result. May be empty for a
+     *  request that only needs to keep its place in the queue, with a result of 0 then.
+     *  @param[in] done Part run on the mainloop with the result of work. Requests it submits
+     *  itself run before the others queued meanwhile.
+     *
+     *  @return False if the executor is stopped, the request is dropped then.
+     */
+    bool submit(int key, std::function<int()> work, std::function<void(int)> done);
+
+    /**
+     *  Check if requests of a key are queued or running.
+     *
+     *  @param[in] key Queue of the requests.
+     *
+     *  @return True if busy.
+     */
+    bool isBusy(int key);
+
+    /**
+     *  Stop all workers. The running requests complete, the queued ones are dropped and no reply
+     *  is run anymore.
+     */
+    void stop();
+
+private:
+    struct Job {
+        std::function<int()> work;
+        std::function<void(int)> done;
+    };
+
+    struct Worker {
+        std::mutex lock;
+        std::condition_variable cond;
+        std::deque<Job> jobs;
+        bool busy = false;     /* A job is running or waits for its reply */
+        bool replying = false; /* Reply of the job runs, jobs it submits go first */
+        size_t inserted = 0;   /* Jobs submitted by the running reply */
+        bool stopped = false;
+        std::thread thread;
+    };
+
+    struct Reply {
+        std::shared_ptr<Worker> worker;
+        std::function<void(int)> done;
+        int result;
+    };
+
+    static void run(std::shared_ptr<Worker> worker);
+    static bool replyCb(void *data);
+    std::mutex mLock; /* Protects mWorkers and mStopped */
+    std::map<int, std::shared_ptr<Worker>> mWorkers;
+    bool mStopped;
+};
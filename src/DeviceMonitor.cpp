@@ -0,0 +1,151 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "DeviceMonitor.h"
+#include "log.h"
+#include "mainloop.h"
+
+/* Time without event after which a created node is ready to be opened */
+#define SETTLE_MS 500
+/* Period pending nodes are checked at */
+#define SETTLE_CHECK_MS 100
+
+DeviceMonitor::DeviceMonitor()
+    : _timeout_handler(0)
+{
+}
+
+DeviceMonitor::~DeviceMonitor()
+{
+    stop();
+}
+
+int DeviceMonitor::start(const char *path,
+                         std::function<void(const std::string &node, bool added)> cb)
+{
+    stop();
+
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd < 0) {
+        log_error("Could not create inotify instance (%m)");
+        return -1;
+    }
+
+    uint32_t mask = IN_CREATE | IN_ATTRIB | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM;
+    if (inotify_add_watch(_fd, path, mask) < 0) {
+        log_error("Could not watch %s for devices (%m)", path);
+        ::close(_fd);
+        _fd = -1;
+        return -1;
+    }
+
+    _cb = cb;
+    log_info("Watching %s for camera devices", path);
+    monitor_read(true);
+    return 0;
+}
+
+void DeviceMonitor::stop()
+{
+    if (_timeout_handler) {
+        Mainloop::get_mainloop()->del_timeout(_timeout_handler);
+        _timeout_handler = 0;
+    }
+    _pending.clear();
+
+    if (_fd < 0)
+        return;
+
+    monitor_read(false);
+    ::close(_fd);
+    _fd = -1;
+}
+
+/* Watched edge-triggered, events are read until there is none left */
+bool DeviceMonitor::_can_read()
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (true) {
+        ssize_t len = read(_fd, buf, sizeof(buf));
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                log_error("Could not read device events (%m)");
+            break;
+        }
+
+        for (char *p = buf; p < buf + len;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                log_warning("Device events lost, devices changed meanwhile are missed");
+                continue;
+            }
+            if (!ev->len || (ev->mask & IN_ISDIR))
+                continue;
+
+            std::string node = ev->name;
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                _pending.erase(node);
+                _cb(node, false);
+            } else {
+                _pending[node] = now_usec();
+            }
+        }
+    }
+
+    if (!_pending.empty() && !_timeout_handler)
+        _timeout_handler
+            = Mainloop::get_mainloop()->add_timeout(SETTLE_CHECK_MS, _settle_cb, this);
+
+    return true;
+}
+
+bool DeviceMonitor::_settle_cb(void *data)
+{
+    return static_cast<DeviceMonitor *>(data)->_settle();
+}
+
+bool DeviceMonitor::_settle()
+{
+    usec_t now = now_usec();
+
+    for (auto it = _pending.begin(); it != _pending.end();) {
+        if (now - it->second < SETTLE_MS * USEC_PER_MSEC) {
+            ++it;
+            continue;
+        }
+        std::string node = it->first;
+        it = _pending.erase(it);
+        _cb(node, true);
+    }
+
+    if (_pending.empty()) {
+        _timeout_handler = 0;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <functional>
+#include <map>
+#include <string>
+
+#include "pollable.h"
+#include "util.h"
+
+/**
+ *  The DeviceMonitor class watches a device directory with inotify from the mainloop and reports
+ *  the nodes created in it and removed from it, so that cameras plugged in, or re-enumerated by
+ *  the USB bus after a brownout, come back without a restart of the daemon.
+ *
+ *  udev creates a node before it sets its owner and permissions, so a created node is reported
+ *  once it had no event for the settle time. A removed node is reported at once.
+ */
+class DeviceMonitor : public Pollable {
+public:
+    DeviceMonitor();
+    ~DeviceMonitor();
+
+    /**
+     *  Start watching a directory.
+     *
+     *  @param[in] path Directory of the device nodes, as "/dev/".
+     *  @param[in] cb Called on the mainloop with the name of the node in the directory, and true
+     *  if it was added or false if it was removed.
+     *
+     *  @return 0 on success, -1 on error.
+     */
+    int start(const char *path, std::function<void(const std::string &node, bool added)> cb);
+
+    void stop();
+
+protected:
+    bool _can_read() override;
+    bool _can_write() override { return false; }
+
+private:
+    static bool _settle_cb(void *data);
+    bool _settle();
+    std::function<void(const std::string &node, bool added)> _cb;
+    std::map<std::string, usec_t> _pending; /* Nodes created, by time of their last event */
+    unsigned int _timeout_handler;
+};
@@ -0,0 +1,236 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gst/gst.h>
+#include <mutex>
+
+#include "EncoderRegistry.h"
+#include "log.h"
+#include "util.h"
+
+#define DEFAULT_KEY_FRAME_INTERVAL 30
+
+/* Encoders in order of preference for each codec, hardware first */
+const EncoderRegistry::Encoder EncoderRegistry::sEncoders[] = {
+    /* H.264 */
+    {"vaapih264enc", CameraParameters::VIDEO_CODING_AVC, "bitrate", 1, "keyframe-period",
+     "max-bframes=0 rate-control=cbr", nullptr},
+    {"v4l2h264enc", CameraParameters::VIDEO_CODING_AVC, nullptr, 0, nullptr, "", nullptr},
+    {"omxh264enc", CameraParameters::VIDEO_CODING_AVC, "target-bitrate", 1000,
+     "interval-intraframes", "control-rate=constant", nullptr},
+    {"nvh264enc", CameraParameters::VIDEO_CODING_AVC, "bitrate", 1, "gop-size",
+     "preset=low-latency-hq bframes=0", nullptr},
+    {"x264enc", CameraParameters::VIDEO_CODING_AVC, "bitrate", 1, "key-int-max",
+     "tune=zerolatency speed-preset=ultrafast bframes=0", "intra-refresh=true"},
+    /* H.265 */
+    {"vaapih265enc", CameraParameters::VIDEO_CODING_HEVC, "bitrate", 1, "keyframe-period",
+     "max-bframes=0 rate-control=cbr", nullptr},
+    {"v4l2h265enc", CameraParameters::VIDEO_CODING_HEVC, nullptr, 0, nullptr, "", nullptr},
+    {"omxh265enc", CameraParameters::VIDEO_CODING_HEVC, "target-bitrate", 1000,
+     "interval-intraframes", "control-rate=constant", nullptr},
+    {"nvh265enc", CameraParameters::VIDEO_CODING_HEVC, "bitrate", 1, "gop-size",
+     "preset=low-latency-hq", nullptr},
+    {"x265enc", CameraParameters::VIDEO_CODING_HEVC, "bitrate", 1, "key-int-max",
+     "tune=zerolatency speed-preset=ultrafast", nullptr},
+    /* Motion JPEG, every frame is a key frame */
+    {"vaapijpegenc", CameraParameters::VIDEO_CODING_MJPEG, nullptr, 0, nullptr, "", nullptr},
+    {"v4l2jpegenc", CameraParameters::VIDEO_CODING_MJPEG, nullptr, 0, nullptr, "", nullptr},
+    {"jpegenc", CameraParameters::VIDEO_CODING_MJPEG, nullptr, 0, nullptr, "", nullptr},
+};
+
+bool EncoderRegistry::sAvailable[ARRAY_SIZE(EncoderRegistry::sEncoders)] = {};
+
+/* Decoders of the compressed formats cameras give, in order of preference, hardware first */
+const EncoderRegistry::Decoder EncoderRegistry::sDecoders[] = {
+    {"vaapijpegdec", CameraParameters::VIDEO_CODING_MJPEG},
+    {"v4l2jpegdec", CameraParameters::VIDEO_CODING_MJPEG},
+    {"jpegdec", CameraParameters::VIDEO_CODING_MJPEG},
+};
+
+bool EncoderRegistry::sDecAvailable[ARRAY_SIZE(EncoderRegistry::sDecoders)] = {};
+std::atomic<uint32_t> EncoderRegistry::sKeyFrameInterval(DEFAULT_KEY_FRAME_INTERVAL);
+
+void EncoderRegistry::probe()
+{
+    static std::once_flag probed;
+
+    std::call_once(probed, [] {
+        gst_init(nullptr, nullptr);
+
+        for (size_t i = 0; i < ARRAY_SIZE(sEncoders); i++) {
+            GstElementFactory *factory = gst_element_factory_find(sEncoders[i].element);
+            if (!factory)
+                continue;
+
+            gst_object_unref(factory);
+            sAvailable[i] = true;
+            log_info("Video encoder available: %s", sEncoders[i].element);
+        }
+
+        for (size_t i = 0; i < ARRAY_SIZE(sDecoders); i++) {
+            GstElementFactory *factory = gst_element_factory_find(sDecoders[i].element);
+            if (!factory)
+                continue;
+
+            gst_object_unref(factory);
+            sDecAvailable[i] = true;
+            log_info("Video decoder available: %s", sDecoders[i].element);
+        }
+    });
+}
+
+const EncoderRegistry::Encoder *
+EncoderRegistry::getEncoder(CameraParameters::VIDEO_CODING_FORMAT codec)
+{
+    probe();
+
+    for (size_t i = 0; i < ARRAY_SIZE(sEncoders); i++) {
+        if (sEncoders[i].codec == codec && sAvailable[i])
+            return &sEncoders[i];
+    }
+
+    return nullptr;
+}
+
+bool EncoderRegistry::isSupported(CameraParameters::VIDEO_CODING_FORMAT codec)
+{
+    return getEncoder(codec) != nullptr;
+}
+
+std::string EncoderRegistry::getEncoderName(CameraParameters::VIDEO_CODING_FORMAT codec)
+{
+    const Encoder *enc = getEncoder(codec);
+    if (!enc)
+        return {};
+
+    return enc->element;
+}
+
+std::string EncoderRegistry::getEncoderPipeline(CameraParameters::VIDEO_CODING_FORMAT codec,
+                                                uint32_t bitrate, bool intraRefresh)
+{
+    const Encoder *enc = getEncoder(codec);
+    if (!enc) {
+        log_error("No encoder found for video coding format %d", codec);
+        return {};
+    }
+
+    std::string pipeline = enc->element;
+
+    if (enc->lowLatency[0])
+        pipeline = pipeline + " " + enc->lowLatency;
+
+    if (bitrate > 0 && enc->bitrate)
+        pipeline
+            = pipeline + " " + enc->bitrate + "=" + std::to_string(bitrate * enc->bitrateScale);
+
+    uint32_t gop = sKeyFrameInterval;
+    if (gop > 0 && enc->gop)
+        pipeline = pipeline + " " + enc->gop + "=" + std::to_string(gop);
+
+    /* refresh spreads over the key frame interval instead of one big key frame */
+    if (intraRefresh && enc->intraRefresh)
+        pipeline = pipeline + " " + enc->intraRefresh;
+
+    return pipeline;
+}
+
+bool EncoderRegistry::setBitrate(GstElement *encoder, uint32_t bitrate)
+{
+    GstElementFactory *factory = gst_element_get_factory(encoder);
+    if (!factory)
+        return false;
+
+    std::string name = gst_plugin_feature_get_name(factory);
+    for (size_t i = 0; i < ARRAY_SIZE(sEncoders); i++) {
+        if (name != sEncoders[i].element)
+            continue;
+        if (!sEncoders[i].bitrate)
+            return false;
+
+        g_object_set(G_OBJECT(encoder), sEncoders[i].bitrate,
+                     (guint)(bitrate * sEncoders[i].bitrateScale), NULL);
+        return true;
+    }
+
+    return false;
+}
+
+std::string EncoderRegistry::getDecoderName(CameraParameters::VIDEO_CODING_FORMAT codec)
+{
+    probe();
+
+    for (size_t i = 0; i < ARRAY_SIZE(sDecoders); i++) {
+        if (sDecoders[i].codec == codec && sDecAvailable[i])
+            return sDecoders[i].element;
+    }
+
+    log_error("No decoder found for video coding format %d", codec);
+    return {};
+}
+
+std::string EncoderRegistry::getParserName(CameraParameters::VIDEO_CODING_FORMAT codec)
+{
+    switch (codec) {
+    case CameraParameters::VIDEO_CODING_AVC:
+        return "h264parse";
+    case CameraParameters::VIDEO_CODING_HEVC:
+        return "h265parse";
+    case CameraParameters::VIDEO_CODING_MJPEG:
+        return "jpegparse";
+    default:
+        return {};
+    }
+}
+
+std::string EncoderRegistry::getEncodedCaps(CameraParameters::VIDEO_CODING_FORMAT codec)
+{
+    switch (codec) {
+    case CameraParameters::VIDEO_CODING_AVC:
+        return "video/x-h264, stream-format=byte-stream, alignment=au";
+    case CameraParameters::VIDEO_CODING_HEVC:
+        return "video/x-h265, stream-format=byte-stream, alignment=au";
+    case CameraParameters::VIDEO_CODING_MJPEG:
+        return "image/jpeg";
+    default:
+        return {};
+    }
+}
+
+std::string EncoderRegistry::getPayloaderName(CameraParameters::VIDEO_CODING_FORMAT codec)
+{
+    switch (codec) {
+    case CameraParameters::VIDEO_CODING_AVC:
+        return "rtph264pay";
+    case CameraParameters::VIDEO_CODING_HEVC:
+        return "rtph265pay";
+    case CameraParameters::VIDEO_CODING_MJPEG:
+        return "rtpjpegpay";
+    default:
+        return {};
+    }
+}
+
+void EncoderRegistry::setKeyFrameInterval(uint32_t frames)
+{
+    sKeyFrameInterval = frames;
+}
+
+uint32_t EncoderRegistry::getKeyFrameInterval()
+{
+    return sKeyFrameInterval;
+}
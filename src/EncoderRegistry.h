@@ -0,0 +1,149 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <gst/gst.h>
+#include <string>
+
+#include "CameraParameters.h"
+
+/**
+ *  The EncoderRegistry class knows the gstreamer video encoders the camera manager can use and
+ *  which of them are installed, along with the decoders of the compressed frames of cameras. The
+ *  registry is probed once and, for a codec, hardware encoders (VA-API, V4L2 M2M, OMX, NVENC) are
+ *  preferred over software ones. All the video paths (RTSP, UDP and recording) build their
+ *  encoder from here, configured for low latency.
+ */
+class EncoderRegistry {
+public:
+    /**
+     *  Check if an encoder for the codec is installed.
+     *
+     *  @param[in] codec Video coding format.
+     *
+     *  @return true if the codec can be encoded.
+     */
+    static bool isSupported(CameraParameters::VIDEO_CODING_FORMAT codec);
+
+    /**
+     *  Get the name of the gstreamer element used to encode the codec.
+     *
+     *  @param[in] codec Video coding format.
+     *
+     *  @return Element name, empty if the codec can not be encoded.
+     */
+    static std::string getEncoderName(CameraParameters::VIDEO_CODING_FORMAT codec);
+
+    /**
+     *  Get the pipeline description of the encoder configured for low latency: no B-frames, a
+     *  key frame every getKeyFrameInterval() frames and the given bitrate.
+     *
+     *  @param[in] codec Video coding format.
+     *  @param[in] bitrate Bitrate in kbps, 0 for the encoder default.
+     *  @param[in] intraRefresh Refresh the picture with intra-coded slices instead of periodic
+     *  key frames, for encoders supporting it. Keeps the frame size, and so the latency, steady.
+     *
+     *  @return Pipeline description, empty if the codec can not be encoded.
+     */
+    static std::string getEncoderPipeline(CameraParameters::VIDEO_CODING_FORMAT codec,
+                                          uint32_t bitrate, bool intraRefresh = false);
+
+    /**
+     *  Change the bitrate of a running encoder built from getEncoderPipeline().
+     *
+     *  @param[in] encoder Encoder element.
+     *  @param[in] bitrate Bitrate in kbps.
+     *
+     *  @return true if the bitrate was applied.
+     */
+    static bool setBitrate(GstElement *encoder, uint32_t bitrate);
+
+    /**
+     *  Get the name of the gstreamer element used to decode the codec, for cameras giving
+     *  compressed frames that are encoded again.
+     *
+     *  @param[in] codec Video coding format.
+     *
+     *  @return Element name, empty if the codec can not be decoded.
+     */
+    static std::string getDecoderName(CameraParameters::VIDEO_CODING_FORMAT codec);
+
+    /**
+     *  Get the name of the parser element for the codec.
+     *
+     *  @param[in] codec Video coding format.
+     *
+     *  @return Element name, empty if the codec is not supported.
+     */
+    static std::string getParserName(CameraParameters::VIDEO_CODING_FORMAT codec);
+
+    /**
+     *  Get the caps of the frames of the codec as a camera encoding on board gives them, access
+     *  units of a byte-stream for H.264 and H.265.
+     *
+     *  @param[in] codec Video coding format.
+     *
+     *  @return Caps description, empty if the codec is not supported.
+     */
+    static std::string getEncodedCaps(CameraParameters::VIDEO_CODING_FORMAT codec);
+
+    /**
+     *  Get the name of the RTP payloader element for the codec.
+     *
+     *  @param[in] codec Video coding format.
+     *
+     *  @return Element name, empty if the codec is not supported.
+     */
+    static std::string getPayloaderName(CameraParameters::VIDEO_CODING_FORMAT codec);
+
+    /**
+     *  Set the number of frames between key frames of the encoded streams.
+     *
+     *  @param[in] frames Key frame interval, 0 for the encoder default.
+     */
+    static void setKeyFrameInterval(uint32_t frames);
+
+    /**
+     *  Get the number of frames between key frames of the encoded streams.
+     *
+     *  @return Key frame interval, 0 if the encoder default is used.
+     */
+    static uint32_t getKeyFrameInterval();
+
+private:
+    struct Encoder {
+        const char *element; /* gstreamer element */
+        CameraParameters::VIDEO_CODING_FORMAT codec;
+        const char *bitrate;      /* Bitrate property, nullptr if it can't be set */
+        uint32_t bitrateScale;    /* Bitrate property units per kbps */
+        const char *gop;          /* Key frame interval property, nullptr if it can't be set */
+        const char *lowLatency;   /* Properties for low latency encoding */
+        const char *intraRefresh; /* Properties for periodic intra refresh, nullptr if none */
+    };
+    struct Decoder {
+        const char *element; /* gstreamer element */
+        CameraParameters::VIDEO_CODING_FORMAT codec;
+    };
+    static const Encoder sEncoders[];
+    static bool sAvailable[];
+    static const Decoder sDecoders[];
+    static bool sDecAvailable[];
+    static std::atomic<uint32_t> sKeyFrameInterval;
+    static void probe();
+    static const Encoder *getEncoder(CameraParameters::VIDEO_CODING_FORMAT codec);
+};
@@ -0,0 +1,197 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "FileWriter.h"
+#include "ThreadPolicy.h"
+#include "log.h"
+#include "util.h"
+
+#define DEFAULT_SYNC_BATCH 8
+/* Weight of the last batch in the averaged throughput */
+#define SPEED_WEIGHT 0.25f
+#define BYTES_PER_MIB (1024.0f * 1024.0f)
+
+uint32_t FileWriter::sSyncBatch = DEFAULT_SYNC_BATCH;
+std::mutex FileWriter::sStatLock;
+float FileWriter::sWriteSpeed = 0;
+
+FileWriter::FileWriter()
+    : mStop(false)
+{
+    mThread = std::thread(&FileWriter::writerThread, this);
+}
+
+FileWriter::~FileWriter()
+{
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mStop = true;
+    }
+    mCond.notify_all();
+
+    if (mThread.joinable())
+        mThread.join();
+}
+
+std::shared_ptr<FileWriter> FileWriter::getInstance()
+{
+    static std::mutex sInstanceLock;
+    static std::weak_ptr<FileWriter> sInstance;
+
+    std::lock_guard<std::mutex> locker(sInstanceLock);
+    std::shared_ptr<FileWriter> writer = sInstance.lock();
+    if (!writer) {
+        writer = std::shared_ptr<FileWriter>(new FileWriter());
+        sInstance = writer;
+    }
+
+    return writer;
+}
+
+void FileWriter::write(const std::string &path, const void *data, size_t size,
+                       std::function<void(int result)> done)
+{
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mJobs.push_back({path, data, size, done});
+    }
+    mCond.notify_one();
+}
+
+float FileWriter::getWriteSpeed()
+{
+    std::lock_guard<std::mutex> locker(sStatLock);
+    return sWriteSpeed;
+}
+
+int FileWriter::getSpace(const std::string &path, float &total, float &available)
+{
+    struct statvfs st;
+    if (statvfs(path.c_str(), &st)) {
+        log_error("Unable to get storage space of %s: %s", path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    total = (float)st.f_blocks * st.f_frsize / BYTES_PER_MIB;
+    available = (float)st.f_bavail * st.f_frsize / BYTES_PER_MIB;
+    return 0;
+}
+
+void FileWriter::setSyncBatch(uint32_t count)
+{
+    sSyncBatch = count > 0 ? count : 1;
+}
+
+/* space is allocated up front so the file does not fragment as it grows */
+int FileWriter::writeFile(const Job &job, int &fd)
+{
+    fd = open(job.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_error("Unable to open %s: %s", job.path.c_str(), strerror(errno));
+        return -1;
+    }
+
+    if (job.size)
+        posix_fallocate(fd, 0, job.size);
+
+    const uint8_t *data = static_cast<const uint8_t *>(job.data);
+    size_t left = job.size;
+    while (left) {
+        ssize_t ret = ::write(fd, data, left);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            log_error("Unable to write %s: %s", job.path.c_str(), strerror(errno));
+            return -1;
+        }
+        data += ret;
+        left -= ret;
+    }
+
+    return 0;
+}
+
+void FileWriter::writerThread()
+{
+    std::vector<std::pair<Job, int>> batch; /* Files written, waiting for the sync */
+    size_t bytes = 0;
+    usec_t start = 0;
+
+    ThreadPolicy::reset("filewriter");
+
+    while (true) {
+        Job job;
+        bool more;
+        {
+            std::unique_lock<std::mutex> locker(mLock);
+            mCond.wait(locker,
+                       [this, &batch] { return mStop || !mJobs.empty() || !batch.empty(); });
+            if (mJobs.empty() && batch.empty())
+                break;
+            more = !mJobs.empty();
+            if (more) {
+                job = mJobs.front();
+                mJobs.pop_front();
+            }
+        }
+
+        if (more) {
+            if (batch.empty())
+                start = now_usec();
+
+            int fd = -1;
+            if (writeFile(job, fd)) {
+                if (fd >= 0)
+                    close(fd);
+                job.done(-1);
+            } else {
+                bytes += job.size;
+                batch.push_back({job, fd});
+            }
+
+            std::lock_guard<std::mutex> locker(mLock);
+            if (batch.size() < sSyncBatch && !mJobs.empty())
+                continue;
+        }
+
+        /* sync the batch, files are reported once they are on storage */
+        for (auto &written : batch) {
+            int ret = fdatasync(written.second);
+            if (ret)
+                log_error("Unable to sync %s: %s", written.first.path.c_str(), strerror(errno));
+            if (close(written.second))
+                ret = -1;
+            written.first.done(ret ? -1 : 0);
+        }
+
+        usec_t elapsed = now_usec() - start;
+        if (bytes && elapsed) {
+            float speed = bytes / BYTES_PER_MIB / (elapsed / (float)USEC_PER_SEC);
+            std::lock_guard<std::mutex> locker(sStatLock);
+            sWriteSpeed
+                = sWriteSpeed > 0.0f ? sWriteSpeed + SPEED_WEIGHT * (speed - sWriteSpeed) : speed;
+        }
+        batch.clear();
+        bytes = 0;
+    }
+}
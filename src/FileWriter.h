@@ -0,0 +1,103 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ *  The FileWriter class writes files from a thread of its own, so that captures are not held up
+ *  by slow storage. Written files are synced in batches, once no more file is waiting or when the
+ *  batch is full, and their completion is reported after they reached the storage.
+ *
+ *  The write throughput is measured on the actual writes, including the syncs, and is reported
+ *  with the space of the storage.
+ */
+class FileWriter {
+public:
+    ~FileWriter();
+
+    /**
+     *  Get the writer, creating it if no capture holds it.
+     *
+     *  @return Writer object.
+     */
+    static std::shared_ptr<FileWriter> getInstance();
+
+    /**
+     *  Queue a file to write.
+     *
+     *  @param[in] path Path of the file, overwritten if it exists.
+     *  @param[in] data Content of the file.
+     *  @param[in] size Size of the content.
+     *  @param[in] done Called on the writer thread with 0 once the file is on storage, -1 on error.
+     *             The content must stay valid until then.
+     */
+    void write(const std::string &path, const void *data, size_t size,
+               std::function<void(int result)> done);
+
+    /**
+     *  Get the write throughput measured over the last batches. It is kept across writers, asking
+     *  for it does not need a writer.
+     *
+     *  @return Throughput in MiB/s, 0 if nothing was written yet.
+     */
+    static float getWriteSpeed();
+
+    /**
+     *  Get the space of the storage holding a path.
+     *
+     *  @param[in] path Path on the storage.
+     *  @param[out] total Total capacity in MiB.
+     *  @param[out] available Space available in MiB.
+     *
+     *  @return 0 on success, -1 if the storage can not be queried.
+     */
+    static int getSpace(const std::string &path, float &total, float &available);
+
+    /**
+     *  Set the max number of files synced together.
+     *
+     *  @param[in] count Number of files, 1 syncs every file on its own.
+     */
+    static void setSyncBatch(uint32_t count);
+
+private:
+    FileWriter();
+    struct Job {
+        std::string path;
+        const void *data;
+        size_t size;
+        std::function<void(int result)> done;
+    };
+    void writerThread();
+    int writeFile(const Job &job, int &fd);
+    std::mutex mLock; /* Protects mJobs and mStop */
+    std::condition_variable mCond;
+    std::deque<Job> mJobs;
+    bool mStop;
+    std::thread mThread;
+    static uint32_t sSyncBatch;
+    static std::mutex sStatLock;
+    static float sWriteSpeed; /* MiB/s, averaged over the batches */
+};
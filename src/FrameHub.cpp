@@ -0,0 +1,308 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <chrono>
+
+#include "FrameHub.h"
+#include "ThreadPolicy.h"
+#include "log.h"
+#include "util.h"
+
+/* Time to back off when the camera device has no frame to give, doubled on each error in a row */
+#define READ_RETRY_MS 10
+#define READ_RETRY_MAX_MS 320
+/* Time without frames after which the camera device is taken as stuck and restarted */
+#define STALL_RESTART_MS 2000
+/* Time the camera device keeps running after the last subscriber left */
+#define DEFAULT_LINGER_MS 3000
+
+uint32_t FrameHub::sLingerMs = DEFAULT_LINGER_MS;
+
+FrameHub::FrameHub(std::shared_ptr<CameraDevice> camDev)
+    : mCamDev(camDev)
+    , mStats(StageStats::get(camDev->getDeviceId()))
+    , mNextId(1)
+    , mSeq(0)
+    , mRunning(false)
+    , mIdleSince(0)
+{
+    log_debug("%s Device:%s", __func__, mCamDev->getDeviceId().c_str());
+}
+
+FrameHub::~FrameHub()
+{
+    std::lock_guard<std::mutex> locker(mThreadLock);
+    stopCapture();
+}
+
+int FrameHub::subscribe()
+{
+    std::lock_guard<std::mutex> locker(mThreadLock);
+    int id;
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        id = mNextId++;
+        mSubscribers[id] = 0;
+    }
+
+    if (!mRunning)
+        startCapture();
+
+    log_debug("%s Device:%s Subscriber:%d", __func__, mCamDev->getDeviceId().c_str(), id);
+    return id;
+}
+
+void FrameHub::unsubscribe(int id)
+{
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mSubscribers.erase(id))
+            return;
+        /* capture thread stops itself once idle for the linger time */
+        if (mSubscribers.empty())
+            mIdleSince = now_usec();
+    }
+
+    /* wake up the subscriber if it is waiting for a frame */
+    mFrameCond.notify_all();
+
+    log_debug("%s Device:%s Subscriber:%d", __func__, mCamDev->getDeviceId().c_str(), id);
+}
+
+CameraDevice::Status FrameHub::read(int id, std::shared_ptr<const Frame> &frame, int timeoutMs)
+{
+    std::unique_lock<std::mutex> lock(mLock);
+
+    if (mSubscribers.find(id) == mSubscribers.end())
+        return CameraDevice::Status::INVALID_ARGUMENT;
+
+    bool ready = mFrameCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, id] {
+        auto it = mSubscribers.find(id);
+        return !mRunning || it == mSubscribers.end() || (mLatest && mLatest->seq > it->second);
+    });
+    if (!ready)
+        return CameraDevice::Status::TIMED_OUT;
+
+    auto it = mSubscribers.find(id);
+    if (!mRunning || it == mSubscribers.end())
+        return CameraDevice::Status::INVALID_STATE;
+
+    frame = mLatest;
+    it->second = frame->seq;
+    return CameraDevice::Status::SUCCESS;
+}
+
+uint64_t FrameHub::getFrameCount() const
+{
+    return mSeq;
+}
+
+/* copy of the image and its layout, without the device buffer it was read in */
+static void copyFrame(Frame &copy, const Frame &frame)
+{
+    const CameraData &data = frame.data;
+    const uint8_t *buf = static_cast<const uint8_t *>(data.buf);
+
+    copy.storage.assign(buf, buf + data.bufSize);
+    copy.data.buf = copy.storage.data();
+    copy.data.bufSize = data.bufSize;
+    copy.data.sec = data.sec;
+    copy.data.nsec = data.nsec;
+    copy.data.width = data.width;
+    copy.data.height = data.height;
+    copy.data.format = data.format;
+    copy.data.planes = data.planes;
+    for (uint32_t i = 0; i < CAMERA_MAX_PLANES; i++)
+        copy.data.plane[i] = data.plane[i];
+    copy.data.seq = data.seq;
+    copy.data.timestamp = data.timestamp;
+    copy.seq = frame.seq;
+}
+
+std::shared_ptr<const Frame> FrameHub::getRepeatFrame()
+{
+    std::lock_guard<std::mutex> locker(mRepeatLock);
+    std::shared_ptr<const Frame> frame;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        frame = mLatest;
+    }
+    /* frames already copied out of the device are kept as they are */
+    if (!frame || !frame->data.release)
+        return frame;
+
+    std::shared_ptr<Frame> copy = std::make_shared<Frame>();
+    copyFrame(*copy, *frame);
+    {
+        /* same seq, not delivered again to the subscribers */
+        std::lock_guard<std::mutex> lock(mLock);
+        if (mLatest == frame)
+            mLatest = copy;
+    }
+
+    return copy;
+}
+
+void FrameHub::stop()
+{
+    std::lock_guard<std::mutex> locker(mThreadLock);
+    stopCapture();
+}
+
+void FrameHub::setInitCallback(std::function<int()> init)
+{
+    std::lock_guard<std::mutex> locker(mThreadLock);
+    mInit = init;
+}
+
+void FrameHub::setLingerTime(uint32_t lingerMs)
+{
+    sLingerMs = lingerMs;
+}
+
+int FrameHub::startCapture()
+{
+    log_info("%s::%s", typeid(this).name(), __func__);
+
+    /* capture thread that stopped on its own, device is stopped already */
+    if (mThread.joinable())
+        mThread.join();
+
+    if (mInit && mInit()) {
+        log_error("Error in initializing camera %s", mCamDev->getDeviceId().c_str());
+        return -1;
+    }
+
+    /* device may be running if started by someone else */
+    CameraDevice::Status ret = mCamDev->start();
+    if (ret != CameraDevice::Status::SUCCESS && ret != CameraDevice::Status::INVALID_STATE
+        && ret != CameraDevice::Status::NOT_SUPPORTED) {
+        log_error("Error in starting camera %s", mCamDev->getDeviceId().c_str());
+        return -1;
+    }
+
+    mRunning = true;
+    mThread = std::thread(&FrameHub::captureThread, this);
+    return 0;
+}
+
+void FrameHub::stopCapture()
+{
+    if (mRunning) {
+        log_info("%s::%s", typeid(this).name(), __func__);
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mRunning = false;
+        }
+        mFrameCond.notify_all();
+    }
+
+    if (mThread.joinable())
+        mThread.join();
+}
+
+/* called with mLock held */
+bool FrameHub::isIdle()
+{
+    return mSubscribers.empty() && (now_usec() - mIdleSince) >= sLingerMs * USEC_PER_MSEC;
+}
+
+void FrameHub::captureThread()
+{
+    uint32_t readErrors = 0;
+    uint32_t retryMs = READ_RETRY_MS;
+    usec_t stallStart = 0;
+
+    ThreadPolicy::apply(mCamDev->getDeviceId(), "cap");
+
+    while (mRunning) {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            if (isIdle()) {
+                log_info("No subscriber for camera %s, stop capture",
+                         mCamDev->getDeviceId().c_str());
+                mRunning = false;
+                break;
+            }
+        }
+
+        CameraData data;
+        usec_t start = now_usec();
+        CameraDevice::Status ret = mCamDev->read(data);
+        if (ret != CameraDevice::Status::SUCCESS || !data.buf || data.bufSize == 0) {
+            if (!readErrors) {
+                log_error("Camera %s returned no frame", mCamDev->getDeviceId().c_str());
+                stallStart = start;
+            }
+            readErrors++;
+            if (start - stallStart >= STALL_RESTART_MS * USEC_PER_MSEC) {
+                /* consumers get fallback frames meanwhile, see gst_frame_fallback() */
+                log_warning("Camera %s stuck for %ums, restart it",
+                            mCamDev->getDeviceId().c_str(), STALL_RESTART_MS);
+                mCamDev->stop();
+                if (mCamDev->start() != CameraDevice::Status::SUCCESS)
+                    log_error("Error in restarting camera %s", mCamDev->getDeviceId().c_str());
+                stallStart = now_usec();
+                retryMs = READ_RETRY_MS;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(retryMs));
+            retryMs = std::min(retryMs * 2, (uint32_t)READ_RETRY_MAX_MS);
+            continue;
+        }
+        if (readErrors)
+            log_info("Camera %s gives frames again after %u failed reads",
+                     mCamDev->getDeviceId().c_str(), readErrors);
+        readErrors = 0;
+        retryMs = READ_RETRY_MS;
+        mStats->record(StageStats::READ, now_usec() - start);
+        mStats->frame();
+
+        /* devices without a capture time are stamped as they are read */
+        if (!data.timestamp)
+            data.timestamp = now_usec() * NSEC_PER_USEC;
+        /* so are the devices that do not tell the format of their frames */
+        if (data.format == CameraParameters::PixelFormat::PIXEL_FORMAT_MIN)
+            mCamDev->getPixelFormat(data.format);
+
+        std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+        frame->data = std::move(data);
+        if (!frame->data.release) {
+            /* device buffer is reused on next read, keep a copy for the consumers */
+            uint8_t *buf = static_cast<uint8_t *>(frame->data.buf);
+            frame->storage.assign(buf, buf + frame->data.bufSize);
+            frame->data.buf = frame->storage.data();
+        }
+        frame->seq = ++mSeq;
+
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            mLatest = frame;
+        }
+        mFrameCond.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        /* a frame from an earlier session must not be given to a new subscriber */
+        mLatest.reset();
+    }
+
+    /* nobody reads the device anymore, let the sensor idle */
+    mCamDev->stop();
+}
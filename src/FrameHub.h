@@ -0,0 +1,144 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "CameraDevice.h"
+#include "StageStats.h"
+#include "util.h"
+
+/**
+ *  The Frame structure holds one image read from the camera device. The image data stays valid
+ *  for as long as a reference to the frame is held. It is either a copy owned by the frame or,
+ *  for devices that release their buffers explicitly, the device buffer itself.
+ */
+struct Frame {
+    Frame() {}
+    Frame(const Frame &) = delete;
+    Frame &operator=(const Frame &) = delete;
+
+    CameraData data;              /**< Image, given back to the device with the frame. */
+    uint64_t seq = 0;             /**< Sequence number assigned by the hub. */
+    std::vector<uint8_t> storage; /**< Image data, if copied from the device. */
+};
+
+/**
+ *  The FrameHub class reads the camera device from a single capture thread and distributes every
+ *  frame to all of its subscribers (RTSP clients, UDP stream, image and video capture). The camera
+ *  is read out once per frame regardless of the number of consumers.
+ *
+ *  The capture thread, and the camera device, run only while there is at least one subscriber.
+ *  The device is started for the first subscriber and stopped once the last one has been gone for
+ *  the linger time, so that short gaps (a client reconnecting) do not restart the sensor.
+ */
+class FrameHub {
+public:
+    FrameHub(std::shared_ptr<CameraDevice> camDev);
+    ~FrameHub();
+
+    /**
+     *  Register a new consumer of frames. Starts the capture thread if needed.
+     *
+     *  @return Subscriber Id to be used with read() and unsubscribe().
+     */
+    int subscribe();
+
+    /**
+     *  Unregister a consumer of frames. The capture thread and the camera device are stopped when
+     *  no new subscriber arrived within the linger time after the last one left.
+     *
+     *  @param[in] id Subscriber Id returned by subscribe().
+     */
+    void unsubscribe(int id);
+
+    /**
+     *  Get the next frame not yet delivered to the subscriber. A new subscriber gets the latest
+     *  frame straight away if one is available.
+     *
+     *  @param[in] id Subscriber Id returned by subscribe().
+     *  @param[out] frame Reference to the shared frame.
+     *  @param[in] timeoutMs Time to wait for a new frame in milliseconds.
+     *
+     *  @return Status of request.
+     */
+    CameraDevice::Status read(int id, std::shared_ptr<const Frame> &frame, int timeoutMs);
+
+    /**
+     *  Get the number of frames read from the camera device since creation.
+     *
+     *  @return Number of frames.
+     */
+    uint64_t getFrameCount() const;
+
+    /**
+     *  Get the last frame read, for the subscribers to repeat when the camera gives none. A frame
+     *  still in a device buffer is copied, once for all the subscribers, and the buffer goes back
+     *  to the device.
+     *
+     *  @return Frame, null if none was read since the capture started.
+     */
+    std::shared_ptr<const Frame> getRepeatFrame();
+
+    /**
+     *  Stop the capture thread and the camera device now, without waiting for the linger time.
+     */
+    void stop();
+
+    /**
+     *  Set the function run before the camera device is started, so that a device initialized on
+     *  first use is so before its first frame is read.
+     *
+     *  @param[in] init Returns 0 once the device is initialized, -1 on error.
+     */
+    void setInitCallback(std::function<int()> init);
+
+    /**
+     *  Set the time the camera device keeps running after the last subscriber left.
+     *
+     *  @param[in] lingerMs Time in milliseconds, 0 to stop at once.
+     */
+    static void setLingerTime(uint32_t lingerMs);
+
+private:
+    void captureThread();
+    int startCapture();
+    void stopCapture();
+    bool isIdle();
+    std::shared_ptr<CameraDevice> mCamDev;
+    StageStats *mStats;
+    std::mutex mLock;       /* Protects frame and subscriber state */
+    std::mutex mThreadLock; /* Serializes start/stop of capture thread */
+    std::mutex mRepeatLock; /* Serializes the copy of the frame to repeat */
+    std::condition_variable mFrameCond;
+    std::map<int, uint64_t> mSubscribers; /* Subscriber Id -> seq of last delivered frame */
+    int mNextId;
+    std::shared_ptr<const Frame> mLatest;
+    std::atomic<uint64_t> mSeq;
+    std::atomic<bool> mRunning;
+    usec_t mIdleSince; /* Time the last subscriber left */
+    std::thread mThread;
+    std::function<int()> mInit;
+    static uint32_t sLingerMs;
+};
@@ -0,0 +1,169 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "FramePool.h"
+#include "log.h"
+
+/* Size of the huge pages the pools are backed with */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+size_t FramePool::sMaxBytes = 0;
+bool FramePool::sHugePages = false;
+std::atomic<size_t> FramePool::sAllocated(0);
+
+static size_t alignUp(size_t size, size_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+FramePool::FramePool(const std::string &name, size_t frameSize)
+    : mName(name)
+    , mFrameSize(frameSize)
+    , mSlotSize(0)
+    , mBase(nullptr)
+    , mLength(0)
+    , mCount(0)
+{
+}
+
+FramePool::~FramePool()
+{
+    /* buffers hold a reference to the pool, all of them are back at this point */
+    if (mBase) {
+        munmap(mBase, mLength);
+        sAllocated -= mLength;
+    }
+}
+
+std::shared_ptr<FramePool> FramePool::create(const std::string &name, size_t frameSize,
+                                             uint32_t count)
+{
+    if (!frameSize || !count)
+        return nullptr;
+
+    std::shared_ptr<FramePool> pool(new FramePool(name, frameSize));
+    if (!pool->allocate(count))
+        return nullptr;
+
+    return pool;
+}
+
+bool FramePool::allocate(uint32_t count)
+{
+    mSlotSize = alignUp(mFrameSize, getpagesize());
+
+    if (sMaxBytes && (size_t)count * mSlotSize > sMaxBytes) {
+        uint32_t capped = sMaxBytes / mSlotSize;
+        if (!capped)
+            capped = 1;
+        log_warning("Frame pool %s: %u buffers over the memory cap, using %u", mName.c_str(),
+                    count, capped);
+        count = capped;
+    }
+
+    if (sHugePages) {
+        mLength = alignUp((size_t)count * mSlotSize, HUGE_PAGE_SIZE);
+        void *addr = mmap(nullptr, mLength, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (addr != MAP_FAILED) {
+            mBase = static_cast<uint8_t *>(addr);
+        } else {
+            log_info("Frame pool %s: no huge pages available, using normal pages",
+                     mName.c_str());
+        }
+    }
+
+    if (!mBase) {
+        mLength = (size_t)count * mSlotSize;
+        void *addr
+            = mmap(nullptr, mLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            log_error("Frame pool %s: unable to allocate %zu bytes", mName.c_str(), mLength);
+            mLength = 0;
+            return false;
+        }
+        mBase = static_cast<uint8_t *>(addr);
+    }
+
+    sAllocated += mLength;
+    mCount = count;
+    mFree.reserve(count);
+    for (uint32_t i = count; i > 0; i--)
+        mFree.push_back(i - 1);
+
+    log_debug("Frame pool %s: %u buffers of %zu bytes", mName.c_str(), mCount, mFrameSize);
+    return true;
+}
+
+std::shared_ptr<uint8_t> FramePool::acquire()
+{
+    uint32_t index;
+
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        if (mFree.empty())
+            return nullptr;
+        index = mFree.back();
+        mFree.pop_back();
+    }
+
+    /* the pool stays alive until the last of its buffers is released */
+    std::shared_ptr<FramePool> self = shared_from_this();
+    return std::shared_ptr<uint8_t>(mBase + index * mSlotSize,
+                                    [self, index](uint8_t *) { self->release(index); });
+}
+
+void FramePool::release(uint32_t index)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    mFree.push_back(index);
+}
+
+size_t FramePool::getFrameSize() const
+{
+    return mFrameSize;
+}
+
+uint32_t FramePool::getCount() const
+{
+    return mCount;
+}
+
+uint32_t FramePool::getFreeCount()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    return mFree.size();
+}
+
+void FramePool::setLimits(size_t maxBytes, bool hugePages)
+{
+    sMaxBytes = maxBytes;
+    sHugePages = hugePages;
+}
+
+size_t FramePool::getMaxBytes()
+{
+    return sMaxBytes;
+}
+
+size_t FramePool::getAllocatedBytes()
+{
+    return sAllocated;
+}
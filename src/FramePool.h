@@ -0,0 +1,116 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ *  The FramePool class holds a fixed set of frame buffers of one size for a camera device. The
+ *  buffers are page-aligned, taken from huge pages when enabled, and allocated once when the pool
+ *  is created, so capturing does not allocate. The memory of a pool is capped, which bounds the
+ *  resident frame memory of a camera.
+ *
+ *  A buffer is given out as a reference counted handle and goes back to the pool when the last
+ *  reference is dropped. Frames built on the handle pass to gstreamer by reference, the buffer is
+ *  reused once gstreamer and all other consumers have released the frame.
+ */
+class FramePool : public std::enable_shared_from_this<FramePool> {
+public:
+    ~FramePool();
+
+    /**
+     *  Create a pool of frame buffers.
+     *
+     *  @param[in] name Name of the pool, for logging.
+     *  @param[in] frameSize Size in bytes of a buffer.
+     *  @param[in] count Number of buffers, reduced to fit the memory cap.
+     *
+     *  @return Pool, nullptr if the memory could not be allocated.
+     */
+    static std::shared_ptr<FramePool> create(const std::string &name, size_t frameSize,
+                                             uint32_t count);
+
+    /**
+     *  Take a free buffer from the pool.
+     *
+     *  @return Handle of the buffer, nullptr if all the buffers are in use.
+     */
+    std::shared_ptr<uint8_t> acquire();
+
+    /**
+     *  Get the size in bytes of a buffer of the pool.
+     *
+     *  @return Size of a buffer.
+     */
+    size_t getFrameSize() const;
+
+    /**
+     *  Get the number of buffers of the pool.
+     *
+     *  @return Number of buffers.
+     */
+    uint32_t getCount() const;
+
+    /**
+     *  Get the number of buffers not in use.
+     *
+     *  @return Number of free buffers.
+     */
+    uint32_t getFreeCount();
+
+    /**
+     *  Set the memory cap and backing of the pools created afterwards.
+     *
+     *  @param[in] maxBytes Max memory in bytes of a pool, 0 for no cap.
+     *  @param[in] hugePages Take the memory from huge pages, if the system has some reserved.
+     */
+    static void setLimits(size_t maxBytes, bool hugePages);
+
+    /**
+     *  Get the memory cap of a pool.
+     *
+     *  @return Max memory in bytes of a pool, 0 for no cap.
+     */
+    static size_t getMaxBytes();
+
+    /**
+     *  Get the memory mapped by all the pools alive.
+     *
+     *  @return Memory in bytes.
+     */
+    static size_t getAllocatedBytes();
+
+private:
+    FramePool(const std::string &name, size_t frameSize);
+    bool allocate(uint32_t count);
+    void release(uint32_t index);
+    std::string mName;
+    size_t mFrameSize;
+    size_t mSlotSize; /* Buffer size rounded up to the alignment */
+    uint8_t *mBase;   /* Memory of all the buffers */
+    size_t mLength;
+    uint32_t mCount;
+    std::mutex mLock;
+    std::vector<uint32_t> mFree; /* Indices of the buffers not in use */
+    static size_t sMaxBytes;
+    static bool sHugePages;
+    static std::atomic<size_t> sAllocated;
+};
@@ -0,0 +1,114 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+
+#include "FramePusher.h"
+#include "ThreadPolicy.h"
+#include "log.h"
+
+/* Time without a frame before a fallback frame is pushed, late frames are waited for */
+#define DEFAULT_STALL_MS 500
+
+uint32_t FramePusher::sStallMs = DEFAULT_STALL_MS;
+
+FramePusher::FramePusher(const std::string &camera, std::function<void(int timeoutMs)> push)
+    : mCamera(camera)
+    , mPush(push)
+    , mWanted(false)
+    , mStop(false)
+    , mTimeoutMs(sStallMs)
+{
+}
+
+FramePusher::~FramePusher()
+{
+    stop();
+}
+
+void FramePusher::setFrameRate(uint32_t fps)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    mTimeoutMs = fps ? std::max(2000 / fps, sStallMs) : sStallMs;
+}
+
+void FramePusher::setStallTime(uint32_t ms)
+{
+    sStallMs = ms ? ms : DEFAULT_STALL_MS;
+}
+
+/* the thread is started on the first need-data, and again after a stop */
+void FramePusher::want()
+{
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mWanted = true;
+    }
+    mCond.notify_one();
+
+    /* stopping meanwhile, the pipeline is going down */
+    std::unique_lock<std::mutex> threadLocker(mThreadLock, std::try_to_lock);
+    if (!threadLocker.owns_lock() || mThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mStop = false;
+    }
+    mThread = std::thread(&FramePusher::pushThread, this);
+}
+
+void FramePusher::enough()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    mWanted = false;
+}
+
+void FramePusher::stop()
+{
+    std::lock_guard<std::mutex> threadLocker(mThreadLock);
+    if (!mThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> locker(mLock);
+        mStop = true;
+        mWanted = false;
+    }
+    mCond.notify_one();
+    mThread.join();
+}
+
+void FramePusher::pushThread()
+{
+    ThreadPolicy::apply(mCamera, "push");
+
+    while (true) {
+        int timeoutMs;
+        {
+            std::unique_lock<std::mutex> locker(mLock);
+            mCond.wait(locker, [this] { return mStop || mWanted; });
+            if (mStop)
+                break;
+            timeoutMs = mTimeoutMs;
+        }
+
+        mPush(timeoutMs);
+    }
+
+    log_debug("Frame pusher of %s stopped", mCamera.c_str());
+}
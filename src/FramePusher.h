@@ -0,0 +1,88 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ *  The FramePusher class feeds an appsrc from a thread of its own, so that the streaming thread
+ *  of the pipeline never waits on the camera. The appsrc signals only start and stop the pusher:
+ *  need-data wants frames, enough-data pauses it. The thread then pushes frames as the camera
+ *  gives them, paced by the camera.
+ *
+ *  The wait for a frame is bounded by the stall time, or twice the frame interval for slow
+ *  cameras. A camera running late keeps the stream waiting, one that stalls gets a fallback frame
+ *  pushed every wait instead of holding up the pipeline, see gst_frame_fallback().
+ */
+class FramePusher {
+public:
+    /**
+     *  @param[in] camera Device Id of the camera, the thread follows its thread policy.
+     *  @param[in] push Reads a frame, waiting at most the time given in milliseconds, and pushes
+     *             it or the fallback frame to the appsrc. Called on the pusher thread.
+     */
+    FramePusher(const std::string &camera, std::function<void(int timeoutMs)> push);
+    ~FramePusher();
+
+    /**
+     *  Set the frame rate of the camera, the wait for a frame is derived from it.
+     *
+     *  @param[in] fps Frames per second, 0 if unknown.
+     */
+    void setFrameRate(uint32_t fps);
+
+    /**
+     *  Set the time without a frame after which the camera is taken as stalled, for the pushers
+     *  set up afterwards.
+     *
+     *  @param[in] ms Time in milliseconds, 0 for the default.
+     */
+    static void setStallTime(uint32_t ms);
+
+    /**
+     *  Start pushing frames, from the need-data signal. Does not block.
+     */
+    void want();
+
+    /**
+     *  Stop pushing frames until wanted again, from the enough-data signal. Does not block.
+     */
+    void enough();
+
+    /**
+     *  Stop the thread and wait for it, before the appsrc goes. The pipeline must not block the
+     *  push anymore, so it is set to NULL first when its appsrc blocks on a full queue.
+     */
+    void stop();
+
+private:
+    void pushThread();
+    std::string mCamera;
+    std::function<void(int)> mPush;
+    std::mutex mLock; /* Protects mWanted and mStop */
+    std::condition_variable mCond;
+    bool mWanted;
+    bool mStop;
+    int mTimeoutMs;         /* Wait for a frame */
+    std::mutex mThreadLock; /* Serializes start and stop of the thread */
+    std::thread mThread;
+    static uint32_t sStallMs;
+};
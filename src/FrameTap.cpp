@@ -0,0 +1,210 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gst/app/gstappsink.h>
+
+#include "FrameTap.h"
+#include "log.h"
+
+/* Tapped data still queued when the consumer stalls, older data is dropped */
+#define RECORD_QUEUE_NS 2000000000
+
+static const char *sTapNames[] = {FRAME_TAP_STILL, FRAME_TAP_RECORD};
+
+std::mutex FrameTap::sLock;
+std::map<std::string, std::shared_ptr<FrameTap>> FrameTap::sTaps;
+
+static std::string getKey(const std::string &device, const std::string &tap)
+{
+    return device + "/" + tap;
+}
+
+FrameTap::FrameTap(GstElement *bin, GstElement *valve, GstElement *sink)
+    : mBin(bin)
+    , mValve(valve)
+    , mSink(sink)
+{
+}
+
+FrameTap::~FrameTap()
+{
+    close();
+    gst_object_unref(mValve);
+    gst_object_unref(mSink);
+}
+
+/*
+ * The branch must never block the live pipeline: the queue leaks, and the appsink does not wait
+ * for a preroll that the closed valve would never let through. A snapshot only needs the latest
+ * frame, a recording needs every buffer of the encoded stream unless the consumer stalls.
+ */
+std::string FrameTap::getPipeline(const std::string &tap)
+{
+    std::string queue = tap == FRAME_TAP_RECORD
+        ? "queue leaky=downstream max-size-buffers=0 max-size-bytes=0 max-size-time="
+            + std::to_string(RECORD_QUEUE_NS)
+        : "queue leaky=downstream max-size-buffers=1";
+    std::string sink = "appsink name=" + tap + "sink";
+    if (tap != FRAME_TAP_RECORD)
+        sink += " max-buffers=1 drop=true";
+
+    return "tee name=" + tap + "tee " + tap + "tee. ! " + queue + " ! valve name=" + tap
+        + "valve drop=true ! " + sink + " sync=false async=false " + tap + "tee. ! queue";
+}
+
+void FrameTap::attach(const std::string &device, GstElement *bin)
+{
+    for (const char *tap : sTapNames) {
+        GstElement *valve = gst_bin_get_by_name(GST_BIN(bin), (std::string(tap) + "valve").c_str());
+        GstElement *sink = gst_bin_get_by_name(GST_BIN(bin), (std::string(tap) + "sink").c_str());
+        if (!valve || !sink) {
+            if (valve)
+                gst_object_unref(valve);
+            if (sink)
+                gst_object_unref(sink);
+            continue;
+        }
+
+        std::lock_guard<std::mutex> locker(sLock);
+        std::shared_ptr<FrameTap> &entry = sTaps[getKey(device, tap)];
+        /* a consumer may still have the tap open from before the pipeline paused */
+        if (entry && entry->mBin == bin) {
+            gst_object_unref(valve);
+            gst_object_unref(sink);
+            continue;
+        }
+
+        log_debug("%s Device:%s Tap:%s", __func__, device.c_str(), tap);
+        entry = std::make_shared<FrameTap>(bin, valve, sink);
+    }
+}
+
+void FrameTap::detach(const std::string &device, GstElement *bin)
+{
+    std::lock_guard<std::mutex> locker(sLock);
+    for (const char *tap : sTapNames) {
+        auto it = sTaps.find(getKey(device, tap));
+        if (it == sTaps.end() || it->second->mBin != bin)
+            continue;
+
+        log_debug("%s Device:%s Tap:%s", __func__, device.c_str(), tap);
+        sTaps.erase(it);
+    }
+}
+
+std::shared_ptr<FrameTap> FrameTap::find(const std::string &device, const std::string &tap)
+{
+    std::lock_guard<std::mutex> locker(sLock);
+    auto it = sTaps.find(getKey(device, tap));
+    return it != sTaps.end() ? it->second : nullptr;
+}
+
+GstSample *FrameTap::pull(int timeoutMs)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    /* a frame let through for an earlier snapshot is not the next one */
+    GstSample *sample;
+    while ((sample = gst_app_sink_try_pull_sample(GST_APP_SINK(mSink), 0)))
+        gst_sample_unref(sample);
+
+    g_object_set(G_OBJECT(mValve), "drop", FALSE, NULL);
+    sample = gst_app_sink_try_pull_sample(GST_APP_SINK(mSink), timeoutMs * GST_MSECOND);
+    g_object_set(G_OBJECT(mValve), "drop", TRUE, NULL);
+
+    if (!sample)
+        log_error("Timeout waiting for a frame of the live pipeline");
+
+    return sample;
+}
+
+GstFlowReturn FrameTap::cbNewSample(GstElement *sink, gpointer user_data)
+{
+    FrameTap *obj = reinterpret_cast<FrameTap *>(user_data);
+
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (!sample)
+        return GST_FLOW_OK;
+
+    {
+        std::lock_guard<std::mutex> locker(obj->mCbLock);
+        if (obj->mCallback)
+            obj->mCallback(sample);
+    }
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+int FrameTap::open(std::function<void(GstSample *sample)> cb)
+{
+    {
+        std::lock_guard<std::mutex> locker(mCbLock);
+        if (mCallback)
+            return 1;
+        mCallback = cb;
+    }
+
+    g_object_set(G_OBJECT(mSink), "emit-signals", TRUE, NULL);
+    g_signal_connect(mSink, "new-sample", G_CALLBACK(cbNewSample), this);
+    g_object_set(G_OBJECT(mValve), "drop", FALSE, NULL);
+
+    return 0;
+}
+
+void FrameTap::close()
+{
+    {
+        std::lock_guard<std::mutex> locker(mCbLock);
+        if (!mCallback)
+            return;
+        mCallback = nullptr;
+    }
+
+    g_object_set(G_OBJECT(mValve), "drop", TRUE, NULL);
+    g_signal_handlers_disconnect_by_data(mSink, this);
+    g_object_set(G_OBJECT(mSink), "emit-signals", FALSE, NULL);
+}
+
+bool FrameTap::isOpen()
+{
+    std::lock_guard<std::mutex> locker(mCbLock);
+    return mCallback != nullptr;
+}
+
+GstCaps *FrameTap::getCaps()
+{
+    GstPad *pad = gst_element_get_static_pad(mSink, "sink");
+    if (!pad)
+        return nullptr;
+
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    gst_object_unref(pad);
+    return caps;
+}
+
+void FrameTap::requestKeyFrame()
+{
+    GstPad *pad = gst_element_get_static_pad(mSink, "sink");
+    if (!pad)
+        return;
+
+    GstStructure *s
+        = gst_structure_new("GstForceKeyUnit", "all-headers", G_TYPE_BOOLEAN, TRUE, NULL);
+    gst_pad_send_event(pad, gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM, s));
+    gst_object_unref(pad);
+}
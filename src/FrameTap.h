@@ -0,0 +1,140 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <functional>
+#include <gst/gst.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/* Raw camera frames, for still capture */
+#define FRAME_TAP_STILL "snap"
+/* Encoded stream, for recording */
+#define FRAME_TAP_RECORD "rec"
+
+/**
+ *  The FrameTap class gives consumers the data of a pipeline that is already running, for what
+ *  cannot or should not be done twice: opening a v4l2 camera, or encoding the camera frames. The
+ *  pipeline splits its data with a tee into a branch ending in a closed valve and an appsink. The
+ *  valve is only open while the data is taken, so the live pipeline is neither renegotiated nor
+ *  restarted and holds no extra buffers while nobody takes them.
+ *
+ *  A still tap is pulled one frame at a time. A record tap pushes every buffer to a callback
+ *  while open.
+ *
+ *  Taps are registered per camera device while their pipeline is playing.
+ */
+class FrameTap {
+public:
+    FrameTap(GstElement *bin, GstElement *valve, GstElement *sink);
+    ~FrameTap();
+
+    /**
+     *  Get the pipeline description of the tee and its tap branch, to be put right after the
+     *  element whose data is tapped. The description ends in the branch carrying on the live
+     *  pipeline.
+     *
+     *  @param[in] tap FRAME_TAP_STILL or FRAME_TAP_RECORD.
+     *
+     *  @return Pipeline description.
+     */
+    static std::string getPipeline(const std::string &tap = FRAME_TAP_STILL);
+
+    /**
+     *  Register the taps of a playing pipeline for the camera device. Pipelines without a tap
+     *  branch are ignored.
+     *
+     *  @param[in] device Camera device Id.
+     *  @param[in] bin Pipeline with the tap branches.
+     */
+    static void attach(const std::string &device, GstElement *bin);
+
+    /**
+     *  Unregister the taps of a pipeline that stops playing.
+     *
+     *  @param[in] device Camera device Id.
+     *  @param[in] bin Pipeline given to attach().
+     */
+    static void detach(const std::string &device, GstElement *bin);
+
+    /**
+     *  Get a tap of the pipeline playing the camera device.
+     *
+     *  @param[in] device Camera device Id.
+     *  @param[in] tap FRAME_TAP_STILL or FRAME_TAP_RECORD.
+     *
+     *  @return The tap, nullptr if no pipeline with the tap is playing the camera device.
+     */
+    static std::shared_ptr<FrameTap> find(const std::string &device,
+                                          const std::string &tap = FRAME_TAP_STILL);
+
+    /**
+     *  Take the next frame of the pipeline.
+     *
+     *  @param[in] timeoutMs Time to wait for the frame in milliseconds.
+     *
+     *  @return Sample with the frame and its caps, nullptr on timeout.
+     */
+    GstSample *pull(int timeoutMs);
+
+    /**
+     *  Start giving every buffer of the pipeline to a callback, from the streaming thread. The
+     *  sample is unreferenced once the callback returns.
+     *
+     *  @param[in] cb Callback taking the samples.
+     *
+     *  @return 0 on success, 1 if the tap is open for another consumer already.
+     */
+    int open(std::function<void(GstSample *sample)> cb);
+
+    /**
+     *  Stop giving buffers to the callback.
+     */
+    void close();
+
+    /**
+     *  Check whether a consumer takes the buffers of the tap.
+     *
+     *  @return true if open.
+     */
+    bool isOpen();
+
+    /**
+     *  Ask the encoder upstream of the tap for a key frame with the stream headers.
+     */
+    void requestKeyFrame();
+
+    /**
+     *  Get the caps of the tapped data.
+     *
+     *  @return Caps to be unreferenced by the caller, nullptr if not negotiated yet.
+     */
+    GstCaps *getCaps();
+
+private:
+    static GstFlowReturn cbNewSample(GstElement *sink, gpointer user_data);
+    static std::mutex sLock; /* Protects sTaps */
+    static std::map<std::string, std::shared_ptr<FrameTap>> sTaps; /* By device and tap */
+    GstElement *mBin; /* Only compared, the tap holds no reference to the pipeline */
+    GstElement *mValve;
+    GstElement *mSink;
+    std::mutex mLock;     /* Serializes snapshots */
+    std::mutex mCbLock;   /* Protects mCallback */
+    std::function<void(GstSample *sample)> mCallback;
+};
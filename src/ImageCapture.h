@@ -17,6 +17,7 @@
  */
 #pragma once
 #include <atomic>
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <thread>
@@ -27,6 +28,7 @@ struct ImageSettings {
     int width;
     int height;
     CameraParameters::IMAGE_FILE_FORMAT fileFormat;
+    int quality; /* Encoder quality 1-100, 0 for the encoder default */
 };
 
 class ImageCapture {
@@ -43,12 +45,20 @@ public:
 
     virtual int init() = 0;
     virtual int uninit() = 0;
-    virtual int start(int num, int interval, std::function<void(int result, int seq_num)> cb) = 0;
+    /* Result of a shot, timestamp is the monotonic capture time of the frame in nano sec */
+    typedef std::function<void(int result, int seq_num, uint64_t timestamp)> result_callback_t;
+
+    /* interval between shots in ms, 0 with a count takes a burst at the camera frame rate */
+    virtual int start(int interval, int count, result_callback_t cb) = 0;
     virtual int stop() = 0;
     virtual int getState() = 0;
     virtual int setInterval(int interval) = 0;
     virtual int getInterval() = 0;
     virtual int setResolution(int imgWidth, int imgHeight) = 0;
     virtual int setFormat(CameraParameters::IMAGE_FILE_FORMAT imgFormat) = 0;
+    virtual int setQuality(int quality) = 0;
     virtual int setLocation(const std::string imgPath) = 0;
+    /* keep the capture ready for the next shot, while the camera is in still mode */
+    virtual int prepare() { return 0; }
+    virtual void release() {}
 };
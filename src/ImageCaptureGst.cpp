@@ -15,32 +15,67 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
 #include <assert.h>
+#include <errno.h>
+#include <chrono>
+#include <cstdio>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
 #include <gst/gst.h>
 #include <sstream>
 #include <unistd.h>
 #include <vector>
 
 #include "CameraParameters.h"
+#include "EncoderRegistry.h"
+#include "FileWriter.h"
+#include "FrameTap.h"
 #include "ImageCaptureGst.h"
+#include "RawBurstFile.h"
+#include "ThreadPolicy.h"
+#include "gst_frame.h"
 
 #include "log.h"
+#include "util.h"
 
 #define DEFAULT_IMAGE_FILE_FORMAT CameraParameters::IMAGE_FILE_JPEG
 #define DEFAULT_FILE_PATH "/tmp/"
 #define V4L2_DEVICE_PREFIX "/dev/"
+#define FRAME_TIMEOUT_MS 1000
+#define DEFAULT_ENCODE_WORKERS 2
+#define DEFAULT_RAW_FILE_SIZE (512ULL * 1024 * 1024)
+/* Shots taken but waiting for an encode worker, per worker */
+#define SHOTS_PER_WORKER 2
 
-int ImageCaptureGst::imgCount = 0;
+std::atomic<int> ImageCaptureGst::imgCount(0);
+uint32_t ImageCaptureGst::sEncodeWorkers = DEFAULT_ENCODE_WORKERS;
+uint64_t ImageCaptureGst::sRawFileSize = DEFAULT_RAW_FILE_SIZE;
 
-ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev)
+ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev,
+                                 std::shared_ptr<FrameHub> frameHub)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
+    , mSubscriber(0)
+    , mHold(false)
     , mState(STATE_IDLE)
     , mWidth(0)
     , mHeight(0)
     , mFormat(DEFAULT_IMAGE_FILE_FORMAT)
+    , mQuality(0)
     , mInterval(0)
     , mPath(DEFAULT_FILE_PATH)
     , mResultCB(nullptr)
+    , mEncoders(sEncodeWorkers)
+    , mShotsDone(false)
+    , mEncodeError(false)
+    , mPendingWrites(0)
+    , mWriter(FileWriter::getInstance())
+    , mEncodeCount(0)
+    , mEncodeTotalUs(0)
+    , mEncodeMaxUs(0)
+    , mSource(nullptr)
+    , mSourceSink(nullptr)
 {
     log_info("%s Device:%s", __func__, mCamDev->getDeviceId().c_str());
 
@@ -49,15 +84,30 @@ ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev)
 }
 
 ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev,
-                                 struct ImageSettings &imgSetting)
+                                 struct ImageSettings &imgSetting,
+                                 std::shared_ptr<FrameHub> frameHub)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
+    , mSubscriber(0)
+    , mHold(false)
     , mState(STATE_IDLE)
     , mWidth(imgSetting.width)
     , mHeight(imgSetting.height)
     , mFormat(imgSetting.fileFormat)
+    , mQuality(imgSetting.quality)
     , mInterval(0)
     , mPath(DEFAULT_FILE_PATH)
     , mResultCB(nullptr)
+    , mEncoders(sEncodeWorkers)
+    , mShotsDone(false)
+    , mEncodeError(false)
+    , mPendingWrites(0)
+    , mWriter(FileWriter::getInstance())
+    , mEncodeCount(0)
+    , mEncodeTotalUs(0)
+    , mEncodeMaxUs(0)
+    , mSource(nullptr)
+    , mSourceSink(nullptr)
 {
     log_info("%s Device:%s with settings", __func__, mCamDev->getDeviceId().c_str());
 
@@ -67,7 +117,9 @@ ImageCaptureGst::ImageCaptureGst(std::shared_ptr<CameraDevice> camDev,
 
 ImageCaptureGst::~ImageCaptureGst()
 {
+    mHold = false;
     stop();
+    destroyEncoders();
 }
 
 int ImageCaptureGst::init()
@@ -92,11 +144,14 @@ int ImageCaptureGst::uninit()
         return -1;
     }
 
+    mHold = false;
+    closeStill();
+    destroyEncoders();
     setState(STATE_IDLE);
     return 0;
 }
 
-int ImageCaptureGst::start(int interval, int count, std::function<void(int result, int seq_num)> cb)
+int ImageCaptureGst::start(int interval, int count, result_callback_t cb)
 {
     int ret = 0;
     log_info("%s::%s interval:%d count:%d", typeid(this).name(), __func__, interval, count);
@@ -118,12 +173,25 @@ int ImageCaptureGst::start(int interval, int count, std::function<void(int resul
     setState(STATE_RUN);
 
     if (count == 1) {
-        // There will be no stop call
+        // There will be no stop call, the result comes once the image is written
         ret = click();
         setState(STATE_INIT);
-        if (mResultCB)
-            mResultCB(ret, 1);
+        if (ret)
+            reportResult(ret, 1, 0);
+        logEncodeStats();
     } else {
+        // frame source stays open for the series, shots only wait for the next frame
+        if (openStill()) {
+            setState(STATE_INIT);
+            return -1;
+        }
+        // shots are taken on one thread and encoded on the others, raw frames are copied as taken
+        mShotsDone = false;
+        mEncodeError = false;
+        if (mFormat != CameraParameters::IMAGE_FILE_RAW) {
+            for (StillEncoder &encoder : mEncoders)
+                mWorkers.emplace_back(&ImageCaptureGst::encodeThread, this, &encoder);
+        }
         // create a thread to capture images
         mThread = std::thread(&ImageCaptureGst::captureThread, this, count);
     }
@@ -137,9 +205,19 @@ int ImageCaptureGst::stop()
 
     setState(STATE_INIT);
 
+    // wake up the capture thread waiting for the next shot
+    {
+        std::lock_guard<std::mutex> locker(mWaitLock);
+    }
+    mWaitCond.notify_all();
+
     if (mThread.joinable())
         mThread.join();
 
+    // results of the images still being written refer to this object
+    waitWrites();
+
+    closeStill();
     return 0;
 }
 
@@ -228,6 +306,18 @@ int ImageCaptureGst::setFormat(CameraParameters::IMAGE_FILE_FORMAT imgFormat)
     return 0;
 }
 
+int ImageCaptureGst::setQuality(int quality)
+{
+    if (quality < 0 || quality > 100) {
+        log_error("Invalid image quality: %d", quality);
+        return 1;
+    }
+
+    mQuality = quality;
+
+    return 0;
+}
+
 int ImageCaptureGst::setLocation(const std::string imgPath)
 {
     // TODO::Check if the path is writeable/valid
@@ -237,69 +327,275 @@ int ImageCaptureGst::setLocation(const std::string imgPath)
     return 0;
 }
 
+/*
+ * Shots are scheduled on the monotonic clock, at start + n * interval, so the timing does not
+ * drift with the time taken by a shot. Slots missed because the frame came late are skipped. An
+ * interval of 0 with a count is a burst, every frame of the sensor is taken until the count.
+ */
 void ImageCaptureGst::captureThread(int num)
 {
-    log_debug("captureThread num:%d int:%d", num, mInterval);
-    int ret = -1;
+    log_debug("captureThread num:%d int:%dms", num, mInterval);
+    ThreadPolicy::apply(mCamDev->getDeviceId(), "img");
     int count = num;
     int seq_num = 0;
-    while (mState == STATE_RUN) {
-        ret = click();
-        if (getState() != STATE_RUN)
-            continue;
+    usec_t next = now_usec();
+    while (getState() == STATE_RUN) {
+        if (mEncodeError) {
+            log_error("Error in Image Capture");
+            setState(STATE_ERROR);
+            break;
+        }
 
-        seq_num++;
-        if (mResultCB)
-            mResultCB(ret, seq_num);
+        GstCaps *caps = nullptr;
+        uint64_t timestamp = 0;
+        GstBuffer *frame = grabFrame(&caps, timestamp);
+        if (getState() != STATE_RUN) {
+            if (frame)
+                gst_buffer_unref(frame);
+            if (caps)
+                gst_caps_unref(caps);
+            break;
+        }
 
-        if (ret) {
+        seq_num++;
+        if (!frame) {
+            reportResult(1, seq_num, 0);
             log_error("Error in Image Capture");
             setState(STATE_ERROR);
-            continue;
+            break;
+        }
+        if (mFormat == CameraParameters::IMAGE_FILE_RAW) {
+            Shot shot = {frame, caps, seq_num, {}, timestamp};
+            if (writeRaw(shot, count > 0 ? count : 0)) {
+                reportResult(1, seq_num, timestamp);
+                mEncodeError = true;
+            } else {
+                reportResult(0, seq_num, timestamp);
+            }
+            gst_buffer_unref(frame);
+            if (caps)
+                gst_caps_unref(caps);
+        } else {
+            queueShot(frame, caps, seq_num, timestamp);
         }
 
         // Check if the capture is periodic or count(w/wo interval) based
-        if (count <= 0) {
-            if (mInterval > 0)
-                sleep(mInterval);
-            else
-                break;
-        } else {
+        if (count > 0) {
             log_debug("Current Count : %d", count);
-            count--;
-            if (count == 0)
-                setState(STATE_INIT);
-            else {
-                if (mInterval > 0)
-                    sleep(mInterval);
-            }
+            if (--count == 0)
+                break;
+        }
+
+        if (mInterval == 0)
+            continue;
+
+        uint64_t interval = (uint64_t)mInterval * USEC_PER_MSEC;
+        next += interval;
+        usec_t now = now_usec();
+        if (next <= now) {
+            uint64_t missed = (now - next) / interval + 1;
+            log_warning("Image capture late, %llu shots skipped", (unsigned long long)missed);
+            next += missed * interval;
+        }
+
+        std::unique_lock<std::mutex> locker(mWaitLock);
+        mWaitCond.wait_for(locker, std::chrono::microseconds(next - now),
+                           [this] { return getState() != STATE_RUN; });
+    }
+
+    // shots taken are encoded, also when stopped
+    {
+        std::lock_guard<std::mutex> locker(mShotLock);
+        mShotsDone = true;
+    }
+    mShotCond.notify_all();
+    for (std::thread &worker : mWorkers)
+        worker.join();
+    mWorkers.clear();
+    waitWrites();
+    if (mRaw.close())
+        mEncodeError = true;
+
+    if (mEncodeError)
+        setState(STATE_ERROR);
+    else if (getState() == STATE_RUN)
+        setState(STATE_INIT);
+
+    logEncodeStats();
+
+    // no stop call may come after the last shot, let go of the camera now
+    closeStill();
+}
+
+/* time from pushing a frame to getting its encoded image, to compare the encoders */
+void ImageCaptureGst::logEncodeStats()
+{
+    uint32_t count = mEncodeCount.exchange(0);
+    uint64_t total = mEncodeTotalUs.exchange(0);
+    uint64_t max = mEncodeMaxUs.exchange(0);
+    if (!count)
+        return;
+
+    log_info("Image encoder %s: %u images, encode time avg %llu us max %llu us",
+             getGstImgEncName(mFormat).c_str(), count, (unsigned long long)(total / count),
+             (unsigned long long)max);
+}
+
+/* The queue is bounded so frames, and the camera buffers they hold, do not pile up */
+void ImageCaptureGst::queueShot(GstBuffer *frame, GstCaps *caps, int seq, uint64_t timestamp)
+{
+    Shot shot = {frame, caps, seq,
+                 mPath + "img_" + std::to_string(++imgCount) + "." + getImgExt(mFormat),
+                 timestamp};
+
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> locker(mShotLock);
+        if (mShots.size() < mEncoders.size() * SHOTS_PER_WORKER) {
+            mShots.push_back(shot);
+            queued = true;
+        }
+    }
+
+    if (queued) {
+        mShotCond.notify_one();
+        return;
+    }
+
+    log_warning("Image encoders busy, shot %d dropped", seq);
+    gst_buffer_unref(frame);
+    if (caps)
+        gst_caps_unref(caps);
+    reportResult(1, seq, timestamp);
+}
+
+void ImageCaptureGst::encodeThread(StillEncoder *encoder)
+{
+    ThreadPolicy::apply(mCamDev->getDeviceId(), "imgenc");
+
+    while (true) {
+        Shot shot;
+        {
+            std::unique_lock<std::mutex> locker(mShotLock);
+            mShotCond.wait(locker, [this] { return mShotsDone || !mShots.empty(); });
+            if (mShots.empty())
+                break;
+            shot = mShots.front();
+            mShots.pop_front();
+        }
+
+        int ret = createEncoder(*encoder);
+        if (!ret)
+            ret = encodeFrame(*encoder, shot);
+        gst_buffer_unref(shot.frame);
+        if (shot.caps)
+            gst_caps_unref(shot.caps);
+
+        // success is reported by the writer
+        if (ret) {
+            mEncodeError = true;
+            reportResult(ret, shot.seq, shot.timestamp);
         }
     }
 }
 
+/* workers report from their own threads, one result at a time */
+void ImageCaptureGst::reportResult(int result, int seq, uint64_t timestamp)
+{
+    std::lock_guard<std::mutex> locker(mResultLock);
+    if (mResultCB)
+        mResultCB(result, seq, timestamp);
+}
+
 int ImageCaptureGst::click()
 {
     log_debug("%s", __func__);
 
-    int ret = 0;
-    if (mCamDev->isGstV4l2Src())
-        ret = createV4l2Pipeline();
-    else
-        ret = createAppsrcPipeline();
+    /* a single shot opens the frame source for itself, a series keeps it open */
+    bool session = mSource != nullptr || mSubscriber || mTap;
+    if (!session && openStill())
+        return 1;
+
+    int ret = 1;
+    Shot shot = {nullptr, nullptr, 1, {}, 0};
+    shot.frame = grabFrame(&shot.caps, shot.timestamp);
+    if (shot.frame && mFormat == CameraParameters::IMAGE_FILE_RAW) {
+        ret = writeRaw(shot, 1);
+        if (mRaw.close())
+            ret = 1;
+        if (!ret)
+            reportResult(0, 1, shot.timestamp);
+        gst_buffer_unref(shot.frame);
+    } else if (shot.frame) {
+        shot.path = mPath + "img_" + std::to_string(++imgCount) + "." + getImgExt(mFormat);
+        ret = encodeFrame(mEncoders[0], shot);
+        gst_buffer_unref(shot.frame);
+    }
+    if (shot.caps)
+        gst_caps_unref(shot.caps);
+
+    if (!session)
+        closeStill();
+
     return ret;
 }
 
+/* Image encoders in order of preference, the first one present in the registry is used */
+static const struct ImageEncoder {
+    CameraParameters::IMAGE_FILE_FORMAT format;
+    const char *element; /* Encoder element */
+    const char *convert; /* Conversion of the camera frames to a format the encoder takes */
+    const char *quality; /* Property setting the quality 1-100, nullptr if none */
+} sImageEncoders[] = {
+    /* GPU conversion and encoding, the frame is uploaded once */
+    {CameraParameters::IMAGE_FILE_JPEG, "vaapijpegenc", "vaapipostproc", "quality"},
+    {CameraParameters::IMAGE_FILE_JPEG, "v4l2jpegenc", "videoconvert", nullptr},
+    {CameraParameters::IMAGE_FILE_JPEG, "jpegenc", nullptr, "quality"},
+};
+
+static std::vector<bool> probeImageEncoders()
+{
+    std::vector<bool> available;
+
+    for (const ImageEncoder &enc : sImageEncoders) {
+        GstElementFactory *factory = gst_element_factory_find(enc.element);
+        available.push_back(factory != nullptr);
+        if (factory) {
+            gst_object_unref(factory);
+            log_info("Image encoder available: %s", enc.element);
+        }
+    }
+
+    return available;
+}
+
+/* The registry is probed once, on first use after gst_init() */
+static const ImageEncoder *getImageEncoder(int format)
+{
+    static const std::vector<bool> available = probeImageEncoders();
+
+    for (size_t i = 0; i < ARRAY_SIZE(sImageEncoders); i++) {
+        if (available[i] && sImageEncoders[i].format == format)
+            return &sImageEncoders[i];
+    }
+
+    return nullptr;
+}
+
 std::string ImageCaptureGst::getGstImgEncName(int format)
 {
-    switch (format) {
-    case CameraParameters::IMAGE_FILE_JPEG:
-        return "jpegenc";
-        break;
-    case CameraParameters::IMAGE_FILE_PNG:
-    case CameraParameters::IMAGE_FILE_RAW:
-    default:
+    const ImageEncoder *enc = getImageEncoder(format);
+    if (!enc)
         return {};
-    }
+
+    std::string name;
+    if (enc->convert)
+        name = std::string(enc->convert) + " ! ";
+    name += enc->element;
+    if (enc->quality && mQuality > 0)
+        name += std::string(" ") + enc->quality + "=" + std::to_string(mQuality);
+
+    return name;
 }
 
 std::string ImageCaptureGst::getGstPixFormat(CameraParameters::PixelFormat pixFormat)
@@ -308,6 +604,9 @@ std::string ImageCaptureGst::getGstPixFormat(CameraParameters::PixelFormat pixFo
     case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
         return "RGB";
         break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return "GRAY8";
+        break;
     default:
         return {};
     }
@@ -326,69 +625,39 @@ std::string ImageCaptureGst::getImgExt(int format)
     }
 }
 
-std::string ImageCaptureGst::getGstPipelineNameV4l2()
+GstBuffer *ImageCaptureGst::readFrame(GstElement *appsrc, uint64_t &timestamp)
 {
-    std::string device = mCamDev->getDeviceId();
-    if (device.empty())
-        return {};
-
-    device.insert(0, V4L2_DEVICE_PREFIX);
-
-    std::string enc = getGstImgEncName(mFormat);
-    if (enc.empty())
-        return {};
-
-    std::string ext = getImgExt(mFormat);
-    if (ext.empty())
-        return {};
+    GstBuffer *buffer = nullptr;
+    CameraDevice::Status status;
+    if (mFrameHub) {
+        // Frame is shared with other consumers, release it when gstreamer is done
+        std::shared_ptr<const Frame> frame;
+        status = mFrameHub->read(mSubscriber, frame, FRAME_TIMEOUT_MS);
+        if (status == CameraDevice::Status::SUCCESS) {
+            buffer = gst_frame_wrap(frame, appsrc);
+            timestamp = frame->data.timestamp;
+        }
+    }
 
-    std::stringstream filter;
-    filter << "video/x-raw, ";
-    if (mWidth > 0 && mHeight > 0) {
-        filter << " width=" << std::to_string(mWidth) << ", height=" << std::to_string(mHeight);
+    if (!buffer) {
+        log_error("No data from camera device");
+        // TODO :: return error or feed blank frames?
     }
 
-    std::stringstream ss;
-    ss << "v4l2src device=" << device + " num-buffers=1"
-       << " ! " << filter.str() << " ! " << enc << " ! "
-       << "filesink location=" << mPath + "img_" << std::to_string(++imgCount) << "." + ext;
-    log_debug("Gstreamer pipeline: %s", ss.str().c_str());
-    return ss.str();
+    return buffer;
 }
 
-int ImageCaptureGst::createV4l2Pipeline()
+/* Wait for a sample on an appsink, and for errors of its pipeline */
+static GstSample *pullSample(GstElement *pipeline, GstElement *appsink)
 {
-    log_info("%s", __func__);
-
-    int ret = 0;
-    GError *error = nullptr;
-    GstElement *pipeline;
-    GstMessage *msg;
-    GstBus *bus;
-    std::string pipeline_str = getGstPipelineNameV4l2();
-    if (pipeline_str.empty()) {
-        log_error("Pipeline String error");
-        return 1;
-    }
-    pipeline = gst_parse_launch(pipeline_str.c_str(), &error);
-    if (!pipeline) {
-        log_error("Error creating pipeline");
-        if (error)
-            g_clear_error(&error);
-        return 1;
-    }
-    gst_element_set_state(pipeline, GST_STATE_PLAYING);
-    bus = gst_element_get_bus(pipeline);
-    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
-                                     (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
-    switch (GST_MESSAGE_TYPE(msg)) {
-    case GST_MESSAGE_EOS: {
-        log_debug("EOS\n");
-        log_info("Image Captured Successfully");
-        ret = 0;
-        break;
-    }
-    case GST_MESSAGE_ERROR: {
+    GstSample *sample
+        = gst_app_sink_try_pull_sample(GST_APP_SINK(appsink), FRAME_TIMEOUT_MS * GST_MSECOND);
+    if (sample)
+        return sample;
+
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+    if (msg) {
         GError *err = NULL; /* error to show to users                 */
         gchar *dbg = NULL;  /* additional debug string for developers */
 
@@ -401,159 +670,438 @@ int ImageCaptureGst::createV4l2Pipeline()
             log_error("[Debug details: %s]", dbg);
             g_free(dbg);
         }
-        ret = 1;
-        break;
-    }
-    default:
-        log_error("Unexpected message of type %d", GST_MESSAGE_TYPE(msg));
-        ret = 1;
-        break;
+        gst_message_unref(msg);
+    } else {
+        log_error("Timeout waiting for image data");
     }
-
-    gst_message_unref(msg);
     gst_object_unref(bus);
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    gst_object_unref(pipeline);
 
-    return ret;
+    return nullptr;
 }
 
-static void cbNeedData(GstElement *appsrc, guint unused_size, ImageCaptureGst *obj)
+static GstElement *launchPipeline(const std::string &desc, GstElement **appsrc,
+                                  GstElement **appsink)
 {
-    log_debug("%s", __func__);
+    log_debug("Gstreamer pipeline: %s", desc.c_str());
 
-    GstFlowReturn ret;
-    CameraData data;
-    CameraDevice::Status status = obj->mCamDev->read(data);
-    if (status != CameraDevice::Status::SUCCESS) {
-        log_error("No data from camera device");
-        // TODO :: return error or feed blank frames?
-    }
-    gsize size = data.bufSize; // width*height*3/2/1.5
-    gsize offset = 0;
-    gsize maxsize = size;
-    GstBuffer *buffer = gst_buffer_new_wrapped_full((GstMemoryFlags)0, data.buf, maxsize, offset,
-                                                    size, NULL, NULL);
-    assert(buffer);
-
-    g_signal_emit_by_name(appsrc, "push-buffer", buffer, &ret);
-    gst_buffer_unref(buffer);
-    if (ret != GST_FLOW_OK) {
-        /* some error */
-        log_error("Error in sending data to gst pipeline");
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(desc.c_str(), &error);
+    if (!pipeline) {
+        log_error("Error creating pipeline: %s", error ? error->message : "");
+        if (error)
+            g_clear_error(&error);
+        return nullptr;
     }
-    g_signal_emit_by_name(appsrc, "end-of-stream", &ret);
-    // gst_app_src_end_of_stream (appsrc);
+    if (error)
+        g_clear_error(&error);
+
+    if (appsrc)
+        *appsrc = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    *appsink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    return pipeline;
 }
 
-int ImageCaptureGst::createAppsrcPipeline()
+static void destroyPipeline(GstElement *&pipeline, GstElement *&appsrc, GstElement *&appsink)
 {
-    log_info("%s", __func__);
+    if (!pipeline)
+        return;
 
-    int ret = 0;
-    GstElement *pipeline, *appsrc, *enc, *imagesink;
-    GstMessage *msg;
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    if (appsrc)
+        gst_object_unref(appsrc);
+    gst_object_unref(appsink);
+    gst_object_unref(pipeline);
+    pipeline = nullptr;
+    appsrc = nullptr;
+    appsink = nullptr;
+}
 
+/* MJPEG frames of v4l2src are decoded before being rescaled or encoded to an other format */
+std::string ImageCaptureGst::getJpegDecoder()
+{
+    if (!mCamDev->isGstV4l2Src()
+        || mCamPixFormat != CameraParameters::PixelFormat::PIXEL_FORMAT_MJPEG)
+        return {};
+
+    return EncoderRegistry::getDecoderName(CameraParameters::VIDEO_CODING_MJPEG);
+}
+
+/*
+ * The encoder pipeline stays PLAYING between shots, a shot only pushes one frame through it. It
+ * is rebuilt only when the image settings change.
+ */
+int ImageCaptureGst::createEncoder(StillEncoder &encoder)
+{
     std::string encname = getGstImgEncName(mFormat);
-    std::string fmt = getGstPixFormat(mCamPixFormat);
     std::string ext = getImgExt(mFormat);
-    if (encname.empty() || fmt.empty() || ext.empty()) {
+    if (encname.empty() || ext.empty()) {
         log_error("Error in fetching gst info");
         return 1;
     }
 
-    /* setup pipeline */
-    pipeline = gst_pipeline_new("pipeline");
-    appsrc = gst_element_factory_make("appsrc", "source");
-    enc = gst_element_factory_make(encname.c_str(), "enc");
-    imagesink = gst_element_factory_make("filesink", "imagesink");
+    /* frames of v4l2src are sized by the camera already, those of a live pipeline by the stream */
+    std::string scale;
+    if (mTap && mWidth > 0 && mHeight > 0) {
+        scale = "videoscale ! video/x-raw, width=" + std::to_string(mWidth)
+            + ", height=" + std::to_string(mHeight) + " ! ";
+    } else if (!mCamDev->isGstV4l2Src() && mWidth > 0 && mHeight > 0) {
+        std::string fmt = getGstPixFormat(mCamPixFormat);
+        if (fmt.empty()) {
+            log_error("Error in fetching gst info");
+            return 1;
+        }
+        // TODO :: Rescaling has issues and outputs corrupted data, need to fix
+        scale = "videoscale ! video/x-raw, format=" + fmt + ", width=" + std::to_string(mWidth)
+            + ", height=" + std::to_string(mHeight) + " ! ";
+    }
+
+    std::string decoder = getJpegDecoder();
+    if (!decoder.empty())
+        decoder += " ! ";
+
+    std::string desc
+        = "appsrc name=src ! " + decoder + scale + encname + " ! appsink name=sink sync=false";
+    if (encoder.pipeline && desc == encoder.desc)
+        return 0;
+
+    destroyPipeline(encoder.pipeline, encoder.src, encoder.sink);
 
-    if (!pipeline || !appsrc || !enc || !imagesink) {
-        log_error("Gst element could not be created. Exiting");
+    encoder.pipeline = launchPipeline(desc, &encoder.src, &encoder.sink);
+    if (!encoder.pipeline)
         return 1;
+    encoder.desc = desc;
+
+    /* a frame at a time, not live so that frames are encoded as soon as they are pushed */
+    g_object_set(G_OBJECT(encoder.src), "stream-type", 0, "format", GST_FORMAT_TIME, NULL);
+    if (!mCamDev->isGstV4l2Src()) {
+        std::string fmt = getGstPixFormat(mCamPixFormat);
+        GstCaps *caps
+            = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, fmt.c_str(), "width",
+                                  G_TYPE_INT, mCamWidth, "height", G_TYPE_INT, mCamHeight,
+                                  "framerate", GST_TYPE_FRACTION, 0, 1, NULL);
+        gst_app_src_set_caps(GST_APP_SRC(encoder.src), caps);
+        gst_caps_unref(caps);
     }
 
-    std::string filepath = mPath + "img_" + std::to_string(++imgCount) + "." + ext;
-    g_object_set(G_OBJECT(imagesink), "location", filepath.c_str(), NULL);
+    log_info("Still pipeline Format:%d, width:%d, Height:%d, Encoder:%s", mCamPixFormat, mWidth,
+             mHeight, encname.c_str());
+    return 0;
+}
 
-    log_info("Pipeline Format:%d, width:%d, Height:%d", mCamPixFormat, mWidth, mHeight);
-    log_info("Pipeline File:%s", filepath.c_str());
+void ImageCaptureGst::destroyEncoders()
+{
+    for (StillEncoder &encoder : mEncoders) {
+        destroyPipeline(encoder.pipeline, encoder.src, encoder.sink);
+        encoder.desc.clear();
+    }
+}
 
-    /* setup */
-    g_object_set(G_OBJECT(appsrc), "caps",
-                 gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, fmt.c_str(), "width",
-                                     G_TYPE_INT, mCamWidth, "height", G_TYPE_INT, mCamHeight,
-                                     "framerate", GST_TYPE_FRACTION, 0, 1, NULL),
-                 NULL);
+void ImageCaptureGst::setEncodeWorkers(uint32_t count)
+{
+    sEncodeWorkers = count > 0 ? count : 1;
+}
 
-    // Resize
-    if (mWidth > 0 && mHeight > 0) {
-        // Add videoscale to resize
-        // TODO :: Rescaling has issues and outputs corrupted data, need to fix
-        GstElement *videoscale = gst_element_factory_make("videoscale", "videoscale");
-        GstElement *filter = gst_element_factory_make("capsfilter", "resize");
-        if (!videoscale || !filter) {
-            log_error("Gst element could not be created. Exiting.\n");
-            // free resources
+void ImageCaptureGst::setRawFileSize(uint64_t bytes)
+{
+    sRawFileSize = bytes > 0 ? bytes : DEFAULT_RAW_FILE_SIZE;
+}
+
+/* Open the frame source, it is kept open for a series of shots so a shot takes the next frame */
+int ImageCaptureGst::openStill()
+{
+    /* the stream of a camera encoding on board has no frames to take a still from */
+    CameraParameters::VIDEO_CODING_FORMAT codec;
+    if (mCamDev->getEncodedFormat(codec) == CameraDevice::Status::SUCCESS) {
+        log_error("No still capture from camera %s, it encodes on board",
+                  mCamDev->getDeviceId().c_str());
+        return 1;
+    }
+
+    /* a v4l2 camera streaming or recording already is busy, take the frames of that pipeline */
+    if (mCamDev->isGstV4l2Src() && !mSource && !mTap) {
+        mTap = FrameTap::find(mCamDev->getDeviceId());
+        if (mTap)
+            log_info("Still capture from the live pipeline of %s", mCamDev->getDeviceId().c_str());
+    }
+
+    /* frames from the hub are timestamped on the first encoder, raw frames need none */
+    if (mFormat != CameraParameters::IMAGE_FILE_RAW && createEncoder(mEncoders[0]))
+        return 1;
+
+    if (mTap)
+        return 0;
+
+    if (!mCamDev->isGstV4l2Src()) {
+        if (!mFrameHub) {
+            log_error("No frame source for camera %s", mCamDev->getDeviceId().c_str());
             return 1;
         }
+        if (!mSubscriber)
+            mSubscriber = mFrameHub->subscribe();
+        return 0;
+    }
 
-        g_object_set(filter, "caps", gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING,
-                                                         fmt.c_str(), "width", G_TYPE_INT, mWidth,
-                                                         "height", G_TYPE_INT, mHeight, NULL),
-                     NULL);
+    if (mSource)
+        return 0;
 
-        gst_bin_add_many(GST_BIN(pipeline), appsrc, videoscale, filter, enc, imagesink, NULL);
-        gst_element_link_many(appsrc, videoscale, filter, enc, imagesink, NULL);
-    } else {
-        gst_bin_add_many(GST_BIN(pipeline), appsrc, enc, imagesink, NULL);
-        gst_element_link_many(appsrc, enc, imagesink, NULL);
+    /* only the latest frame is held, older ones are dropped as the sensor runs */
+    std::stringstream ss;
+    ss << "v4l2src device=" << V4L2_DEVICE_PREFIX << mCamDev->getDeviceId() << " ! "
+       << (getJpegDecoder().empty() ? "video/x-raw" : "image/jpeg");
+    if (mWidth > 0 && mHeight > 0)
+        ss << ", width=" << mWidth << ", height=" << mHeight;
+    ss << " ! appsink name=sink max-buffers=1 drop=true sync=false";
+
+    mSource = launchPipeline(ss.str(), nullptr, &mSourceSink);
+    return mSource ? 0 : 1;
+}
+
+void ImageCaptureGst::closeStill()
+{
+    /* the sensor keeps running for the next shot */
+    if (mFrameHub && mSubscriber && !mHold) {
+        mFrameHub->unsubscribe(mSubscriber);
+        mSubscriber = 0;
     }
-    /* setup appsrc */
-    g_object_set(G_OBJECT(appsrc), "stream-type", 0, // GST_APP_STREAM_TYPE_STREAM
-                 "format", GST_FORMAT_TIME, "is-live", TRUE, NULL);
-    g_signal_connect(appsrc, "need-data", G_CALLBACK(cbNeedData), this);
+    mTap.reset();
 
-    /* play */
-    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GstElement *none = nullptr;
+    destroyPipeline(mSource, none, mSourceSink);
+}
 
-    /* add watch for messages */
-    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
-    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
-                                     (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
-    switch (GST_MESSAGE_TYPE(msg)) {
-    case GST_MESSAGE_EOS: {
-        log_info("EOS\n");
-        ret = 0;
-        break;
+/*
+ * Get ready for shots in still mode: the encoder is built and, for cameras read through the frame
+ * hub, the hub keeps the sensor streaming between shots. A v4l2 camera is not held open, its
+ * node is needed by the stream and recording pipeline that may start meanwhile.
+ */
+int ImageCaptureGst::prepare()
+{
+    if (getState() != STATE_INIT) {
+        log_error("Invalid State : %d", getState());
+        return -1;
     }
-    case GST_MESSAGE_ERROR: {
-        GError *err = NULL; /* error to show to users                 */
-        gchar *dbg = NULL;  /* additional debug string for developers */
 
-        gst_message_parse_error(msg, &err, &dbg);
-        if (err) {
-            log_error("ERROR: %s\n", err->message);
-            g_error_free(err);
+    mHold = true;
+    if (mFormat != CameraParameters::IMAGE_FILE_RAW && createEncoder(mEncoders[0]))
+        return 1;
+
+    if (!mCamDev->isGstV4l2Src() && mFrameHub && !mSubscriber)
+        mSubscriber = mFrameHub->subscribe();
+
+    return 0;
+}
+
+void ImageCaptureGst::release()
+{
+    mHold = false;
+    if (getState() == STATE_INIT)
+        closeStill();
+}
+
+/* Take the next frame of the camera, with its caps if they are not known up front */
+GstBuffer *ImageCaptureGst::grabFrame(GstCaps **caps, uint64_t &timestamp)
+{
+    if (!mSource && !mTap)
+        return readFrame(mEncoders[0].src, timestamp);
+
+    GstSample *sample = mTap ? mTap->pull(FRAME_TIMEOUT_MS) : pullSample(mSource, mSourceSink);
+    if (!sample)
+        return nullptr;
+
+    GstBuffer *buffer = gst_buffer_ref(gst_sample_get_buffer(sample));
+    /* frames of the stream pipeline are taken as they come out of the tap */
+    timestamp = mSource ? gst_frame_get_timestamp(buffer, mSource) : now_usec() * NSEC_PER_USEC;
+    *caps = gst_caps_ref(gst_sample_get_caps(sample));
+    gst_sample_unref(sample);
+
+    return buffer;
+}
+
+/* A JPEG frame of the camera is already the image asked for, unless it has to be rescaled */
+bool ImageCaptureGst::isPassthrough(const Shot &shot) const
+{
+    if (!shot.caps || mFormat != CameraParameters::IMAGE_FILE_JPEG || gst_caps_is_empty(shot.caps))
+        return false;
+
+    const GstStructure *st = gst_caps_get_structure(shot.caps, 0);
+    if (!gst_structure_has_name(st, "image/jpeg"))
+        return false;
+
+    if (mWidth == 0 || mHeight == 0)
+        return true;
+
+    int width = 0, height = 0;
+    return gst_structure_get_int(st, "width", &width)
+        && gst_structure_get_int(st, "height", &height) && (uint32_t)width == mWidth
+        && (uint32_t)height == mHeight;
+}
+
+int ImageCaptureGst::encodeFrame(StillEncoder &encoder, const Shot &shot)
+{
+    if (isPassthrough(shot)) {
+        log_debug("Image %d saved as captured", shot.seq);
+        return writeImage(shot, gst_sample_new(shot.frame, shot.caps, nullptr, nullptr));
+    }
+
+    if (shot.caps) {
+        GstCaps *current = gst_app_src_get_caps(GST_APP_SRC(encoder.src));
+        if (!current || !gst_caps_is_equal(current, shot.caps))
+            gst_app_src_set_caps(GST_APP_SRC(encoder.src), shot.caps);
+        if (current)
+            gst_caps_unref(current);
+    }
+
+    /* an image that came too late for an earlier shot must not be taken for this one */
+    GstSample *stale;
+    while ((stale = gst_app_sink_try_pull_sample(GST_APP_SINK(encoder.sink), 0)))
+        gst_sample_unref(stale);
+
+    usec_t start = now_usec();
+    if (gst_app_src_push_buffer(GST_APP_SRC(encoder.src), gst_buffer_ref(shot.frame))
+        != GST_FLOW_OK) {
+        log_error("Error in sending data to gst pipeline");
+        return 1;
+    }
+
+    GstSample *sample = pullSample(encoder.pipeline, encoder.sink);
+    if (!sample)
+        return 1;
+
+    uint64_t elapsed = now_usec() - start;
+    log_debug("Image %d encoded in %llu us", shot.seq, (unsigned long long)elapsed);
+    mEncodeCount++;
+    mEncodeTotalUs += elapsed;
+    uint64_t max = mEncodeMaxUs;
+    while (elapsed > max && !mEncodeMaxUs.compare_exchange_weak(max, elapsed))
+        ;
+
+    return writeImage(shot, sample);
+}
+
+/* The image is written by the writer thread, the sample is held until then */
+int ImageCaptureGst::writeImage(const Shot &shot, GstSample *sample)
+{
+    const std::string &filepath = shot.path;
+    int seq = shot.seq;
+    uint64_t timestamp = shot.timestamp;
+    GstBuffer *image = gst_sample_get_buffer(sample);
+    GstMapInfo *map = new GstMapInfo;
+    if (!gst_buffer_map(image, map, GST_MAP_READ)) {
+        log_error("Unable to map image");
+        gst_sample_unref(sample);
+        delete map;
+        return 1;
+    }
+
+    {
+        std::lock_guard<std::mutex> locker(mWriteLock);
+        mPendingWrites++;
+    }
+
+    mWriter->write(filepath, map->data, map->size,
+                   [this, filepath, sample, map, seq, timestamp](int ret) {
+        gst_buffer_unmap(gst_sample_get_buffer(sample), map);
+        gst_sample_unref(sample);
+        delete map;
+
+        if (ret) {
+            log_error("Unable to write image %s", filepath.c_str());
+            mEncodeError = true;
+        } else {
+            log_info("Image Captured Successfully: %s", filepath.c_str());
         }
-        if (dbg) {
-            log_error("[Debug details: %s]\n", dbg);
-            g_free(dbg);
+        reportResult(ret ? 1 : 0, seq, timestamp);
+
+        {
+            std::lock_guard<std::mutex> locker(mWriteLock);
+            mPendingWrites--;
         }
-        ret = 1;
-        break;
+        mWriteCond.notify_all();
+    });
+
+    return 0;
+}
+
+void ImageCaptureGst::waitWrites()
+{
+    std::unique_lock<std::mutex> locker(mWriteLock);
+    mWriteCond.wait(locker, [this] { return mPendingWrites == 0; });
+}
+
+/* Caps of the frames of a shot, for the frames of the raw file to be read back */
+std::string ImageCaptureGst::getRawFormat(const Shot &shot)
+{
+    if (shot.caps) {
+        gchar *str = gst_caps_to_string(shot.caps);
+        std::string format = str;
+        g_free(str);
+        return format;
     }
-    default:
-        log_error("Unexpected message of type %d", GST_MESSAGE_TYPE(msg));
-        ret = 1;
-        break;
+
+    GstVideoMeta *meta = gst_buffer_get_video_meta(shot.frame);
+    if (meta)
+        return std::string("video/x-raw, format=") + gst_video_format_to_string(meta->format)
+            + ", width=" + std::to_string(meta->width) + ", height=" + std::to_string(meta->height);
+
+    return "video/x-raw, format=" + getGstPixFormat(mCamPixFormat)
+        + ", width=" + std::to_string(mCamWidth) + ", height=" + std::to_string(mCamHeight);
+}
+
+/*
+ * A file is sized for the frames left in the series, up to sRawFileSize: a series without count,
+ * or one too long for a file, rolls over to a new file once one is full.
+ */
+int ImageCaptureGst::openRaw(const Shot &shot, size_t frameSize, uint32_t frames)
+{
+    uint64_t maxFrames = std::max<uint64_t>(1, sRawFileSize / frameSize);
+    if (!frames || frames > maxFrames)
+        frames = maxFrames;
+
+    std::string path = mPath + "img_" + std::to_string(++imgCount) + "." + getImgExt(mFormat);
+    if (mRaw.open(path, getRawFormat(shot), frameSize, frames))
+        return 1;
+
+    /* padded lines of the frames from the hub are kept, the layout is in the header */
+    GstVideoMeta *meta = gst_buffer_get_video_meta(shot.frame);
+    if (meta)
+        mRaw.setPlanes(meta->n_planes, meta->offset, meta->stride);
+
+    return 0;
+}
+
+/*
+ * Raw frames skip the encoders and the writer thread: the frame is copied from the camera buffer
+ * into the mapped file as it is taken, the file is synced once when closed.
+ */
+int ImageCaptureGst::writeRaw(const Shot &shot, uint32_t frames)
+{
+    GstMapInfo map;
+    if (!gst_buffer_map(shot.frame, &map, GST_MAP_READ)) {
+        log_error("Unable to map image");
+        return 1;
     }
 
-    /* clean up */
-    gst_message_unref(msg);
-    gst_object_unref(bus);
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    gst_object_unref(GST_OBJECT(pipeline));
+    int ret = 0;
+    if (!mRaw.isOpen())
+        ret = openRaw(shot, map.size, frames);
+    if (!ret) {
+        ret = mRaw.append(map.data, map.size, shot.timestamp, shot.seq);
+        if (ret == -ENOSPC) {
+            mRaw.close();
+            ret = openRaw(shot, map.size, frames);
+            if (!ret)
+                ret = mRaw.append(map.data, map.size, shot.timestamp, shot.seq);
+        }
+    }
+    gst_buffer_unmap(shot.frame, &map);
 
-    return ret;
+    if (ret) {
+        log_error("Unable to write raw image %d", shot.seq);
+        return 1;
+    }
+
+    log_debug("Raw image %d written to %s", shot.seq, mRaw.getPath().c_str());
+    return 0;
 }
@@ -16,50 +16,124 @@
  * limitations under the License.
  */
 #pragma once
+#include <condition_variable>
+#include <deque>
+#include <gst/gst.h>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "CameraDevice.h"
+#include "FileWriter.h"
+#include "FrameHub.h"
+#include "FrameTap.h"
 #include "ImageCapture.h"
+#include "RawBurstFile.h"
 
 class ImageCaptureGst final : public ImageCapture {
 public:
-    ImageCaptureGst(std::shared_ptr<CameraDevice> camDev);
-    ImageCaptureGst(std::shared_ptr<CameraDevice> camDev, struct ImageSettings &imgSetting);
+    ImageCaptureGst(std::shared_ptr<CameraDevice> camDev,
+                    std::shared_ptr<FrameHub> frameHub = nullptr);
+    ImageCaptureGst(std::shared_ptr<CameraDevice> camDev, struct ImageSettings &imgSetting,
+                    std::shared_ptr<FrameHub> frameHub = nullptr);
     ~ImageCaptureGst();
 
     int init();
     int uninit();
-    int start(int interval, int count, std::function<void(int result, int seq_num)> cb);
+    int start(int interval, int count, result_callback_t cb);
     int stop();
     int getState();
     int setInterval(int interval);
     int getInterval();
     int setResolution(int imgWidth, int imgHeight);
     int setFormat(CameraParameters::IMAGE_FILE_FORMAT imgFormat);
+    int setQuality(int quality);
     int setLocation(const std::string imgPath);
+    int prepare();
+    void release();
+    GstBuffer *readFrame(GstElement *appsrc, uint64_t &timestamp);
+    static void setEncodeWorkers(uint32_t count);
+    static uint32_t getEncodeWorkers() { return sEncodeWorkers; }
+    static void setRawFileSize(uint64_t bytes);
     std::shared_ptr<CameraDevice> mCamDev;
 
 private:
-    static int imgCount;
+    /* Encoder pipeline of a worker, kept PLAYING between shots */
+    struct StillEncoder {
+        GstElement *pipeline = nullptr;
+        GstElement *src = nullptr;
+        GstElement *sink = nullptr;
+        std::string desc; /* Pipeline description, to rebuild it on setting change */
+    };
+    /* Frame taken by the capture thread, waiting for a worker to encode it */
+    struct Shot {
+        GstBuffer *frame;
+        GstCaps *caps; /* Caps of the frame, nullptr if those of the camera */
+        int seq;
+        std::string path;
+        uint64_t timestamp; /* Monotonic capture time in nano sec */
+    };
+    static std::atomic<int> imgCount;
+    static uint32_t sEncodeWorkers;
+    static uint64_t sRawFileSize; /* Max size of a raw file of a series without count */
     int setState(int state);
     int click();
     void captureThread(int num);
-    int createV4l2Pipeline();
+    void encodeThread(StillEncoder *encoder);
+    void queueShot(GstBuffer *frame, GstCaps *caps, int seq, uint64_t timestamp);
+    void reportResult(int result, int seq, uint64_t timestamp);
+    void logEncodeStats();
     std::string getGstImgEncName(int format);
     std::string getGstPixFormat(CameraParameters::PixelFormat pixFormat);
     std::string getImgExt(int format);
-    std::string getGstPipelineNameV4l2();
-    int createAppsrcPipeline();
+    std::string getJpegDecoder();
+    int createEncoder(StillEncoder &encoder);
+    void destroyEncoders();
+    int openStill();
+    void closeStill();
+    GstBuffer *grabFrame(GstCaps **caps, uint64_t &timestamp);
+    int encodeFrame(StillEncoder &encoder, const Shot &shot);
+    bool isPassthrough(const Shot &shot) const;
+    int writeImage(const Shot &shot, GstSample *sample);
+    int writeRaw(const Shot &shot, uint32_t frames);
+    int openRaw(const Shot &shot, size_t frameSize, uint32_t frames);
+    std::string getRawFormat(const Shot &shot);
+    void waitWrites();
+    std::shared_ptr<FrameHub> mFrameHub;
+    int mSubscriber;
+    bool mHold; /* Frame source kept between shots, in still mode */
     std::string mDevice;
     std::atomic<int> mState;
     uint32_t mWidth;                             /* Image Width*/
     uint32_t mHeight;                            /* Image Height*/
     CameraParameters::IMAGE_FILE_FORMAT mFormat; /* Image File Format*/
-    uint32_t mInterval;                          /* Image Capture interval */
+    int mQuality;                                /* Encoder quality 1-100, 0 for default */
+    uint32_t mInterval;                          /* Image Capture interval in ms */
     std::string mPath;                           /* Image File Destination Path*/
     uint32_t mCamWidth;                          /* Camera Frame Width*/
     uint32_t mCamHeight;                         /* Camera Frame Height*/
     CameraParameters::PixelFormat mCamPixFormat; /* Camera Frame Pixel Format*/
-    std::function<void(int result, int seq_num)> mResultCB;
+    result_callback_t mResultCB;
     std::thread mThread;
+    std::mutex mWaitLock; /* Wakes up the capture thread waiting for the next shot on stop */
+    std::condition_variable mWaitCond;
+    std::vector<StillEncoder> mEncoders; /* One per encode worker */
+    std::vector<std::thread> mWorkers;
+    std::mutex mShotLock; /* Protects mShots and mShotsDone */
+    std::condition_variable mShotCond;
+    std::deque<Shot> mShots;
+    bool mShotsDone;                /* No more shots coming for the workers */
+    std::atomic<bool> mEncodeError; /* A worker failed to encode or write an image */
+    std::mutex mResultLock;         /* Serializes the result callbacks */
+    std::mutex mWriteLock;          /* Protects mPendingWrites */
+    std::condition_variable mWriteCond;
+    uint32_t mPendingWrites; /* Images queued to the writer, not yet on storage */
+    std::shared_ptr<FileWriter> mWriter;
+    std::atomic<uint32_t> mEncodeCount; /* Encode time of the images since last logged */
+    std::atomic<uint64_t> mEncodeTotalUs;
+    std::atomic<uint64_t> mEncodeMaxUs;
+    GstElement *mSource;       /* Frames of v4l2src cameras, open during a series of shots */
+    GstElement *mSourceSink;
+    std::shared_ptr<FrameTap> mTap; /* Live pipeline of the camera, instead of mSource */
+    RawBurstFile mRaw; /* File of the raw frames of the series, in IMAGE_FILE_RAW format */
 };
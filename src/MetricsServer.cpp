@@ -0,0 +1,381 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "MetricsServer.h"
+#include "log.h"
+
+/* Requests are a single GET line and a few headers, anything bigger is not a scrape */
+#define MAX_REQUEST_SIZE 4096
+#define LISTEN_BACKLOG 4
+
+/* One connection, closed once the page is written */
+class MetricsServer::Client : public Pollable {
+public:
+    Client(MetricsServer *server, int fd)
+        : _server(server)
+        , _written(0)
+        , _done(false)
+    {
+        _fd = fd;
+    }
+
+    ~Client()
+    {
+        monitor_read(false);
+        monitor_write(false);
+        ::close(_fd);
+    }
+
+    bool isDone() const { return _done; }
+
+protected:
+    /* Watched edge-triggered, the socket is read until empty */
+    bool _can_read() override
+    {
+        char buf[512];
+
+        while (true) {
+            ssize_t r = ::read(_fd, buf, sizeof(buf));
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0 && errno == EAGAIN)
+                return true;
+            if (r <= 0) {
+                _finish();
+                return false;
+            }
+
+            _request.append(buf, r);
+            if (_request.find("\r\n\r\n") != std::string::npos
+                || _request.find("\n\n") != std::string::npos)
+                break;
+            if (_request.size() > MAX_REQUEST_SIZE) {
+                _respond("413 Request Entity Too Large", {});
+                return false;
+            }
+        }
+
+        if (_request.compare(0, 4, "GET ")) {
+            _respond("405 Method Not Allowed", {});
+            return false;
+        }
+
+        std::string body;
+        _server->_collect(body);
+        _respond("200 OK", body);
+        return false;
+    }
+
+    bool _can_write() override { return _write(); }
+
+private:
+    void _respond(const char *status, const std::string &body)
+    {
+        char header[160];
+        snprintf(header, sizeof(header),
+                 "HTTP/1.0 %s\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %zu\r\n"
+                 "Connection: close\r\n\r\n",
+                 status, body.size());
+        _response = header;
+        _response += body;
+
+        /* the socket buffer takes most pages at once, wait for room otherwise */
+        if (_write())
+            monitor_write(true);
+    }
+
+    /* returns true while there is more to write */
+    bool _write()
+    {
+        while (_written < _response.size()) {
+            ssize_t r = ::send(_fd, _response.data() + _written, _response.size() - _written,
+                               MSG_NOSIGNAL);
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r < 0 && errno == EAGAIN)
+                return true;
+            if (r < 0) {
+                log_debug("Metrics client gone: %m");
+                break;
+            }
+            _written += r;
+        }
+
+        _finish();
+        return false;
+    }
+
+    void _finish()
+    {
+        /* the peer sees the end of the page, the socket is closed when reaped */
+        shutdown(_fd, SHUT_RDWR);
+        _done = true;
+    }
+
+    MetricsServer *_server;
+    std::string _request;
+    std::string _response;
+    size_t _written;
+    bool _done;
+};
+
+MetricsServer::MetricsServer()
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop();
+}
+
+int MetricsServer::listen(const char *addr, unsigned long port)
+{
+    struct sockaddr_in sockaddr = {};
+
+    stop();
+
+    _fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd < 0) {
+        log_error("Could not create metrics socket (%m)");
+        return -1;
+    }
+
+    int reuse = 1;
+    setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_port = htons(port);
+    if (inet_pton(AF_INET, addr, &sockaddr.sin_addr) != 1) {
+        log_error("Invalid metrics address %s", addr);
+        goto fail;
+    }
+
+    if (bind(_fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) < 0
+        || ::listen(_fd, LISTEN_BACKLOG) < 0) {
+        log_error("Could not listen for metrics on %s:%lu (%m)", addr, port);
+        goto fail;
+    }
+
+    log_info("Metrics served on http://%s:%lu/metrics", addr, port);
+    monitor_read(true);
+    return 0;
+
+fail:
+    ::close(_fd);
+    _fd = -1;
+    return -1;
+}
+
+int MetricsServer::listen(const char *path)
+{
+    struct sockaddr_un sockaddr = {};
+
+    stop();
+
+    if (strlen(path) >= sizeof(sockaddr.sun_path)) {
+        log_error("Metrics socket path too long: %s", path);
+        return -1;
+    }
+
+    _fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_fd < 0) {
+        log_error("Could not create metrics socket (%m)");
+        return -1;
+    }
+
+    sockaddr.sun_family = AF_UNIX;
+    strcpy(sockaddr.sun_path, path);
+    unlink(path);
+
+    if (bind(_fd, (struct sockaddr *)&sockaddr, sizeof(sockaddr)) < 0
+        || ::listen(_fd, LISTEN_BACKLOG) < 0) {
+        log_error("Could not listen for metrics on %s (%m)", path);
+        ::close(_fd);
+        _fd = -1;
+        return -1;
+    }
+
+    _socket_path = path;
+    log_info("Metrics served on unix:%s", path);
+    monitor_read(true);
+    return 0;
+}
+
+void MetricsServer::stop()
+{
+    _clients.clear();
+
+    if (_fd < 0)
+        return;
+
+    monitor_read(false);
+    ::close(_fd);
+    _fd = -1;
+
+    if (!_socket_path.empty()) {
+        unlink(_socket_path.c_str());
+        _socket_path.clear();
+    }
+}
+
+void MetricsServer::addCollector(std::function<void(std::string &out)> collector)
+{
+    _collectors.push_back(collector);
+}
+
+/* clients can not be deleted from their own callbacks, they go on the next accept */
+void MetricsServer::_reap()
+{
+    _clients.remove_if([](const std::unique_ptr<Client> &c) { return c->isDone(); });
+}
+
+/* Watched edge-triggered, connections are accepted until there is none left */
+bool MetricsServer::_can_read()
+{
+    _reap();
+
+    while (true) {
+        int fd = accept4(_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN)
+                log_error("Could not accept metrics connection (%m)");
+            return true;
+        }
+
+        _clients.emplace_back(new Client(this, fd));
+        _clients.back()->monitor_read(true);
+    }
+}
+
+void MetricsServer::_collect(std::string &out)
+{
+    for (auto &collector : _collectors)
+        collector(out);
+
+    _collectThreads(out);
+}
+
+/* CPU time of each thread of the process, as accounted by the kernel */
+void MetricsServer::_collectThreads(std::string &out)
+{
+    DIR *dir = opendir("/proc/self/task");
+    if (!dir)
+        return;
+
+    long ticks = sysconf(_SC_CLK_TCK);
+    if (ticks <= 0)
+        ticks = 100;
+
+    appendHeader(out, "dcm_thread_cpu_seconds_total", "counter",
+                 "CPU time spent by each thread of the daemon.");
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        char path[64], stat[512];
+        snprintf(path, sizeof(path), "/proc/self/task/%s/stat", entry->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        ssize_t len = read(fd, stat, sizeof(stat) - 1);
+        close(fd);
+        if (len <= 0)
+            continue;
+        stat[len] = '\0';
+
+        /* tid (comm) state ppid ..., comm may hold spaces and parentheses */
+        char *open_paren = strchr(stat, '(');
+        char *close_paren = strrchr(stat, ')');
+        if (!open_paren || !close_paren || close_paren < open_paren)
+            continue;
+
+        unsigned long long utime, stime;
+        if (sscanf(close_paren + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                   &utime, &stime)
+            != 2)
+            continue;
+
+        std::string comm(open_paren + 1, close_paren);
+        std::string labels = "thread=\"" + escapeLabel(comm) + "\",tid=\"" + entry->d_name + "\"";
+        appendSample(out, "dcm_thread_cpu_seconds_total", labels, (double)(utime + stime) / ticks);
+    }
+
+    closedir(dir);
+}
+
+void MetricsServer::appendHeader(std::string &out, const char *name, const char *type,
+                                 const char *help)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void MetricsServer::appendSample(std::string &out, const char *name, const std::string &labels,
+                                 double value)
+{
+    char buf[32];
+
+    out += name;
+    if (!labels.empty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    snprintf(buf, sizeof(buf), " %.15g\n", value);
+    out += buf;
+}
+
+std::string MetricsServer::escapeLabel(const std::string &value)
+{
+    std::string ret;
+
+    for (char c : value) {
+        if (c == '\\' || c == '"')
+            ret += '\\';
+        if (c == '\n') {
+            ret += "\\n";
+            continue;
+        }
+        ret += c;
+    }
+
+    return ret;
+}
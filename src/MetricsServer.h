@@ -0,0 +1,114 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pollable.h"
+
+struct MetricsSettings {
+    std::string address = "127.0.0.1"; // Address the TCP port is bound to
+    int port = 0;                       // TCP port, 0 for none
+    std::string socketPath;             // Unix socket, used instead of the TCP port if set
+};
+
+/**
+ *  The MetricsServer class answers HTTP GET requests on a local TCP port or Unix socket with the
+ *  metrics of the daemon in the Prometheus text format. Metrics are gathered from the collectors
+ *  on the mainloop at each request, nothing is computed while nobody scrapes.
+ *
+ *  Every request gets the whole page and the connection is closed after it, as allowed by
+ *  HTTP/1.0, so a scrape costs one accept, one read and a few writes.
+ */
+class MetricsServer : public Pollable {
+public:
+    MetricsServer();
+    ~MetricsServer();
+
+    /**
+     *  Listen on a TCP port.
+     *
+     *  @param[in] addr Address to bind to, use the loopback one to keep metrics local.
+     *  @param[in] port TCP port.
+     *
+     *  @return 0 on success, -1 on error.
+     */
+    int listen(const char *addr, unsigned long port);
+
+    /**
+     *  Listen on a Unix stream socket.
+     *
+     *  @param[in] path Path of the socket, an existing socket file is replaced.
+     *
+     *  @return 0 on success, -1 on error.
+     */
+    int listen(const char *path);
+
+    void stop();
+
+    /**
+     *  Add a source of metrics.
+     *
+     *  @param[in] collector Called on the mainloop for each request, appends its metrics in the
+     *  Prometheus text format to the page.
+     */
+    void addCollector(std::function<void(std::string &out)> collector);
+
+    /**
+     *  Append the HELP and TYPE lines of a metric to a page.
+     *
+     *  @param[out] out Page.
+     *  @param[in] name Name of the metric.
+     *  @param[in] type Prometheus type, "counter", "gauge" or "summary".
+     *  @param[in] help Description of the metric.
+     */
+    static void appendHeader(std::string &out, const char *name, const char *type,
+                             const char *help);
+
+    /**
+     *  Append a sample of a metric to a page.
+     *
+     *  @param[out] out Page.
+     *  @param[in] name Name of the metric.
+     *  @param[in] labels Labels without braces, as in camera="/dev/video0", may be empty.
+     *  @param[in] value Value of the sample.
+     */
+    static void appendSample(std::string &out, const char *name, const std::string &labels,
+                             double value);
+
+    /**
+     *  Get a label value with quotes, backslashes and newlines escaped.
+     */
+    static std::string escapeLabel(const std::string &value);
+
+protected:
+    bool _can_read() override;
+    bool _can_write() override { return false; }
+
+private:
+    class Client;
+    void _collect(std::string &out);
+    void _collectThreads(std::string &out);
+    void _reap();
+    std::string _socket_path; /* Unlinked on stop, empty for TCP */
+    std::vector<std::function<void(std::string &out)>> _collectors;
+    std::list<std::unique_ptr<Client>> _clients;
+};
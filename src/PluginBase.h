@@ -55,6 +55,14 @@ public:
         return pluginList;
     }
 
+    /**
+     *  Discover the camera devices of the plugin. Called once by the PluginManager before
+     *  getCameraDevices(), each plugin from a thread of its own so that slow discoveries run at the
+     *  same time. Plugins should not probe hardware at construction, which happens serially
+     *  during static initialization.
+     */
+    virtual void init() {}
+
     /**
      *  Get the list of camera devices discovered by plugin.
      *
@@ -71,6 +79,23 @@ public:
      */
     virtual std::shared_ptr<CameraDevice> createCameraDevice(std::string deviceID) = 0;
 
+    /**
+     *  Add a camera device that appeared after init(), a device node created in /dev.
+     *
+     *  @param[in] deviceID Name of the device node.
+     *
+     *  @return True if the device is a camera of the plugin, listed by getCameraDevices() from now
+     *  on.
+     */
+    virtual bool addCameraDevice(const std::string &deviceID) { return false; }
+
+    /**
+     *  Remove a camera device whose device node is gone.
+     *
+     *  @param[in] deviceID Name of the device node.
+     */
+    virtual void removeCameraDevice(const std::string &deviceID) {}
+
 protected:
     /**
      *  Constructor. Self-registers by adding itself to the list.
@@ -16,18 +16,44 @@
  * limitations under the License.
  */
 
+#include <thread>
+#include <typeinfo>
+
 #include "PluginManager.h"
+#include "log.h"
+#include "util.h"
 
 // build a map of camera device(key) and their plugin(value)
 PluginManager::PluginManager()
 {
-    // for all plugins, get the list of camera devices discovered
-    for (PluginBase *plugin : PluginBase::getPlugins()) {
-        for (std::string deviceID : plugin->getCameraDevices()) {
+    const std::vector<PluginBase *> &plugins = PluginBase::getPlugins();
+    std::vector<std::vector<std::string>> devices(plugins.size());
+    std::vector<std::thread> threads;
+    usec_t start = now_usec();
+
+    // plugins discover their devices at the same time, a slow one does not hold the others
+    for (size_t i = 0; i < plugins.size(); i++) {
+        threads.push_back(std::thread([&plugins, &devices, i]() {
+            usec_t t = now_usec();
+            plugins[i]->init();
+            devices[i] = plugins[i]->getCameraDevices();
+            log_info("Plugin %s found %zu devices in %llu ms", typeid(*plugins[i]).name(),
+                     devices[i].size(), (unsigned long long)(now_usec() - t) / USEC_PER_MSEC);
+        }));
+    }
+    for (auto &t : threads)
+        t.join();
+
+    // for all plugins, add the devices discovered in plugin order
+    for (size_t i = 0; i < plugins.size(); i++) {
+        for (std::string deviceID : devices[i]) {
             // add the (device,factory) pair to map
-            mPluginMap[deviceID] = plugin;
+            mPluginMap[deviceID] = plugins[i];
         }
     }
+
+    log_info("Startup: %zu plugins enumerated in %llu ms", plugins.size(),
+             (unsigned long long)(now_usec() - start) / USEC_PER_MSEC);
 }
 
 PluginManager::~PluginManager()
@@ -45,9 +71,36 @@ std::vector<std::string> PluginManager::listCameraDevices()
 
 std::shared_ptr<CameraDevice> PluginManager::createCameraDevice(std::string deviceID)
 {
-    if (mPluginMap.find(deviceID) == mPluginMap.end()) {
+    // may be called from several threads at once, the map is not modified
+    auto it = mPluginMap.find(deviceID);
+    if (it == mPluginMap.end()) {
         return nullptr;
     } else {
-        return mPluginMap[deviceID]->createCameraDevice(deviceID);
+        return it->second->createCameraDevice(deviceID);
+    }
+}
+
+bool PluginManager::addCameraDevice(const std::string &deviceID)
+{
+    if (mPluginMap.find(deviceID) != mPluginMap.end())
+        return true;
+
+    for (PluginBase *plugin : PluginBase::getPlugins()) {
+        if (plugin->addCameraDevice(deviceID)) {
+            mPluginMap[deviceID] = plugin;
+            return true;
+        }
     }
+
+    return false;
+}
+
+void PluginManager::removeCameraDevice(const std::string &deviceID)
+{
+    auto it = mPluginMap.find(deviceID);
+    if (it == mPluginMap.end())
+        return;
+
+    it->second->removeCameraDevice(deviceID);
+    mPluginMap.erase(it);
 }
@@ -29,6 +29,22 @@ public:
     std::vector<std::string> listCameraDevices();
     std::shared_ptr<CameraDevice> createCameraDevice(std::string deviceID);
 
+    /**
+     *  Give a device node created after startup to the plugin that handles it.
+     *
+     *  @param[in] deviceID Name of the device node.
+     *
+     *  @return True if a plugin took it as one of its camera devices.
+     */
+    bool addCameraDevice(const std::string &deviceID);
+
+    /**
+     *  Forget a camera device whose device node is gone.
+     *
+     *  @param[in] deviceID Name of the device node.
+     */
+    void removeCameraDevice(const std::string &deviceID);
+
 private:
     std::map<std::string, PluginBase *> mPluginMap;
 };
@@ -0,0 +1,209 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cmath>
+
+#include "PoseHistory.h"
+#include "log.h"
+
+/* 12.8s at the 20Hz requested, images are tagged once encoded and written */
+#define HISTORY_SIZE 256
+/* Samples further than this from the capture time are not used */
+#define MAX_SAMPLE_GAP_US (500 * USEC_PER_MSEC)
+/* An autopilot time going back by more than this is a reboot */
+#define REBOOT_GAP_MS 1000
+
+void Pose::toQuaternion(float q[4]) const
+{
+    float cr = cosf(roll / 2), sr = sinf(roll / 2);
+    float cp = cosf(pitch / 2), sp = sinf(pitch / 2);
+    float cy = cosf(yaw / 2), sy = sinf(yaw / 2);
+
+    q[0] = cr * cp * cy + sr * sp * sy;
+    q[1] = sr * cp * cy - cr * sp * sy;
+    q[2] = cr * sp * cy + sr * cp * sy;
+    q[3] = cr * cp * sy - sr * sp * cy;
+}
+
+PoseHistory::PoseHistory()
+    : mPositions(HISTORY_SIZE)
+    , mAttitudes(HISTORY_SIZE)
+    , mOffsetValid(false)
+    , mOffset(0)
+    , mLastBootMs(0)
+    , mLastUpdate(0)
+{
+}
+
+/* called with mLock held */
+void PoseHistory::updateOffset(uint32_t timeBootMs)
+{
+    usec_t now = now_usec();
+
+    if (mOffsetValid && timeBootMs + REBOOT_GAP_MS < mLastBootMs) {
+        log_info("Autopilot rebooted, pose history cleared");
+        mPositions.clear();
+        mAttitudes.clear();
+        mOffsetValid = false;
+    }
+    mLastBootMs = timeBootMs;
+    mLastUpdate = now;
+
+    int64_t offset = (int64_t)now - (int64_t)timeBootMs * (int64_t)USEC_PER_MSEC;
+    if (!mOffsetValid || offset < mOffset) {
+        mOffset = offset;
+        mOffsetValid = true;
+    }
+}
+
+void PoseHistory::addPosition(uint32_t timeBootMs, int32_t lat, int32_t lon, int32_t alt,
+                              int32_t relativeAlt)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    usec_t time = (usec_t)timeBootMs * USEC_PER_MSEC;
+
+    updateOffset(timeBootMs);
+    /* repeated or reordered message */
+    if (mPositions.size() && time <= mPositions[mPositions.size() - 1].time)
+        return;
+
+    mPositions.push({time, lat, lon, alt, relativeAlt});
+}
+
+void PoseHistory::addAttitude(uint32_t timeBootMs, float roll, float pitch, float yaw)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    usec_t time = (usec_t)timeBootMs * USEC_PER_MSEC;
+
+    updateOffset(timeBootMs);
+    if (mAttitudes.size() && time <= mAttitudes[mAttitudes.size() - 1].time)
+        return;
+
+    mAttitudes.push({time, roll, pitch, yaw});
+}
+
+/*
+ * Find the samples around time, a == b if only one is close enough. f is the fraction of the way
+ * from a to b.
+ */
+template <typename T>
+bool PoseHistory::bracket(const Ring<T> &ring, usec_t time, const T *&a, const T *&b, float &f)
+{
+    size_t i = ring.lowerBound(time);
+    f = 0;
+
+    if (i < ring.size() && i > 0) {
+        a = &ring[i - 1];
+        b = &ring[i];
+        if (b->time - a->time <= 2 * MAX_SAMPLE_GAP_US) {
+            f = (float)(time - a->time) / (b->time - a->time);
+            return true;
+        }
+        /* gap in the stream, take the nearest one */
+        a = b = (time - a->time < b->time - time) ? a : b;
+    } else if (i < ring.size()) {
+        a = b = &ring[i];
+    } else if (ring.size()) {
+        a = b = &ring[ring.size() - 1];
+    } else {
+        return false;
+    }
+
+    usec_t gap = a->time > time ? a->time - time : time - a->time;
+    return gap <= MAX_SAMPLE_GAP_US;
+}
+
+/* Interpolate an angle the short way round */
+static float lerpAngle(float a, float b, float f)
+{
+    float d = b - a;
+    if (d > (float)M_PI)
+        d -= 2 * (float)M_PI;
+    else if (d < -(float)M_PI)
+        d += 2 * (float)M_PI;
+
+    float r = a + d * f;
+    if (r > (float)M_PI)
+        r -= 2 * (float)M_PI;
+    else if (r < -(float)M_PI)
+        r += 2 * (float)M_PI;
+    return r;
+}
+
+static int32_t lerp(int32_t a, int32_t b, float f)
+{
+    return (int32_t)llround(a + ((int64_t)b - a) * (double)f);
+}
+
+bool PoseHistory::getPose(usec_t time, Pose &pose) const
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    float f;
+
+    pose.hasPosition = pose.hasAttitude = false;
+    if (!mOffsetValid || (int64_t)time < mOffset)
+        return false;
+    /* samples are kept on the autopilot clock */
+    time -= mOffset;
+
+    const PositionSample *pa, *pb;
+    pose.hasPosition = bracket(mPositions, time, pa, pb, f);
+    if (pose.hasPosition) {
+        pose.lat = lerp(pa->lat, pb->lat, f);
+        /* across the antimeridian the longitude goes the short way too */
+        int64_t dlon = (int64_t)pb->lon - pa->lon;
+        if (dlon > 1800000000LL)
+            dlon -= 3600000000LL;
+        else if (dlon < -1800000000LL)
+            dlon += 3600000000LL;
+        int64_t lon = pa->lon + llround(dlon * (double)f);
+        if (lon > 1800000000LL)
+            lon -= 3600000000LL;
+        else if (lon < -1800000000LL)
+            lon += 3600000000LL;
+        pose.lon = (int32_t)lon;
+        pose.alt = lerp(pa->alt, pb->alt, f);
+        pose.relativeAlt = lerp(pa->relativeAlt, pb->relativeAlt, f);
+    }
+
+    const AttitudeSample *aa, *ab;
+    pose.hasAttitude = bracket(mAttitudes, time, aa, ab, f);
+    if (pose.hasAttitude) {
+        pose.roll = lerpAngle(aa->roll, ab->roll, f);
+        pose.pitch = aa->pitch + (ab->pitch - aa->pitch) * f;
+        pose.yaw = lerpAngle(aa->yaw, ab->yaw, f);
+    }
+
+    return pose.hasPosition || pose.hasAttitude;
+}
+
+bool PoseHistory::getBootTime(usec_t time, uint32_t &timeBootMs) const
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (!mOffsetValid || (int64_t)time < mOffset)
+        return false;
+
+    timeBootMs = (uint32_t)(((int64_t)time - mOffset) / (int64_t)USEC_PER_MSEC);
+    return true;
+}
+
+usec_t PoseHistory::getLastUpdate() const
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    return mLastUpdate;
+}
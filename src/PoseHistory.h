@@ -0,0 +1,178 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include "util.h"
+
+/**
+ *  Position and attitude of the vehicle at a point in time.
+ */
+struct Pose {
+    bool hasPosition = false; /**< lat, lon, alt and relativeAlt are valid. */
+    bool hasAttitude = false; /**< roll, pitch and yaw are valid. */
+    int32_t lat = 0;          /**< Latitude in degrees * 1E7. */
+    int32_t lon = 0;          /**< Longitude in degrees * 1E7. */
+    int32_t alt = 0;          /**< Altitude (MSL) in mm. */
+    int32_t relativeAlt = 0;  /**< Altitude above ground in mm. */
+    float roll = 0;           /**< Roll angle in rad. */
+    float pitch = 0;          /**< Pitch angle in rad. */
+    float yaw = 0;            /**< Yaw angle in rad. */
+
+    /**
+     *  Get the attitude as a quaternion.
+     *
+     *  @param[out] q Quaternion (w, x, y, z), the MAVLink order.
+     */
+    void toQuaternion(float q[4]) const;
+};
+
+/**
+ *  The PoseHistory class keeps the last seconds of position and attitude reported by the autopilot
+ *  (GLOBAL_POSITION_INT, ATTITUDE) in rings indexed by time, to geotag images with the pose the
+ *  vehicle had when the frame was captured rather than when the image was written.
+ *
+ *  Samples are kept on the time since boot of the autopilot they are stamped with. Local times are
+ *  mapped onto it with the smallest difference seen between the receive time and the autopilot
+ *  time, that of the message with the least delay. The history starts over when the autopilot
+ *  reboots.
+ */
+class PoseHistory {
+public:
+    PoseHistory();
+
+    /**
+     *  Add a position sample.
+     *
+     *  @param[in] timeBootMs Time since boot of the autopilot in ms.
+     *  @param[in] lat Latitude in degrees * 1E7.
+     *  @param[in] lon Longitude in degrees * 1E7.
+     *  @param[in] alt Altitude (MSL) in mm.
+     *  @param[in] relativeAlt Altitude above ground in mm.
+     */
+    void addPosition(uint32_t timeBootMs, int32_t lat, int32_t lon, int32_t alt,
+                     int32_t relativeAlt);
+
+    /**
+     *  Add an attitude sample.
+     *
+     *  @param[in] timeBootMs Time since boot of the autopilot in ms.
+     *  @param[in] roll Roll angle in rad.
+     *  @param[in] pitch Pitch angle in rad.
+     *  @param[in] yaw Yaw angle in rad.
+     */
+    void addAttitude(uint32_t timeBootMs, float roll, float pitch, float yaw);
+
+    /**
+     *  Get the pose at a time, interpolated between the samples around it. Position and attitude
+     *  are left invalid if no sample is close enough in time.
+     *
+     *  @param[in] time Monotonic time in micro sec.
+     *  @param[out] pose Pose at the time.
+     *
+     *  @return True if the pose has a position or an attitude.
+     */
+    bool getPose(usec_t time, Pose &pose) const;
+
+    /**
+     *  Get the time since boot of the autopilot at a local time.
+     *
+     *  @param[in] time Monotonic time in micro sec.
+     *  @param[out] timeBootMs Time since boot of the autopilot in ms.
+     *
+     *  @return True if the autopilot time is known.
+     */
+    bool getBootTime(usec_t time, uint32_t &timeBootMs) const;
+
+    /**
+     *  Get the time the last sample was received.
+     *
+     *  @return Monotonic time in micro sec, 0 if no sample yet.
+     */
+    usec_t getLastUpdate() const;
+
+private:
+    struct PositionSample {
+        usec_t time; /* Autopilot time in micro sec */
+        int32_t lat;
+        int32_t lon;
+        int32_t alt;
+        int32_t relativeAlt;
+    };
+
+    struct AttitudeSample {
+        usec_t time; /* Autopilot time in micro sec */
+        float roll;
+        float pitch;
+        float yaw;
+    };
+
+    /* Fixed size ring of samples in time order, the oldest is overwritten */
+    template <typename T> class Ring {
+    public:
+        Ring(size_t size)
+            : mSamples(size)
+            , mHead(0)
+            , mCount(0)
+        {
+        }
+        void push(const T &sample)
+        {
+            mSamples[(mHead + mCount) % mSamples.size()] = sample;
+            if (mCount < mSamples.size())
+                mCount++;
+            else
+                mHead = (mHead + 1) % mSamples.size();
+        }
+        void clear() { mHead = mCount = 0; }
+        size_t size() const { return mCount; }
+        /* 0 is the oldest sample */
+        const T &operator[](size_t i) const { return mSamples[(mHead + i) % mSamples.size()]; }
+        /* first sample at or after time, size() if none */
+        size_t lowerBound(usec_t time) const
+        {
+            size_t lo = 0, hi = mCount;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if ((*this)[mid].time < time)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            return lo;
+        }
+
+    private:
+        std::vector<T> mSamples;
+        size_t mHead;
+        size_t mCount;
+    };
+
+    void updateOffset(uint32_t timeBootMs);
+    template <typename T>
+    static bool bracket(const Ring<T> &ring, usec_t time, const T *&a, const T *&b, float &f);
+    mutable std::mutex mLock; /* Samples come on the mainloop, images are tagged from workers */
+    Ring<PositionSample> mPositions;
+    Ring<AttitudeSample> mAttitudes;
+    bool mOffsetValid;
+    int64_t mOffset;      /* Local time - autopilot time of the fastest message, in us */
+    uint32_t mLastBootMs; /* Autopilot time of the last sample, to detect a reboot */
+    usec_t mLastUpdate;
+};
@@ -0,0 +1,153 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+
+#include "RateController.h"
+#include "log.h"
+
+/* Loss above which the bitrate is lowered, in 1/256 (~10%) */
+#define LOSS_HIGH 26
+/* Loss below which the bitrate may be raised, in 1/256 (~2%) */
+#define LOSS_LOW 5
+/* Jitter above which the link is considered congested, in ms */
+#define JITTER_HIGH_MS 50
+/* Raise the bitrate by 1/INCREASE_DIV per clean report */
+#define INCREASE_DIV 20
+/* Time to wait after a change before raising the bitrate again */
+#define INCREASE_HOLD_MS 2000
+
+#define RTCP_SR 200
+#define RTCP_RR 201
+#define RTCP_HEADER_LEN 8
+#define RTCP_SENDER_INFO_LEN 20
+#define RTCP_REPORT_BLOCK_LEN 24
+
+uint32_t RateController::sMinBitrate = 0;
+uint32_t RateController::sMaxBitrate = 0;
+
+RateController::RateController(uint32_t bitrate)
+    : mStatus()
+    , mLastChange(0)
+{
+    mStatus.bitrate = bitrate;
+}
+
+void RateController::reset(uint32_t bitrate)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    /* held for a while before raising it again, as after a change of its own */
+    mStatus.bitrate = bitrate;
+    mLastChange = now_usec();
+}
+
+bool RateController::update(uint8_t fractionLost, uint32_t jitter)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    uint32_t bitrate = mStatus.bitrate;
+
+    mStatus.loss = fractionLost;
+    mStatus.jitter = jitter;
+    mStatus.reports++;
+
+    if (fractionLost > LOSS_HIGH) {
+        /* back off in proportion to the loss */
+        bitrate = bitrate - (uint64_t)bitrate * fractionLost / 512;
+    } else if (jitter > JITTER_HIGH_MS) {
+        /* queues are building up on the link, loss follows soon */
+        bitrate = bitrate - bitrate / 8;
+    } else if (fractionLost < LOSS_LOW
+               && now_usec() - mLastChange >= INCREASE_HOLD_MS * USEC_PER_MSEC) {
+        bitrate = bitrate + std::max<uint32_t>(bitrate / INCREASE_DIV, 1);
+    }
+
+    bitrate = std::max(std::min(bitrate, sMaxBitrate), sMinBitrate);
+    if (bitrate == mStatus.bitrate)
+        return false;
+
+    if (bitrate < mStatus.bitrate)
+        mStatus.decreases++;
+    else
+        mStatus.increases++;
+
+    log_debug("Bitrate %u -> %u kbps, loss:%u/256 jitter:%ums", mStatus.bitrate, bitrate,
+              fractionLost, jitter);
+    mStatus.bitrate = bitrate;
+    mLastChange = now_usec();
+    return true;
+}
+
+uint32_t RateController::getBitrate() const
+{
+    std::lock_guard<std::mutex> locker(mLock);
+    return mStatus.bitrate;
+}
+
+void RateController::setLimits(uint32_t minBitrate, uint32_t maxBitrate)
+{
+    sMinBitrate = std::min(minBitrate, maxBitrate);
+    sMaxBitrate = maxBitrate;
+}
+
+bool RateController::isEnabled()
+{
+    return sMaxBitrate > 0;
+}
+
+uint32_t RateController::getMaxBitrate()
+{
+    return sMaxBitrate;
+}
+
+static uint32_t read_be32(const uint8_t *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+bool RateController::parseReport(const uint8_t *data, size_t len, uint8_t &fractionLost,
+                                 uint32_t &jitter)
+{
+    /* walk the packets of the compound packet */
+    while (len >= RTCP_HEADER_LEN) {
+        if ((data[0] >> 6) != 2)
+            return false;
+
+        uint8_t count = data[0] & 0x1f;
+        uint8_t type = data[1];
+        size_t pktLen = ((size_t)(data[2] << 8 | data[3]) + 1) * 4;
+        if (pktLen > len)
+            return false;
+
+        size_t offset = RTCP_HEADER_LEN;
+        if (type == RTCP_SR)
+            offset += RTCP_SENDER_INFO_LEN;
+
+        if ((type == RTCP_SR || type == RTCP_RR) && count > 0
+            && offset + RTCP_REPORT_BLOCK_LEN <= pktLen) {
+            const uint8_t *block = data + offset;
+            fractionLost = block[4];
+            jitter = read_be32(block + 12);
+            return true;
+        }
+
+        data += pktLen;
+        len -= pktLen;
+    }
+
+    return false;
+}
@@ -0,0 +1,109 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#include "util.h"
+
+/**
+ *  The RateController class adapts the bitrate of a video encoder to the link quality the
+ *  receivers report in RTCP receiver reports. A lossy link lowers the bitrate in proportion to the
+ *  loss, a clean link raises it slowly, always within the configured limits.
+ */
+class RateController {
+public:
+    struct Status {
+        uint32_t bitrate;   /**< Current bitrate in kbps. */
+        uint8_t loss;       /**< Fraction of packets lost in the last report, in 1/256. */
+        uint32_t jitter;    /**< Interarrival jitter of the last report in ms. */
+        uint64_t reports;   /**< Number of reports received. */
+        uint64_t decreases; /**< Number of times the bitrate was lowered. */
+        uint64_t increases; /**< Number of times the bitrate was raised. */
+    };
+
+    RateController(uint32_t bitrate);
+
+    /**
+     *  Take the loss and jitter of a receiver report into account.
+     *
+     *  @param[in] fractionLost Fraction of packets lost since the last report, in 1/256.
+     *  @param[in] jitter Interarrival jitter in ms.
+     *
+     *  @return true if the bitrate has to be changed to getBitrate().
+     */
+    bool update(uint8_t fractionLost, uint32_t jitter);
+
+    /**
+     *  Get the bitrate the encoder should run at.
+     *
+     *  @return Bitrate in kbps.
+     */
+    uint32_t getBitrate() const;
+
+    /**
+     *  Start over from a bitrate set from outside, adaptation goes on from there.
+     *
+     *  @param[in] bitrate Bitrate in kbps.
+     */
+    void reset(uint32_t bitrate);
+
+    /**
+     *  Set the limits of the bitrate of all the controllers. Adaptation is enabled when the
+     *  maximum is not 0.
+     *
+     *  @param[in] minBitrate Lowest bitrate in kbps.
+     *  @param[in] maxBitrate Highest, and starting, bitrate in kbps.
+     */
+    static void setLimits(uint32_t minBitrate, uint32_t maxBitrate);
+
+    /**
+     *  Check if the bitrate of the streams is adapted to the link.
+     *
+     *  @return true if enabled.
+     */
+    static bool isEnabled();
+
+    /**
+     *  Get the bitrate the streams start at.
+     *
+     *  @return Bitrate in kbps, 0 if adaptation is disabled.
+     */
+    static uint32_t getMaxBitrate();
+
+    /**
+     *  Get the first report block of an RTCP sender or receiver report packet.
+     *
+     *  @param[in] data RTCP compound packet.
+     *  @param[in] len Length of the packet.
+     *  @param[out] fractionLost Fraction of packets lost, in 1/256.
+     *  @param[out] jitter Interarrival jitter in RTP timestamp units.
+     *
+     *  @return true if a report block was found.
+     */
+    static bool parseReport(const uint8_t *data, size_t len, uint8_t &fractionLost,
+                            uint32_t &jitter);
+
+private:
+    mutable std::mutex mLock;
+    Status mStatus;
+    usec_t mLastChange;
+    static uint32_t sMinBitrate;
+    static uint32_t sMaxBitrate;
+};
@@ -0,0 +1,168 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "RawBurstFile.h"
+#include "log.h"
+
+#define PAGE_ALIGN(x) (((x) + 4095) & ~(size_t)4095)
+
+RawBurstFile::RawBurstFile()
+    : mFd(-1)
+    , mMap(nullptr)
+    , mMapSize(0)
+    , mUsed(0)
+{
+}
+
+RawBurstFile::~RawBurstFile()
+{
+    close();
+}
+
+/*
+ * posix_fallocate reserves the extents without writing them, the frames are then the only data
+ * written. On file systems without fallocate the C library writes the file full instead: a
+ * sparse file would raise SIGBUS on the mapping once the storage is full.
+ */
+int RawBurstFile::open(const std::string &path, const std::string &format, size_t frameSize,
+                       uint32_t frames)
+{
+    close();
+
+    if (!frames || !frameSize)
+        return -EINVAL;
+
+    size_t dataOffset = PAGE_ALIGN(sizeof(RawBurstHeader) + frames * sizeof(RawBurstEntry));
+    size_t size = dataOffset + frames * PAGE_ALIGN(frameSize);
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        int ret = -errno;
+        log_error("Unable to create raw file %s: %s", path.c_str(), strerror(-ret));
+        return ret;
+    }
+
+    int err = posix_fallocate(fd, 0, size);
+    if (err) {
+        log_error("Unable to allocate %zu bytes for raw file %s: %s", size, path.c_str(),
+                  strerror(err));
+        ::close(fd);
+        unlink(path.c_str());
+        return -err;
+    }
+
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        int ret = -errno;
+        log_error("Unable to map raw file %s: %m", path.c_str());
+        ::close(fd);
+        unlink(path.c_str());
+        return ret;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    mFd = fd;
+    mMap = (uint8_t *)map;
+    mMapSize = size;
+    mUsed = dataOffset;
+    mPath = path;
+
+    RawBurstHeader *h = header();
+    memcpy(h->magic, RAW_BURST_MAGIC, sizeof(h->magic));
+    h->version = 1;
+    h->capacity = frames;
+    h->count = 0;
+    h->planes = 0;
+    h->dataOffset = dataOffset;
+    strncpy(h->format, format.c_str(), sizeof(h->format) - 1);
+
+    log_debug("Raw file %s: %u frames of %zu bytes", path.c_str(), frames, frameSize);
+    return 0;
+}
+
+void RawBurstFile::setPlanes(uint32_t planes, const size_t offset[], const int stride[])
+{
+    if (!mMap)
+        return;
+
+    RawBurstHeader *h = header();
+    h->planes = planes < RAW_BURST_MAX_PLANES ? planes : RAW_BURST_MAX_PLANES;
+    for (uint32_t i = 0; i < h->planes; i++) {
+        h->offset[i] = offset[i];
+        h->stride[i] = stride[i];
+    }
+}
+
+/* The count is updated last, a file cut short holds the frames counted */
+int RawBurstFile::append(const void *data, size_t size, uint64_t timestamp, uint32_t seq)
+{
+    if (!mMap)
+        return -EBADF;
+
+    RawBurstHeader *h = header();
+    if (h->count == h->capacity || mUsed + size > mMapSize)
+        return -ENOSPC;
+
+    memcpy(mMap + mUsed, data, size);
+
+    RawBurstEntry *e = &index()[h->count];
+    e->offset = mUsed;
+    e->size = size;
+    e->timestamp = timestamp;
+    e->seq = seq;
+    h->count++;
+
+    mUsed = PAGE_ALIGN(mUsed + size);
+    return 0;
+}
+
+int RawBurstFile::close()
+{
+    if (mFd < 0)
+        return 0;
+
+    int ret = 0;
+    uint32_t count = header()->count;
+
+    /* pages are written back once, here, instead of on every frame */
+    if (msync(mMap, mMapSize, MS_SYNC) < 0)
+        ret = -errno;
+    munmap(mMap, mMapSize);
+    mMap = nullptr;
+
+    if (mUsed < mMapSize && ftruncate(mFd, mUsed) < 0)
+        log_warning("Unable to trim raw file %s: %m", mPath.c_str());
+    if (fdatasync(mFd) < 0 && !ret)
+        ret = -errno;
+    ::close(mFd);
+    mFd = -1;
+
+    if (ret)
+        log_error("Unable to sync raw file %s: %s", mPath.c_str(), strerror(-ret));
+    else
+        log_info("Raw file written: %s, %u frames, %zu bytes", mPath.c_str(), count, mUsed);
+
+    mMapSize = 0;
+    mUsed = 0;
+    return ret;
+}
@@ -0,0 +1,125 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#define RAW_BURST_MAGIC "DCMRAW1"
+#define RAW_BURST_FORMAT_LEN 256
+#define RAW_BURST_MAX_PLANES 4
+
+/* Header at the start of a raw burst file, all fields little endian as written by the host */
+struct RawBurstHeader {
+    char magic[8];                         /* RAW_BURST_MAGIC */
+    uint32_t version;                      /* 1 */
+    uint32_t capacity;                     /* Entries of the index */
+    uint32_t count;                        /* Frames written, updated after each frame */
+    uint32_t planes;                       /* Planes described below, 0 if packed */
+    uint64_t dataOffset;                   /* Offset of the first frame */
+    uint32_t offset[RAW_BURST_MAX_PLANES]; /* Offset of each plane in a frame */
+    uint32_t stride[RAW_BURST_MAX_PLANES]; /* Bytes per line of each plane */
+    char format[RAW_BURST_FORMAT_LEN];     /* GStreamer caps of the frames */
+};
+
+/* Index entry of a frame, the index follows the header */
+struct RawBurstEntry {
+    uint64_t offset;    /* Offset of the frame in the file */
+    uint64_t size;      /* Size in bytes of the frame */
+    uint64_t timestamp; /* Monotonic capture time in nano sec */
+    uint32_t seq;       /* Shot number in the capture */
+    uint32_t reserved;
+};
+
+/**
+ *  The RawBurstFile class writes frames as captured into a file preallocated for a whole burst
+ *  and mapped in memory. A frame is copied once, from the camera buffer to the page cache, with
+ *  no encoder nor write call per frame, so that bursts keep up with the sensor. The header and
+ *  the index of the frames come first, the frames follow on page boundaries.
+ *
+ *  The file is synced and cut to what was written when closed.
+ */
+class RawBurstFile {
+public:
+    RawBurstFile();
+    ~RawBurstFile();
+
+    /**
+     *  Create a file for a burst, its blocks are allocated up front.
+     *
+     *  @param[in] path Path of the file, overwritten if it exists.
+     *  @param[in] format GStreamer caps of the frames.
+     *  @param[in] frameSize Size in bytes of a frame, frames may be smaller.
+     *  @param[in] frames Number of frames the file holds.
+     *
+     *  @return 0 on success, -errno otherwise.
+     */
+    int open(const std::string &path, const std::string &format, size_t frameSize,
+             uint32_t frames);
+
+    /**
+     *  Describe the planes of the frames, when their lines are padded.
+     *
+     *  @param[in] planes Number of planes, at most RAW_BURST_MAX_PLANES.
+     *  @param[in] offset Offset of each plane in a frame.
+     *  @param[in] stride Bytes per line of each plane.
+     */
+    void setPlanes(uint32_t planes, const size_t offset[], const int stride[]);
+
+    /**
+     *  Copy a frame into the file.
+     *
+     *  @param[in] data Frame data.
+     *  @param[in] size Size in bytes of the frame.
+     *  @param[in] timestamp Monotonic capture time in nano sec.
+     *  @param[in] seq Shot number.
+     *
+     *  @return 0 on success, -ENOSPC if the file is full, the frame is not written.
+     */
+    int append(const void *data, size_t size, uint64_t timestamp, uint32_t seq);
+
+    /**
+     *  Sync the frames written to storage, give back the blocks not used and close the file.
+     *
+     *  @return 0 on success, -errno if the frames may not be on storage.
+     */
+    int close();
+
+    /**
+     *  Check whether a file is open.
+     *
+     *  @return True if open.
+     */
+    bool isOpen() const { return mFd >= 0; }
+
+    /**
+     *  Get the path of the file.
+     *
+     *  @return Path, empty if none was opened.
+     */
+    const std::string &getPath() const { return mPath; }
+
+private:
+    int mFd;
+    uint8_t *mMap;
+    size_t mMapSize;
+    size_t mUsed; /* Bytes up to the end of the last frame */
+    std::string mPath;
+    RawBurstHeader *header() const { return (RawBurstHeader *)mMap; }
+    RawBurstEntry *index() const { return (RawBurstEntry *)(mMap + sizeof(RawBurstHeader)); }
+};
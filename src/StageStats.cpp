@@ -0,0 +1,242 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <algorithm>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "StageStats.h"
+#include "log.h"
+
+std::atomic<int> StageStats::sTraceFd(-1);
+
+static std::mutex sLock; /* Protects sCameras and dump state */
+static std::map<std::string, std::unique_ptr<StageStats>> sCameras;
+
+static const char *sTraceMarkers[] = {
+    "/sys/kernel/tracing/trace_marker",
+    "/sys/kernel/debug/tracing/trace_marker",
+};
+
+LatencyHistogram::LatencyHistogram()
+    : mCount(0)
+    , mSum(0)
+    , mMax(0)
+{
+    for (auto &b : mBuckets)
+        b = 0;
+}
+
+/* 0-7 one bucket each, then 8 buckets per power of two */
+int LatencyHistogram::bucketOf(uint64_t usec)
+{
+    if (usec < 8)
+        return usec;
+
+    int exp = 63 - __builtin_clzll(usec);
+    int bucket = 8 + (exp - 3) * 8 + ((usec >> (exp - 3)) & 7);
+    return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::upperOf(int bucket)
+{
+    if (bucket < 8)
+        return bucket;
+
+    int exp = (bucket - 8) / 8 + 3;
+    uint64_t sub = (bucket - 8) % 8;
+    return ((8 + sub + 1) << (exp - 3)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t usec)
+{
+    mBuckets[bucketOf(usec)].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(usec, std::memory_order_relaxed);
+
+    uint64_t max = mMax.load(std::memory_order_relaxed);
+    while (usec > max && !mMax.compare_exchange_weak(max, usec, std::memory_order_relaxed))
+        ;
+}
+
+void LatencyHistogram::summarize(Summary &summary) const
+{
+    /* counters move while read, the buckets are what the percentiles come from */
+    uint64_t counts[BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    summary = {};
+    summary.count = total;
+    summary.max = mMax;
+    if (!total)
+        return;
+    summary.sum = mSum;
+    summary.mean = mSum / std::max<uint64_t>(mCount, 1);
+
+    const struct {
+        uint64_t *value;
+        unsigned int permille;
+    } percentiles[] = {{&summary.p50, 500}, {&summary.p90, 900}, {&summary.p99, 990}};
+
+    uint64_t seen = 0;
+    size_t p = 0;
+    for (int i = 0; i < BUCKETS && p < ARRAY_SIZE(percentiles); i++) {
+        seen += counts[i];
+        while (p < ARRAY_SIZE(percentiles) && seen * 1000 >= total * percentiles[p].permille) {
+            *percentiles[p].value = std::min(upperOf(i), summary.max);
+            p++;
+        }
+    }
+}
+
+void LatencyHistogram::forEachBucket(std::function<void(uint64_t upper, uint64_t count)> cb) const
+{
+    for (int i = 0; i < BUCKETS; i++) {
+        uint64_t count = mBuckets[i].load(std::memory_order_relaxed);
+        if (count)
+            cb(upperOf(i), count);
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto &b : mBuckets)
+        b = 0;
+    mCount = 0;
+    mSum = 0;
+    mMax = 0;
+}
+
+StageStats::StageStats(const std::string &camera)
+    : mCamera(camera)
+    , mFrames(0)
+    , mDropped(0)
+    , mEncodedBytes(0)
+    , mQueueLevel(0)
+    , mDumpFrames(0)
+    , mDumpTime(now_usec())
+{
+}
+
+StageStats *StageStats::get(const std::string &camera)
+{
+    std::lock_guard<std::mutex> locker(sLock);
+
+    std::unique_ptr<StageStats> &stats = sCameras[camera];
+    if (!stats)
+        stats.reset(new StageStats(camera));
+    return stats.get();
+}
+
+const char *StageStats::getStageName(Stage stage)
+{
+    static const char *names[STAGES] = {"read", "push", "encoded", "payloaded", "sent"};
+
+    return names[stage];
+}
+
+void StageStats::record(Stage stage, uint64_t usec)
+{
+    mStages[stage].record(usec);
+
+    int fd = sTraceFd.load(std::memory_order_relaxed);
+    if (fd < 0)
+        return;
+
+    char marker[128];
+    int len = snprintf(marker, sizeof(marker), "dcm: camera=%s stage=%s latency_us=%llu\n",
+                       mCamera.c_str(), getStageName(stage), (unsigned long long)usec);
+    if (len > 0)
+        (void)write(fd, marker, std::min<size_t>(len, sizeof(marker) - 1));
+}
+
+void StageStats::reset()
+{
+    std::lock_guard<std::mutex> locker(sLock);
+
+    for (auto &stage : mStages)
+        stage.reset();
+    mFrames = 0;
+    mDropped = 0;
+    mEncodedBytes = 0;
+    mDumpFrames = 0;
+    mDumpTime = now_usec();
+}
+
+void StageStats::dump()
+{
+    std::lock_guard<std::mutex> locker(sLock);
+    usec_t now = now_usec();
+
+    for (auto &camera : sCameras) {
+        StageStats &stats = *camera.second;
+        uint64_t frames = stats.mFrames;
+        double fps = now > stats.mDumpTime
+            ? (frames - stats.mDumpFrames) * (double)USEC_PER_SEC / (now - stats.mDumpTime)
+            : 0;
+        stats.mDumpFrames = frames;
+        stats.mDumpTime = now;
+
+        log_info("Camera %s: %llu frames, %.1f fps, %llu dropped", stats.mCamera.c_str(),
+                 (unsigned long long)frames, fps, (unsigned long long)stats.mDropped.load());
+        for (int i = 0; i < STAGES; i++) {
+            LatencyHistogram::Summary s;
+            stats.mStages[i].summarize(s);
+            if (!s.count)
+                continue;
+            log_info("  %-9s n=%llu mean=%lluus p50=%lluus p90=%lluus p99=%lluus max=%lluus",
+                     getStageName((Stage)i), (unsigned long long)s.count,
+                     (unsigned long long)s.mean, (unsigned long long)s.p50,
+                     (unsigned long long)s.p90, (unsigned long long)s.p99,
+                     (unsigned long long)s.max);
+        }
+    }
+}
+
+void StageStats::forEach(std::function<void(const StageStats &stats)> cb)
+{
+    std::lock_guard<std::mutex> locker(sLock);
+
+    for (auto &camera : sCameras)
+        cb(*camera.second);
+}
+
+void StageStats::setTraceMarker(bool enable)
+{
+    int fd = sTraceFd.exchange(-1);
+    if (fd >= 0)
+        close(fd);
+    if (!enable)
+        return;
+
+    for (const char *path : sTraceMarkers) {
+        fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            log_info("Stage latencies traced to %s", path);
+            sTraceFd = fd;
+            return;
+        }
+    }
+    log_warning("No ftrace marker found, stage latencies are not traced (%m)");
+}
@@ -0,0 +1,191 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+
+#include "util.h"
+
+/**
+ *  The LatencyHistogram class records latencies into log-linear buckets, 8 linear ones per power
+ *  of two, so percentiles are known within 12% with a fixed, small footprint. Recording is lock
+ *  free and takes a few relaxed atomic adds.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    struct Summary {
+        uint64_t count;
+        uint64_t sum;  /* All values in micro sec */
+        uint64_t mean;
+        uint64_t p50;
+        uint64_t p90;
+        uint64_t p99;
+        uint64_t max;
+    };
+
+    /**
+     *  Record a latency.
+     *
+     *  @param[in] usec Latency in micro sec.
+     */
+    void record(uint64_t usec);
+
+    /**
+     *  Get count, mean, percentiles and max of the values recorded since the last reset.
+     *
+     *  @param[out] summary Statistics.
+     */
+    void summarize(Summary &summary) const;
+
+    /**
+     *  Get the values recorded, bucket by bucket.
+     *
+     *  @param[in] cb Called with the upper bound in micro sec and the count of each non empty
+     *  bucket, in increasing order.
+     */
+    void forEachBucket(std::function<void(uint64_t upper, uint64_t count)> cb) const;
+
+    uint64_t getCount() const { return mCount; }
+
+    void reset();
+
+    static const int BUCKETS = 8 + 29 * 8;
+
+private:
+    static int bucketOf(uint64_t usec);
+    static uint64_t upperOf(int bucket);
+    std::atomic<uint64_t> mBuckets[BUCKETS];
+    std::atomic<uint64_t> mCount;
+    std::atomic<uint64_t> mSum;
+    std::atomic<uint64_t> mMax;
+};
+
+/**
+ *  The StageStats class keeps the latency of each stage of the frame pipeline of a camera, from
+ *  the sensor to the network, and its frame rate. Latencies are taken from the capture time of a
+ *  frame, except for READ which is the time CameraDevice::read() took.
+ *
+ *  A stage of a camera is recorded by one streaming thread, so the shared atomic counters are not
+ *  contended. Statistics are dumped to the log on SIGUSR1 and may also be emitted as ftrace
+ *  markers, picked up by trace-cmd or Perfetto.
+ */
+class StageStats {
+public:
+    enum Stage {
+        READ = 0,  /**< CameraDevice::read() */
+        PUSH,      /**< Frame pushed into an appsrc */
+        ENCODED,   /**< Out of the encoder */
+        PAYLOADED, /**< Out of the RTP payloader */
+        SENT,      /**< Into the network sink */
+        STAGES,
+    };
+
+    /**
+     *  Get the statistics of a camera, created on first use and kept for the process lifetime.
+     *
+     *  @param[in] camera Device Id of the camera.
+     *
+     *  @return Statistics of the camera.
+     */
+    static StageStats *get(const std::string &camera);
+
+    /**
+     *  Record the latency of a stage.
+     *
+     *  @param[in] stage Stage of the pipeline.
+     *  @param[in] usec Latency in micro sec.
+     */
+    void record(Stage stage, uint64_t usec);
+
+    /**
+     *  Count a frame read from the camera.
+     */
+    void frame() { mFrames.fetch_add(1, std::memory_order_relaxed); }
+
+    /**
+     *  Count frames dropped because an appsrc queue was full.
+     *
+     *  @param[in] frames Number of frames dropped.
+     */
+    void drop(uint64_t frames = 1) { mDropped.fetch_add(frames, std::memory_order_relaxed); }
+
+    /**
+     *  Count the bytes out of the encoder, for its bitrate.
+     *
+     *  @param[in] bytes Size of an encoded frame.
+     */
+    void encoded(uint64_t bytes) { mEncodedBytes.fetch_add(bytes, std::memory_order_relaxed); }
+
+    /**
+     *  Set the bytes queued in the appsrc after the last push.
+     *
+     *  @param[in] bytes Queue level in bytes.
+     */
+    void setQueueLevel(uint64_t bytes) { mQueueLevel.store(bytes, std::memory_order_relaxed); }
+
+    uint64_t getFrameCount() const { return mFrames; }
+    uint64_t getDropCount() const { return mDropped; }
+    uint64_t getEncodedBytes() const { return mEncodedBytes; }
+    uint64_t getQueueLevel() const { return mQueueLevel; }
+    const LatencyHistogram &getHistogram(Stage stage) const { return mStages[stage]; }
+    const std::string &getCamera() const { return mCamera; }
+
+    /**
+     *  Clear the latencies and counters, as for a new measurement.
+     */
+    void reset();
+
+    /**
+     *  Log fps and stage latencies of all cameras.
+     */
+    static void dump();
+
+    /**
+     *  Call a function for the statistics of each camera.
+     *
+     *  @param[in] cb Function called.
+     */
+    static void forEach(std::function<void(const StageStats &stats)> cb);
+
+    /**
+     *  Emit a trace marker for each recorded latency.
+     *
+     *  @param[in] enable True to open the ftrace marker, false to close it.
+     */
+    static void setTraceMarker(bool enable);
+
+    static const char *getStageName(Stage stage);
+
+private:
+    StageStats(const std::string &camera);
+    std::string mCamera;
+    LatencyHistogram mStages[STAGES];
+    std::atomic<uint64_t> mFrames;
+    std::atomic<uint64_t> mDropped;
+    std::atomic<uint64_t> mEncodedBytes;
+    std::atomic<uint64_t> mQueueLevel;
+    /* Frame count and time of the last dump, for the frame rate in between */
+    uint64_t mDumpFrames;
+    usec_t mDumpTime;
+    static std::atomic<int> sTraceFd;
+};
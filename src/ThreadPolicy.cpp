@@ -0,0 +1,188 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <errno.h>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ThreadPolicy.h"
+#include "log.h"
+#include "util.h"
+
+/* Thread names are cut to 15 chars by the kernel */
+#define THREAD_NAME_MAX 16
+
+static std::mutex sLock;
+static std::map<std::string, ThreadPolicy> sPolicies;
+
+ThreadPolicy::ThreadPolicy()
+    : priority(0)
+    , nice(0)
+{
+}
+
+bool ThreadPolicy::isSet() const
+{
+    return !cpus.empty() || priority > 0 || nice != 0;
+}
+
+int ThreadPolicy::parseCpus(const std::string &list, std::set<int> &cpus)
+{
+    size_t pos = 0;
+
+    cpus.clear();
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string item = list.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.empty())
+            continue;
+
+        int first, last;
+        size_t dash = item.find('-');
+        if (safe_atoi(item.substr(0, dash).c_str(), &first) < 0)
+            return -EINVAL;
+        if (dash == std::string::npos)
+            last = first;
+        else if (safe_atoi(item.substr(dash + 1).c_str(), &last) < 0)
+            return -EINVAL;
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            return -EINVAL;
+
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.insert(cpu);
+    }
+
+    return 0;
+}
+
+/* CPUs the process was started on, taken before any thread is placed */
+static const cpu_set_t &processCpus()
+{
+    static cpu_set_t cpus = [] {
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set)) {
+            CPU_ZERO(&set);
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                CPU_SET(cpu, &set);
+        }
+        return set;
+    }();
+
+    return cpus;
+}
+
+void ThreadPolicy::set(const std::string &owner, const ThreadPolicy &policy)
+{
+    processCpus();
+
+    std::lock_guard<std::mutex> locker(sLock);
+
+    if (policy.isSet())
+        sPolicies[owner] = policy;
+    else
+        sPolicies.erase(owner);
+}
+
+void ThreadPolicy::apply(const std::string &owner, const char *role)
+{
+    /* role:video0 for camera /dev/video0 */
+    size_t slash = owner.rfind('/');
+    std::string name = owner.substr(slash == std::string::npos ? 0 : slash + 1);
+    if (role) {
+        name = std::string(role) + ":" + name;
+        pthread_setname_np(pthread_self(), name.substr(0, THREAD_NAME_MAX - 1).c_str());
+    } else {
+        /* threads the main thread starts do not inherit its scheduling */
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+        if (pthread_setattr_default_np(&attr))
+            log_warning("Threads started by %s inherit its scheduling", name.c_str());
+        pthread_attr_destroy(&attr);
+    }
+
+    ThreadPolicy policy;
+    {
+        std::lock_guard<std::mutex> locker(sLock);
+        auto it = sPolicies.find(owner);
+        if (it != sPolicies.end())
+            policy = it->second;
+    }
+
+    place(name, policy);
+}
+
+void ThreadPolicy::reset(const char *role)
+{
+    pthread_setname_np(pthread_self(), std::string(role).substr(0, THREAD_NAME_MAX - 1).c_str());
+    place(role, ThreadPolicy());
+}
+
+/*
+ * Threads without a policy are given the default placement back: they may have been started by
+ * the mainloop, or be pooled threads of gstreamer that ran for another camera before.
+ */
+void ThreadPolicy::place(const std::string &name, const ThreadPolicy &policy)
+{
+    cpu_set_t set = processCpus();
+    if (!policy.cpus.empty()) {
+        CPU_ZERO(&set);
+        for (int cpu : policy.cpus)
+            CPU_SET(cpu, &set);
+    }
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret)
+        log_warning("Thread %s not bound to its CPUs: %s", name.c_str(), strerror(ret));
+
+    int sched;
+    struct sched_param param = {};
+    if (policy.priority > 0) {
+        param.sched_priority = policy.priority;
+        ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret)
+            log_warning("Thread %s not given SCHED_FIFO priority %d: %s", name.c_str(),
+                        policy.priority, strerror(ret));
+    } else {
+        if (!pthread_getschedparam(pthread_self(), &sched, &param) && sched != SCHED_OTHER) {
+            param.sched_priority = 0;
+            ret = pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+            if (ret)
+                log_warning("Thread %s not given SCHED_OTHER back: %s", name.c_str(),
+                            strerror(ret));
+        }
+
+        /* the nice level is per thread on Linux */
+        id_t tid = (id_t)syscall(SYS_gettid);
+        errno = 0;
+        int nice = getpriority(PRIO_PROCESS, tid);
+        if (!errno && nice != policy.nice && setpriority(PRIO_PROCESS, tid, policy.nice) < 0)
+            log_warning("Thread %s not given nice level %d: %m", name.c_str(), policy.nice);
+    }
+
+    if (policy.isSet())
+        log_debug("Thread %s placed", name.c_str());
+}
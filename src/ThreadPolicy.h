@@ -0,0 +1,78 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <set>
+#include <string>
+
+/**
+ *  The ThreadPolicy class places the threads of a camera, or of the mainloop, on the CPUs and at
+ *  the scheduling priority set in the conf file, so that video keeps its pace when other processes
+ *  of the companion computer load it. Threads apply the policy of their owner themselves when they
+ *  start and name themselves, for top and perf to show them.
+ */
+class ThreadPolicy {
+public:
+    ThreadPolicy();
+
+    std::set<int> cpus; /* CPUs the threads may run on, any if empty */
+    int priority;       /* SCHED_FIFO priority from 1 to 99, 0 to keep SCHED_OTHER */
+    int nice;           /* Nice level of SCHED_OTHER threads, from -20 to 19 */
+
+    /**
+     *  Parse a list of CPUs such as "2,3" or "0-1,3".
+     *
+     *  @param[in] list List of CPUs.
+     *  @param[out] cpus CPUs of the list.
+     *
+     *  @return 0 on success, -EINVAL if the list is malformed.
+     */
+    static int parseCpus(const std::string &list, std::set<int> &cpus);
+
+    /**
+     *  Set the policy of the threads of an owner started afterwards.
+     *
+     *  @param[in] owner Device Id of the camera, or "mainloop".
+     *  @param[in] policy Policy of its threads.
+     */
+    static void set(const std::string &owner, const ThreadPolicy &policy);
+
+    /**
+     *  Name the calling thread and apply the policy of its owner. Without a policy the thread is
+     *  given the default placement back: the CPUs of the process, SCHED_OTHER and nice level 0.
+     *  Failures are logged and the thread keeps running as it was, setting a real-time priority
+     *  or a lower nice level needs CAP_SYS_NICE.
+     *
+     *  @param[in] owner Device Id of the camera, or "mainloop".
+     *  @param[in] role Short name of the thread, the name is role:device, at most 15 chars. Null
+     *  for the main thread, which keeps the name of the process. The threads it starts afterwards
+     *  run SCHED_OTHER rather than inheriting its scheduling.
+     */
+    static void apply(const std::string &owner, const char *role);
+
+    /**
+     *  Name the calling thread and give it the default placement, for threads of no camera
+     *  started from the mainloop.
+     *
+     *  @param[in] role Name of the thread, at most 15 chars.
+     */
+    static void reset(const char *role);
+
+private:
+    bool isSet() const;
+    static void place(const std::string &name, const ThreadPolicy &policy);
+};
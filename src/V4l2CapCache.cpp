@@ -0,0 +1,207 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "V4l2CapCache.h"
+#include "log.h"
+#include "util.h"
+#include "v4l2_interface.h"
+
+#define CACHE_MAGIC "DCMV4L2C"
+/* Bump on any change of the layout of the file */
+#define CACHE_VERSION 2
+/* Bound of the strings and lists read from the file, far above any real device */
+#define CACHE_MAX_STRING 256
+#define CACHE_MAX_ITEMS 4096
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t ctrlSize; /* sizeof(struct v4l2_queryctrl), kernel headers may differ */
+    uint32_t count;
+};
+
+static std::string get_string(const uint8_t *s, size_t len)
+{
+    return std::string(reinterpret_cast<const char *>(s), strnlen((const char *)s, len));
+}
+
+static bool write_string(FILE *fp, const std::string &s)
+{
+    uint32_t len = s.size();
+    return fwrite(&len, sizeof(len), 1, fp) == 1 && fwrite(s.data(), 1, len, fp) == len;
+}
+
+static bool read_string(FILE *fp, std::string &s)
+{
+    uint32_t len;
+    if (fread(&len, sizeof(len), 1, fp) != 1 || len > CACHE_MAX_STRING)
+        return false;
+
+    s.resize(len);
+    return fread(&s[0], 1, len, fp) == len;
+}
+
+template <typename T> static bool write_list(FILE *fp, const std::vector<T> &list)
+{
+    uint32_t count = list.size();
+    return fwrite(&count, sizeof(count), 1, fp) == 1
+        && fwrite(list.data(), sizeof(T), count, fp) == count;
+}
+
+template <typename T> static bool read_list(FILE *fp, std::vector<T> &list)
+{
+    uint32_t count;
+    if (fread(&count, sizeof(count), 1, fp) != 1 || count > CACHE_MAX_ITEMS)
+        return false;
+
+    list.resize(count);
+    return fread(list.data(), sizeof(T), count, fp) == count;
+}
+
+V4l2CapCache &V4l2CapCache::get()
+{
+    static V4l2CapCache cache;
+    return cache;
+}
+
+int V4l2CapCache::load(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+
+    mPath = path;
+    if (mPath.empty())
+        return 0;
+
+    /* the cache directory is not created by the installation */
+    size_t slash = mPath.rfind('/');
+    if (slash != std::string::npos && slash > 0)
+        mkdir(mPath.substr(0, slash).c_str(), 0755);
+
+    FILE *fp = fopen(mPath.c_str(), "rb");
+    if (!fp) {
+        log_debug("No V4L2 capability cache at %s", mPath.c_str());
+        return -1;
+    }
+
+    CacheHeader hdr;
+    bool valid = fread(&hdr, sizeof(hdr), 1, fp) == 1
+        && !memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) && hdr.version == CACHE_VERSION
+        && hdr.ctrlSize == sizeof(struct v4l2_queryctrl) && hdr.count <= CACHE_MAX_ITEMS;
+
+    std::map<std::string, Entry> entries;
+    for (uint32_t i = 0; valid && i < hdr.count; i++) {
+        std::string key;
+        Entry entry;
+        std::shared_ptr<V4l2Caps> caps = std::make_shared<V4l2Caps>();
+        valid = read_string(fp, key) && read_string(fp, entry.ident)
+            && read_list(fp, caps->controls);
+        entry.caps = caps;
+        entries[key] = entry;
+    }
+    fclose(fp);
+
+    if (!valid) {
+        /* rewritten as the devices are probed again */
+        log_warning("Ignoring invalid V4L2 capability cache %s", mPath.c_str());
+        return -1;
+    }
+
+    mEntries = entries;
+    log_info("V4L2 capability cache: %zu devices", mEntries.size());
+    return 0;
+}
+
+std::shared_ptr<const V4l2Caps> V4l2CapCache::lookup(int fd, const struct v4l2_capability &vcap)
+{
+    std::string bus = get_string(vcap.bus_info, sizeof(vcap.bus_info));
+    /* nodes of a camera share the bus, tell them apart by what they do */
+    char nodeCaps[16];
+    snprintf(nodeCaps, sizeof(nodeCaps), "%08x",
+             vcap.capabilities & V4L2_CAP_DEVICE_CAPS ? vcap.device_caps : vcap.capabilities);
+    std::string key = bus + "/" + nodeCaps;
+    char version[16];
+    snprintf(version, sizeof(version), "%08x", vcap.version);
+    std::string ident = get_string(vcap.driver, sizeof(vcap.driver)) + "/" + version + "/"
+        + get_string(vcap.card, sizeof(vcap.card));
+
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto it = mEntries.find(key);
+        if (it != mEntries.end() && it->second.ident == ident)
+            return it->second.caps;
+    }
+
+    /* devices are probed in parallel, only the cache itself is locked */
+    usec_t start = now_usec();
+    std::shared_ptr<V4l2Caps> caps = std::make_shared<V4l2Caps>();
+    if (v4l2_query_control(fd, caps->controls)) {
+        log_error("Error in probing V4L2 device on %s", bus.c_str());
+        return nullptr;
+    }
+    log_info("Probed V4L2 device on %s: %zu controls in %llu us", key.c_str(),
+             caps->controls.size(), (unsigned long long)(now_usec() - start));
+
+    std::lock_guard<std::mutex> lock(mLock);
+    /* a device of the same bus and node probed before is replaced */
+    mEntries[key] = {ident, caps};
+    save();
+    return caps;
+}
+
+/* called with mLock held */
+int V4l2CapCache::save()
+{
+    if (mPath.empty())
+        return 0;
+
+    /* written aside and renamed, so a power cut never leaves a partial file */
+    std::string tmpPath = mPath + ".tmp";
+    FILE *fp = fopen(tmpPath.c_str(), "wb");
+    if (!fp) {
+        log_warning("Cannot write V4L2 capability cache %s: %s", tmpPath.c_str(),
+                    strerror(errno));
+        return -1;
+    }
+
+    CacheHeader hdr = {};
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CACHE_VERSION;
+    hdr.ctrlSize = sizeof(struct v4l2_queryctrl);
+    hdr.count = mEntries.size();
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    for (auto it = mEntries.begin(); ok && it != mEntries.end(); ++it) {
+        ok = write_string(fp, it->first) && write_string(fp, it->second.ident)
+            && write_list(fp, it->second.caps->controls);
+    }
+    if (fclose(fp))
+        ok = false;
+
+    if (!ok || rename(tmpPath.c_str(), mPath.c_str())) {
+        log_warning("Error in writing V4L2 capability cache %s", mPath.c_str());
+        remove(tmpPath.c_str());
+        return -1;
+    }
+
+    return 0;
+}
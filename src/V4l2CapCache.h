@@ -0,0 +1,76 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <linux/videodev2.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ *  The V4l2Caps structure holds what a V4L2 device reports about itself that does not change
+ *  while it is plugged in: its controls.
+ */
+struct V4l2Caps {
+    std::vector<struct v4l2_queryctrl> controls; /**< Controls in the order of QUERYCTRL. */
+};
+
+/**
+ *  The V4l2CapCache class keeps the capabilities probed from V4L2 devices, so that the control
+ *  walk, a few dozen ioctls per camera, runs once per device rather than on each init.
+ *
+ *  An entry is keyed by the bus the device is plugged in and the capabilities of the node, as the
+ *  capture and metadata nodes of a UVC camera share the bus. It is valid for as long as the
+ *  driver, its version and the card name on that bus stay the same. The entries are saved to a
+ *  binary file loaded at startup, so cold boots with the same cameras do not probe them at all.
+ */
+class V4l2CapCache {
+public:
+    static V4l2CapCache &get();
+
+    /**
+     *  Load the entries saved in a file, and save new entries there from now on.
+     *
+     *  @param[in] path Cache file, empty to keep the entries in memory only.
+     *
+     *  @return 0 on success, -1 if the file is missing or not valid.
+     */
+    int load(const std::string &path);
+
+    /**
+     *  Get the capabilities of a device, probed from it if not cached or if the device changed.
+     *
+     *  @param[in] fd File descriptor of the device.
+     *  @param[in] vcap Capability of the device, as from v4l2_query_cap().
+     *
+     *  @return Capabilities of the device, nullptr on error.
+     */
+    std::shared_ptr<const V4l2Caps> lookup(int fd, const struct v4l2_capability &vcap);
+
+private:
+    V4l2CapCache() {}
+    struct Entry {
+        std::string ident; /* Driver, version and card of the device on the bus */
+        std::shared_ptr<const V4l2Caps> caps;
+    };
+    int save();
+    std::mutex mLock;
+    std::string mPath;
+    std::map<std::string, Entry> mEntries; /* Bus info and device caps -> entry */
+};
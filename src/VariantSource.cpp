@@ -0,0 +1,225 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+
+#include "VariantSource.h"
+#include "gst_frame.h"
+#include "log.h"
+
+/* Time to wait for a camera frame, and for its conversion */
+#define FRAME_TIMEOUT_MS 1000
+#define DEFAULT_FRAMERATE 30
+
+static std::string getGstPixFormat(CameraParameters::PixelFormat pixFormat)
+{
+    switch (pixFormat) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        return "RGB";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        return "UYVY";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        return "YUY2";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV422P:
+        return "Y42B";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        return "NV12";
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return "GRAY8";
+    default:
+        return "I420";
+    }
+}
+
+VariantSource::VariantSource(std::shared_ptr<CameraDevice> camDev,
+                             std::shared_ptr<FrameHub> frameHub)
+    : mCamDev(camDev)
+    , mFrameHub(frameHub)
+    , mPipeline(nullptr)
+    , mAppsrc(nullptr)
+    , mAppsink(nullptr)
+    , mSubscriber(0)
+{
+    log_debug("%s Device:%s", __func__, mCamDev->getDeviceId().c_str());
+}
+
+VariantSource::~VariantSource()
+{
+    stop();
+}
+
+std::string VariantSource::getDeviceId() const
+{
+    return mCamDev->getDeviceId();
+}
+
+CameraDevice::Status VariantSource::getInfo(CameraInfo &camInfo) const
+{
+    return mCamDev->getInfo(camInfo);
+}
+
+bool VariantSource::isGstV4l2Src() const
+{
+    return false;
+}
+
+CameraDevice::Status VariantSource::init(CameraParameters &camParam)
+{
+    return CameraDevice::Status::SUCCESS;
+}
+
+CameraDevice::Status VariantSource::uninit()
+{
+    return CameraDevice::Status::SUCCESS;
+}
+
+CameraDevice::Status VariantSource::start()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (mPipeline)
+        return CameraDevice::Status::INVALID_STATE;
+
+    uint32_t width = 0, height = 0, fps = 0;
+    CameraParameters::PixelFormat format = CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420;
+    mCamDev->getSize(width, height);
+    mCamDev->getPixelFormat(format);
+    if (mCamDev->getFrameRate(fps) != CameraDevice::Status::SUCCESS || fps == 0)
+        fps = DEFAULT_FRAMERATE;
+
+    /* conversion is done frame by frame as read() asks for it, nothing is ever queued */
+    GError *error = nullptr;
+    mPipeline = gst_parse_launch("appsrc name=src ! videoconvert ! video/x-raw, format=I420 ! "
+                                 "appsink name=sink max-buffers=2 drop=true sync=false",
+                                 &error);
+    if (!mPipeline) {
+        log_error("Unable to create conversion pipeline: %s", error ? error->message : "");
+        if (error)
+            g_error_free(error);
+        return CameraDevice::Status::ERROR_UNKNOWN;
+    }
+    if (error)
+        g_error_free(error);
+
+    mAppsrc = gst_bin_get_by_name(GST_BIN(mPipeline), "src");
+    mAppsink = gst_bin_get_by_name(GST_BIN(mPipeline), "sink");
+
+    std::string fmt = getGstPixFormat(format);
+    gst_app_src_set_caps(GST_APP_SRC(mAppsrc),
+                         gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, fmt.c_str(),
+                                             "width", G_TYPE_INT, width, "height", G_TYPE_INT,
+                                             height, "framerate", GST_TYPE_FRACTION, fps, 1, NULL));
+    g_object_set(G_OBJECT(mAppsrc), "stream-type", 0, "format", GST_FORMAT_TIME, "is-live", TRUE,
+                 NULL);
+
+    mSubscriber = mFrameHub->subscribe();
+    gst_element_set_state(mPipeline, GST_STATE_PLAYING);
+
+    log_info("Conversion for stream variants started, camera %s", mCamDev->getDeviceId().c_str());
+    return CameraDevice::Status::SUCCESS;
+}
+
+CameraDevice::Status VariantSource::stop()
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (!mPipeline)
+        return CameraDevice::Status::INVALID_STATE;
+
+    mFrameHub->unsubscribe(mSubscriber);
+    mSubscriber = 0;
+
+    gst_element_set_state(mPipeline, GST_STATE_NULL);
+    gst_object_unref(mAppsrc);
+    gst_object_unref(mAppsink);
+    gst_object_unref(mPipeline);
+    mAppsrc = nullptr;
+    mAppsink = nullptr;
+    mPipeline = nullptr;
+
+    log_info("Conversion for stream variants stopped, camera %s", mCamDev->getDeviceId().c_str());
+    return CameraDevice::Status::SUCCESS;
+}
+
+static void release_sample(GstSample *sample, GstMapInfo *map)
+{
+    gst_buffer_unmap(gst_sample_get_buffer(sample), map);
+    gst_sample_unref(sample);
+    delete map;
+}
+
+CameraDevice::Status VariantSource::read(CameraData &data)
+{
+    std::lock_guard<std::mutex> locker(mLock);
+
+    if (!mPipeline)
+        return CameraDevice::Status::INVALID_STATE;
+
+    std::shared_ptr<const Frame> frame;
+    CameraDevice::Status ret = mFrameHub->read(mSubscriber, frame, FRAME_TIMEOUT_MS);
+    if (ret != CameraDevice::Status::SUCCESS)
+        return ret;
+
+    /* the camera frame is referenced, not copied, until videoconvert is done with it */
+    if (gst_app_src_push_buffer(GST_APP_SRC(mAppsrc), gst_frame_wrap(frame, mAppsrc))
+        != GST_FLOW_OK)
+        return CameraDevice::Status::ERROR_UNKNOWN;
+
+    GstSample *sample
+        = gst_app_sink_try_pull_sample(GST_APP_SINK(mAppsink), FRAME_TIMEOUT_MS * GST_MSECOND);
+    if (!sample)
+        return CameraDevice::Status::TIMED_OUT;
+
+    GstMapInfo *map = new GstMapInfo;
+    if (!gst_buffer_map(gst_sample_get_buffer(sample), map, GST_MAP_READ)) {
+        gst_sample_unref(sample);
+        delete map;
+        return CameraDevice::Status::ERROR_UNKNOWN;
+    }
+
+    /* converted frame keeps the capture time and sequence of the camera frame */
+    data = CameraData();
+    data.sec = frame->data.sec;
+    data.nsec = frame->data.nsec;
+    data.width = frame->data.width;
+    data.height = frame->data.height;
+    data.format = CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420;
+    data.seq = frame->data.seq;
+    data.timestamp = frame->data.timestamp;
+    data.buf = map->data;
+    data.bufSize = map->size;
+    data.release = [sample, map]() { release_sample(sample, map); };
+
+    return CameraDevice::Status::SUCCESS;
+}
+
+CameraDevice::Status VariantSource::getSize(uint32_t &width, uint32_t &height) const
+{
+    return mCamDev->getSize(width, height);
+}
+
+CameraDevice::Status VariantSource::getPixelFormat(CameraParameters::PixelFormat &format) const
+{
+    format = CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420;
+    return CameraDevice::Status::SUCCESS;
+}
+
+CameraDevice::Status VariantSource::getFrameRate(uint32_t &fps) const
+{
+    return mCamDev->getFrameRate(fps);
+}
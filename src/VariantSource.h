@@ -0,0 +1,62 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <atomic>
+#include <gst/gst.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CameraDevice.h"
+#include "FrameHub.h"
+
+/**
+ *  The VariantSource class is a camera device giving the frames of another camera converted once
+ *  to I420. It feeds a FrameHub shared by all the RTSP stream variants of a mount, so that clients
+ *  asking for different resolutions or frame rates only scale and encode, and the conversion of
+ *  the camera frames is not repeated in every pipeline.
+ *
+ *  The conversion pipeline runs while the hub has subscribers, i.e. while at least one variant is
+ *  playing, and is torn down with the hub's linger time once the last variant stops.
+ */
+class VariantSource final : public CameraDevice {
+public:
+    VariantSource(std::shared_ptr<CameraDevice> camDev, std::shared_ptr<FrameHub> frameHub);
+    ~VariantSource();
+    std::string getDeviceId() const;
+    Status getInfo(CameraInfo &camInfo) const;
+    bool isGstV4l2Src() const;
+    Status init(CameraParameters &camParam);
+    Status uninit();
+    Status start();
+    Status stop();
+    Status read(CameraData &data);
+    Status getSize(uint32_t &width, uint32_t &height) const;
+    Status getPixelFormat(CameraParameters::PixelFormat &format) const;
+    Status getFrameRate(uint32_t &fps) const;
+
+private:
+    std::shared_ptr<CameraDevice> mCamDev;
+    std::shared_ptr<FrameHub> mFrameHub; /* Hub of the camera frames to convert */
+    std::mutex mLock;                    /* Protects the pipeline */
+    GstElement *mPipeline;
+    GstElement *mAppsrc;
+    GstElement *mAppsink;
+    int mSubscriber;
+};
@@ -17,6 +17,7 @@
  */
 #pragma once
 #include <atomic>
+#include <cstdint>
 #include <functional>
 #include <string>
 #include <thread>
@@ -30,6 +31,17 @@ struct VideoSettings {
     int bitRate; // in kbps
     CameraParameters::VIDEO_CODING_FORMAT encoder;
     CameraParameters::VIDEO_FILE_FORMAT fileFormat;
+    int segmentTime; // in seconds, 0 for no time limit
+    int segmentSize; // in MB, 0 for no size limit
+};
+
+struct VideoCaptureStats {
+    uint64_t bytes;      // encoded bytes written
+    uint32_t avgBitRate; // in kbps, since the start of the recording
+    uint32_t bitRate;    // in kbps, over the last second
+    float frameRate;     // encoded frames per second, over the last second
+    uint64_t dropped;    // camera frames lost before the encoder
+    uint32_t elapsedMs;  // recording time
 };
 
 class VideoCapture {
@@ -57,4 +69,8 @@ public:
     virtual int setFrameRate(int frameRate) = 0;
     virtual int setLocation(const std::string vidPath) = 0;
     virtual std::string getLocation() = 0;
+    /* encode ahead of start(), so that the recording holds the seconds before it */
+    virtual int startPreroll() = 0;
+    virtual bool isPrerolling() = 0;
+    virtual int getStats(VideoCaptureStats &stats) = 0;
 };
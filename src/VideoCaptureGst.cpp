@@ -15,9 +15,15 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
 #include <sstream>
 
+#include "CaptureGroup.h"
+#include "EncoderRegistry.h"
+#include "FrameTap.h"
 #include "VideoCaptureGst.h"
+#include "gst_frame.h"
 #include "log.h"
 
 #define DEFAULT_WIDTH 640
@@ -28,11 +34,25 @@
 #define DEFAULT_FILE_FORMAT CameraParameters::VIDEO_FILE_MP4
 #define DEFAULT_FILE_PATH "/tmp/"
 #define V4L2_DEVICE_PREFIX "/dev/"
+/* Interval of the MP4 fragments, at most this much of a recording is lost on power loss */
+#define MP4_FRAGMENT_MS 1000
+/* Default bound of the pre-event ring */
+#define DEFAULT_PREROLL_BYTES (16 * 1024 * 1024)
+/* Sink of the encode pipeline filling the pre-event ring */
+#define PREROLL_SINK "appsink name=rollsink sync=false emit-signals=true"
+/* Window of the instant bitrate and frame rate of the recording */
+#define STATS_WINDOW_US USEC_PER_SEC
 
 int VideoCaptureGst::vidCount = 0;
+bool VideoCaptureGst::sShareStream = false;
+uint32_t VideoCaptureGst::sPrerollTime = 0;
+size_t VideoCaptureGst::sPrerollBytes = DEFAULT_PREROLL_BYTES;
 
-VideoCaptureGst::VideoCaptureGst(std::shared_ptr<CameraDevice> camDev)
+VideoCaptureGst::VideoCaptureGst(std::shared_ptr<CameraDevice> camDev,
+                                 std::shared_ptr<FrameHub> frameHub)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
+    , mSubscriber(0)
     , mState(STATE_IDLE)
     , mWidth(0)
     , mHeight(0)
@@ -41,14 +61,34 @@ VideoCaptureGst::VideoCaptureGst(std::shared_ptr<CameraDevice> camDev)
     , mEnc(DEFAULT_ENCODER)
     , mFileFmt(DEFAULT_FILE_FORMAT)
     , mFilePath(DEFAULT_FILE_PATH)
+    , mSegmentTime(0)
+    , mSegmentSize(0)
     , mPipeline(nullptr)
+    , mFrameDuration(GST_CLOCK_TIME_NONE)
+    , mTapSrc(nullptr)
+    , mTapOffset(GST_CLOCK_TIME_NONE)
+    , mRollPipeline(nullptr)
+    , mRingBytes(0)
+    , mRollRecording(false)
+    , mStatBytes(0)
+    , mStatStart(0)
+    , mWinStart(0)
+    , mWinBytes(0)
+    , mWinFrames(0)
+    , mWinBitRate(0)
+    , mWinFrameRate(0)
+    , mDropped(0)
+    , mLastOffset(GST_BUFFER_OFFSET_NONE)
 {
     log_info("%s Device:%s", __func__, mCamDev->getDeviceId().c_str());
 }
 
 VideoCaptureGst::VideoCaptureGst(std::shared_ptr<CameraDevice> camDev,
-                                 struct VideoSettings &vidSetting)
+                                 struct VideoSettings &vidSetting,
+                                 std::shared_ptr<FrameHub> frameHub)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
+    , mSubscriber(0)
     , mState(STATE_IDLE)
     , mWidth(vidSetting.width)
     , mHeight(vidSetting.height)
@@ -57,8 +97,24 @@ VideoCaptureGst::VideoCaptureGst(std::shared_ptr<CameraDevice> camDev,
     , mEnc(vidSetting.encoder)
     , mFileFmt(vidSetting.fileFormat)
     , mFilePath(DEFAULT_FILE_PATH)
+    , mSegmentTime(vidSetting.segmentTime)
+    , mSegmentSize(vidSetting.segmentSize)
     , mPipeline(nullptr)
-
+    , mFrameDuration(GST_CLOCK_TIME_NONE)
+    , mTapSrc(nullptr)
+    , mTapOffset(GST_CLOCK_TIME_NONE)
+    , mRollPipeline(nullptr)
+    , mRingBytes(0)
+    , mRollRecording(false)
+    , mStatBytes(0)
+    , mStatStart(0)
+    , mWinStart(0)
+    , mWinBytes(0)
+    , mWinFrames(0)
+    , mWinBitRate(0)
+    , mWinFrameRate(0)
+    , mDropped(0)
+    , mLastOffset(GST_BUFFER_OFFSET_NONE)
 {
     log_info("%s Device:%s with settings", __func__, mCamDev->getDeviceId().c_str());
 }
@@ -93,6 +149,7 @@ int VideoCaptureGst::uninit()
         return -1;
     }
 
+    stopPreroll();
     setState(STATE_IDLE);
     return 0;
 }
@@ -108,15 +165,47 @@ int VideoCaptureGst::start()
 
     // TODO::Validate video settings
 
-    int ret = 0;
-    if (mCamDev->isGstV4l2Src()) {
-        ret = createV4l2Pipeline();
-        if (!ret)
-            setState(STATE_RUN);
+    {
+        std::lock_guard<std::mutex> locker(mStatsLock);
+        mStatBytes = 0;
+        mStatStart = mWinStart = now_usec();
+        mWinBytes = mWinFrames = 0;
+        mWinBitRate = 0;
+        mWinFrameRate = 0;
+        mDropped = 0;
+    }
+
+    int ret = 1;
+    if (mRollPipeline) {
+        /* the camera is being encoded for the pre-event ring, only the file is new */
+        ret = createPrerollWriter();
+        if (ret) {
+            /* the ring pipeline holds the camera, the recording starts now without it */
+            log_error("Pre-event recording failed, recording without it");
+            stopPreroll();
+        }
+    }
+    if (ret) {
+        /* the stream being encoded already is recorded as is, if of the encoding asked for */
+        /* the RTSP pipeline runs on a clock of its own, grouped cameras encode themselves */
+        std::shared_ptr<FrameTap> tap;
+        if (sShareStream && !mCaptureGroup)
+            tap = FrameTap::find(mCamDev->getDeviceId(), FRAME_TAP_RECORD);
+
+        if (tap)
+            ret = createTapPipeline(tap);
+        if (tap && !ret)
+            log_info("Recording the RTSP stream of %s", mCamDev->getDeviceId().c_str());
+        else if (mCamDev->isGstV4l2Src())
+            ret = createV4l2Pipeline(false);
         else
-            setState(STATE_ERROR);
-    } else
-        ret = -1;
+            ret = createAppsrcPipeline(false);
+    }
+
+    if (!ret)
+        setState(STATE_RUN);
+    else
+        setState(STATE_ERROR);
 
     return ret;
 }
@@ -271,34 +360,68 @@ int VideoCaptureGst::setLocation(const std::string vidPath)
     return ret;
 }
 
-std::string VideoCaptureGst::getLocation()
+void VideoCaptureGst::setShareStream(bool enable)
 {
-    return mFilePath;
+    sShareStream = enable;
 }
 
-std::string VideoCaptureGst::getGstEncName(int encFormat)
+bool VideoCaptureGst::getShareStream()
 {
-    std::string ret;
+    return sShareStream;
+}
 
-    switch (encFormat) {
-    case CameraParameters::VIDEO_CODING_AVC:
-        ret = std::string("x264enc");
-        break;
-    default:
-        ret = {};
-        break;
+void VideoCaptureGst::setCaptureGroup(std::shared_ptr<CaptureGroup> group)
+{
+    if (getState() == STATE_RUN)
+        log_warning("Change will not take effect");
+
+    mCaptureGroup = group;
+}
+
+int VideoCaptureGst::setSegment(int seconds, int megabytes)
+{
+    if (seconds < 0 || megabytes < 0) {
+        log_error("Invalid segment length");
+        return 1;
     }
 
-    return ret;
+    if (getState() == STATE_RUN)
+        log_warning("Change will not take effect");
+
+    mSegmentTime = seconds;
+    mSegmentSize = megabytes;
+
+    return 0;
+}
+
+std::string VideoCaptureGst::getLocation()
+{
+    return mFilePath;
+}
+
+std::string VideoCaptureGst::getGstEncName(int encFormat)
+{
+    /* best encoder installed for the format, with the bitrate applied */
+    return EncoderRegistry::getEncoderPipeline(
+        static_cast<CameraParameters::VIDEO_CODING_FORMAT>(encFormat), mBitRate);
 }
 
 std::string VideoCaptureGst::getGstParserName(int encFormat)
+{
+    return EncoderRegistry::getParserName(
+        static_cast<CameraParameters::VIDEO_CODING_FORMAT>(encFormat));
+}
+
+std::string VideoCaptureGst::getGstMuxerName(int fileFormat)
 {
     std::string ret;
 
-    switch (encFormat) {
-    case CameraParameters::VIDEO_CODING_AVC:
-        ret = std::string("h264parse");
+    switch (fileFormat) {
+    case CameraParameters::VIDEO_FILE_MP4:
+        ret = std::string("mp4mux");
+        break;
+    case CameraParameters::VIDEO_FILE_MKV:
+        ret = std::string("matroskamux");
         break;
     default:
         ret = {};
@@ -308,13 +431,16 @@ std::string VideoCaptureGst::getGstParserName(int encFormat)
     return ret;
 }
 
-std::string VideoCaptureGst::getGstMuxerName(int fileFormat)
+std::string VideoCaptureGst::getFileExt(int fileFormat)
 {
     std::string ret;
 
     switch (fileFormat) {
     case CameraParameters::VIDEO_FILE_MP4:
-        ret = std::string("mp4mux");
+        ret = std::string("mp4");
+        break;
+    case CameraParameters::VIDEO_FILE_MKV:
+        ret = std::string("mkv");
         break;
     default:
         ret = {};
@@ -324,23 +450,86 @@ std::string VideoCaptureGst::getGstMuxerName(int fileFormat)
     return ret;
 }
 
-std::string VideoCaptureGst::getFileExt(int fileFormat)
+std::string VideoCaptureGst::getGstPixFormat(CameraParameters::PixelFormat pixFormat)
 {
     std::string ret;
 
-    switch (fileFormat) {
-    case CameraParameters::VIDEO_FILE_MP4:
-        ret = std::string("mp4");
+    switch (pixFormat) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        ret = std::string("RGB");
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        ret = std::string("UYVY");
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        ret = std::string("YUY2");
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV422P:
+        ret = std::string("Y42B");
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        ret = std::string("NV12");
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        ret = std::string("GRAY8");
         break;
     default:
-        ret = {};
+        ret = std::string("I420");
         break;
     }
 
     return ret;
 }
 
-std::string VideoCaptureGst::getGstV4l2PipelineName()
+/*
+ * Files are written by splitmuxsink, which starts a new file at the first key frame past the
+ * segment length without the pipeline stopping. Every segment is finalized on its own, and the
+ * muxer is set up in setupMuxer() so that the file being written survives a power loss.
+ */
+std::string VideoCaptureGst::getGstSinkName(const std::string &ext)
+{
+    std::stringstream ss;
+    bool segmented = mSegmentTime > 0 || mSegmentSize > 0;
+
+    ss << "splitmuxsink name=recsink location=" << mFilePath << "vid_" << std::to_string(++vidCount)
+       << (segmented ? "_%05d." : ".") << ext;
+    if (mSegmentTime > 0)
+        ss << " max-size-time=" << (uint64_t)mSegmentTime * GST_SECOND
+           << " send-keyframe-requests=true";
+    if (mSegmentSize > 0)
+        ss << " max-size-bytes=" << (uint64_t)mSegmentSize * 1024 * 1024;
+
+    return ss.str();
+}
+
+/* fragmented MP4 is playable up to the last fragment written, Matroska up to the last cluster */
+int VideoCaptureGst::setupMuxer()
+{
+    std::string muxer = getGstMuxerName(mFileFmt);
+    GstElement *mux = gst_element_factory_make(muxer.c_str(), NULL);
+    if (!mux) {
+        log_error("Muxer %s not available", muxer.c_str());
+        return 1;
+    }
+    if (mFileFmt == CameraParameters::VIDEO_FILE_MP4)
+        g_object_set(G_OBJECT(mux), "fragment-duration", MP4_FRAGMENT_MS, NULL);
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(mPipeline), "recsink");
+    g_object_set(G_OBJECT(sink), "muxer", mux, NULL);
+    gst_object_unref(sink);
+
+    return 0;
+}
+
+// The stream of a camera encoding on board is recorded as it is, in the codec of the camera
+bool VideoCaptureGst::getEncodedFormat(CameraParameters::VIDEO_CODING_FORMAT &codec)
+{
+    return mCamDev->getEncodedFormat(codec) == CameraDevice::Status::SUCCESS
+        && !EncoderRegistry::getEncodedCaps(codec).empty()
+        && !getGstParserName(codec).empty();
+}
+
+std::string VideoCaptureGst::getGstV4l2PipelineName(bool preroll)
 {
     std::string device = mCamDev->getDeviceId();
     if (device.empty())
@@ -348,33 +537,163 @@ std::string VideoCaptureGst::getGstV4l2PipelineName()
 
     device.insert(0, V4L2_DEVICE_PREFIX);
 
-    std::string encoder = getGstEncName(mEnc);
-    std::string parser = getGstParserName(mEnc);
     std::string muxer = getGstMuxerName(mFileFmt);
     std::string ext = getFileExt(mFileFmt);
+    CameraParameters::VIDEO_CODING_FORMAT codec;
+    if (getEncodedFormat(codec)) {
+        if (muxer.empty() || ext.empty())
+            return {};
+        return "v4l2src name=camsrc device=" + device + " ! "
+            + EncoderRegistry::getEncodedCaps(codec) + " ! " + getGstParserName(codec) + " ! "
+            + (preroll ? PREROLL_SINK : getGstSinkName(ext));
+    }
+
+    std::string encoder = getGstEncName(mEnc);
+    std::string parser = getGstParserName(mEnc);
     if (encoder.empty() || parser.empty() || muxer.empty() || ext.empty())
         return {};
 
     std::stringstream filter;
-    std::stringstream sbr;
     std::stringstream ss;
 
-    filter << "video/x-raw, ";
+    // MJPEG frames are tapped before being decoded, for stills to be saved as they come
+    CameraParameters::PixelFormat pixFormat = CameraParameters::PixelFormat::PIXEL_FORMAT_MIN;
+    mCamDev->getPixelFormat(pixFormat);
+    std::string decoder;
+    if (pixFormat == CameraParameters::PixelFormat::PIXEL_FORMAT_MJPEG)
+        decoder = EncoderRegistry::getDecoderName(CameraParameters::VIDEO_CODING_MJPEG);
+    bool mjpeg = !decoder.empty();
+
+    filter << (mjpeg ? "image/jpeg, " : "video/x-raw, ");
     if (mFrmRate > 0)
         filter << " framerate=" << std::to_string(mFrmRate) << "/1,";
     if (mWidth > 0 && mHeight > 0)
         filter << " width=" << std::to_string(mWidth) << ", height=" << std::to_string(mHeight);
 
-    if (mBitRate > 0)
-        sbr << " bitrate=" << std::to_string(mBitRate);
+    /* still capture takes its frames from the recording, the device cannot be opened twice */
+    ss << "v4l2src name=camsrc device=" << device << " ! ";
+    if (mjpeg)
+        ss << filter.str() << " ! " << FrameTap::getPipeline() << " ! " << decoder;
+    else
+        ss << FrameTap::getPipeline() << " ! " << filter.str();
+    ss << " ! " << encoder << " ! " << parser << " ! "
+       << (preroll ? PREROLL_SINK : getGstSinkName(ext));
+
+    return ss.str();
+}
+
+std::string VideoCaptureGst::getGstAppsrcPipelineName(bool preroll)
+{
+    /* frames encoded by the camera are only parsed for the muxer */
+    CameraParameters::VIDEO_CODING_FORMAT codec;
+    if (getEncodedFormat(codec)) {
+        std::string ext = getFileExt(mFileFmt);
+        if (getGstMuxerName(mFileFmt).empty() || ext.empty())
+            return {};
+        return "appsrc name=mysrc ! " + getGstParserName(codec) + " ! "
+            + (preroll ? PREROLL_SINK : getGstSinkName(ext));
+    }
+
+    std::string encoder = getGstEncName(mEnc);
+    std::string parser = getGstParserName(mEnc);
+    std::string muxer = getGstMuxerName(mFileFmt);
+    std::string ext = getFileExt(mFileFmt);
+    if (encoder.empty() || parser.empty() || muxer.empty() || ext.empty())
+        return {};
+
+    std::stringstream rate;
+    std::stringstream scale;
+    std::stringstream ss;
+
+    /* appsrc runs at the camera rate, convert if a different rate is set */
+    if (mFrmRate > 0)
+        rate << " ! videorate ! video/x-raw, framerate=" << std::to_string(mFrmRate) << "/1";
 
-    ss << "v4l2src device=" << device << " ! " << filter.str() << " ! " << encoder << sbr.str()
-       << " ! " << parser << " ! " << muxer << " ! "
-       << "filesink location=" << mFilePath + "vid_" << std::to_string(++vidCount) << "." + ext;
+    if (mWidth > 0 && mHeight > 0)
+        scale << " ! videoscale ! video/x-raw, width=" << std::to_string(mWidth)
+              << ", height=" << std::to_string(mHeight);
+
+    ss << "appsrc name=mysrc" << rate.str() << " ! videoconvert" << scale.str() << " ! " << encoder
+       << " ! " << parser << " ! " << (preroll ? PREROLL_SINK : getGstSinkName(ext));
 
     return ss.str();
 }
 
+/* the stream is encoded by the RTSP pipeline, only parsed for the muxer */
+std::string VideoCaptureGst::getGstTapPipelineName()
+{
+    std::string parser = getGstParserName(mEnc);
+    std::string muxer = getGstMuxerName(mFileFmt);
+    std::string ext = getFileExt(mFileFmt);
+    if (parser.empty() || muxer.empty() || ext.empty())
+        return {};
+
+    return "appsrc name=mysrc ! " + parser + " ! " + getGstSinkName(ext);
+}
+
+GstBuffer *VideoCaptureGst::readFrame(GstElement *appsrc, int timeoutMs)
+{
+    GstBuffer *buffer = nullptr;
+    CameraDevice::Status ret;
+    if (mFrameHub) {
+        // Frame is shared with other consumers, release it when gstreamer is done
+        std::shared_ptr<const Frame> frame;
+        ret = mFrameHub->read(mSubscriber, frame, timeoutMs);
+        if (ret == CameraDevice::Status::SUCCESS) {
+            buffer = gst_frame_wrap(frame, appsrc);
+            gst_frame_read(&mMisses);
+        }
+    }
+
+    if (!buffer) {
+        // appsrc waits for a push before asking again, so never leave it without a frame
+        mDropped++;
+        buffer = gst_frame_fallback(&mMisses, mFrameHub.get(), appsrc);
+        if (!buffer)
+            return nullptr;
+    }
+    GST_BUFFER_DURATION(buffer) = mFrameDuration;
+
+    return buffer;
+}
+
+/* called on the pusher thread, waits for a camera frame and pushes it to appsrc */
+static void pushFrame(VideoCaptureGst *obj, GstElement *appsrc, int timeoutMs)
+{
+    GstBuffer *buffer = obj->readFrame(appsrc, timeoutMs);
+    if (!buffer)
+        return;
+    GstFlowReturn ret = gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer);
+    if (ret != GST_FLOW_OK && ret != GST_FLOW_FLUSHING)
+        log_error("Error in sending data to gst pipeline");
+}
+
+/* the frames are pushed from the pusher thread, the streaming thread does not wait on the camera */
+static void cbNeedData(GstAppSrc *appsrc, guint unused_size, gpointer user_data)
+{
+    VideoCaptureGst *obj = reinterpret_cast<VideoCaptureGst *>(user_data);
+
+    obj->wantFrames(true);
+}
+
+static void cbEnoughData(GstAppSrc *appsrc, gpointer user_data)
+{
+    VideoCaptureGst *obj = reinterpret_cast<VideoCaptureGst *>(user_data);
+
+    obj->wantFrames(false);
+}
+
+void VideoCaptureGst::wantFrames(bool want)
+{
+    if (!mPusher)
+        return;
+
+    if (want)
+        mPusher->want();
+    else
+        mPusher->enough();
+}
+
 static gboolean gstMsgCb(GstBus *bus, GstMessage *message, gpointer user_data)
 {
     GstElement *pipeline = (GstElement *)user_data;
@@ -427,21 +746,217 @@ static gboolean gstMsgCb(GstBus *bus, GstMessage *message, gpointer user_data)
     return TRUE;
 }
 
-int VideoCaptureGst::createV4l2Pipeline()
+int VideoCaptureGst::createV4l2Pipeline(bool preroll)
 {
-    int ret = 0;
     log_info("%s", __func__);
 
     GError *error = nullptr;
-    GstStateChangeReturn result;
 
-    std::string pipeline_str = getGstV4l2PipelineName();
+    std::string pipeline_str = getGstV4l2PipelineName(preroll);
+    if (pipeline_str.empty()) {
+        log_error("Pipeline String error");
+        return 1;
+    }
+    log_debug("pipeline = %s", pipeline_str.c_str());
+
+    mPipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (!mPipeline) {
+        log_error("Error creating pipeline");
+        if (error)
+            g_clear_error(&error);
+        return 1;
+    }
+
+    gst_frame_add_thread_policy(mPipeline, "camsrc", "src", mCamDev->getDeviceId(), "rec");
+    if (preroll ? connectPreroll() : setupMuxer()) {
+        gst_object_unref(mPipeline);
+        mPipeline = nullptr;
+        return 1;
+    }
+
+    int ret = startPipeline();
+    if (!ret)
+        FrameTap::attach(mCamDev->getDeviceId(), mPipeline);
+
+    return ret;
+}
+
+int VideoCaptureGst::createAppsrcPipeline(bool preroll)
+{
+    log_info("%s", __func__);
+
+    GError *error = nullptr;
+    CameraParameters::PixelFormat pixFormat;
+    uint32_t width, height, fps;
+
+    std::string pipeline_str = getGstAppsrcPipelineName(preroll);
+    if (pipeline_str.empty()) {
+        log_error("Pipeline String error");
+        return 1;
+    }
+    log_debug("pipeline = %s", pipeline_str.c_str());
+
+    mPipeline = gst_parse_launch(pipeline_str.c_str(), &error);
+    if (!mPipeline) {
+        log_error("Error creating pipeline");
+        if (error)
+            g_clear_error(&error);
+        return 1;
+    }
+
+    gst_frame_add_thread_policy(mPipeline, "mysrc", "src", mCamDev->getDeviceId(), "rec");
+    if (preroll ? connectPreroll() : setupMuxer()) {
+        gst_object_unref(mPipeline);
+        mPipeline = nullptr;
+        return 1;
+    }
+
+    mCamDev->getSize(width, height);
+    mCamDev->getPixelFormat(pixFormat);
+    fps = 0;
+    if (mCamDev->getFrameRate(fps) != CameraDevice::Status::SUCCESS || fps == 0)
+        fps = DEFAULT_FRAMERATE;
+    mFrameDuration = gst_util_uint64_scale_int(GST_SECOND, 1, fps);
+
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(mPipeline), "mysrc");
+    GstCaps *caps;
+    CameraParameters::VIDEO_CODING_FORMAT codec;
+    if (getEncodedFormat(codec)) {
+        caps = gst_caps_from_string(EncoderRegistry::getEncodedCaps(codec).c_str());
+        gst_caps_set_simple(caps, "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+                            "framerate", GST_TYPE_FRACTION, fps, 1, NULL);
+    } else {
+        caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING,
+                                   getGstPixFormat(pixFormat).c_str(), "width", G_TYPE_INT, width,
+                                   "height", G_TYPE_INT, height, "framerate", GST_TYPE_FRACTION,
+                                   fps, 1, NULL);
+    }
+    gst_app_src_set_caps(GST_APP_SRC(appsrc), caps);
+    gst_caps_unref(caps);
+    /* buffers carry the capture time of the frames */
+    g_object_set(G_OBJECT(appsrc), "stream-type", 0, "format", GST_FORMAT_TIME, "is-live", TRUE,
+                 NULL);
+
+    /* frames are pushed from a thread of their own, paced by the camera */
+    mPusher.reset(new FramePusher(mCamDev->getDeviceId(), [this, appsrc](int timeoutMs) {
+        pushFrame(this, appsrc, timeoutMs);
+    }));
+    mPusher->setFrameRate(fps);
+
+    GstAppSrcCallbacks cbs;
+    cbs.need_data = cbNeedData;
+    cbs.enough_data = cbEnoughData;
+    cbs.seek_data = NULL;
+    gst_app_src_set_callbacks(GST_APP_SRC_CAST(appsrc), &cbs, this, NULL);
+    gst_object_unref(appsrc);
+
+    /* get a share of the camera frames for the recording */
+    if (mFrameHub)
+        mSubscriber = mFrameHub->subscribe();
+    mMisses = GstFrameMisses();
+
+    int ret = startPipeline();
+    if (ret)
+        mPusher.reset();
+    if (ret && mFrameHub)
+        mFrameHub->unsubscribe(mSubscriber);
+
+    return ret;
+}
+
+/* media type of the encoded stream for each coding format the recording takes */
+static const char *getGstMediaType(CameraParameters::VIDEO_CODING_FORMAT encFormat)
+{
+    switch (encFormat) {
+    case CameraParameters::VIDEO_CODING_AVC:
+        return "video/x-h264";
+    case CameraParameters::VIDEO_CODING_HEVC:
+        return "video/x-h265";
+    case CameraParameters::VIDEO_CODING_MJPEG:
+        return "image/jpeg";
+    default:
+        return nullptr;
+    }
+}
+
+/* called from the streaming thread of the RTSP pipeline */
+void VideoCaptureGst::pushStream(GstSample *sample)
+{
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    if (!buffer)
+        return;
+
+    /* a recording starts with a key frame */
+    if (!GST_CLOCK_TIME_IS_VALID(mTapOffset)) {
+        if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+            return;
+        mTapOffset = GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DTS(buffer)) ? GST_BUFFER_DTS(buffer)
+                                                                     : GST_BUFFER_PTS(buffer);
+        if (!GST_CLOCK_TIME_IS_VALID(mTapOffset))
+            mTapOffset = 0;
+    }
+
+    /* the data is shared, only the timestamps are moved to the start of the recording */
+    buffer = gst_buffer_copy(buffer);
+    if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)))
+        GST_BUFFER_PTS(buffer) = GST_BUFFER_PTS(buffer) > mTapOffset
+            ? GST_BUFFER_PTS(buffer) - mTapOffset
+            : 0;
+    if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DTS(buffer)))
+        GST_BUFFER_DTS(buffer) = GST_BUFFER_DTS(buffer) > mTapOffset
+            ? GST_BUFFER_DTS(buffer) - mTapOffset
+            : 0;
+
+    if (gst_app_src_push_buffer(GST_APP_SRC(mTapSrc), buffer) != GST_FLOW_OK)
+        log_error("Error in sending data to gst pipeline");
+}
+
+int VideoCaptureGst::createTapPipeline(std::shared_ptr<FrameTap> tap)
+{
+    log_info("%s", __func__);
+
+    const char *type = getGstMediaType(mEnc);
+    GstCaps *caps = tap->getCaps();
+    if (!caps || !type || !gst_structure_has_name(gst_caps_get_structure(caps, 0), type)) {
+        log_warning("RTSP stream not of the recording encoding, encode again");
+        if (caps)
+            gst_caps_unref(caps);
+        return 1;
+    }
+
+    int ret = createStreamPipeline(caps);
+    gst_caps_unref(caps);
+    if (ret)
+        return 1;
+
+    mTapOffset = GST_CLOCK_TIME_NONE;
+    if (tap->open([this](GstSample *sample) { pushStream(sample); })) {
+        log_warning("RTSP stream recorded already");
+        gst_element_set_state(mPipeline, GST_STATE_NULL);
+        gst_object_unref(mPipeline);
+        mPipeline = nullptr;
+        gst_object_unref(mTapSrc);
+        mTapSrc = nullptr;
+        return 1;
+    }
+
+    /* the recording starts at the next key frame, ask for it now */
+    mTap = tap;
+    mTap->requestKeyFrame();
+    return 0;
+}
+
+/* File pipeline of an encoded stream, the buffers are pushed with pushStream() */
+int VideoCaptureGst::createStreamPipeline(GstCaps *caps)
+{
+    std::string pipeline_str = getGstTapPipelineName();
     if (pipeline_str.empty()) {
         log_error("Pipeline String error");
         return 1;
     }
     log_debug("pipeline = %s", pipeline_str.c_str());
 
+    GError *error = nullptr;
     mPipeline = gst_parse_launch(pipeline_str.c_str(), &error);
     if (!mPipeline) {
         log_error("Error creating pipeline");
@@ -449,6 +964,319 @@ int VideoCaptureGst::createV4l2Pipeline()
             g_clear_error(&error);
         return 1;
     }
+
+    if (setupMuxer()) {
+        gst_object_unref(mPipeline);
+        mPipeline = nullptr;
+        return 1;
+    }
+
+    mTapSrc = gst_bin_get_by_name(GST_BIN(mPipeline), "mysrc");
+    gst_app_src_set_caps(GST_APP_SRC(mTapSrc), caps);
+    g_object_set(G_OBJECT(mTapSrc), "stream-type", 0, "format", GST_FORMAT_TIME, "is-live", TRUE,
+                 NULL);
+
+    if (startPipeline()) {
+        gst_object_unref(mTapSrc);
+        mTapSrc = nullptr;
+        return 1;
+    }
+
+    return 0;
+}
+
+void VideoCaptureGst::setPreroll(uint32_t seconds, size_t maxBytes)
+{
+    sPrerollTime = seconds;
+    if (maxBytes > 0)
+        sPrerollBytes = maxBytes;
+}
+
+bool VideoCaptureGst::isPrerollEnabled()
+{
+    return sPrerollTime > 0;
+}
+
+/*
+ * The camera is encoded all along while pre-rolling, into a ring of the last GOPs in memory. A
+ * recording writes the ring to the file and then appends the buffers as they are encoded, so it
+ * holds the seconds before it was started.
+ */
+int VideoCaptureGst::startPreroll()
+{
+    log_info("%s::%s", typeid(this).name(), __func__);
+
+    if (!isPrerollEnabled() || getState() != STATE_INIT) {
+        log_error("Invalid State : %d", getState());
+        return -1;
+    }
+    if (mRollPipeline)
+        return 0;
+
+    int ret = mCamDev->isGstV4l2Src() ? createV4l2Pipeline(true) : createAppsrcPipeline(true);
+    if (ret)
+        return ret;
+
+    /* the encode pipeline runs across recordings, mPipeline is the file pipeline of each */
+    mRollPipeline = mPipeline;
+    mPipeline = nullptr;
+
+    log_info("Pre-event recording of %us, at most %zu bytes", sPrerollTime, sPrerollBytes);
+    return 0;
+}
+
+int VideoCaptureGst::stopPreroll()
+{
+    if (!mRollPipeline)
+        return 0;
+
+    log_info("%s::%s", typeid(this).name(), __func__);
+
+    FrameTap::detach(mCamDev->getDeviceId(), mRollPipeline);
+
+    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(mRollPipeline));
+    gst_bus_remove_signal_watch(bus);
+    gst_object_unref(GST_OBJECT(bus));
+    gst_element_set_state(mRollPipeline, GST_STATE_NULL);
+    mPusher.reset();
+    gst_object_unref(mRollPipeline);
+    mRollPipeline = nullptr;
+
+    if (mFrameHub)
+        mFrameHub->unsubscribe(mSubscriber);
+
+    std::lock_guard<std::mutex> locker(mRollLock);
+    while (!mRing.empty())
+        dropGop();
+
+    return 0;
+}
+
+bool VideoCaptureGst::isPrerolling()
+{
+    return mRollPipeline != nullptr;
+}
+
+static GstFlowReturn cbRollSample(GstElement *sink, gpointer user_data)
+{
+    VideoCaptureGst *obj = reinterpret_cast<VideoCaptureGst *>(user_data);
+
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    if (sample) {
+        obj->pushPreroll(sample);
+        gst_sample_unref(sample);
+    }
+
+    return GST_FLOW_OK;
+}
+
+int VideoCaptureGst::connectPreroll()
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(mPipeline), "rollsink");
+    if (!sink)
+        return 1;
+
+    g_signal_connect(sink, "new-sample", G_CALLBACK(cbRollSample), this);
+    gst_object_unref(sink);
+    return 0;
+}
+
+/* called with mRollLock held */
+void VideoCaptureGst::dropGop()
+{
+    for (GstSample *sample : mRing.front().samples)
+        gst_sample_unref(sample);
+    mRingBytes -= mRing.front().bytes;
+    mRing.pop_front();
+}
+
+/* called from the streaming thread of the encode pipeline */
+void VideoCaptureGst::pushPreroll(GstSample *sample)
+{
+    std::lock_guard<std::mutex> locker(mRollLock);
+    if (mRollRecording) {
+        pushStream(sample);
+        return;
+    }
+
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    if (!buffer)
+        return;
+
+    GstClockTime ts = GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DTS(buffer)) ? GST_BUFFER_DTS(buffer)
+                                                                      : GST_BUFFER_PTS(buffer);
+
+    /* the ring is made of whole GOPs, so that it always starts with a key frame */
+    if (!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+        mRing.push_back({{}, 0, ts});
+    else if (mRing.empty())
+        return;
+
+    Gop &gop = mRing.back();
+    gsize size = gst_buffer_get_size(buffer);
+    gop.samples.push_back(gst_sample_ref(sample));
+    gop.bytes += size;
+    mRingBytes += size;
+
+    /* drop the oldest GOP once the others cover the pre-event time, or memory runs out */
+    while (mRing.size() > 1
+           && (mRingBytes > sPrerollBytes
+               || (GST_CLOCK_TIME_IS_VALID(ts) && GST_CLOCK_TIME_IS_VALID(mRing[1].start)
+                   && ts - mRing[1].start >= (GstClockTime)sPrerollTime * GST_SECOND)))
+        dropGop();
+
+    /* a single GOP over the memory bound, wait for the next key frame */
+    if (mRingBytes > sPrerollBytes) {
+        log_warning("Pre-event ring over %zu bytes, GOP dropped", sPrerollBytes);
+        dropGop();
+    }
+}
+
+int VideoCaptureGst::createPrerollWriter()
+{
+    log_info("%s", __func__);
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(mRollPipeline), "rollsink");
+    GstPad *pad = gst_element_get_static_pad(sink, "sink");
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    gst_object_unref(pad);
+    gst_object_unref(sink);
+    if (!caps) {
+        log_error("Pre-event encoder not running");
+        return 1;
+    }
+
+    int ret = createStreamPipeline(caps);
+    gst_caps_unref(caps);
+    if (ret)
+        return 1;
+
+    /* the ring goes to the file first, then the buffers as they come */
+    std::lock_guard<std::mutex> locker(mRollLock);
+    mTapOffset = GST_CLOCK_TIME_NONE;
+    while (!mRing.empty()) {
+        for (GstSample *sample : mRing.front().samples)
+            pushStream(sample);
+        dropGop();
+    }
+    mRollRecording = true;
+
+    return 0;
+}
+
+static GstPadProbeReturn cbEncodedFrame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    VideoCaptureGst *obj = reinterpret_cast<VideoCaptureGst *>(user_data);
+
+    obj->onEncodedFrame(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn cbCameraFrame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    VideoCaptureGst *obj = reinterpret_cast<VideoCaptureGst *>(user_data);
+
+    obj->onCameraFrame(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+/* called from the streaming thread, for every buffer going into the file */
+void VideoCaptureGst::onEncodedFrame(GstBuffer *buffer)
+{
+    gsize size = gst_buffer_get_size(buffer);
+    usec_t now = now_usec();
+
+    std::lock_guard<std::mutex> locker(mStatsLock);
+    mStatBytes += size;
+    mWinBytes += size;
+    mWinFrames++;
+    if (now - mWinStart < STATS_WINDOW_US)
+        return;
+
+    mWinBitRate = mWinBytes * 8 * USEC_PER_MSEC / (now - mWinStart);
+    mWinFrameRate = (float)mWinFrames * USEC_PER_SEC / (now - mWinStart);
+    mWinStart = now;
+    mWinBytes = 0;
+    mWinFrames = 0;
+}
+
+/* v4l2src numbers the frames of the driver, frames it could not dequeue in time leave a gap */
+void VideoCaptureGst::onCameraFrame(GstBuffer *buffer)
+{
+    guint64 offset = GST_BUFFER_OFFSET(buffer);
+    if (offset == GST_BUFFER_OFFSET_NONE)
+        return;
+
+    if (mLastOffset != GST_BUFFER_OFFSET_NONE && offset > mLastOffset + 1)
+        mDropped += offset - mLastOffset - 1;
+    mLastOffset = offset;
+}
+
+void VideoCaptureGst::addStatsProbes()
+{
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(mPipeline), "recsink");
+    if (sink) {
+        /* requested when the parser was linked */
+        GstPad *pad = gst_element_get_static_pad(sink, "video");
+        if (pad) {
+            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cbEncodedFrame, this, NULL);
+            gst_object_unref(pad);
+        }
+        gst_object_unref(sink);
+    }
+
+    GstElement *src = gst_bin_get_by_name(GST_BIN(mPipeline), "camsrc");
+    if (src) {
+        GstPad *pad = gst_element_get_static_pad(src, "src");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cbCameraFrame, this, NULL);
+        gst_object_unref(pad);
+        gst_object_unref(src);
+    }
+}
+
+int VideoCaptureGst::getStats(VideoCaptureStats &stats)
+{
+    if (getState() != STATE_RUN)
+        return -1;
+
+    usec_t now = now_usec();
+    {
+        std::lock_guard<std::mutex> locker(mStatsLock);
+        stats.bytes = mStatBytes;
+        stats.elapsedMs = (now - mStatStart) / USEC_PER_MSEC;
+        stats.avgBitRate
+            = now > mStatStart ? mStatBytes * 8 * USEC_PER_MSEC / (now - mStatStart) : 0;
+        /* nothing came for a whole window, the encoder or the camera stalled */
+        bool stalled = now - mWinStart >= 2 * STATS_WINDOW_US;
+        stats.bitRate = stalled ? 0 : mWinBitRate;
+        stats.frameRate = stalled ? 0 : mWinFrameRate;
+    }
+
+    /* frames of the camera the encoder did not keep up with, a tapped stream has no camera */
+    stats.dropped = mDropped;
+    GstElement *camera = mRollPipeline ? mRollPipeline : mTap ? nullptr : mPipeline;
+    GstElement *appsrc = camera ? gst_bin_get_by_name(GST_BIN(camera), "mysrc") : nullptr;
+    if (appsrc) {
+        stats.dropped += gst_frame_get_dropped(appsrc);
+        gst_object_unref(appsrc);
+    }
+
+    return 0;
+}
+
+int VideoCaptureGst::startPipeline()
+{
+    GstStateChangeReturn result;
+
+    addStatsProbes();
+
+    if (mCaptureGroup) {
+        /* running time, and so every timestamp, is the same for all cameras of the group */
+        gst_pipeline_use_clock(GST_PIPELINE(mPipeline), mCaptureGroup->getClock());
+        gst_element_set_start_time(mPipeline, GST_CLOCK_TIME_NONE);
+        gst_element_set_base_time(mPipeline, mCaptureGroup->getBaseTime());
+    }
+
     result = gst_element_set_state(mPipeline, GST_STATE_PLAYING);
     if (result == GST_STATE_CHANGE_FAILURE) {
         log_error("Error setting PLAY state");
@@ -458,7 +1286,7 @@ int VideoCaptureGst::createV4l2Pipeline()
     }
 
     result = gst_element_get_state(mPipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
-    if (result != GST_STATE_CHANGE_SUCCESS) {
+    if (result != GST_STATE_CHANGE_SUCCESS && result != GST_STATE_CHANGE_NO_PREROLL) {
         log_error("Error going to PLAY state");
         gst_object_unref(GST_OBJECT(mPipeline));
         mPipeline = nullptr;
@@ -470,7 +1298,7 @@ int VideoCaptureGst::createV4l2Pipeline()
     g_signal_connect(G_OBJECT(bus), "message", G_CALLBACK(gstMsgCb), mPipeline);
     gst_object_unref(GST_OBJECT(bus));
 
-    return ret;
+    return 0;
 }
 
 int VideoCaptureGst::destroyPipeline()
@@ -480,8 +1308,35 @@ int VideoCaptureGst::destroyPipeline()
 
     // gst_element_set_state (mPipeline, GST_STATE_NULL);
     // gst_object_unref (mPipeline);
+    FrameTap::detach(mCamDev->getDeviceId(), mPipeline);
+    if (mTap) {
+        /* no buffer is pushed anymore once closed */
+        mTap->close();
+        mTap.reset();
+    }
+    if (mRollPipeline) {
+        /* the ring fills again from the next key frame */
+        std::lock_guard<std::mutex> locker(mRollLock);
+        mRollRecording = false;
+    }
+    if (mTapSrc) {
+        gst_object_unref(mTapSrc);
+        mTapSrc = nullptr;
+    }
+    /* no frame is pushed after the end of stream, the pre-event ring keeps its pusher */
+    if (!mRollPipeline)
+        mPusher.reset();
     log_info("Sending EoS");
-    gst_element_send_event(mPipeline, gst_event_new_eos());
+    GstElement *appsrc = gst_bin_get_by_name(GST_BIN(mPipeline), "mysrc");
+    if (appsrc) {
+        gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+        gst_object_unref(appsrc);
+    } else
+        gst_element_send_event(mPipeline, gst_event_new_eos());
+
+    /* the encode pipeline of the pre-event ring keeps its share of the camera frames */
+    if (mFrameHub && !mRollPipeline)
+        mFrameHub->unsubscribe(mSubscriber);
 
     return ret;
 }
@@ -17,18 +17,30 @@
  */
 #pragma once
 #include <atomic>
+#include <deque>
 #include <functional>
 #include <gst/gst.h>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "CameraDevice.h"
+#include "FrameHub.h"
+#include "FramePusher.h"
+#include "FrameTap.h"
 #include "VideoCapture.h"
+#include "gst_frame.h"
+#include "util.h"
+
+class CaptureGroup;
 
 class VideoCaptureGst final : public VideoCapture {
 public:
-    VideoCaptureGst(std::shared_ptr<CameraDevice> camDev);
-    VideoCaptureGst(std::shared_ptr<CameraDevice> camDev, struct VideoSettings &vidSetting);
+    VideoCaptureGst(std::shared_ptr<CameraDevice> camDev,
+                    std::shared_ptr<FrameHub> frameHub = nullptr);
+    VideoCaptureGst(std::shared_ptr<CameraDevice> camDev, struct VideoSettings &vidSetting,
+                    std::shared_ptr<FrameHub> frameHub = nullptr);
     ~VideoCaptureGst();
 
     int init();
@@ -43,19 +55,60 @@ public:
     int setEncoder(CameraParameters::VIDEO_CODING_FORMAT vidEnc);
     int setFormat(CameraParameters::VIDEO_FILE_FORMAT fileFormat);
     int setLocation(const std::string vidPath);
+    int setSegment(int seconds, int megabytes);
+    void setCaptureGroup(std::shared_ptr<CaptureGroup> group);
     std::string getLocation();
+    GstBuffer *readFrame(GstElement *appsrc, int timeoutMs);
+    void wantFrames(bool want);
+    int startPreroll();
+    bool isPrerolling();
+    int getStats(VideoCaptureStats &stats);
+    void pushPreroll(GstSample *sample);
+    void onEncodedFrame(GstBuffer *buffer);
+    void onCameraFrame(GstBuffer *buffer);
+    static void setShareStream(bool enable);
+    static bool getShareStream();
+    static void setPreroll(uint32_t seconds, size_t maxBytes);
+    static bool isPrerollEnabled();
 
 private:
     static int vidCount;
+    static bool sShareStream;
+    static uint32_t sPrerollTime; /* Seconds kept before the recording starts, 0 if off */
+    static size_t sPrerollBytes;  /* Bound of the pre-event ring */
+    /* Buffers of the pre-event ring from a key frame to the next */
+    struct Gop {
+        std::vector<GstSample *> samples;
+        size_t bytes;
+        GstClockTime start;
+    };
     int setState(int state);
     std::string getGstEncName(int format);
     std::string getGstParserName(int format);
     std::string getGstMuxerName(int format);
     std::string getFileExt(int format);
-    std::string getGstV4l2PipelineName();
-    int createV4l2Pipeline();
+    std::string getGstPixFormat(CameraParameters::PixelFormat pixFormat);
+    std::string getGstSinkName(const std::string &ext);
+    int setupMuxer();
+    bool getEncodedFormat(CameraParameters::VIDEO_CODING_FORMAT &codec);
+    std::string getGstV4l2PipelineName(bool preroll);
+    std::string getGstAppsrcPipelineName(bool preroll);
+    std::string getGstTapPipelineName();
+    int createV4l2Pipeline(bool preroll);
+    int createAppsrcPipeline(bool preroll);
+    int createTapPipeline(std::shared_ptr<FrameTap> tap);
+    int createStreamPipeline(GstCaps *caps);
+    int createPrerollWriter();
+    int connectPreroll();
+    int stopPreroll();
+    void dropGop();
+    void addStatsProbes();
+    void pushStream(GstSample *sample);
+    int startPipeline();
     int destroyPipeline();
     std::shared_ptr<CameraDevice> mCamDev;
+    std::shared_ptr<FrameHub> mFrameHub;
+    int mSubscriber;
     std::atomic<int> mState;
     int mWidth;
     int mHeight;
@@ -64,5 +117,29 @@ private:
     CameraParameters::VIDEO_CODING_FORMAT mEnc;
     CameraParameters::VIDEO_FILE_FORMAT mFileFmt;
     std::string mFilePath;
+    int mSegmentTime; /* Seconds per file, 0 for no time limit */
+    int mSegmentSize; /* MB per file, 0 for no size limit */
     GstElement *mPipeline;
+    GstClockTime mFrameDuration; /* Duration of a frame at the camera frame rate */
+    std::shared_ptr<FrameTap> mTap; /* Encoded stream of the RTSP pipeline, if recorded */
+    GstElement *mTapSrc;
+    GstClockTime mTapOffset; /* Time of the first recorded buffer in the RTSP pipeline */
+    GstElement *mRollPipeline; /* Encode pipeline filling the pre-event ring */
+    std::shared_ptr<CaptureGroup> mCaptureGroup; /* Clock and base time shared with others */
+    std::mutex mRollLock;      /* Protects the ring and mRollRecording */
+    std::deque<Gop> mRing;
+    size_t mRingBytes;
+    bool mRollRecording; /* Encoded buffers go to the file instead of the ring */
+    std::mutex mStatsLock; /* Protects the recording stats */
+    uint64_t mStatBytes;
+    usec_t mStatStart;
+    usec_t mWinStart; /* Window of the instant bitrate and frame rate */
+    uint64_t mWinBytes;
+    uint32_t mWinFrames;
+    uint32_t mWinBitRate;
+    float mWinFrameRate;
+    std::atomic<uint64_t> mDropped; /* Camera frames lost before the encoder */
+    guint64 mLastOffset;            /* Sequence of the last frame of v4l2src */
+    GstFrameMisses mMisses;         /* Frames the camera did not give, pushed from the fallback */
+    std::unique_ptr<FramePusher> mPusher; /* Pushes the camera frames into the appsrc */
 };
@@ -16,6 +16,44 @@
  * limitations under the License.
  */
 #pragma once
+#include <cstdint>
+#include <string>
+
+/* Transport policy of an RTSP mount */
+struct RtspTransport {
+    enum { PROTO_UDP = 1, PROTO_UDP_MCAST = 2, PROTO_TCP = 4 };
+    uint32_t protocols = 0;    /* Allowed lower transports, 0 for the server default */
+    std::string mcastMin;      /* First multicast address, empty for no multicast */
+    std::string mcastMax;      /* Last multicast address */
+    uint16_t mcastPortMin = 0; /* Multicast port range */
+    uint16_t mcastPortMax = 0;
+    uint8_t mcastTtl = 1;      /* Time-to-live of multicast packets */
+    uint16_t port = 0;         /* Port of the RTSP server of the mount, 0 for the default */
+    std::string path;          /* Path of the mount, empty for /<camera-device-id> */
+};
+
+/* Properties of the video stream as streamed now */
+struct VideoStreamInfo {
+    uint8_t status = 0;     /* 1 if streaming */
+    int width = 0;          /* Resolution of the stream */
+    int height = 0;
+    uint32_t frameRate = 0; /* Frames per second, 0 if unknown */
+    uint32_t bitRate = 0;   /* Encoder bitrate in kbps, 0 if the encoder default is used */
+    int codec = 0;          /* CameraParameters::VIDEO_CODING_FORMAT of the encoder */
+    uint32_t clients = 0;   /* RTSP sessions playing the stream */
+    std::string path;       /* Mount of an RTSP stream, empty for others */
+    std::string address;    /* Destination of a UDP stream */
+    int port = 0;           /* Port of the RTSP server or of the UDP destination */
+};
+
+/* Region of the image the encoder spends more bits on, in fractions of the image size */
+struct VideoRoi {
+    float x = 0;      /* Left edge, from 0 to 1 */
+    float y = 0;      /* Top edge, from 0 to 1 */
+    float width = 0;  /* 0 for no region */
+    float height = 0;
+    int deltaQp = -8; /* Quantizer offset in the region, negative for a sharper image */
+};
 
 class VideoStream {
 public:
@@ -29,6 +67,7 @@ public:
     virtual int start() = 0;
     virtual int stop() = 0;
     virtual int getState() = 0;
+    // Takes effect at once while streaming, the receivers get a key frame of the new size
     virtual int setResolution(int imgWidth, int imgHeight) = 0;
     virtual int getResolution(int &imgWidth, int &imgHeight) = 0;
     virtual int setFormat(int vidFormat) = 0;
@@ -41,4 +80,14 @@ public:
     virtual int getPort() = 0;
     virtual int setTextOverlay(std::string text, int timeSec) { return -1; };
     virtual std::string getTextOverlay() { return {}; };
+    // Set the encoder bitrate in kbps, at once while streaming
+    virtual int setBitRate(uint32_t bitRate) { return -1; };
+    // Current encoder bitrate in kbps, 0 if the encoder default is used
+    virtual int getBitRate() { return 0; };
+    // Region the encoder favors, from the next frame on. Encoders without ROI support ignore it
+    virtual int setRegionOfInterest(const VideoRoi &roi) { return -1; };
+    // Mount of the stream on the RTSP server, empty if not served over RTSP
+    virtual std::string getPath() { return {}; };
+    // Number of clients with a session on the stream, 0 if not served over RTSP
+    virtual int getClientCount() { return 0; };
 };
@@ -16,34 +16,105 @@
  * limitations under the License.
  */
 
+#include <arpa/inet.h>
+#include <cstring>
 #include <gst/app/gstappsrc.h>
-
+#include <netinet/in.h>
+#include <vector>
+
+#include "EncoderRegistry.h"
+#include "FramePusher.h"
+#include "FrameTap.h"
+#include "RateController.h"
+#include "VariantSource.h"
+#include "VideoCaptureGst.h"
 #include "VideoStreamRtsp.h"
+#include "gst_frame.h"
+#include "util.h"
 
 #define DEFAULT_HOST "127.0.0.1"
 #define DEFAULT_SERVICE_PORT 8554
+#define DEFAULT_FRAMERATE 25
+#define DEFAULT_MAX_VARIANTS 2
+#define DEFAULT_MCAST_PORT_MIN 5000
+#define DEFAULT_MCAST_PORT_MAX 5010
+#define DEFAULT_OVERLAY_SEC 30
+/* RTP clock rate of video payloads */
+#define VIDEO_CLOCK_KHZ 90
+
+uint32_t VideoStreamRtsp::sMaxVariants = DEFAULT_MAX_VARIANTS;
+bool VideoStreamRtsp::sPrewarm = false;
+bool VideoStreamRtsp::sOverlay = false;
+std::map<uint32_t, VideoStreamRtsp::Server> VideoStreamRtsp::sServers;
+std::map<uint32_t, uint32_t> VideoStreamRtsp::sMaxClients;
+std::mutex VideoStreamRtsp::sServerLock;
+
+/* Video convertors in order of preference, the first one present in the registry is used */
+static const struct VideoConvertor {
+    const char *element;  /* Element doing the conversion and scaling */
+    const char *encoder;  /* Prefix of the encoders taking its output, empty for any */
+    const char *pipeline; /* Pipeline fragment for the convertor */
+    const char *caps;     /* Caps of the convertor output */
+} sConvertors[] = {
+    /* GPU conversion and scaling in one pass, output stays in VA surfaces for the encoder */
+    {"vaapipostproc", "vaapi", "vaapipostproc", "video/x-raw(memory:VASurface)"},
+    /* output pixel format is fixed as QGC only supports I420 */
+    {"videoconvert", "", "videoconvert ! videoscale", "video/x-raw, format=I420"},
+};
+
+static std::vector<bool> probeGstVideoConvertors()
+{
+    std::vector<bool> available;
+
+    for (const VideoConvertor &conv : sConvertors) {
+        GstElementFactory *factory = gst_element_factory_find(conv.element);
+        available.push_back(factory != nullptr);
+        if (factory) {
+            gst_object_unref(factory);
+            log_info("Video convertor available: %s", conv.element);
+        }
+    }
+
+    return available;
+}
 
-GstRTSPServer *VideoStreamRtsp::mServer = nullptr;
-bool VideoStreamRtsp::isAttach = false;
-uint32_t VideoStreamRtsp::refCnt = 0;
+/* The registry is probed once, on first use after gst_init() */
+static const VideoConvertor &getGstVideoConvertor(const std::string &encoder)
+{
+    static const std::vector<bool> available = probeGstVideoConvertors();
+
+    for (size_t i = 0; i < ARRAY_SIZE(sConvertors); i++) {
+        const char *prefix = sConvertors[i].encoder;
+        if (available[i] && encoder.compare(0, strlen(prefix), prefix) == 0)
+            return sConvertors[i];
+    }
+
+    /* let pipeline creation report the missing element */
+    return sConvertors[ARRAY_SIZE(sConvertors) - 1];
+}
 
-static std::string getGstVideoConvertor()
+/* Frame rate asked for by the client in the URL query, 0 if none */
+static int getQueryFrameRate(std::map<std::string, std::string> &params)
 {
+    int fps = 0;
 
-    std::string convertor;
+    auto it = params.find("framerate");
+    if (it == params.end())
+        return 0;
 
-    convertor = "videoconvert";
+    if (safe_atoi(it->second.c_str(), &fps) < 0 || fps <= 0) {
+        log_warning("Invalid framerate in URL query: %s", it->second.c_str());
+        return 0;
+    }
 
-    return convertor;
+    return fps;
 }
 
-static std::string getGstVideoConvertorCaps(std::map<std::string, std::string> &params,
+static std::string getGstVideoConvertorCaps(const VideoConvertor &convertor,
+                                            std::map<std::string, std::string> &params,
                                             uint32_t setWidth, uint32_t setHeight)
 {
-    std::string caps;
-
-    /* output pixel format is fixed as QGC only supports I420*/
-    caps = "video/x-raw, format=I420";
+    std::string caps = convertor.caps;
 
     std::string width = params["width"];
     std::string height = params["height"];
@@ -63,32 +134,49 @@ static std::string getGstVideoConvertorCaps(std::map<std::string, std::string> &
             + std::to_string(setHeight);
     }
 
+    int fps = getQueryFrameRate(params);
+    if (fps > 0)
+        caps = caps + ", framerate=" + std::to_string(fps) + "/1";
+
     return caps;
 }
 
-static std::string getGstVideoEncoder(CameraParameters::VIDEO_CODING_FORMAT encFormat)
+/* Bitrate in kbps asked for by the client in the URL query, 0 if none */
+static int getQueryBitRate(std::map<std::string, std::string> &params)
 {
-    std::string enc;
+    int bitrate = 0;
 
-    switch (encFormat) {
-    case CameraParameters::VIDEO_CODING_AVC:
-        enc = std::string("vaapih264enc");
-        break;
-    default:
-        enc = std::string("vaapih264enc");
-        break;
+    auto it = params.find("bitrate");
+    if (it == params.end())
+        return 0;
+
+    if (safe_atoi(it->second.c_str(), &bitrate) < 0 || bitrate <= 0) {
+        log_warning("Invalid bitrate in URL query: %s", it->second.c_str());
+        return 0;
     }
 
-    return enc;
+    return bitrate;
 }
 
-static std::string getGstRtspVideoSink()
+/* encoder starts at the highest bitrate when it adapts to the link */
+static std::string getGstVideoEncoder(CameraParameters::VIDEO_CODING_FORMAT encFormat,
+                                      std::map<std::string, std::string> &params,
+                                      uint32_t setBitRate)
 {
-    std::string sink;
+    int bitrate = getQueryBitRate(params);
+    if (bitrate <= 0)
+        bitrate = setBitRate ? setBitRate : RateController::getMaxBitrate();
 
-    sink = "rtph264pay name=pay0";
+    std::string encoder = EncoderRegistry::getEncoderPipeline(encFormat, bitrate);
+    if (encoder.empty())
+        return {};
 
-    return sink;
+    return encoder + " name=venc";
+}
+
+static std::string getGstRtspVideoSink(CameraParameters::VIDEO_CODING_FORMAT encFormat)
+{
+    return EncoderRegistry::getPayloaderName(encFormat) + " name=pay0";
 }
 
 static std::string getGstPixFormat(CameraParameters::PixelFormat pixFormat)
@@ -102,6 +190,18 @@ static std::string getGstPixFormat(CameraParameters::PixelFormat pixFormat)
     case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
         pix = "UYVY";
         break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        pix = "YUY2";
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV422P:
+        pix = "Y42B";
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        pix = "NV12";
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        pix = "GRAY8";
+        break;
     default:
         pix = "I420";
     }
@@ -118,8 +218,17 @@ static float getBytesPerPixel(CameraParameters::PixelFormat pixFormat)
         ret = 3;
         break;
     case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV422P:
         ret = 2;
         break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        ret = 1;
+        break;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420:
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        ret = 1.5;
+        break;
     default:
         ret = 2;
     }
@@ -157,14 +266,95 @@ static std::map<std::string, std::string> parseUrlQuery(const char *query)
     return map;
 }
 
-VideoStreamRtsp::VideoStreamRtsp(std::shared_ptr<CameraDevice> camDev)
+/*
+ * Canonical form of the URL query, clients asking for the same parameters in any order get the
+ * same key and share one pipeline
+ */
+static std::string getVariantKey(const std::map<std::string, std::string> &params)
+{
+    std::string key;
+
+    for (auto &param : params) {
+        if (!key.empty())
+            key += "&";
+        key += param.first + "=" + param.second;
+    }
+
+    return key;
+}
+
+/* Context of an appsrc pipeline created for a client */
+struct AppsrcContext {
+    VideoStreamRtsp *obj;
+    std::shared_ptr<FrameHub> frameHub; /* Camera frames, or the converted ones of the variants */
+    std::mutex lock;       /* Protects subscriber */
+    int subscriber;        /* 0 while the media does not need frames */
+    GstClockTime duration; /* Duration of a frame at the camera frame rate */
+    guint64 dropped;       /* Frames dropped because the appsrc queue was full */
+    StageStats *stats;     /* Drops and queue level of the camera */
+    GstFrameMisses misses; /* Frames the camera did not give, pushed from the fallback */
+    std::unique_ptr<FramePusher> pusher; /* Pushes the frames, need-data only starts it */
+};
+
+/* Bitrate adaptation of a media, owned by its element */
+struct RateContext {
+    RateContext(VideoStreamRtsp *o, GstElement *enc)
+        : obj(o)
+        , encoder(enc)
+        , ctrl(RateController::getMaxBitrate())
+    {
+    }
+    ~RateContext() { gst_object_unref(encoder); }
+
+    VideoStreamRtsp *obj;
+    GstElement *encoder;
+    RateController ctrl;
+};
+
+/* the camera only runs while a media is playing, subscribe on the first need-data */
+static int acquireSubscriber(AppsrcContext *ctx)
+{
+    std::lock_guard<std::mutex> locker(ctx->lock);
+
+    if (ctx->frameHub && !ctx->subscriber)
+        ctx->subscriber = ctx->frameHub->subscribe();
+
+    return ctx->subscriber;
+}
+
+static void releaseSubscriber(AppsrcContext *ctx)
+{
+    std::lock_guard<std::mutex> locker(ctx->lock);
+
+    if (ctx->frameHub && ctx->subscriber)
+        ctx->frameHub->unsubscribe(ctx->subscriber);
+    ctx->subscriber = 0;
+}
+
+static int getSubscriber(AppsrcContext *ctx)
+{
+    std::lock_guard<std::mutex> locker(ctx->lock);
+
+    return ctx->subscriber;
+}
+
+VideoStreamRtsp::VideoStreamRtsp(std::shared_ptr<CameraDevice> camDev,
+                                 std::shared_ptr<FrameHub> frameHub)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
     , mState(STATE_IDLE)
     , mWidth(0)
     , mHeight(0)
     , mEncFormat(CameraParameters::VIDEO_CODING_AVC)
     , mHost(DEFAULT_HOST)
     , mPort(DEFAULT_SERVICE_PORT)
+    , mServer(nullptr)
+    , mWarmMedia(nullptr)
+    , mBitRate(RateController::getMaxBitrate())
+    , mSetBitRate(0)
+    , mRoi(std::make_shared<GstFrameRoi>())
+    , mOvTime(DEFAULT_OVERLAY_SEC)
+    , mOvUntil(0)
 {
     log_info("%s Device:%s", __func__, mCamDev->getDeviceId().c_str());
     mPath = "/" + mCamDev->getDeviceId();
@@ -172,7 +362,15 @@ VideoStreamRtsp::VideoStreamRtsp(std::shared_ptr<CameraDevice> camDev)
         mPath = "/gazebo";
 
     /* Default: Set the RTSP video res same as camera res */
-    mCamDev->getSize(mWidth, mHeight);
+    uint32_t width = 0, height = 0;
+    mCamDev->getSize(width, height);
+    mWidth = width;
+    mHeight = height;
+
+    /* variants of the mount share one conversion of the camera frames */
+    if (mFrameHub && !mCamDev->isGstV4l2Src())
+        mVariantHub
+            = std::make_shared<FrameHub>(std::make_shared<VariantSource>(mCamDev, mFrameHub));
 }
 
 VideoStreamRtsp::~VideoStreamRtsp()
@@ -238,6 +436,8 @@ int VideoStreamRtsp::stop()
     }
 
     ret = stopRtspServer();
+    if (mVariantHub)
+        mVariantHub->stop();
     setState(STATE_INIT);
     return ret;
 }
@@ -298,6 +498,34 @@ int VideoStreamRtsp::setResolution(int imgWidth, int imgHeight)
 {
     mWidth = imgWidth;
     mHeight = imgHeight;
+
+    /* scale the running pipelines, clients keep their session and get a key frame of the size */
+    const VideoConvertor &convertor
+        = getGstVideoConvertor(EncoderRegistry::getEncoderName(mEncFormat));
+    std::lock_guard<std::mutex> locker(mLiveLock);
+    for (GstElement *pipeline : mLive) {
+        /* size asked for by the client in the URL is kept */
+        if (g_object_get_data(G_OBJECT(pipeline), "fixed-size"))
+            continue;
+
+        GstElement *filter = gst_bin_get_by_name(GST_BIN(pipeline), "vcaps");
+        if (!filter)
+            continue;
+
+        std::map<std::string, std::string> params;
+        int fps = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(pipeline), "framerate"));
+        if (fps > 0)
+            params["framerate"] = std::to_string(fps);
+        GstCaps *caps = gst_caps_from_string(
+            getGstVideoConvertorCaps(convertor, params, mWidth, mHeight).c_str());
+        if (caps) {
+            g_object_set(filter, "caps", caps, NULL);
+            gst_caps_unref(caps);
+            gst_frame_force_key_unit(pipeline, "pay0");
+        }
+        gst_object_unref(filter);
+    }
+
     return 0;
 }
 
@@ -308,31 +536,78 @@ int VideoStreamRtsp::getResolution(int &imgWidth, int &imgHeight)
     return 0;
 }
 
-int VideoStreamRtsp::setFormat(int vidFormat)
+/* all the pipelines of the mount take the region from their next frame on */
+int VideoStreamRtsp::setRegionOfInterest(const VideoRoi &roi)
 {
+    std::lock_guard<std::mutex> locker(mRoi->lock);
+    mRoi->roi = roi;
     return 0;
 }
 
+/* clients negotiated the codec in the SDP, they are disconnected and reconnect to the new one */
+int VideoStreamRtsp::setFormat(int vidFormat)
+{
+    CameraParameters::VIDEO_CODING_FORMAT codec
+        = static_cast<CameraParameters::VIDEO_CODING_FORMAT>(vidFormat);
+    if (EncoderRegistry::getEncoderName(codec).empty()
+        || EncoderRegistry::getPayloaderName(codec).empty()) {
+        log_error("Video coding format %d not supported for streaming", vidFormat);
+        return -1;
+    }
+
+    if (codec == mEncFormat)
+        return 0;
+
+    log_info("%s streams video coding format %d", mPath.c_str(), vidFormat);
+    mEncFormat = codec;
+    if (getState() != STATE_RUN)
+        return 0;
+
+    stop();
+    return start();
+}
+
 int VideoStreamRtsp::getFormat()
 {
-    return 0;
+    return mEncFormat;
 }
 
 /* The host/IP/Multicast group to send the packets to */
+/* a multicast group is used as the multicast address of the mount */
 int VideoStreamRtsp::setAddress(std::string ipAddr)
 {
+    struct in_addr addr;
+
+    if (inet_pton(AF_INET, ipAddr.c_str(), &addr) != 1) {
+        log_error("Invalid address: %s", ipAddr.c_str());
+        return -1;
+    }
+
+    mHost = ipAddr;
+    if (IN_MULTICAST(ntohl(addr.s_addr)) && mTransport.mcastMin.empty()) {
+        mTransport.mcastMin = ipAddr;
+        mTransport.mcastMax = ipAddr;
+    }
+
     return 0;
 }
 
 std::string VideoStreamRtsp::getAddress()
 {
-    return 0;
+    return mHost;
 }
 
+/* the mount moves to the server of the port, its clients reconnect */
 int VideoStreamRtsp::setPort(uint32_t port)
 {
+    if (port == mPort)
+        return 0;
+
+    bool running = getState() == STATE_RUN;
+    if (running)
+        stop();
     mPort = port;
-    return 0;
+    return running ? start() : 0;
 }
 
 int VideoStreamRtsp::getPort()
@@ -340,6 +615,201 @@ int VideoStreamRtsp::getPort()
     return mPort;
 }
 
+/* The default variant, without URL query, is always allowed */
+bool VideoStreamRtsp::isVariantAllowed(const std::string &key)
+{
+    std::lock_guard<std::mutex> locker(mVariantLock);
+
+    return key.empty() || mVariants.count(key) || mVariants.size() < sMaxVariants;
+}
+
+int VideoStreamRtsp::acquireVariant(const std::string &key)
+{
+    std::lock_guard<std::mutex> locker(mVariantLock);
+
+    if (!key.empty() && !mVariants.count(key) && mVariants.size() >= sMaxVariants)
+        return -1;
+
+    mVariants[key]++;
+    log_debug("%s::%s variants:%zu", mPath.c_str(), key.c_str(), mVariants.size());
+    return 0;
+}
+
+void VideoStreamRtsp::releaseVariant(const std::string &key)
+{
+    std::lock_guard<std::mutex> locker(mVariantLock);
+
+    auto it = mVariants.find(key);
+    if (it == mVariants.end())
+        return;
+
+    if (--it->second == 0)
+        mVariants.erase(it);
+}
+
+void VideoStreamRtsp::setMaxVariants(uint32_t count)
+{
+    sMaxVariants = count;
+}
+
+int VideoStreamRtsp::setBitRate(uint32_t bitRate)
+{
+    int ret = 0;
+
+    mSetBitRate = bitRate;
+    mBitRate = bitRate;
+
+    std::lock_guard<std::mutex> locker(mLiveLock);
+    for (GstElement *pipeline : mLive) {
+        /* bitrate asked for by the client in the URL is kept */
+        if (g_object_get_data(G_OBJECT(pipeline), "fixed-bitrate"))
+            continue;
+
+        GstElement *encoder = gst_bin_get_by_name(GST_BIN(pipeline), "venc");
+        if (!encoder)
+            continue;
+        if (!EncoderRegistry::setBitrate(encoder, bitRate))
+            ret = -1;
+        gst_object_unref(encoder);
+
+        /* adaptation to the link goes on from the new bitrate */
+        RateContext *rctx
+            = reinterpret_cast<RateContext *>(g_object_get_data(G_OBJECT(pipeline), "rate-ctx"));
+        if (rctx)
+            rctx->ctrl.reset(bitRate);
+    }
+
+    return ret;
+}
+
+void VideoStreamRtsp::setAdaptedBitRate(uint32_t bitRate)
+{
+    mBitRate = bitRate;
+}
+
+void VideoStreamRtsp::addLivePipeline(GstElement *pipeline)
+{
+    std::lock_guard<std::mutex> locker(mLiveLock);
+    mLive.push_back(GST_ELEMENT(gst_object_ref(pipeline)));
+}
+
+void VideoStreamRtsp::removeLivePipeline(GstElement *pipeline)
+{
+    std::lock_guard<std::mutex> locker(mLiveLock);
+    for (auto it = mLive.begin(); it != mLive.end(); ++it) {
+        if (*it == pipeline) {
+            gst_object_unref(*it);
+            mLive.erase(it);
+            break;
+        }
+    }
+}
+
+int VideoStreamRtsp::getBitRate()
+{
+    return mBitRate;
+}
+
+std::string VideoStreamRtsp::getPath()
+{
+    return mPath;
+}
+
+struct SessionCount {
+    const char *path;
+    int count;
+};
+
+static GstRTSPFilterResult cb_count_session(GstRTSPSessionPool *pool, GstRTSPSession *session,
+                                            gpointer user_data)
+{
+    SessionCount *sc = reinterpret_cast<SessionCount *>(user_data);
+    gint matched = 0;
+
+    if (gst_rtsp_session_get_media(session, sc->path, &matched))
+        sc->count++;
+
+    return GST_RTSP_FILTER_KEEP;
+}
+
+int VideoStreamRtsp::getClientCount()
+{
+    if (!mServer)
+        return 0;
+
+    SessionCount sc = {mPath.c_str(), 0};
+    GstRTSPSessionPool *pool = gst_rtsp_server_get_session_pool(mServer);
+    GList *list = gst_rtsp_session_pool_filter(pool, cb_count_session, &sc);
+    g_list_free(list);
+    g_object_unref(pool);
+
+    return sc.count;
+}
+
+/* taken on the next start of the mount, set before it is started */
+int VideoStreamRtsp::setTransport(const RtspTransport &transport)
+{
+    if (getState() == STATE_RUN) {
+        log_error("Transport of %s cannot be changed while streaming", mPath.c_str());
+        return -1;
+    }
+
+    mTransport = transport;
+    if (transport.port)
+        mPort = transport.port;
+    if (!transport.path.empty())
+        mPath = transport.path[0] == '/' ? transport.path : "/" + transport.path;
+    return 0;
+}
+
+void VideoStreamRtsp::setPrewarm(bool enable)
+{
+    sPrewarm = enable;
+}
+
+void VideoStreamRtsp::setOverlay(bool enable)
+{
+    sOverlay = enable;
+}
+
+/* sessions beyond the limit are refused with 503 Service Unavailable */
+void VideoStreamRtsp::setMaxClients(uint32_t port, uint32_t count)
+{
+    std::lock_guard<std::mutex> locker(sServerLock);
+    sMaxClients[port] = count;
+}
+
+int VideoStreamRtsp::setTextOverlay(std::string text, int timeSec)
+{
+    std::lock_guard<std::mutex> locker(mOverlayLock);
+    mOvText = text;
+    mOvTime = timeSec;
+    mOvUntil = timeSec < 0 ? UINT64_MAX : now_usec() + (uint64_t)timeSec * USEC_PER_SEC;
+    return 0;
+}
+
+std::string VideoStreamRtsp::getTextOverlay()
+{
+    std::lock_guard<std::mutex> locker(mOverlayLock);
+    return mOvText;
+}
+
+/* called for every frame of every pipeline with an overlay, they share the text of the mount */
+std::string VideoStreamRtsp::getOverlayFrameText()
+{
+    std::string camText = mCamDev->getOverlayText();
+    std::lock_guard<std::mutex> locker(mOverlayLock);
+    if (!camText.empty() && camText != mOvText) {
+        mOvText = camText;
+        mOvUntil
+            = mOvTime < 0 ? UINT64_MAX : now_usec() + (uint64_t)mOvTime * USEC_PER_SEC;
+    }
+
+    if (mOvText.empty() || now_usec() > mOvUntil)
+        return {};
+    return mOvText;
+}
+
 int VideoStreamRtsp::getCameraResolution(uint32_t &width, uint32_t &height)
 {
     mCamDev->getSize(width, height);
@@ -353,68 +823,191 @@ CameraParameters::PixelFormat VideoStreamRtsp::getCameraPixelFormat()
     return format;
 }
 
+/* Cameras encoding on board are streamed as they are, in a codec that can be payloaded */
+bool VideoStreamRtsp::getCameraEncodedFormat(CameraParameters::VIDEO_CODING_FORMAT &codec)
+{
+    return mCamDev->getEncodedFormat(codec) == CameraDevice::Status::SUCCESS
+        && !EncoderRegistry::getEncodedCaps(codec).empty()
+        && !EncoderRegistry::getPayloaderName(codec).empty();
+}
+
+uint32_t VideoStreamRtsp::getCameraFrameRate()
+{
+    uint32_t fps = 0;
+    if (mCamDev->getFrameRate(fps) != CameraDevice::Status::SUCCESS || fps == 0)
+        fps = DEFAULT_FRAMERATE;
+    return fps;
+}
+
+/*
+ * Software conversion of the camera frames is done once for all variants, the pipelines then only
+ * scale and encode. GPU conversion and scaling is already a single pass on the camera frames.
+ */
+bool VideoStreamRtsp::useVariantHub()
+{
+    if (!mVariantHub)
+        return false;
+
+    const VideoConvertor &convertor
+        = getGstVideoConvertor(EncoderRegistry::getEncoderName(mEncFormat));
+    return !strcmp(convertor.element, "videoconvert");
+}
+
+/*
+ * The stream of a camera encoding on board is only parsed, for the parameter sets to be sent
+ * with every key frame, and payloaded. Nothing is converted or encoded on the companion computer.
+ */
+std::string VideoStreamRtsp::getGstEncodedPipeline(CameraParameters::VIDEO_CODING_FORMAT codec,
+                                                   bool record)
+{
+    std::string source;
+    if (mCamDev->isGstV4l2Src())
+        source = "v4l2src device=/dev/" + mCamDev->getDeviceId() + " ! "
+            + EncoderRegistry::getEncodedCaps(codec);
+    else
+        source = "appsrc name=mysrc";
+
+    /* recordings take the stream as the camera encodes it */
+    std::string tap;
+    if (record && codec == mEncFormat)
+        tap = FrameTap::getPipeline(FRAME_TAP_RECORD) + " ! ";
+
+    return source + " ! " + EncoderRegistry::getParserName(codec) + " config-interval=-1 ! " + tap
+        + getGstRtspVideoSink(codec);
+}
+
 std::string VideoStreamRtsp::getGstPipeline(std::map<std::string, std::string> &params)
 {
     std::string name;
     std::string source;
+
+    CameraParameters::VIDEO_CODING_FORMAT codec;
+    if (getCameraEncodedFormat(codec)) {
+        name = getGstEncodedPipeline(codec, VideoCaptureGst::getShareStream());
+        log_debug("%s:%s", __func__, name.c_str());
+        return name;
+    }
+
     if (mCamDev->isGstV4l2Src()) {
-        source = "v4l2src device=/dev/" + mCamDev->getDeviceId();
+        /* still capture takes its frames from the stream, the device cannot be opened twice */
+        source = "v4l2src device=/dev/" + mCamDev->getDeviceId() + " ! ";
+
+        /* compressed frames are tapped as they come, stills of the camera size are saved as is */
+        std::string decoder;
+        if (getCameraPixelFormat() == CameraParameters::PixelFormat::PIXEL_FORMAT_MJPEG)
+            decoder = EncoderRegistry::getDecoderName(CameraParameters::VIDEO_CODING_MJPEG);
+        if (!decoder.empty())
+            source += "image/jpeg ! " + FrameTap::getPipeline() + " ! " + decoder;
+        else
+            source += FrameTap::getPipeline();
     } else {
         source = "appsrc name=mysrc";
     }
 
-    name = source + " ! " + getGstVideoConvertor() + " ! "
-        + getGstVideoConvertorCaps(params, mWidth, mHeight) + " ! " + getGstVideoEncoder(mEncFormat)
-        + " ! " + getGstRtspVideoSink();
+    /* text is blended on the raw frames, the overlay stays silent while there is none */
+    if (sOverlay)
+        source = source + " ! textoverlay name=ovl";
+
+    /* drop or duplicate frames if the client asked for a different rate */
+    if (getQueryFrameRate(params) > 0)
+        source = source + " ! videorate";
+
+    /* convert in the same memory the encoder works on, the format may be changed meanwhile */
+    CameraParameters::VIDEO_CODING_FORMAT format = mEncFormat;
+    const VideoConvertor &convertor
+        = getGstVideoConvertor(EncoderRegistry::getEncoderName(format));
+
+    /* frames from the variant hub are I420 already */
+    std::string pipeline = useVariantHub() ? "videoscale" : convertor.pipeline;
+
+    /* recordings of the camera take the default stream, at full quality, as it is encoded */
+    std::string record;
+    if (params.empty() && VideoCaptureGst::getShareStream())
+        record = FrameTap::getPipeline(FRAME_TAP_RECORD) + " ! ";
+
+    /* named, so that the size can be changed while the pipeline runs */
+    std::string caps = getGstVideoConvertorCaps(convertor, params, mWidth, mHeight);
+
+    name = source + " ! " + pipeline + " ! capsfilter name=vcaps caps=\"" + caps + "\" ! "
+        + getGstVideoEncoder(format, params, mSetBitRate) + " ! " + record
+        + getGstRtspVideoSink(format);
 
     log_debug("%s:%s", __func__, name.c_str());
     return name;
 }
 
-GstBuffer *VideoStreamRtsp::readFrame()
+GstBuffer *VideoStreamRtsp::readFrame(GstElement *appsrc, FrameHub *frameHub, int subscriber,
+                                      GstFrameMisses *misses, int timeoutMs)
 {
     // log_debug("%s::%s", typeid(this).name(), __func__);
 
-    GstBuffer *buffer;
-    CameraData data;
+    GstBuffer *buffer = nullptr;
     CameraDevice::Status ret = CameraDevice::Status::ERROR_UNKNOWN;
-    ret = mCamDev->read(data);
-    /* add retry logic? */
-    if (ret == CameraDevice::Status::SUCCESS) {
-        gsize size = data.bufSize;
-        gsize offset = 0;
-        gsize maxsize = size;
-        buffer = gst_buffer_new_wrapped_full((GstMemoryFlags)0, data.buf, maxsize, offset, size,
-                                             NULL, NULL);
-    } else {
-        log_error("Camera returned no frame");
-        uint32_t width, height;
-        getCameraResolution(width, height);
-        gsize size = width * height * getBytesPerPixel(getCameraPixelFormat());
-        buffer = gst_buffer_new_allocate(NULL, size, NULL);
-        /* this makes the image white */
-        gst_buffer_memset(buffer, 0, 0xff, size);
+    if (frameHub) {
+        /* frame is shared with other consumers, release it when gstreamer is done */
+        std::shared_ptr<const Frame> frame;
+        ret = frameHub->read(subscriber, frame, timeoutMs);
+        if (ret == CameraDevice::Status::SUCCESS) {
+            buffer = gst_frame_wrap(frame, appsrc);
+            gst_frame_read(misses);
+        }
     }
 
+    if (!buffer)
+        buffer = gst_frame_fallback(misses, frameHub, appsrc);
+
     return buffer;
 }
 
-/* called when we need to give data to appsrc */
-static void cb_need_data(GstAppSrc *appsrc, guint unused, gpointer user_data)
+/* called on the pusher thread, waits for a camera frame and pushes it to appsrc */
+static void pushFrame(AppsrcContext *ctx, GstElement *appsrc, int timeoutMs)
 {
     GstFlowReturn ret;
-    VideoStreamRtsp *obj = reinterpret_cast<VideoStreamRtsp *>(user_data);
 
-    GstBuffer *buffer = obj->readFrame();
+    /* media paused meanwhile, the pusher is told enough */
+    int subscriber = getSubscriber(ctx);
+    if (ctx->frameHub && !subscriber)
+        return;
+
+    GstBuffer *buffer = ctx->obj->readFrame(appsrc, ctx->frameHub.get(), subscriber,
+                                            &ctx->misses, timeoutMs);
     if (buffer) {
-        ret = gst_app_src_push_buffer(appsrc, buffer);
-        if (ret != GST_FLOW_OK) {
+        GST_BUFFER_DURATION(buffer) = ctx->duration;
+        ret = gst_frame_push(appsrc, buffer, &ctx->dropped, ctx->stats);
+        if (ret != GST_FLOW_OK && ret != GST_FLOW_FLUSHING) {
             /* some error */
             log_error("Error in sending data to gst pipeline");
         }
     }
 }
 
+/* called when we need to give data to appsrc, the frames are pushed from the pusher thread */
+static void cb_need_data(GstAppSrc *appsrc, guint unused, gpointer user_data)
+{
+    AppsrcContext *ctx = reinterpret_cast<AppsrcContext *>(user_data);
+
+    acquireSubscriber(ctx);
+    ctx->pusher->want();
+}
+
+/* called when the appsrc queue is full */
+static void cb_enough_data(GstAppSrc *appsrc, gpointer user_data)
+{
+    AppsrcContext *ctx = reinterpret_cast<AppsrcContext *>(user_data);
+
+    ctx->pusher->enough();
+}
+
+/* called when the appsrc is finalized */
+static void cb_appsrc_destroy(gpointer user_data)
+{
+    AppsrcContext *ctx = reinterpret_cast<AppsrcContext *>(user_data);
+
+    ctx->pusher->stop();
+    releaseSubscriber(ctx);
+    delete ctx;
+}
+
 /*
  * ### For future reference ###
  * After setup request, gst-rtsp-server does following to construct media and pipeline
@@ -427,6 +1020,39 @@ static void cb_need_data(GstAppSrc *appsrc, guint unused, gpointer user_data)
  * 7. Emit Signal: media_configure
  */
 
+/*
+ * Parameters of the media asked for by the URL, the ones of cb_gen_key() for cb_create_element()
+ * to build the same pipeline. The stream encoded by the camera is the same for all clients, and
+ * clients over the encode variants of the mount share the default one.
+ */
+static std::map<std::string, std::string> getMediaParams(VideoStreamRtsp *obj,
+                                                         const GstRTSPUrl *url)
+{
+    std::map<std::string, std::string> params;
+
+    CameraParameters::VIDEO_CODING_FORMAT codec;
+    if (obj->getCameraEncodedFormat(codec))
+        return params;
+
+    params = parseUrlQuery(url->query);
+    std::string key = getVariantKey(params);
+    if (!obj->isVariantAllowed(key)) {
+        log_warning("Max encode variants reached, serving default stream for: %s", key.c_str());
+        params.clear();
+    }
+
+    return params;
+}
+
+/* clients with the same key share the media, and so the encoder pipeline */
+static gchar *cb_gen_key(GstRTSPMediaFactory *factory, const GstRTSPUrl *url)
+{
+    VideoStreamRtsp *obj
+        = reinterpret_cast<VideoStreamRtsp *>(g_object_get_data(G_OBJECT(factory), "user_data"));
+
+    return g_strdup(getVariantKey(getMediaParams(obj, url)).c_str());
+}
+
 static GstElement *cb_create_element(GstRTSPMediaFactory *factory, const GstRTSPUrl *url)
 {
     log_debug("%s", __func__);
@@ -435,10 +1061,21 @@ static GstElement *cb_create_element(GstRTSPMediaFactory *factory, const GstRTSP
     VideoStreamRtsp *obj
         = reinterpret_cast<VideoStreamRtsp *>(g_object_get_data(G_OBJECT(factory), "user_data"));
 
-    /* parse query string from URL */
-    std::map<std::string, std::string> params = parseUrlQuery(url->query);
+    std::map<std::string, std::string> params = getMediaParams(obj, url);
+    CameraParameters::VIDEO_CODING_FORMAT codec;
+    bool encoded = obj->getCameraEncodedFormat(codec);
+
+    /* count the pipeline against the encode variants, the cap may be reached since cb_gen_key() */
+    std::string key = getVariantKey(params);
+    if (obj->acquireVariant(key)) {
+        log_warning("Max encode variants reached, serving default stream for: %s", key.c_str());
+        params.clear();
+        key.clear();
+        obj->acquireVariant(key);
+    }
 
     std::string launch = obj->getCameraDevice()->getGstRTSPPipeline();
+    bool variant = launch.empty() && !encoded && obj->useVariantHub();
     if (launch.empty()) {
         /* build pipeline description based on params received from URL */
         launch = obj->getGstPipeline(params);
@@ -453,15 +1090,40 @@ static GstElement *cb_create_element(GstRTSPMediaFactory *factory, const GstRTSP
     if (pipeline == NULL) {
         if (error)
             g_error_free(error);
+        obj->releaseVariant(key);
         return NULL;
     }
 
+    /* released when the media is unprepared */
+    g_object_set_data_full(G_OBJECT(pipeline), "variant", g_strdup(key.c_str()), g_free);
+
+    /* bitrate asked for by the client is kept, not adapted to the link */
+    if (getQueryBitRate(params) > 0)
+        g_object_set_data(G_OBJECT(pipeline), "fixed-bitrate", GINT_TO_POINTER(TRUE));
+
+    /* so is the size, the frame rate is kept when the size of the stream is changed */
+    if (!params["width"].empty() && !params["height"].empty())
+        g_object_set_data(G_OBJECT(pipeline), "fixed-size", GINT_TO_POINTER(TRUE));
+    g_object_set_data(G_OBJECT(pipeline), "framerate",
+                      GINT_TO_POINTER(getQueryFrameRate(params)));
+
     if (error != NULL) {
         /* a recoverable error was encountered */
         log_warning("recoverable parsing error: %s", error->message);
         g_error_free(error);
     }
 
+    /* latency of the frames from their capture to the network */
+    StageStats *stats = StageStats::get(obj->getCameraDevice()->getDeviceId());
+    gst_frame_add_latency_probe(pipeline, "mysrc", "src", stats, StageStats::PUSH);
+    gst_frame_add_latency_probe(pipeline, "venc", "src", stats, StageStats::ENCODED);
+    gst_frame_add_latency_probe(pipeline, "pay0", "src", stats, StageStats::PAYLOADED);
+    gst_frame_add_latency_stamp(pipeline, "venc");
+    gst_frame_add_roi(pipeline, "venc", obj->getRoi());
+    gst_frame_add_thread_policy(pipeline, encoded ? "pay0" : "venc", "sink",
+                                obj->getCameraDevice()->getDeviceId(), "enc");
+    gst_frame_add_text_overlay(pipeline, "ovl", [obj]() { return obj->getOverlayFrameText(); });
+
     /* return if not appsrc pipeline, else configure */
     if (launch.find("appsrc") == std::string::npos)
         return pipeline;
@@ -471,24 +1133,55 @@ static GstElement *cb_create_element(GstRTSPMediaFactory *factory, const GstRTSP
 
     uint32_t width, height;
     obj->getCameraResolution(width, height);
-    std::string fmt = getGstPixFormat(obj->getCameraPixelFormat());
-
-    /* set capabilities of appsrc element*/
-    gst_app_src_set_caps(GST_APP_SRC(appsrc),
-                         gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, fmt.c_str(),
-                                             "width", G_TYPE_INT, width, "height", G_TYPE_INT,
-                                             height, "framerate", GST_TYPE_FRACTION, 25, 1, NULL));
+    CameraParameters::PixelFormat format = variant
+        ? CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420
+        : obj->getCameraPixelFormat();
+    std::string fmt = getGstPixFormat(format);
+    uint32_t fps = obj->getCameraFrameRate();
+    gsize frameSize = width * height * getBytesPerPixel(format);
+
+    /* set capabilities of appsrc element, frames encoded by the camera are smaller than raw */
+    GstCaps *caps;
+    if (encoded) {
+        caps = gst_caps_from_string(EncoderRegistry::getEncodedCaps(codec).c_str());
+        gst_caps_set_simple(caps, "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+                            "framerate", GST_TYPE_FRACTION, fps, 1, NULL);
+    } else {
+        caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, fmt.c_str(), "width",
+                                   G_TYPE_INT, width, "height", G_TYPE_INT, height, "framerate",
+                                   GST_TYPE_FRACTION, fps, 1, NULL);
+    }
+    gst_app_src_set_caps(GST_APP_SRC(appsrc), caps);
+    gst_caps_unref(caps);
 
-    /* setup appsrc */
+    /* setup appsrc, the queue is bounded so latency does not grow when the encoder is slow */
     g_object_set(G_OBJECT(appsrc), "stream-type", 0, "format", GST_FORMAT_TIME, "is-live", TRUE,
                  NULL);
+    gst_frame_setup_queue(appsrc, frameSize);
+
+    /* each client pipeline gets its own share of the camera frames */
+    AppsrcContext *ctx = new AppsrcContext;
+    ctx->obj = obj;
+    ctx->frameHub = variant ? obj->getVariantHub() : obj->getFrameHub();
+    ctx->subscriber = 0;
+    ctx->duration = gst_util_uint64_scale_int(GST_SECOND, 1, fps);
+    ctx->dropped = 0;
+    ctx->stats = stats;
+    ctx->pusher.reset(new FramePusher(obj->getCameraDevice()->getDeviceId(),
+                                      [ctx, appsrc](int timeoutMs) {
+                                          pushFrame(ctx, appsrc, timeoutMs);
+                                      }));
+    ctx->pusher->setFrameRate(fps);
+
+    /* media callbacks release the camera while the media is not playing */
+    g_object_set_data(G_OBJECT(pipeline), "appsrc-ctx", ctx);
 
     /* install the callback that will be called when a buffer is needed */
     GstAppSrcCallbacks cbs;
     cbs.need_data = cb_need_data;
-    cbs.enough_data = NULL;
+    cbs.enough_data = cb_enough_data;
     cbs.seek_data = NULL;
-    gst_app_src_set_callbacks(GST_APP_SRC_CAST(appsrc), &cbs, obj, NULL);
+    gst_app_src_set_callbacks(GST_APP_SRC_CAST(appsrc), &cbs, ctx, cb_appsrc_destroy);
 
     gst_object_unref(appsrc);
 
@@ -499,19 +1192,161 @@ static void cb_unprepared(GstRTSPMedia *media, gpointer user_data)
 {
     log_debug("%s", __func__);
 
-    /* TODO:: Stop camera device capturing*/
+    VideoStreamRtsp *obj = reinterpret_cast<VideoStreamRtsp *>(user_data);
+    GstElement *element = gst_rtsp_media_get_element(media);
+    const gchar *key = (const gchar *)g_object_get_data(G_OBJECT(element), "variant");
+    if (key)
+        obj->releaseVariant(key);
+    g_object_set_data(G_OBJECT(element), "variant", NULL);
+    FrameTap::detach(obj->getCameraDevice()->getDeviceId(), element);
+    obj->removeLivePipeline(element);
+
+    /* stop camera device capturing, unless other consumers still read it */
+    AppsrcContext *ctx
+        = reinterpret_cast<AppsrcContext *>(g_object_get_data(G_OBJECT(element), "appsrc-ctx"));
+    if (ctx) {
+        /* the pipeline is down, a push blocked on a full queue has returned */
+        ctx->pusher->stop();
+        releaseSubscriber(ctx);
+
+        GstElement *appsrc = gst_bin_get_by_name(GST_BIN(element), "mysrc");
+        guint64 dropped = ctx->dropped + gst_frame_get_dropped(appsrc);
+        if (dropped)
+            log_info("RTSP media dropped %llu frames", (unsigned long long)dropped);
+        gst_object_unref(appsrc);
+    }
+    gst_object_unref(element);
+}
+
+static void cb_rate_destroy(gpointer user_data)
+{
+    delete reinterpret_cast<RateContext *>(user_data);
+}
+
+/* called for every RTCP packet received from a source, clients carry the receiver reports */
+static void cb_ssrc_active(GObject *session, GObject *source, gpointer user_data)
+{
+    RateContext *rctx = reinterpret_cast<RateContext *>(user_data);
+    GstStructure *stats = NULL;
+    gboolean haveRb = FALSE;
+    guint fractionLost = 0, jitter = 0;
+
+    /* a recording of the stream shares the encoder, the link must not lower its quality */
+    std::shared_ptr<FrameTap> rec
+        = FrameTap::find(rctx->obj->getCameraDevice()->getDeviceId(), FRAME_TAP_RECORD);
+    if (rec && rec->isOpen())
+        return;
+
+    g_object_get(source, "stats", &stats, NULL);
+    if (!stats)
+        return;
+
+    if (gst_structure_get_boolean(stats, "have-rb", &haveRb) && haveRb
+        && gst_structure_get_uint(stats, "rb-fractionlost", &fractionLost)
+        && gst_structure_get_uint(stats, "rb-jitter", &jitter)
+        && rctx->ctrl.update(fractionLost, jitter / VIDEO_CLOCK_KHZ)) {
+        uint32_t bitrate = rctx->ctrl.getBitrate();
+        if (EncoderRegistry::setBitrate(rctx->encoder, bitrate))
+            rctx->obj->setAdaptedBitRate(bitrate);
+    }
+
+    gst_structure_free(stats);
+}
+
+static void cb_media_prepared(GstRTSPMedia *media, gpointer user_data)
+{
+    VideoStreamRtsp *obj = reinterpret_cast<VideoStreamRtsp *>(user_data);
+    GstElement *element = gst_rtsp_media_get_element(media);
+
+    /* size and bitrate of the stream can be changed while the media is prepared */
+    obj->addLivePipeline(element);
+
+    if (!RateController::isEnabled()) {
+        gst_object_unref(element);
+        return;
+    }
+
+    if (g_object_get_data(G_OBJECT(element), "fixed-bitrate")) {
+        gst_object_unref(element);
+        return;
+    }
+
+    GstElement *encoder = gst_bin_get_by_name(GST_BIN(element), "venc");
+    if (!encoder) {
+        gst_object_unref(element);
+        return;
+    }
+
+    RateContext *rctx = new RateContext(obj, encoder);
+    g_object_set_data_full(G_OBJECT(element), "rate-ctx", rctx, cb_rate_destroy);
+    gst_object_unref(element);
+
+    for (guint i = 0; i < gst_rtsp_media_n_streams(media); i++) {
+        GObject *session = gst_rtsp_stream_get_rtpsession(gst_rtsp_media_get_stream(media, i));
+        if (!session)
+            continue;
+        g_signal_connect(session, "on-ssrc-active", (GCallback)cb_ssrc_active, rctx);
+        g_object_unref(session);
+    }
+}
+
+/* media is paused when its last client leaves, a pre-warmed media stays prepared */
+static void cb_new_state(GstRTSPMedia *media, gint state, gpointer user_data)
+{
+    VideoStreamRtsp *obj = reinterpret_cast<VideoStreamRtsp *>(user_data);
+    GstElement *element = gst_rtsp_media_get_element(media);
+    std::string device = obj->getCameraDevice()->getDeviceId();
+
+    /* frames only flow to the tap while the media plays */
+    if (state == GST_STATE_PLAYING)
+        FrameTap::attach(device, element);
+    if (state != GST_STATE_PAUSED && state != GST_STATE_NULL) {
+        gst_object_unref(element);
+        return;
+    }
+    FrameTap::detach(device, element);
+
+    AppsrcContext *ctx
+        = reinterpret_cast<AppsrcContext *>(g_object_get_data(G_OBJECT(element), "appsrc-ctx"));
+    if (ctx) {
+        log_debug("Media paused, release camera");
+        ctx->pusher->enough();
+        releaseSubscriber(ctx);
+    }
+    gst_object_unref(element);
 }
 
 static void cb_media_configure(GstRTSPMediaFactory *factory, GstRTSPMedia *media)
 {
     log_debug("%s", __func__);
 
-    /* TODO:: Start camera device capturing */
+    /* camera device capturing starts with the first need-data of the appsrc */
 
+    g_signal_connect(media, "new-state", (GCallback)cb_new_state,
+                     g_object_get_data(G_OBJECT(factory), "user_data"));
+    g_signal_connect(media, "prepared", (GCallback)cb_media_prepared,
+                     g_object_get_data(G_OBJECT(factory), "user_data"));
     g_signal_connect(media, "unprepared", (GCallback)cb_unprepared,
                      g_object_get_data(G_OBJECT(factory), "user_data"));
 }
 
+/* ask the encoder for a key frame so that a client joining a running media starts at once */
+static void cb_play_request(GstRTSPClient *client, GstRTSPContext *ctx, gpointer user_data)
+{
+    if (!ctx->media)
+        return;
+
+    log_debug("Force key frame for new client");
+    GstElement *element = gst_rtsp_media_get_element(ctx->media);
+    gst_frame_force_key_unit(element, "pay0");
+    gst_object_unref(element);
+}
+
+static void cb_client_connected(GstRTSPServer *server, GstRTSPClient *client, gpointer user_data)
+{
+    g_signal_connect(client, "play-request", (GCallback)cb_play_request, NULL);
+}
+
 int VideoStreamRtsp::startRtspServer()
 {
     log_debug("%s::%s", typeid(this).name(), __func__);
@@ -519,37 +1354,144 @@ int VideoStreamRtsp::startRtspServer()
     /* create RTSP server */
     createRtspServer();
 
+    /* get the mount points of the server of the port */
+    GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points(mServer);
+
+    /* another camera configured on the same path of the server, checked and mounted at once */
+    std::unique_lock<std::mutex> locker(sServerLock);
+    gint matched = 0;
+    GstRTSPMediaFactory *other = gst_rtsp_mount_points_match(mounts, mPath.c_str(), &matched);
+    if (other) {
+        g_object_unref(other);
+        if ((size_t)matched == mPath.size()) {
+            log_error("RTSP path %s already mounted on port %u", mPath.c_str(), mPort);
+            locker.unlock();
+            g_object_unref(mounts);
+            destroyRtspServer();
+            return -1;
+        }
+    }
+
     GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new();
     if (!factory) {
         log_error("Error in creating media factory");
+        locker.unlock();
+        g_object_unref(mounts);
+        destroyRtspServer();
         return -1;
     }
 
     g_object_set_data(G_OBJECT(factory), "user_data", this);
     GstRTSPMediaFactoryClass *factory_class = GST_RTSP_MEDIA_FACTORY_GET_CLASS(factory);
     factory_class->create_element = cb_create_element;
+    factory_class->gen_key = cb_gen_key;
+
+    /* clients asking for the same stream share one encoder pipeline */
+    gst_rtsp_media_factory_set_shared(factory, TRUE);
 
     g_signal_connect(factory, "media-configure", (GCallback)cb_media_configure, NULL);
 
-    /* get the default mount points from the server */
-    GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points(mServer);
+    /* restrict the transports, multicast sends the video once for all the clients */
+    applyTransport(factory);
 
     /* attach the video to the RTSP URL */
     gst_rtsp_mount_points_add_factory(mounts, mPath.c_str(), factory);
+    locker.unlock();
     log_info("RTSP stream ready at rtsp://<ip-address>:%s%s", std::to_string(mPort).c_str(),
              mPath.c_str());
     g_object_unref(mounts);
 
-    /* Attach RTSP Server */
-    attachRtspServer();
+    if (sPrewarm)
+        prewarmMedia(factory);
 
     return 0;
 }
 
+void VideoStreamRtsp::applyTransport(GstRTSPMediaFactory *factory)
+{
+    if (mTransport.protocols) {
+        int protocols = GST_RTSP_LOWER_TRANS_UNKNOWN;
+        if (mTransport.protocols & RtspTransport::PROTO_UDP)
+            protocols |= GST_RTSP_LOWER_TRANS_UDP;
+        if (mTransport.protocols & RtspTransport::PROTO_UDP_MCAST)
+            protocols |= GST_RTSP_LOWER_TRANS_UDP_MCAST;
+        if (mTransport.protocols & RtspTransport::PROTO_TCP)
+            protocols |= GST_RTSP_LOWER_TRANS_TCP;
+        gst_rtsp_media_factory_set_protocols(factory, (GstRTSPLowerTrans)protocols);
+    }
+
+    if (mTransport.mcastMin.empty())
+        return;
+
+    uint16_t portMin = mTransport.mcastPortMin ? mTransport.mcastPortMin : DEFAULT_MCAST_PORT_MIN;
+    uint16_t portMax = mTransport.mcastPortMax ? mTransport.mcastPortMax : DEFAULT_MCAST_PORT_MAX;
+
+    GstRTSPAddressPool *pool = gst_rtsp_address_pool_new();
+    if (!gst_rtsp_address_pool_add_range(pool, mTransport.mcastMin.c_str(),
+                                         mTransport.mcastMax.c_str(), portMin, portMax,
+                                         mTransport.mcastTtl)) {
+        log_error("Invalid multicast range %s-%s:%u-%u", mTransport.mcastMin.c_str(),
+                  mTransport.mcastMax.c_str(), portMin, portMax);
+        g_object_unref(pool);
+        return;
+    }
+
+    gst_rtsp_media_factory_set_address_pool(factory, pool);
+    g_object_unref(pool);
+    log_info("RTSP stream %s multicast on %s-%s:%u-%u ttl:%u", mPath.c_str(),
+             mTransport.mcastMin.c_str(), mTransport.mcastMax.c_str(), portMin, portMax,
+             mTransport.mcastTtl);
+}
+
+/*
+ * Build and prepare the media of the default stream before any client asks for it. The extra
+ * prepare holds the media prepared, and paused, when the last client leaves so that a reconnect
+ * only has to set it playing again.
+ */
+int VideoStreamRtsp::prewarmMedia(GstRTSPMediaFactory *factory)
+{
+    log_debug("%s::%s", typeid(this).name(), __func__);
+
+    GstRTSPUrl *url = nullptr;
+    std::string uri = "rtsp://127.0.0.1:" + std::to_string(mPort) + mPath;
+    if (gst_rtsp_url_parse(uri.c_str(), &url) != GST_RTSP_OK) {
+        log_error("Invalid RTSP URL: %s", uri.c_str());
+        return -1;
+    }
+
+    /* shared, so it is the media given to the clients of the default stream too */
+    GstRTSPMedia *media = gst_rtsp_media_factory_construct(factory, url);
+    gst_rtsp_url_free(url);
+    if (!media) {
+        log_error("Error in creating media for %s", mPath.c_str());
+        return -1;
+    }
+
+    GstRTSPThreadPool *pool = gst_rtsp_server_get_thread_pool(mServer);
+    GstRTSPThread *thread = gst_rtsp_thread_pool_get_thread(pool, GST_RTSP_THREAD_TYPE_MEDIA, NULL);
+    g_object_unref(pool);
+
+    if (!gst_rtsp_media_prepare(media, thread)) {
+        log_error("Error in preparing media for %s", mPath.c_str());
+        g_object_unref(media);
+        return -1;
+    }
+
+    mWarmMedia = media;
+    log_info("RTSP stream %s prepared", mPath.c_str());
+    return 0;
+}
+
 int VideoStreamRtsp::stopRtspServer()
 {
     log_debug("%s::%s", typeid(this).name(), __func__);
 
+    if (mWarmMedia) {
+        gst_rtsp_media_unprepare(mWarmMedia);
+        g_object_unref(mWarmMedia);
+        mWarmMedia = nullptr;
+    }
+
     /* get the default mount points from the server */
     GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points(mServer);
 
@@ -564,36 +1506,54 @@ int VideoStreamRtsp::stopRtspServer()
     return 0;
 }
 
+/* mounts on the same port share its server */
 GstRTSPServer *VideoStreamRtsp::createRtspServer()
 {
-    if (mServer) {
-        refCnt++;
-        return mServer;
-    } else {
-        log_info("%s", __func__);
+    std::lock_guard<std::mutex> locker(sServerLock);
+    Server &server = sServers[mPort];
+    if (!server.server) {
+        log_info("%s port:%u", __func__, mPort);
         gst_init(nullptr, nullptr);
 
         /* create RTSP server */
-        mServer = gst_rtsp_server_new();
+        server.server = gst_rtsp_server_new();
 
         /* set the port number */
-        g_object_set(mServer, "service", std::to_string(mPort).c_str(), nullptr);
-        refCnt++;
-        return mServer;
+        g_object_set(server.server, "service", std::to_string(mPort).c_str(), nullptr);
+        g_signal_connect(server.server, "client-connected", (GCallback)cb_client_connected, NULL);
+
+        auto max = sMaxClients.find(mPort);
+        if (max != sMaxClients.end()) {
+            GstRTSPSessionPool *pool = gst_rtsp_server_get_session_pool(server.server);
+            gst_rtsp_session_pool_set_max_sessions(pool, max->second);
+            g_object_unref(pool);
+        }
+
+        /* probe for the video convertor and encoder before the first client connects */
+        getGstVideoConvertor(EncoderRegistry::getEncoderName(CameraParameters::VIDEO_CODING_AVC));
+
+        attachRtspServer(server, mPort);
     }
+
+    server.refCnt++;
+    mServer = server.server;
+    return mServer;
 }
 
 void VideoStreamRtsp::destroyRtspServer()
 {
-    refCnt--;
-    if (refCnt == 0) {
-        log_info("%s", __func__);
-        g_object_unref(mServer);
-        mServer = nullptr;
-        isAttach = false;
-    }
+    std::lock_guard<std::mutex> locker(sServerLock);
+    auto it = sServers.find(mPort);
+    mServer = nullptr;
+    if (it == sServers.end())
+        return;
 
-    return;
+    if (--it->second.refCnt == 0) {
+        log_info("%s port:%u", __func__, mPort);
+        detachRtspServer(it->second);
+        g_object_unref(it->second.server);
+        sServers.erase(it);
+    }
 }
 
 static gboolean timeout(GstRTSPServer *server)
@@ -607,14 +1567,55 @@ static gboolean timeout(GstRTSPServer *server)
     return TRUE;
 }
 
-void VideoStreamRtsp::attachRtspServer()
+static gpointer rtsp_server_thread(gpointer data)
 {
-    if (!isAttach) {
-        log_info("%s", __func__);
-        gst_rtsp_server_attach(mServer, nullptr);
-        isAttach = true;
+    GMainLoop *loop = (GMainLoop *)data;
+    GMainContext *context = g_main_loop_get_context(loop);
 
-        /* Periodically remove timed out sessions*/
-        g_timeout_add_seconds(2, (GSourceFunc)timeout, mServer);
+    /* client threads of the server take the context of the thread they are created from */
+    g_main_context_push_thread_default(context);
+    g_main_loop_run(loop);
+    g_main_context_pop_thread_default(context);
+
+    return nullptr;
+}
+
+/*
+ * Each server runs on its own context and thread, so that client handshakes and session cleanup
+ * do not hold up MAVLink on the mainloop, nor the cameras of the other servers. What the server
+ * reads from the streams is atomic or locked, mounts and sessions are locked by the server itself.
+ */
+void VideoStreamRtsp::attachRtspServer(Server &server, uint32_t port)
+{
+    server.context = g_main_context_new();
+    server.loop = g_main_loop_new(server.context, FALSE);
+    server.attachId = gst_rtsp_server_attach(server.server, server.context);
+
+    /* Periodically remove timed out sessions*/
+    GSource *source = g_timeout_source_new_seconds(2);
+    g_source_set_callback(source, (GSourceFunc)timeout, server.server, NULL);
+    server.cleanupId = g_source_attach(source, server.context);
+    g_source_unref(source);
+
+    std::string name = "rtsp-" + std::to_string(port);
+    server.thread = g_thread_new(name.c_str(), rtsp_server_thread, server.loop);
+}
+
+void VideoStreamRtsp::detachRtspServer(Server &server)
+{
+    g_main_loop_quit(server.loop);
+    g_thread_join(server.thread);
+    server.thread = nullptr;
+
+    for (guint id : {server.attachId, server.cleanupId}) {
+        GSource *source = g_main_context_find_source_by_id(server.context, id);
+        if (source)
+            g_source_destroy(source);
     }
+    server.attachId = server.cleanupId = 0;
+
+    g_main_loop_unref(server.loop);
+    server.loop = nullptr;
+    g_main_context_unref(server.context);
+    server.context = nullptr;
 }
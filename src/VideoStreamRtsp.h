@@ -21,16 +21,22 @@
 #include <gst/gst.h>
 #include <gst/rtsp-server/rtsp-server.h>
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "CameraDevice.h"
+#include "FrameHub.h"
 #include "VideoStream.h"
+#include "gst_frame.h"
 #include "log.h"
 
 class VideoStreamRtsp final : public VideoStream {
 public:
-    VideoStreamRtsp(std::shared_ptr<CameraDevice> camDev);
+    VideoStreamRtsp(std::shared_ptr<CameraDevice> camDev,
+                    std::shared_ptr<FrameHub> frameHub = nullptr);
     ~VideoStreamRtsp();
 
     int init();
@@ -50,26 +56,88 @@ public:
     int getPort();
     int getCameraResolution(uint32_t &width, uint32_t &height);
     CameraParameters::PixelFormat getCameraPixelFormat();
+    uint32_t getCameraFrameRate();
+    bool getCameraEncodedFormat(CameraParameters::VIDEO_CODING_FORMAT &codec);
     std::string getGstPipeline(std::map<std::string, std::string> &params);
-    GstBuffer *readFrame();
+    GstBuffer *readFrame(GstElement *appsrc, FrameHub *frameHub, int subscriber,
+                         GstFrameMisses *misses, int timeoutMs);
     std::shared_ptr<CameraDevice> getCameraDevice() { return mCamDev;  };
+    std::shared_ptr<FrameHub> getFrameHub() { return mFrameHub; };
+    std::shared_ptr<FrameHub> getVariantHub() { return mVariantHub; };
+    bool useVariantHub();
+    bool isVariantAllowed(const std::string &key);
+    int acquireVariant(const std::string &key);
+    void releaseVariant(const std::string &key);
+    static void setMaxVariants(uint32_t count);
+    static uint32_t getMaxVariants() { return sMaxVariants; }
+    static void setPrewarm(bool enable);
+    static void setOverlay(bool enable);
+    static void setMaxClients(uint32_t port, uint32_t count);
+    int setTextOverlay(std::string text, int timeSec);
+    std::string getTextOverlay();
+    std::string getOverlayFrameText();
+    int setBitRate(uint32_t bitRate);
+    int setRegionOfInterest(const VideoRoi &roi);
+    std::shared_ptr<GstFrameRoi> getRoi() { return mRoi; };
+    void setAdaptedBitRate(uint32_t bitRate);
+    void addLivePipeline(GstElement *pipeline);
+    void removeLivePipeline(GstElement *pipeline);
+    int setTransport(const RtspTransport &transport);
+    int getBitRate();
+    std::string getPath();
+    int getClientCount();
 
 private:
+    /* RTSP server of a port, run by its own context and thread, shared by the mounts on it */
+    struct Server {
+        GstRTSPServer *server = nullptr;
+        GMainContext *context = nullptr;
+        GMainLoop *loop = nullptr;
+        GThread *thread = nullptr;
+        guint attachId = 0;
+        guint cleanupId = 0;
+        uint32_t refCnt = 0;
+    };
+
     GstRTSPServer *createRtspServer();
     void destroyRtspServer();
-    void attachRtspServer();
+    static void attachRtspServer(Server &server, uint32_t port);
+    static void detachRtspServer(Server &server);
     int setState(int state);
     int startRtspServer();
     int stopRtspServer();
+    int prewarmMedia(GstRTSPMediaFactory *factory);
+    void applyTransport(GstRTSPMediaFactory *factory);
+    std::string getGstEncodedPipeline(CameraParameters::VIDEO_CODING_FORMAT codec, bool record);
     std::shared_ptr<CameraDevice> mCamDev;
+    std::shared_ptr<FrameHub> mFrameHub;
+    std::shared_ptr<FrameHub> mVariantHub; /* Camera frames converted once for all variants */
     std::atomic<int> mState;
-    uint32_t mWidth;
-    uint32_t mHeight;
-    CameraParameters::VIDEO_CODING_FORMAT mEncFormat;
+    /* Read by the RTSP server thread when it builds a pipeline */
+    std::atomic<uint32_t> mWidth;
+    std::atomic<uint32_t> mHeight;
+    std::atomic<CameraParameters::VIDEO_CODING_FORMAT> mEncFormat;
     std::string mHost;
     uint32_t mPort;
     std::string mPath;
-    static GstRTSPServer *mServer;
-    static bool isAttach;
-    static uint32_t refCnt;
+    RtspTransport mTransport;
+    GstRTSPServer *mServer; /* Server of the port, while the mount is up */
+    std::mutex mVariantLock;
+    std::map<std::string, uint32_t> mVariants; /* Variant key -> count of pipelines */
+    GstRTSPMedia *mWarmMedia;                  /* Default media kept prepared between clients */
+    std::atomic<uint32_t> mBitRate;            /* Last bitrate chosen for the link, in kbps */
+    std::atomic<uint32_t> mSetBitRate;         /* Bitrate set through the API, 0 for default */
+    std::mutex mLiveLock;
+    std::vector<GstElement *> mLive; /* Pipelines of the prepared media */
+    std::shared_ptr<GstFrameRoi> mRoi; /* Region of interest of the encoders */
+    std::mutex mOverlayLock;
+    std::string mOvText;
+    int mOvTime;       /* Time in sec to keep the overlay, -1 forever */
+    uint64_t mOvUntil; /* Monotonic time in usec the overlay is shown until */
+    static uint32_t sMaxVariants;              /* Max distinct encode variants per mount */
+    static bool sPrewarm;
+    static bool sOverlay; /* Text overlay on the frames before they are encoded */
+    static std::map<uint32_t, Server> sServers;      /* By port */
+    static std::map<uint32_t, uint32_t> sMaxClients; /* Max sessions by port, none if absent */
+    static std::mutex sServerLock; /* Protects sServers and sMaxClients, cameras start at once */
 };
@@ -16,18 +16,37 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <gst/app/gstappsrc.h>
 #include <gst/gst.h>
 #include <unistd.h>
 
+#include "EncoderRegistry.h"
 #include "VideoStreamUdp.h"
+#include "gst_frame.h"
 #include "log.h"
+#include "util.h"
 
-VideoStreamUdp::VideoStreamUdp(std::shared_ptr<CameraDevice> camDev)
+#define DEFAULT_FRAMERATE 25
+// RTP clock rate of video payloads
+#define VIDEO_CLOCK_KHZ 90
+// Report the latency of the stream every so many seconds of frames
+#define LATENCY_REPORT_SEC 10
+
+UdpStreamSettings VideoStreamUdp::sSettings;
+
+VideoStreamUdp::VideoStreamUdp(std::shared_ptr<CameraDevice> camDev,
+                               std::shared_ptr<FrameHub> frameHub)
     : mCamDev(camDev)
+    , mFrameHub(frameHub)
+    , mSubscriber(0)
     , mState(STATE_IDLE)
     , mWidth(640)
     , mHeight(360)
+    , mCamWidth(640)
+    , mCamHeight(360)
+    , mFrmRate(DEFAULT_FRAMERATE)
+    , mEncFormat(CameraParameters::VIDEO_CODING_AVC)
     , mHost("127.0.0.1")
     , mPort(5600)
     , mOvText("")
@@ -35,11 +54,24 @@ VideoStreamUdp::VideoStreamUdp(std::shared_ptr<CameraDevice> camDev)
     , mOvFrmCnt(0)
     , mPipeline(nullptr)
     , mTextOverlay(nullptr)
+    , mEncoder(nullptr)
+    , mSetBitRate(0)
+    , mBitRate(0)
+    , mLatencySum(0)
+    , mLatencyMax(0)
+    , mLatencyCnt(0)
+    , mDropped(0)
+    , mStats(StageStats::get(camDev->getDeviceId()))
+    , mRoi(std::make_shared<GstFrameRoi>())
 {
     log_info("%s Device:%s", __func__, mCamDev->getDeviceId().c_str());
 
+    uint32_t fps = 0;
+    if (mCamDev->getFrameRate(fps) == CameraDevice::Status::SUCCESS && fps > 0)
+        mFrmRate = fps;
+
     mOvText = mCamDev->getDeviceId();
-    mOvFrmCnt = mOvTime * 25;
+    mOvFrmCnt = mOvTime * mFrmRate;
 }
 
 VideoStreamUdp::~VideoStreamUdp()
@@ -90,9 +122,26 @@ int VideoStreamUdp::setState(int state)
 
 int VideoStreamUdp::setResolution(int imgWidth, int imgHeight)
 {
-    // TODO::Check if the argument is valid
+    if (imgWidth <= 0 || imgHeight <= 0)
+        return -1;
+
     mWidth = imgWidth;
     mHeight = imgHeight;
+
+    // Scale the running stream, the receiver gets a key frame of the new size
+    if (!mPipeline || getState() != STATE_RUN)
+        return 0;
+
+    GstElement *filter = gst_bin_get_by_name(GST_BIN(mPipeline), "ScaleCaps");
+    if (!filter)
+        return -1;
+    GstCaps *caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "I420", "width",
+                                        G_TYPE_INT, mWidth, "height", G_TYPE_INT, mHeight, NULL);
+    g_object_set(G_OBJECT(filter), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    gst_object_unref(filter);
+    gst_frame_force_key_unit(mPipeline, "H264Rtp");
+
     return 0;
 }
 
@@ -105,13 +154,29 @@ int VideoStreamUdp::getResolution(int &imgWidth, int &imgHeight)
 
 int VideoStreamUdp::setFormat(int vidFormat)
 {
-    // TODO::Check if the argument is valid
-    return 0;
+    CameraParameters::VIDEO_CODING_FORMAT codec
+        = static_cast<CameraParameters::VIDEO_CODING_FORMAT>(vidFormat);
+    if (EncoderRegistry::getEncoderName(codec).empty()
+        || EncoderRegistry::getPayloaderName(codec).empty()) {
+        log_error("Video coding format %d not supported for streaming", vidFormat);
+        return -1;
+    }
+
+    if (codec == mEncFormat)
+        return 0;
+
+    // The receiver has to be set up for the new payload anyway, the pipeline is built again
+    mEncFormat = codec;
+    if (!mPipeline || getState() != STATE_RUN)
+        return 0;
+
+    destroyAppsrcPipeline();
+    return createAppsrcPipeline();
 }
 
 int VideoStreamUdp::getFormat()
 {
-    return 0;
+    return mEncFormat;
 }
 
 int VideoStreamUdp::setAddress(std::string ipAddr)
@@ -138,12 +203,27 @@ int VideoStreamUdp::getPort()
     return mPort;
 }
 
+// Called for every frame going into the overlay, the element is only updated on changes
+std::string VideoStreamUdp::getOverlayFrameText()
+{
+    std::string camText = mCamDev->getOverlayText();
+    if (mOvText.compare(camText) != 0 && !camText.empty()) {
+        mOvText = camText;
+        mOvFrmCnt = mFrmRate * mOvTime;
+    }
+
+    if (!mOvFrmCnt)
+        return {};
+    if (mOvFrmCnt > 0)
+        mOvFrmCnt--;
+    return mOvText;
+}
+
 int VideoStreamUdp::setTextOverlay(std::string text, int timeSec)
 {
     mOvText = text;
     mOvTime = timeSec;
-    // TODO :: Replace 25 with camera frame rate
-    mOvFrmCnt = 25 * mOvTime;
+    mOvFrmCnt = mFrmRate * mOvTime;
     return 0;
 }
 
@@ -152,67 +232,147 @@ std::string VideoStreamUdp::getTextOverlay()
     return mOvText;
 }
 
-GstBuffer *VideoStreamUdp::readFrame()
+int VideoStreamUdp::setBitRate(uint32_t bitRate)
 {
-    GstBuffer *buffer;
-    static GstClockTime timestamp = 0;
-    CameraData data;
-    CameraDevice::Status ret = mCamDev->read(data);
-    if (ret == CameraDevice::Status::SUCCESS) {
-        gsize size = data.bufSize;
-        gsize offset = 0;
-        gsize maxsize = size;
-        buffer = gst_buffer_new_wrapped_full((GstMemoryFlags)0, data.buf, maxsize, offset, size,
-                                             NULL, NULL);
-    } else {
-        log_error("Camera returned no frame");
-        // TODO :: Change the multiplication factor based on pix format
-        gsize size = mWidth * mHeight * 3;
-        buffer = gst_buffer_new_allocate(NULL, size, NULL);
-        // this makes the image white
-        gst_buffer_memset(buffer, 0, 0xff, size);
-    }
+    mSetBitRate = bitRate;
+    mBitRate = bitRate;
+    if (!mEncoder)
+        return 0;
 
-    // Add timestamp
-    GST_BUFFER_PTS(buffer) = timestamp;
-    GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale_int(1, GST_SECOND, 25);
-    timestamp += GST_BUFFER_DURATION(buffer);
+    if (!EncoderRegistry::setBitrate(mEncoder, bitRate))
+        return -1;
+    // Adaptation to the link goes on from the new bitrate
+    if (mRateCtrl)
+        mRateCtrl->reset(bitRate);
 
-    // Add Overlay
-    std::string camText = mCamDev->getOverlayText();
-    if (mOvText.compare(camText) != 0 && !camText.empty()) {
-        mOvText = camText;
-        mOvFrmCnt = 25 * mOvTime;
+    return 0;
+}
+
+int VideoStreamUdp::setRegionOfInterest(const VideoRoi &roi)
+{
+    std::lock_guard<std::mutex> locker(mRoi->lock);
+    mRoi->roi = roi;
+    return 0;
+}
+
+int VideoStreamUdp::getBitRate()
+{
+    return mBitRate;
+}
+
+void VideoStreamUdp::wantFrames(bool want)
+{
+    if (!mPusher)
+        return;
+
+    if (want)
+        mPusher->want();
+    else
+        mPusher->enough();
+}
+
+void VideoStreamUdp::onRtcpReport(const uint8_t *data, size_t len)
+{
+    uint8_t fractionLost;
+    uint32_t jitter;
+
+    if (!mRateCtrl || !RateController::parseReport(data, len, fractionLost, jitter))
+        return;
+
+    if (mRateCtrl->update(fractionLost, jitter / VIDEO_CLOCK_KHZ)) {
+        mBitRate = mRateCtrl->getBitrate();
+        EncoderRegistry::setBitrate(mEncoder, mBitRate);
     }
+}
 
-    if (mOvFrmCnt || mOvFrmCnt == -1) {
-        g_object_set(G_OBJECT(mTextOverlay), "text", mOvText.c_str(), "valignment", 2, "halignment",
-                     0, "shaded-background", TRUE, NULL);
-        if (mOvFrmCnt > 0)
-            mOvFrmCnt--;
-    } else {
-        g_object_set(G_OBJECT(mTextOverlay), "text", "", NULL);
+GstFlowReturn VideoStreamUdp::pushFrame(GstElement *appsrc, GstBuffer *buffer)
+{
+    return gst_frame_push(appsrc, buffer, &mDropped, mStats);
+}
+
+void VideoStreamUdp::setSettings(const UdpStreamSettings &settings)
+{
+    sSettings = settings;
+}
+
+// Time from the capture of the frame, its PTS, to the end of its encoding
+void VideoStreamUdp::onEncodedFrame(GstBuffer *buffer)
+{
+    GstClock *clock = gst_element_get_clock(mPipeline);
+    if (!clock)
+        return;
+
+    GstClockTime now = gst_clock_get_time(clock) - gst_element_get_base_time(mPipeline);
+    gst_object_unref(clock);
+    if (!GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)) || now < GST_BUFFER_PTS(buffer))
+        return;
+
+    uint64_t latency = now - GST_BUFFER_PTS(buffer);
+    mLatencySum += latency;
+    mLatencyMax = std::max(mLatencyMax, latency);
+    if (++mLatencyCnt < LATENCY_REPORT_SEC * mFrmRate)
+        return;
+
+    log_info("UDP stream latency from capture: avg %.1fms max %.1fms",
+             (double)mLatencySum / mLatencyCnt / NSEC_PER_MSEC,
+             (double)mLatencyMax / NSEC_PER_MSEC);
+    mLatencySum = 0;
+    mLatencyMax = 0;
+    mLatencyCnt = 0;
+}
+
+GstBuffer *VideoStreamUdp::readFrame(GstElement *appsrc, int timeoutMs)
+{
+    GstBuffer *buffer = nullptr;
+    CameraDevice::Status ret;
+    if (mFrameHub) {
+        // Frame is shared with other consumers, release it when gstreamer is done
+        std::shared_ptr<const Frame> frame;
+        ret = mFrameHub->read(mSubscriber, frame, timeoutMs);
+        if (ret == CameraDevice::Status::SUCCESS) {
+            buffer = gst_frame_wrap(frame, appsrc);
+            gst_frame_read(&mMisses);
+        }
     }
+
+    if (!buffer)
+        buffer = gst_frame_fallback(&mMisses, mFrameHub.get(), appsrc);
+    if (!buffer)
+        return nullptr;
+    GST_BUFFER_DURATION(buffer) = gst_util_uint64_scale_int(GST_SECOND, 1, mFrmRate);
+
     return buffer;
 }
 
-static void cb_need_data(GstAppSrc *appsrc, guint unused_size, gpointer user_data)
+// Called on the pusher thread, waits for a camera frame and pushes it to appsrc
+static void push_frame(VideoStreamUdp *obj, GstElement *appsrc, int timeoutMs)
 {
     GstFlowReturn ret;
-    VideoStreamUdp *obj = (VideoStreamUdp *)user_data;
 
-    GstBuffer *buffer = obj->readFrame();
+    GstBuffer *buffer = obj->readFrame(appsrc, timeoutMs);
     if (buffer) {
-        g_signal_emit_by_name(appsrc, "push-buffer", buffer, &ret);
-        if (ret != GST_FLOW_OK) {
+        ret = obj->pushFrame(appsrc, buffer);
+        if (ret != GST_FLOW_OK && ret != GST_FLOW_FLUSHING) {
             // some error
             log_error("Error in sending data to gst pipeline");
         }
     }
 }
 
+// The frames are pushed from the pusher thread, the streaming thread does not wait on the camera
+static void cb_need_data(GstAppSrc *appsrc, guint unused_size, gpointer user_data)
+{
+    VideoStreamUdp *obj = (VideoStreamUdp *)user_data;
+
+    obj->wantFrames(true);
+}
+
+// The queue is bounded, frames over the bound are dropped as the policy says in pushFrame()
 static void cb_enough_data(GstAppSrc *src, gpointer user_data)
 {
+    VideoStreamUdp *obj = (VideoStreamUdp *)user_data;
+
+    obj->wantFrames(false);
 }
 
 static gboolean cb_seek_data(GstAppSrc *src, guint64 offset, gpointer user_data)
@@ -220,62 +380,198 @@ static gboolean cb_seek_data(GstAppSrc *src, guint64 offset, gpointer user_data)
     return TRUE;
 }
 
+static GstPadProbeReturn cb_encoded_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    VideoStreamUdp *obj = (VideoStreamUdp *)user_data;
+
+    obj->onEncodedFrame(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+// RTCP packet sent back by the receiver
+static void cb_rtcp_handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data)
+{
+    VideoStreamUdp *obj = (VideoStreamUdp *)user_data;
+    GstMapInfo info;
+
+    if (!gst_buffer_map(buffer, &info, GST_MAP_READ))
+        return;
+
+    obj->onRtcpReport(info.data, info.size);
+    gst_buffer_unmap(buffer, &info);
+}
+
 int VideoStreamUdp::createAppsrcPipeline()
 {
     log_info("%s::%s", typeid(this).name(), __func__);
 
     int ret = 0;
     gboolean link_ok;
-    GstElement *src, *conv, *enc, *parser, *payload, *sink;
+    GstElement *src, *conv, *scale, *scaleCaps, *enc, *parser, *payload, *sink;
     GstCaps *caps;
 
+    // Frames of a camera encoding on board in the codec of the stream go straight to the payloader
+    CameraParameters::VIDEO_CODING_FORMAT codec = CameraParameters::VIDEO_CODING_MIN;
+    bool encoded = mCamDev->getEncodedFormat(codec) == CameraDevice::Status::SUCCESS
+        && codec == mEncFormat;
+
     mPipeline = gst_pipeline_new("UdpStream");
     src = gst_element_factory_make("appsrc", "VideoSrc");
-    conv = gst_element_factory_make("videoconvert", "Conv");
-    mTextOverlay = gst_element_factory_make("textoverlay", "textoverlay");
-    enc = gst_element_factory_make("x264enc", "H264Enc");
-    parser = gst_element_factory_make("h264parse", "Parser");
-    payload = gst_element_factory_make("rtph264pay", "H264Rtp");
+    conv = scale = scaleCaps = enc = nullptr;
+    mTextOverlay = nullptr;
+    if (!encoded) {
+        conv = gst_element_factory_make("videoconvert", "Conv");
+        scale = gst_element_factory_make("videoscale", "Scale");
+        scaleCaps = gst_element_factory_make("capsfilter", "ScaleCaps");
+        mTextOverlay = gst_element_factory_make("textoverlay", "textoverlay");
+        // Best encoder installed for the codec, set up for low latency, starting at the bitrate
+        // set or at the highest one when it adapts to the link
+        std::string encoder = EncoderRegistry::getEncoderPipeline(
+            mEncFormat,
+            mSetBitRate ? mSetBitRate : RateController::getMaxBitrate(), sSettings.lowLatency);
+        if (!encoder.empty())
+            encoder += " name=venc";
+        enc = encoder.empty() ? nullptr
+                              : gst_parse_bin_from_description(encoder.c_str(), TRUE, NULL);
+    }
+    parser = gst_element_factory_make(EncoderRegistry::getParserName(mEncFormat).c_str(), "Parser");
+    payload = gst_element_factory_make(EncoderRegistry::getPayloaderName(mEncFormat).c_str(),
+                                       "H264Rtp");
     sink = gst_element_factory_make("udpsink", "UdpSink");
 
     // TODO::Check if all the elements are created
-    if (!mPipeline || !src || !conv || !mTextOverlay || !enc || !parser || !payload || !sink) {
+    if (!mPipeline || !src || !parser || !payload || !sink
+        || (!encoded && (!conv || !scale || !scaleCaps || !mTextOverlay || !enc))) {
         log_error("One element could not be created. Exiting.\n");
         return -1;
     }
 
+    // Frames come at the size of the camera, they are scaled to the size of the stream
+    mCamWidth = mWidth;
+    mCamHeight = mHeight;
+    uint32_t camWidth = 0, camHeight = 0;
+    if (mCamDev->getSize(camWidth, camHeight) == CameraDevice::Status::SUCCESS && camWidth
+        && camHeight) {
+        mCamWidth = camWidth;
+        mCamHeight = camHeight;
+    }
+
     // Set appsrc caps
     // TODO :: Remove the format hardcode
-    gst_app_src_set_caps(GST_APP_SRC(src),
-                         gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "RGB", "width",
-                                             G_TYPE_INT, mWidth, "height", G_TYPE_INT, mHeight,
-                                             "framerate", GST_TYPE_FRACTION, 25, 1, NULL));
+    if (encoded) {
+        caps = gst_caps_from_string(EncoderRegistry::getEncodedCaps(mEncFormat).c_str());
+        gst_caps_set_simple(caps, "width", G_TYPE_INT, mCamWidth, "height", G_TYPE_INT,
+                            mCamHeight, "framerate", GST_TYPE_FRACTION, mFrmRate, 1, NULL);
+        gst_app_src_set_caps(GST_APP_SRC(src), caps);
+        gst_caps_unref(caps);
+    } else {
+        gst_app_src_set_caps(GST_APP_SRC(src),
+                             gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "RGB",
+                                                 "width", G_TYPE_INT, mCamWidth, "height",
+                                                 G_TYPE_INT, mCamHeight, "framerate",
+                                                 GST_TYPE_FRACTION, mFrmRate, 1, NULL));
+    }
 
-    // Setup appsrc
+    // Setup appsrc, with a bounded queue so latency does not grow when the encoder is slow
     g_object_set(G_OBJECT(src), "is-live", TRUE, "format", GST_FORMAT_TIME, NULL);
+    // TODO :: Change the multiplication factor based on pix format
+    gst_frame_setup_queue(src, mCamWidth * mCamHeight * 3);
+    mDropped = 0;
+    if (sSettings.lowLatency) {
+        // A frame is read when needed, report a single frame of latency
+        gint64 frameTime = gst_util_uint64_scale_int(GST_SECOND, 1, mFrmRate);
+        g_object_set(G_OBJECT(src), "min-latency", (gint64)0, "max-latency", frameTime, "block",
+                     FALSE, NULL);
+    }
 
-    // Setup convertor
-    caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "I420", NULL);
+    // Setup convertor and scaler, the size can be changed while running
+    if (scaleCaps) {
+        caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "I420", "width",
+                                   G_TYPE_INT, mWidth, "height", G_TYPE_INT, mHeight, NULL);
+        g_object_set(G_OBJECT(scaleCaps), "caps", caps, NULL);
+        gst_caps_unref(caps);
+    }
 
     // Setup encoder
 
-    // Setup payload
+    // Setup payload, parameter sets are repeated for receivers joining late
+    g_object_set(G_OBJECT(payload), "config-interval", sSettings.configInterval, NULL);
+    if (sSettings.mtu)
+        g_object_set(G_OBJECT(payload), "mtu", sSettings.mtu, NULL);
 
     // Setup sink
     g_object_set(G_OBJECT(sink), "host", mHost.c_str(), NULL);
     g_object_set(G_OBJECT(sink), "port", mPort, NULL);
+    if (sSettings.lowLatency) {
+        // Send the packets as soon as they are encoded
+        g_object_set(G_OBJECT(sink), "sync", FALSE, "async", FALSE, NULL);
+
+        GstPad *pad = gst_element_get_static_pad(payload, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, cb_encoded_frame, this, NULL);
+        gst_object_unref(pad);
+    }
 
     // Add element to bin
     // gst_bin_add_many(GST_BIN(mPipeline), src, conv, enc, parser, payload, sink, NULL);
-    gst_bin_add_many(GST_BIN(mPipeline), src, conv, mTextOverlay, enc, parser, payload, sink, NULL);
+    if (encoded) {
+        gst_bin_add_many(GST_BIN(mPipeline), src, parser, payload, sink, NULL);
+        if (!gst_element_link_many(src, parser, payload, sink, NULL))
+            log_error("Failed to link parser and payloader!");
+    } else {
+        gst_bin_add_many(GST_BIN(mPipeline), src, conv, scale, scaleCaps, mTextOverlay, enc,
+                         parser, payload, sink, NULL);
+
+        // Link src to sink
+        gst_element_link_many(src, conv, NULL);
+        link_ok = gst_element_link_many(conv, scale, scaleCaps, mTextOverlay, NULL);
+        if (!link_ok) {
+            log_error("Failed to link convertor and encoder!");
+        }
+        gst_element_link_many(mTextOverlay, enc, payload, sink, NULL);
+    }
 
-    // Link src to sink
-    gst_element_link_many(src, conv, NULL);
-    link_ok = gst_element_link_filtered(conv, mTextOverlay, caps);
-    if (!link_ok) {
-        log_error("Failed to link convertor and encoder!");
+    // latency of the frames from their capture to the network
+    gst_frame_add_latency_probe(mPipeline, "VideoSrc", "src", mStats, StageStats::PUSH);
+    gst_frame_add_latency_probe(mPipeline, "venc", "src", mStats, StageStats::ENCODED);
+    gst_frame_add_latency_probe(mPipeline, "H264Rtp", "src", mStats, StageStats::PAYLOADED);
+    gst_frame_add_latency_probe(mPipeline, "UdpSink", "sink", mStats, StageStats::SENT);
+    gst_frame_add_latency_stamp(mPipeline, "venc");
+    gst_frame_add_roi(mPipeline, "venc", mRoi);
+    gst_frame_add_thread_policy(mPipeline, enc ? "venc" : "H264Rtp", "sink", mCamDev->getDeviceId(),
+                                "enc");
+    gst_frame_add_text_overlay(mPipeline, "textoverlay",
+                               [this]() { return getOverlayFrameText(); });
+
+    // Bitrate can be changed while running
+    mEncoder = enc ? gst_bin_get_by_name(GST_BIN(enc), "venc") : nullptr;
+
+    // Receiver reports come back on the RTCP port next to the RTP port
+    if (RateController::isEnabled()) {
+        GstElement *rtcpSrc = gst_element_factory_make("udpsrc", "RtcpSrc");
+        GstElement *rtcpSink = gst_element_factory_make("fakesink", "RtcpSink");
+        if (rtcpSrc && rtcpSink && mEncoder) {
+            g_object_set(G_OBJECT(rtcpSrc), "port", mPort + 1, NULL);
+            g_object_set(G_OBJECT(rtcpSink), "signal-handoffs", TRUE, "sync", FALSE, "async",
+                         FALSE, NULL);
+            g_signal_connect(rtcpSink, "handoff", G_CALLBACK(cb_rtcp_handoff), this);
+            gst_bin_add_many(GST_BIN(mPipeline), rtcpSrc, rtcpSink, NULL);
+            gst_element_link(rtcpSrc, rtcpSink);
+            mBitRate = mSetBitRate ? mSetBitRate : RateController::getMaxBitrate();
+            mRateCtrl.reset(new RateController(mBitRate));
+        } else {
+            log_warning("Bitrate of UDP stream not adapted to the link");
+            if (rtcpSrc)
+                gst_object_unref(rtcpSrc);
+            if (rtcpSink)
+                gst_object_unref(rtcpSink);
+        }
     }
-    gst_element_link_many(mTextOverlay, enc, payload, sink, NULL);
+
+    // Frames are pushed from a thread of their own, paced by the camera
+    mPusher.reset(new FramePusher(mCamDev->getDeviceId(), [this, src](int timeoutMs) {
+        push_frame(this, src, timeoutMs);
+    }));
+    mPusher->setFrameRate(mFrmRate);
 
     // Connect signals
     GstAppSrcCallbacks cbs;
@@ -284,6 +580,10 @@ int VideoStreamUdp::createAppsrcPipeline()
     cbs.seek_data = cb_seek_data;
     gst_app_src_set_callbacks(GST_APP_SRC_CAST(src), &cbs, this, NULL);
 
+    // Get a share of the camera frames
+    if (mFrameHub)
+        mSubscriber = mFrameHub->subscribe();
+
     // Set pipeline to play
     gst_element_set_state(mPipeline, GST_STATE_PLAYING);
 
@@ -296,9 +596,27 @@ int VideoStreamUdp::destroyAppsrcPipeline()
 
     int ret = 0;
 
+    GstElement *src = gst_bin_get_by_name(GST_BIN(mPipeline), "VideoSrc");
+    guint64 dropped = mDropped + gst_frame_get_dropped(src);
+    if (dropped)
+        log_info("UDP stream dropped %llu frames", (unsigned long long)dropped);
+    gst_object_unref(src);
+
     // clean up
     gst_element_set_state(mPipeline, GST_STATE_NULL);
+    // The pipeline is down, a push blocked on a full queue has returned
+    mPusher.reset();
     gst_object_unref(GST_OBJECT(mPipeline));
+    mRateCtrl.reset();
+    if (mEncoder) {
+        gst_object_unref(mEncoder);
+        mEncoder = nullptr;
+    }
+
+    if (mFrameHub)
+        mFrameHub->unsubscribe(mSubscriber);
+    // The frame kept to be repeated holds a camera buffer
+    mMisses = GstFrameMisses();
 
     return ret;
 }
@@ -22,11 +22,23 @@
 #include <memory>
 
 #include "CameraDevice.h"
+#include "FrameHub.h"
+#include "FramePusher.h"
+#include "RateController.h"
 #include "VideoStream.h"
+#include "gst_frame.h"
+
+// Tuning of the UDP stream
+struct UdpStreamSettings {
+    bool lowLatency = false; // Intra refresh, no sink sync, one frame of appsrc latency
+    uint32_t mtu = 0;        // Max RTP packet size, 0 for the payloader default
+    int configInterval = 1;  // Seconds between SPS/PPS, -1 with every key frame
+};
 
 class VideoStreamUdp final : public VideoStream {
 public:
-    VideoStreamUdp(std::shared_ptr<CameraDevice> camDev);
+    VideoStreamUdp(std::shared_ptr<CameraDevice> camDev,
+                   std::shared_ptr<FrameHub> frameHub = nullptr);
     ~VideoStreamUdp();
 
     int init();
@@ -46,16 +58,32 @@ public:
     int getPort();
     int setTextOverlay(std::string text, int timeSec);
     std::string getTextOverlay();
-    GstBuffer *readFrame();
+    int setBitRate(uint32_t bitRate);
+    int getBitRate();
+    int setRegionOfInterest(const VideoRoi &roi);
+    std::string getOverlayFrameText();
+    GstBuffer *readFrame(GstElement *appsrc, int timeoutMs);
+    // Start or pause the pusher thread, from the appsrc signals
+    void wantFrames(bool want);
+    void onRtcpReport(const uint8_t *data, size_t len);
+    void onEncodedFrame(GstBuffer *buffer);
+    GstFlowReturn pushFrame(GstElement *appsrc, GstBuffer *buffer);
+    static void setSettings(const UdpStreamSettings &settings);
 
 private:
     int setState(int state);
     int createAppsrcPipeline();
     int destroyAppsrcPipeline();
     std::shared_ptr<CameraDevice> mCamDev;
+    std::shared_ptr<FrameHub> mFrameHub;
+    int mSubscriber;
     std::atomic<int> mState;
     uint32_t mWidth;
     uint32_t mHeight;
+    uint32_t mCamWidth; // Size of the frames read from the camera
+    uint32_t mCamHeight;
+    uint32_t mFrmRate;
+    CameraParameters::VIDEO_CODING_FORMAT mEncFormat;
     std::string mHost;
     uint32_t mPort;
     std::string mOvText;
@@ -63,4 +91,17 @@ private:
     int mOvFrmCnt; // framerate * mOvTime
     GstElement *mPipeline;
     GstElement *mTextOverlay;
+    GstElement *mEncoder;                      // Encoder element inside the encoder bin
+    std::unique_ptr<RateController> mRateCtrl; // Bitrate adaptation from RTCP receiver reports
+    std::atomic<uint32_t> mSetBitRate;         // Bitrate set through the API, 0 for default
+    std::atomic<uint32_t> mBitRate;            // Last bitrate chosen for the link, in kbps
+    uint64_t mLatencySum;                      // Capture to encoded latency of frames, in ns
+    uint64_t mLatencyMax;
+    uint32_t mLatencyCnt;
+    guint64 mDropped;       // Frames dropped because the appsrc queue was full
+    GstFrameMisses mMisses; // Frames the camera did not give, pushed from the fallback
+    StageStats *mStats;
+    std::unique_ptr<FramePusher> mPusher; // Pushes the camera frames into the appsrc
+    std::shared_ptr<GstFrameRoi> mRoi; // Region of interest of the encoder
+    static UdpStreamSettings sSettings;
 };
@@ -25,12 +25,11 @@
 
 #include "avahi_publisher.h"
 #include "log.h"
-#include "mainloop.h"
 
 AvahiPublisher::AvahiPublisher(std::map<std::string, std::vector<std::string>> &_strMap, int _port,
                                const char *_type)
     : is_running(false)
-    , avahi_poll(nullptr)
+    , threaded_poll(nullptr)
     , info_map(_strMap)
     , client(nullptr)
     , group(nullptr)
@@ -119,7 +118,7 @@ void AvahiPublisher::publish_services(AvahiClient *c)
     }
 
     if (avahi_entry_group_is_empty(group)) {
-        for (auto kv : info_map) {
+        for (auto kv : services) {
             AvahiStringList *strlist = txt_record_from_list(kv.second);
             ret = avahi_entry_group_add_service_strlst(group, AVAHI_IF_UNSPEC, AVAHI_PROTO_INET,
                                                        (AvahiPublishFlags)0, (kv.first).c_str(),
@@ -139,25 +138,112 @@ void AvahiPublisher::publish_services(AvahiClient *c)
     }
 }
 
+/* the same streams, whatever their TXT records */
+static bool same_services(const std::map<std::string, std::vector<std::string>> &a,
+                          const std::map<std::string, std::vector<std::string>> &b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (auto &kv : a) {
+        if (b.find(kv.first) == b.end())
+            return false;
+    }
+    return true;
+}
+
 void AvahiPublisher::start()
 {
-    log_info("AVAHI START");
     if (is_running)
         return;
 
+    /* the services tried, update() starts again only once streams are added or removed */
+    services = info_map;
     if (info_map.size() == 0) {
         log_debug("No streams found. Not publishing avahi services");
         return;
     }
 
+    log_info("AVAHI START");
+
+    threaded_poll = avahi_threaded_poll_new();
+    if (!threaded_poll) {
+        log_error(
+            "Unable to create avahi poll. Video streams won't be published as avahi services.");
+        return;
+    }
+
     is_running = true;
     int error;
 
-    client = avahi_client_new(Mainloop::get_mainloop()->get_avahi_poll_api(), (AvahiClientFlags)0,
+    /* callbacks of the client run on the poll thread from its start on */
+    client = avahi_client_new(avahi_threaded_poll_get(threaded_poll), (AvahiClientFlags)0,
                               avahi_client_cb, this, &error);
     if (!client) {
         log_error("Unalbe to create avahi client. Video streams won't be published as avahi services.");
+        return;
     }
+
+    if (avahi_threaded_poll_start(threaded_poll) < 0)
+        log_error("Unable to start avahi poll thread");
+}
+
+void AvahiPublisher::update()
+{
+    if (!is_running) {
+        if (!same_services(info_map, services))
+            start();
+        return;
+    }
+
+    if (info_map.empty()) {
+        stop();
+        return;
+    }
+
+    avahi_threaded_poll_lock(threaded_poll);
+    if (!update_txt_records()) {
+        services = info_map;
+        reset_services();
+        if (client && avahi_client_get_state(client) == AVAHI_CLIENT_S_RUNNING)
+            publish_services(client);
+    }
+    avahi_threaded_poll_unlock(threaded_poll);
+}
+
+/*
+ * Services only added or removed make the group be published again, TXT records changed in place
+ * are announced as they are, without withdrawing the services.
+ */
+bool AvahiPublisher::update_txt_records()
+{
+    if (!same_services(info_map, services))
+        return false;
+
+    // nothing published yet, the group takes the copy once the client runs
+    if (!group || avahi_entry_group_is_empty(group)) {
+        services = info_map;
+        return true;
+    }
+
+    for (auto &kv : info_map) {
+        std::vector<std::string> &txtList = services[kv.first];
+        if (txtList == kv.second)
+            continue;
+
+        AvahiStringList *strlist = txt_record_from_list(kv.second);
+        int ret = avahi_entry_group_update_service_txt_strlst(
+            group, AVAHI_IF_UNSPEC, AVAHI_PROTO_INET, (AvahiPublishFlags)0, (kv.first).c_str(),
+            type, NULL, strlist);
+        avahi_string_list_free(strlist);
+        if (ret < 0) {
+            log_error("Failed to update TXT record of %s: %s", (kv.first).c_str(),
+                      avahi_strerror(ret));
+            return false;
+        }
+        txtList = kv.second;
+    }
+
+    return true;
 }
 
 void AvahiPublisher::stop()
@@ -166,8 +252,13 @@ void AvahiPublisher::stop()
         return;
     is_running = false;
 
-    avahi_client_free(client);
+    /* joins the poll thread, no callback runs afterwards */
+    avahi_threaded_poll_stop(threaded_poll);
+    if (client)
+        avahi_client_free(client);
     client = nullptr;
     group = nullptr;
+    avahi_threaded_poll_free(threaded_poll);
+    threaded_poll = nullptr;
 }
 #endif
@@ -20,12 +20,17 @@
 #ifdef ENABLE_AVAHI
 #include <avahi-client/client.h>
 #include <avahi-client/publish.h>
-#include <avahi-common/watch.h>
+#include <avahi-common/thread-watch.h>
 #include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+/*
+ * Publishes the streams on a poll of its own, run by an Avahi thread, so that daemon restarts and
+ * collisions are handled apart from the mainloop. The map of the services is copied on start and
+ * update, it may change meanwhile.
+ */
 class AvahiPublisher {
 public:
     AvahiPublisher(std::map<std::string, std::vector<std::string>> &_strMap, int _port,
@@ -33,11 +38,14 @@ public:
     ~AvahiPublisher();
     void start();
     void stop();
+    /* Publish the services again after the map changed, TXT records are updated in place */
+    void update();
 
 private:
     bool is_running;
-    const AvahiPoll *avahi_poll;
+    AvahiThreadedPoll *threaded_poll;
     std::map<std::string, std::vector<std::string>> &info_map;
+    std::map<std::string, std::vector<std::string>> services; /* Copy read by the poll thread */
     AvahiClient *client;
     AvahiEntryGroup *group;
     int port;
@@ -45,6 +53,7 @@ private:
 
     void publish_services(AvahiClient *c);
     void reset_services();
+    bool update_txt_records();
     static void avahi_client_cb(AvahiClient *c, AvahiClientState state, void *userdata);
     static void entry_group_callback(AvahiEntryGroup *g, AvahiEntryGroupState state,
                                      void *userdata);
@@ -0,0 +1,190 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <glib-unix.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "epoll_mainloop.h"
+#include "log.h"
+
+/* Events taken per epoll_wait(), the rest come with the next wakeup of the GLib loop */
+#define MAX_EVENTS 32
+
+EpollMainloop::EpollMainloop()
+    : _epfd(-1)
+    , _source(0)
+    , _next_id(1)
+{
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd < 0) {
+        log_error("Could not create epoll descriptor (%m)");
+        return;
+    }
+
+    _source = g_unix_fd_add(_epfd, G_IO_IN, _epoll_cb, this);
+}
+
+EpollMainloop::~EpollMainloop()
+{
+    if (_source)
+        g_source_remove(_source);
+    if (_epfd >= 0)
+        close(_epfd);
+}
+
+gboolean EpollMainloop::_epoll_cb(gint fd, GIOCondition condition, gpointer data)
+{
+    assert(data);
+
+    ((EpollMainloop *)data)->_dispatch();
+    return G_SOURCE_CONTINUE;
+}
+
+int EpollMainloop::_update(int fd, fd_watch &watch, bool added)
+{
+    struct epoll_event ev = {};
+
+    ev.events = EPOLLET;
+    if (watch.in.id)
+        ev.events |= EPOLLIN;
+    if (watch.out.id)
+        ev.events |= EPOLLOUT;
+    ev.data.fd = fd;
+
+    if (ev.events == EPOLLET)
+        return epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, nullptr);
+
+    /* a modification reports the descriptor again if it is ready already */
+    return epoll_ctl(_epfd, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+}
+
+int EpollMainloop::add_fd(int fd, int flags, bool (*cb)(const void *data, int flags),
+                          const void *data)
+{
+    assert(cb);
+
+    if (_epfd < 0)
+        return GlibMainloop::add_fd(fd, flags, cb, data);
+
+    if (!(flags & (Mainloop::IO_IN | Mainloop::IO_OUT))) {
+        log_error("No valid flags are set. flags=%d", flags);
+        return -EINVAL;
+    }
+
+    auto it = _watches.find(fd);
+    bool added = it == _watches.end();
+    fd_watch &watch = added ? _watches[fd] : it->second;
+
+    /* both directions on one handler are kept as two, removed together */
+    int id = _next_id++;
+    if (flags & Mainloop::IO_IN) {
+        if (watch.in.id)
+            _handlers.erase(watch.in.id);
+        watch.in = {id, cb, data};
+    }
+    if (flags & Mainloop::IO_OUT) {
+        if (watch.out.id)
+            _handlers.erase(watch.out.id);
+        watch.out = {id, cb, data};
+    }
+
+    if (_update(fd, watch, added) < 0) {
+        int err = errno;
+        log_error("Could not watch fd %d (%s)", fd, strerror(err));
+        if (watch.in.id == id)
+            watch.in.id = 0;
+        if (watch.out.id == id)
+            watch.out.id = 0;
+        if (!watch.in.id && !watch.out.id)
+            _watches.erase(fd);
+        return -err;
+    }
+
+    _handlers[id] = fd;
+    return id;
+}
+
+void EpollMainloop::remove_fd(int handler)
+{
+    assert(handler > 0);
+
+    auto h = _handlers.find(handler);
+    if (h == _handlers.end()) {
+        if (_epfd < 0)
+            GlibMainloop::remove_fd(handler);
+        return;
+    }
+
+    int fd = h->second;
+    _handlers.erase(h);
+
+    auto it = _watches.find(fd);
+    if (it == _watches.end())
+        return;
+
+    fd_watch &watch = it->second;
+    if (watch.in.id == handler)
+        watch.in.id = 0;
+    if (watch.out.id == handler)
+        watch.out.id = 0;
+
+    /* the descriptor may be closed already, it left the set then */
+    if (_update(fd, watch, false) < 0 && errno != EBADF && errno != ENOENT)
+        log_error("Could not update watch of fd %d (%m)", fd);
+
+    if (!watch.in.id && !watch.out.id)
+        _watches.erase(it);
+}
+
+/* The handler is looked up again for each call, an earlier one may have removed it */
+void EpollMainloop::_call(int fd, bool out, int flags)
+{
+    auto it = _watches.find(fd);
+    if (it == _watches.end())
+        return;
+
+    fd_handler handler = out ? it->second.out : it->second.in;
+    if (!handler.id)
+        return;
+
+    if (!handler.cb(handler.data, flags))
+        remove_fd(handler.id);
+}
+
+void EpollMainloop::_dispatch()
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    int n = epoll_wait(_epfd, events, MAX_EVENTS, 0);
+    if (n < 0) {
+        if (errno != EINTR)
+            log_error("epoll_wait failed (%m)");
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        /* errors and hangups are reported to the reader, which gets them from read() */
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            _call(fd, false, Mainloop::IO_IN);
+        if (events[i].events & EPOLLOUT)
+            _call(fd, true, Mainloop::IO_OUT);
+    }
+}
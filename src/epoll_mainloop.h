@@ -0,0 +1,68 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <glib.h>
+#include <map>
+#include <sys/epoll.h>
+
+#include "glib_mainloop.h"
+
+/*
+ * Mainloop watching descriptors with one edge-triggered epoll set. The epoll descriptor is the
+ * only source added to the GLib context, which still runs the timeouts and the sources of
+ * GStreamer and Avahi, so a wakeup dispatches all ready descriptors at once without going through
+ * a GSource each.
+ *
+ * Being edge-triggered, a callback must read or write until EAGAIN, or it is not called again
+ * before new data comes.
+ */
+class EpollMainloop : public GlibMainloop {
+public:
+    EpollMainloop();
+    ~EpollMainloop();
+
+    int add_fd(int fd, int flags, bool (*cb)(const void *data, int flags),
+               const void *data) override;
+    void remove_fd(int handler) override;
+
+private:
+    /* Watch of one direction of the descriptor */
+    struct fd_handler {
+        int id; /* Handler returned by add_fd(), 0 if not watched */
+        bool (*cb)(const void *data, int flags);
+        const void *data;
+    };
+
+    /* Descriptors are in the epoll set once, with the handlers of both directions */
+    struct fd_watch {
+        struct fd_handler in;
+        struct fd_handler out;
+    };
+
+    int _epfd;
+    unsigned int _source;
+    int _next_id;
+    std::map<int, fd_watch> _watches; /* By descriptor */
+    std::map<int, int> _handlers;      /* Descriptor by handler */
+
+    int _update(int fd, fd_watch &watch, bool added);
+    void _dispatch();
+    void _call(int fd, bool out, int flags);
+    static gboolean _epoll_cb(gint fd, GIOCondition condition, gpointer data);
+};
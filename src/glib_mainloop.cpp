@@ -107,6 +107,13 @@ void GlibMainloop::del_timeout(unsigned int timeout_handler)
     g_source_remove(timeout_handler);
 }
 
+unsigned int GlibMainloop::add_signal(int signum, bool (*cb)(void *), const void *data)
+{
+    assert(cb);
+
+    return g_unix_signal_add(signum, (GSourceFunc)cb, (void *)data);
+}
+
 static gboolean fd_io_cb(gint fd, GIOCondition condition, gpointer user_data)
 {
     int flags = 0;
@@ -37,6 +37,7 @@ public:
     unsigned int add_timeout(unsigned int timeout_msec, bool (*cb)(void *),
                              const void *data) override;
     void del_timeout(unsigned int timeout_handler) override;
+    unsigned int add_signal(int signum, bool (*cb)(void *), const void *data) override;
     int add_fd(int fd, int flags, bool (*cb)(const void *data, int flags), const void *data) override;
     void remove_fd(int handler) override;
 
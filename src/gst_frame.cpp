@@ -0,0 +1,597 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gst/video/video.h>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#include "gst_frame.h"
+#include "ThreadPolicy.h"
+#include "latency_stamp.h"
+#include "log.h"
+#include "util.h"
+
+/* Log every so many dropped frames */
+#define DROP_LOG_INTERVAL 100
+
+static guint sQueueFrames = DEFAULT_QUEUE_FRAMES;
+static GstFrameLeak sQueueLeak = GST_FRAME_LEAK_OLDEST;
+static bool sLatencyStamp = false;
+static GstFrameFallback sFallback = GST_FRAME_FALLBACK_BLANK;
+
+/* Blank frames by pixel format and size, shared by all streams */
+static std::mutex sBlankLock;
+static std::map<std::tuple<int, guint, guint>, GstBuffer *> sBlank;
+
+static void release_frame(gpointer data)
+{
+    delete static_cast<std::shared_ptr<const Frame> *>(data);
+}
+
+GstVideoFormat gst_frame_get_video_format(CameraParameters::PixelFormat format)
+{
+    switch (format) {
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_GREY:
+        return GST_VIDEO_FORMAT_GRAY8;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV420:
+        return GST_VIDEO_FORMAT_I420;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUV422P:
+        return GST_VIDEO_FORMAT_Y42B;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_UYVY:
+        return GST_VIDEO_FORMAT_UYVY;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_YUYV:
+        return GST_VIDEO_FORMAT_YUY2;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_NV12:
+        return GST_VIDEO_FORMAT_NV12;
+    case CameraParameters::PixelFormat::PIXEL_FORMAT_RGB24:
+        return GST_VIDEO_FORMAT_RGB;
+    default:
+        return GST_VIDEO_FORMAT_UNKNOWN;
+    }
+}
+
+GstBuffer *gst_frame_wrap(const std::shared_ptr<const Frame> &frame, GstElement *element)
+{
+    const CameraData &data = frame->data;
+    gsize size = data.bufSize;
+    GstBuffer *buffer
+        = gst_buffer_new_wrapped_full(GST_MEMORY_FLAG_READONLY, data.buf, size, 0, size,
+                                      new std::shared_ptr<const Frame>(frame), release_frame);
+
+    /* padded lines and planes are read in place, instead of repacked to the default layout */
+    GstVideoFormat format = gst_frame_get_video_format(data.format);
+    if (data.planes && format != GST_VIDEO_FORMAT_UNKNOWN) {
+        gsize offset[GST_VIDEO_MAX_PLANES] = {};
+        gint stride[GST_VIDEO_MAX_PLANES] = {};
+        for (guint i = 0; i < data.planes && i < GST_VIDEO_MAX_PLANES; i++) {
+            offset[i] = data.plane[i].offset;
+            stride[i] = data.plane[i].stride;
+        }
+        gst_buffer_add_video_meta_full(buffer, GST_VIDEO_FRAME_FLAG_NONE, format, data.width,
+                                       data.height, data.planes, offset, stride);
+    }
+
+    gst_frame_set_timestamp(buffer, element, frame->data.timestamp);
+    return buffer;
+}
+
+void gst_frame_set_timestamp(GstBuffer *buffer, GstElement *element, uint64_t timestamp)
+{
+    GstClock *clock = element ? gst_element_get_clock(element) : nullptr;
+    if (!clock) {
+        /* not playing yet, leave it to the element */
+        GST_BUFFER_PTS(buffer) = GST_CLOCK_TIME_NONE;
+        GST_BUFFER_DTS(buffer) = GST_CLOCK_TIME_NONE;
+        return;
+    }
+
+    GstClockTime runningTime = gst_clock_get_time(clock) - gst_element_get_base_time(element);
+    gst_object_unref(clock);
+
+    uint64_t now = now_usec() * NSEC_PER_USEC;
+    uint64_t age = (timestamp && now > timestamp) ? now - timestamp : 0;
+
+    GST_BUFFER_PTS(buffer) = runningTime > age ? runningTime - age : 0;
+    GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+}
+
+uint64_t gst_frame_get_timestamp(GstBuffer *buffer, GstElement *element)
+{
+    uint64_t now = now_usec() * NSEC_PER_USEC;
+    GstClock *clock = gst_element_get_clock(element);
+    if (!clock || !GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) {
+        if (clock)
+            gst_object_unref(clock);
+        return now;
+    }
+
+    GstClockTime runningTime = gst_clock_get_time(clock) - gst_element_get_base_time(element);
+    gst_object_unref(clock);
+
+    uint64_t age = runningTime > GST_BUFFER_PTS(buffer) ? runningTime - GST_BUFFER_PTS(buffer) : 0;
+    return now > age ? now - age : now;
+}
+
+struct LatencyProbe {
+    StageStats *stats;
+    StageStats::Stage stage;
+};
+
+static GstPadProbeReturn latency_probe_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    LatencyProbe *probe = (LatencyProbe *)user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    if (!buffer || !GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)))
+        return GST_PAD_PROBE_OK;
+
+    GstElement *element = gst_pad_get_parent_element(pad);
+    if (!element)
+        return GST_PAD_PROBE_OK;
+
+    GstClock *clock = gst_element_get_clock(element);
+    if (clock) {
+        GstClockTime runningTime = gst_clock_get_time(clock) - gst_element_get_base_time(element);
+        if (probe->stage == StageStats::ENCODED)
+            probe->stats->encoded(gst_buffer_get_size(buffer));
+        if (runningTime >= GST_BUFFER_PTS(buffer))
+            probe->stats->record(probe->stage,
+                                 (runningTime - GST_BUFFER_PTS(buffer)) / NSEC_PER_USEC);
+        gst_object_unref(clock);
+    }
+    gst_object_unref(element);
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void latency_probe_free(gpointer data)
+{
+    delete (LatencyProbe *)data;
+}
+
+void gst_frame_add_latency_probe(GstElement *bin, const char *name, const char *pad,
+                                 StageStats *stats, StageStats::Stage stage)
+{
+    GstElement *element = gst_bin_get_by_name(GST_BIN(bin), name);
+    if (!element)
+        return;
+
+    GstPad *p = gst_element_get_static_pad(element, pad);
+    if (p) {
+        gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, latency_probe_cb,
+                          new LatencyProbe{stats, stage}, latency_probe_free);
+        gst_object_unref(p);
+    }
+    gst_object_unref(element);
+}
+
+/* formats whose first plane is 8 bits luma */
+static bool has_luma_plane(GstVideoFormat format)
+{
+    switch (format) {
+    case GST_VIDEO_FORMAT_I420:
+    case GST_VIDEO_FORMAT_YV12:
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_NV21:
+    case GST_VIDEO_FORMAT_Y42B:
+    case GST_VIDEO_FORMAT_Y444:
+    case GST_VIDEO_FORMAT_GRAY8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static GstPadProbeReturn latency_stamp_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer)
+        return GST_PAD_PROBE_OK;
+
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!caps)
+        return GST_PAD_PROBE_OK;
+    GstVideoInfo vinfo;
+    bool ok = gst_video_info_from_caps(&vinfo, caps)
+        && has_luma_plane(GST_VIDEO_INFO_FORMAT(&vinfo));
+    gst_caps_unref(caps);
+    if (!ok)
+        return GST_PAD_PROBE_OK;
+
+    GstElement *element = gst_pad_get_parent_element(pad);
+    if (!element)
+        return GST_PAD_PROBE_OK;
+    uint32_t stamp = latency_stamp_from_monotonic(gst_frame_get_timestamp(buffer, element));
+    gst_object_unref(element);
+
+    /* frames wrapped from the camera are read-only, mapping for write copies them */
+    buffer = gst_buffer_make_writable(buffer);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &vinfo, buffer, GST_MAP_WRITE))
+        return GST_PAD_PROBE_OK;
+    latency_stamp_write((uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0),
+                        GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0), GST_VIDEO_FRAME_WIDTH(&frame),
+                        GST_VIDEO_FRAME_HEIGHT(&frame), stamp);
+    gst_video_frame_unmap(&frame);
+
+    return GST_PAD_PROBE_OK;
+}
+
+void gst_frame_set_latency_stamp(bool enable)
+{
+    sLatencyStamp = enable;
+}
+
+void gst_frame_add_latency_stamp(GstElement *bin, const char *name)
+{
+    if (!sLatencyStamp)
+        return;
+
+    GstElement *element = gst_bin_get_by_name(GST_BIN(bin), name);
+    if (!element)
+        return;
+
+    GstPad *p = gst_element_get_static_pad(element, "sink");
+    if (p) {
+        gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, latency_stamp_cb, nullptr, nullptr);
+        gst_object_unref(p);
+    }
+    gst_object_unref(element);
+}
+
+void gst_frame_set_queue_policy(guint frames, GstFrameLeak leak)
+{
+    sQueueFrames = frames;
+    sQueueLeak = leak;
+}
+
+guint gst_frame_get_queue_frames()
+{
+    return sQueueFrames;
+}
+
+static bool has_property(GstElement *element, const char *name)
+{
+    return g_object_class_find_property(G_OBJECT_GET_CLASS(element), name) != nullptr;
+}
+
+/* appsrc applies the leak policy itself, only when built and run with gstreamer 1.20 or later */
+static bool has_leaky_type(GstElement *appsrc)
+{
+#if GST_CHECK_VERSION(1, 20, 0)
+    return has_property(appsrc, "leaky-type");
+#else
+    return false;
+#endif
+}
+
+void gst_frame_setup_queue(GstElement *appsrc, gsize frameSize)
+{
+    gst_app_src_set_max_bytes(GST_APP_SRC(appsrc), (guint64)sQueueFrames * frameSize);
+    g_object_set(G_OBJECT(appsrc), "block", sQueueLeak == GST_FRAME_LEAK_BLOCK, NULL);
+
+    if (sQueueLeak == GST_FRAME_LEAK_BLOCK || !has_leaky_type(appsrc))
+        return;
+
+#if GST_CHECK_VERSION(1, 20, 0)
+    /* appsrc drops frames by itself, limit the buffers too in case frames are small */
+    g_object_set(G_OBJECT(appsrc), "max-buffers", (guint64)sQueueFrames, "leaky-type",
+                 sQueueLeak == GST_FRAME_LEAK_OLDEST ? GST_APP_LEAKY_TYPE_DOWNSTREAM
+                                                     : GST_APP_LEAKY_TYPE_UPSTREAM,
+                 NULL);
+#endif
+}
+
+GstFlowReturn gst_frame_push(GstElement *appsrc, GstBuffer *buffer, guint64 *dropped,
+                             StageStats *stats)
+{
+    GstAppSrc *src = GST_APP_SRC(appsrc);
+    bool full = gst_app_src_get_current_level_bytes(src) + gst_buffer_get_size(buffer)
+        > gst_app_src_get_max_bytes(src);
+
+    if (sQueueLeak != GST_FRAME_LEAK_BLOCK && full && !has_leaky_type(appsrc)) {
+        /* older appsrc would queue without bound, drop the frame being pushed */
+        gst_buffer_unref(buffer);
+        if (stats)
+            stats->drop();
+        if (++*dropped == 1 || *dropped % DROP_LOG_INTERVAL == 0)
+            log_warning("Encoder falls behind, %llu frames dropped", (unsigned long long)*dropped);
+        return GST_FLOW_OK;
+    }
+
+    /* appsrc drops a frame by itself to make room for this one */
+    if (stats && sQueueLeak != GST_FRAME_LEAK_BLOCK && full)
+        stats->drop();
+
+    GstFlowReturn ret = gst_app_src_push_buffer(src, buffer);
+    if (stats)
+        stats->setQueueLevel(gst_app_src_get_current_level_bytes(src));
+    return ret;
+}
+
+guint64 gst_frame_get_dropped(GstElement *appsrc)
+{
+    guint64 dropped = 0;
+
+    if (has_property(appsrc, "dropped"))
+        g_object_get(G_OBJECT(appsrc), "dropped", &dropped, NULL);
+
+    return dropped;
+}
+
+void gst_frame_force_key_unit(GstElement *bin, const char *name)
+{
+    GstElement *element = gst_bin_get_by_name(GST_BIN(bin), name);
+    if (!element)
+        return;
+
+    GstPad *pad = gst_element_get_static_pad(element, "src");
+    if (pad) {
+        GstStructure *s = gst_structure_new("GstForceKeyUnit", "all-headers", G_TYPE_BOOLEAN,
+                                            TRUE, NULL);
+        gst_pad_send_event(pad, gst_event_new_custom(GST_EVENT_CUSTOM_UPSTREAM, s));
+        gst_object_unref(pad);
+    }
+    gst_object_unref(element);
+}
+
+void gst_frame_set_fallback(GstFrameFallback fallback)
+{
+    sFallback = fallback;
+}
+
+void gst_frame_read(GstFrameMisses *misses)
+{
+    if (misses->count)
+        log_info("Camera gives frames again after %u missed", misses->count);
+    misses->count = 0;
+}
+
+/* white frame, each plane of the format filled on its own */
+static GstBuffer *new_blank(const GstVideoInfo *info)
+{
+    gsize size = GST_VIDEO_INFO_SIZE(info);
+    GstBuffer *buffer = gst_buffer_new_allocate(NULL, size, NULL);
+    GstMapInfo map;
+
+    switch (GST_VIDEO_INFO_FORMAT(info)) {
+    case GST_VIDEO_FORMAT_UYVY:
+        if (gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
+            for (gsize i = 0; i + 1 < map.size; i += 2) {
+                map.data[i] = 0x80;
+                map.data[i + 1] = 0xff;
+            }
+            gst_buffer_unmap(buffer, &map);
+        }
+        break;
+    default:
+        for (guint p = 0; p < GST_VIDEO_INFO_N_PLANES(info); p++) {
+            gsize start = GST_VIDEO_INFO_PLANE_OFFSET(info, p);
+            gsize end = p + 1 < GST_VIDEO_INFO_N_PLANES(info)
+                ? GST_VIDEO_INFO_PLANE_OFFSET(info, p + 1)
+                : size;
+            /* chroma planes are neutral */
+            guint8 value = GST_VIDEO_INFO_IS_YUV(info) && p > 0 ? 0x80 : 0xff;
+            gst_buffer_memset(buffer, start, value, end - start);
+        }
+    }
+
+    return buffer;
+}
+
+GstBuffer *gst_frame_fallback(GstFrameMisses *misses, FrameHub *frameHub, GstElement *appsrc)
+{
+    misses->count++;
+    /* a camera that hiccups at the frame rate would flood the log */
+    if (!(misses->count & (misses->count - 1)))
+        log_error("Camera returned no frame, %u in a row", misses->count);
+
+    GstBuffer *buffer = nullptr;
+    std::shared_ptr<const Frame> last;
+    if (sFallback == GST_FRAME_FALLBACK_REPEAT && frameHub)
+        last = frameHub->getRepeatFrame();
+    if (last) {
+        buffer = gst_frame_wrap(last, appsrc);
+    } else {
+        GstVideoInfo info;
+        GstCaps *caps = gst_app_src_get_caps(GST_APP_SRC(appsrc));
+        if (!caps || !gst_video_info_from_caps(&info, caps)) {
+            if (caps)
+                gst_caps_unref(caps);
+            return nullptr;
+        }
+        gst_caps_unref(caps);
+
+        std::lock_guard<std::mutex> locker(sBlankLock);
+        GstBuffer *&blank = sBlank[std::make_tuple((int)GST_VIDEO_INFO_FORMAT(&info),
+                                                   GST_VIDEO_INFO_WIDTH(&info),
+                                                   GST_VIDEO_INFO_HEIGHT(&info))];
+        if (!blank)
+            blank = new_blank(&info);
+        /* new buffer on the same memory, the image is not copied */
+        buffer = gst_buffer_copy(blank);
+    }
+
+    gst_frame_set_timestamp(buffer, appsrc, 0);
+    return buffer;
+}
+
+/* structures of the ROI meta read by the encoders, with the quantizer offset of the region */
+static const char *const sRoiParams[] = {"roi/vaapi", "roi/va", "roi/msdk"};
+
+static GstPadProbeReturn roi_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer)
+        return GST_PAD_PROBE_OK;
+
+    GstFrameRoi *shared = ((std::shared_ptr<GstFrameRoi> *)user_data)->get();
+    VideoRoi roi;
+    {
+        std::lock_guard<std::mutex> locker(shared->lock);
+        roi = shared->roi;
+    }
+    if (roi.width <= 0 || roi.height <= 0)
+        return GST_PAD_PROBE_OK;
+
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!caps)
+        return GST_PAD_PROBE_OK;
+    GstVideoInfo vinfo;
+    bool ok = gst_video_info_from_caps(&vinfo, caps);
+    gst_caps_unref(caps);
+    if (!ok)
+        return GST_PAD_PROBE_OK;
+
+    /* the region follows the size of the stream */
+    int width = GST_VIDEO_INFO_WIDTH(&vinfo);
+    int height = GST_VIDEO_INFO_HEIGHT(&vinfo);
+    guint x = CLAMP(roi.x, 0.0f, 1.0f) * width;
+    guint y = CLAMP(roi.y, 0.0f, 1.0f) * height;
+    guint w = MIN((guint)(roi.width * width), width - x);
+    guint h = MIN((guint)(roi.height * height), height - y);
+    if (!w || !h)
+        return GST_PAD_PROBE_OK;
+
+    buffer = gst_buffer_make_writable(buffer);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+    GstVideoRegionOfInterestMeta *meta
+        = gst_buffer_add_video_region_of_interest_meta(buffer, "roi", x, y, w, h);
+    for (const char *param : sRoiParams)
+        gst_video_region_of_interest_meta_add_param(
+            meta, gst_structure_new(param, "delta-qp", G_TYPE_INT, roi.deltaQp, NULL));
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void roi_free(gpointer user_data)
+{
+    delete (std::shared_ptr<GstFrameRoi> *)user_data;
+}
+
+void gst_frame_add_roi(GstElement *bin, const char *name, const std::shared_ptr<GstFrameRoi> &roi)
+{
+    if (!roi)
+        return;
+
+    GstElement *element = gst_bin_get_by_name(GST_BIN(bin), name);
+    if (!element)
+        return;
+
+    GstPad *p = gst_element_get_static_pad(element, "sink");
+    if (p) {
+        gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, roi_cb,
+                          new std::shared_ptr<GstFrameRoi>(roi), roi_free);
+        gst_object_unref(p);
+    }
+    gst_object_unref(element);
+}
+
+struct TextOverlay {
+    std::function<std::string()> text;
+    std::string shown;
+};
+
+static GstPadProbeReturn text_overlay_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    TextOverlay *overlay = (TextOverlay *)user_data;
+    std::string text = overlay->text();
+    if (text == overlay->shown)
+        return GST_PAD_PROBE_OK;
+
+    /* the element renders the text again only when it is set */
+    GstElement *element = gst_pad_get_parent_element(pad);
+    if (!element)
+        return GST_PAD_PROBE_OK;
+    g_object_set(G_OBJECT(element), "text", text.c_str(), "silent", text.empty(), NULL);
+    gst_object_unref(element);
+    overlay->shown = text;
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void text_overlay_free(gpointer user_data)
+{
+    delete (TextOverlay *)user_data;
+}
+
+void gst_frame_add_text_overlay(GstElement *bin, const char *name,
+                                std::function<std::string()> text)
+{
+    GstElement *element = gst_bin_get_by_name(GST_BIN(bin), name);
+    if (!element)
+        return;
+
+    /* bottom left, on a shaded background, nothing until there is text */
+    g_object_set(G_OBJECT(element), "text", "", "silent", TRUE, "valignment", 2, "halignment", 0,
+                 "shaded-background", TRUE, NULL);
+
+    GstPad *p = gst_element_get_static_pad(element, "video_sink");
+    if (p) {
+        TextOverlay *overlay = new TextOverlay;
+        overlay->text = text;
+        gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, text_overlay_cb, overlay,
+                          text_overlay_free);
+        gst_object_unref(p);
+    }
+    gst_object_unref(element);
+}
+
+struct StreamingThread {
+    std::string camera;
+    const char *role;
+    GThread *thread;
+};
+
+static GstPadProbeReturn thread_policy_cb(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    StreamingThread *st = (StreamingThread *)user_data;
+
+    /* only one thread streams through a pad at a time */
+    GThread *self = g_thread_self();
+    if (st->thread != self) {
+        ThreadPolicy::apply(st->camera, st->role);
+        st->thread = self;
+    }
+
+    return GST_PAD_PROBE_OK;
+}
+
+static void thread_policy_free(gpointer user_data)
+{
+    delete (StreamingThread *)user_data;
+}
+
+void gst_frame_add_thread_policy(GstElement *bin, const char *name, const char *pad,
+                                 const std::string &camera, const char *role)
+{
+    GstElement *element = gst_bin_get_by_name(GST_BIN(bin), name);
+    if (!element)
+        return;
+
+    GstPad *p = gst_element_get_static_pad(element, pad);
+    if (p) {
+        gst_pad_add_probe(p, GST_PAD_PROBE_TYPE_BUFFER, thread_policy_cb,
+                          new StreamingThread{camera, role, nullptr}, thread_policy_free);
+        gst_object_unref(p);
+    }
+    gst_object_unref(element);
+}
@@ -0,0 +1,263 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <gst/app/gstappsrc.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "FrameHub.h"
+#include "StageStats.h"
+#include "VideoStream.h"
+
+#define DEFAULT_QUEUE_FRAMES 2
+
+/**
+ *  Get the gstreamer video format of the frames of a pixel format.
+ *
+ *  @param[in] format Pixel format.
+ *
+ *  @return Video format, GST_VIDEO_FORMAT_UNKNOWN if not raw or not mapped.
+ */
+GstVideoFormat gst_frame_get_video_format(CameraParameters::PixelFormat format);
+
+/**
+ *  Wrap a frame in a read-only GstBuffer without copying the image data. The frame is referenced
+ *  until gstreamer releases the buffer. The buffer is timestamped with the capture time of the
+ *  frame, see gst_frame_set_timestamp(). Frames with their planes described carry a
+ *  GstVideoMeta, so that padded lines are read in place.
+ *
+ *  @param[in] frame Frame to wrap.
+ *  @param[in] element Element the buffer is pushed from.
+ *
+ *  @return Buffer wrapping the frame.
+ */
+GstBuffer *gst_frame_wrap(const std::shared_ptr<const Frame> &frame, GstElement *element);
+
+/**
+ *  Set PTS/DTS of a buffer to a capture time on the running time of the element's pipeline. The
+ *  age of the frame is measured on the monotonic clock and taken off the current running time, so
+ *  the result does not depend on the clock the pipeline uses.
+ *
+ *  @param[in] buffer Buffer to timestamp.
+ *  @param[in] element Element the buffer is pushed from, null to leave the buffer untimestamped.
+ *  @param[in] timestamp Monotonic capture time in nano sec, 0 for now.
+ */
+void gst_frame_set_timestamp(GstBuffer *buffer, GstElement *element, uint64_t timestamp);
+
+/**
+ *  Get the capture time of a buffer timestamped on the running time of the element's pipeline,
+ *  the reverse of gst_frame_set_timestamp().
+ *
+ *  @param[in] buffer Buffer out of the pipeline.
+ *  @param[in] element Element of the pipeline.
+ *
+ *  @return Monotonic capture time in nano sec, now if the buffer has no timestamp.
+ */
+uint64_t gst_frame_get_timestamp(GstBuffer *buffer, GstElement *element);
+
+/**
+ *  Record the latency of the buffers going through a pad of an element, from their capture time
+ *  to the time they pass the pad, as a stage of the camera statistics. Buffers are expected to be
+ *  timestamped with gst_frame_set_timestamp().
+ *
+ *  @param[in] bin Pipeline the element is in, looked up recursively.
+ *  @param[in] name Name of the element, nothing is done if it is not there.
+ *  @param[in] pad Name of the static pad of the element.
+ *  @param[in] stats Statistics of the camera.
+ *  @param[in] stage Stage the pad is.
+ */
+void gst_frame_add_latency_probe(GstElement *bin, const char *name, const char *pad,
+                                 StageStats *stats, StageStats::Stage stage);
+
+/**
+ *  Stamp the capture time into the image of the frames going into the encoder, for the glass to
+ *  glass latency to be measured by the receiver, see latency_stamp.h.
+ *
+ *  @param[in] enable True to stamp the frames of the pipelines set up afterwards.
+ */
+void gst_frame_set_latency_stamp(bool enable);
+
+/**
+ *  Stamp the frames going into an element, if enabled with gst_frame_set_latency_stamp(). Only
+ *  raw formats with a luma plane are stamped, I420 and NV12 among them.
+ *
+ *  @param[in] bin Pipeline the element is in, looked up recursively.
+ *  @param[in] name Name of the encoder, nothing is done if it is not there.
+ */
+void gst_frame_add_latency_stamp(GstElement *bin, const char *name);
+
+/**
+ *  Policy applied when the appsrc queue of a stream is full, because the encoder falls behind.
+ */
+enum GstFrameLeak {
+    GST_FRAME_LEAK_OLDEST, /**< Drop the oldest queued frame, keeps the latency low. */
+    GST_FRAME_LEAK_NEWEST, /**< Drop the frame being pushed. */
+    GST_FRAME_LEAK_BLOCK,  /**< Wait for room in the queue, the camera is read slower. */
+};
+
+/**
+ *  Set the depth and the leak policy of the appsrc queues set up afterwards.
+ *
+ *  @param[in] frames Number of frames the queue holds.
+ *  @param[in] leak Policy when the queue is full.
+ */
+void gst_frame_set_queue_policy(guint frames, GstFrameLeak leak);
+
+/**
+ *  Get the depth of the appsrc queues set up afterwards.
+ *
+ *  @return Number of frames a queue holds.
+ */
+guint gst_frame_get_queue_frames();
+
+/**
+ *  Bound the queue of an appsrc to the configured number of frames and apply the leak policy.
+ *  Dropping the oldest frame needs the leaky-type property of appsrc (gstreamer 1.20), older
+ *  versions drop the newest frame instead.
+ *
+ *  @param[in] appsrc Appsrc element.
+ *  @param[in] frameSize Size in bytes of a frame.
+ */
+void gst_frame_setup_queue(GstElement *appsrc, gsize frameSize);
+
+/**
+ *  Push a buffer into an appsrc set up with gst_frame_setup_queue(), dropping it if the queue is
+ *  full and appsrc does not apply the leak policy itself.
+ *
+ *  @param[in] appsrc Appsrc element.
+ *  @param[in] buffer Buffer to push, ownership is taken.
+ *  @param[in,out] dropped Counter of the frames dropped.
+ *  @param[in] stats Statistics the drops and the queue level are reported to, may be null.
+ *
+ *  @return Result of the push, GST_FLOW_OK if the buffer was dropped.
+ */
+GstFlowReturn gst_frame_push(GstElement *appsrc, GstBuffer *buffer, guint64 *dropped,
+                             StageStats *stats = nullptr);
+
+/**
+ *  Get the number of frames dropped by the appsrc itself, when it applies the leak policy.
+ *
+ *  @param[in] appsrc Appsrc element.
+ *
+ *  @return Number of frames dropped.
+ */
+guint64 gst_frame_get_dropped(GstElement *appsrc);
+
+/**
+ *  Ask the encoder upstream of an element for a key frame, with the stream headers, so that the
+ *  receivers can decode from the next frame on.
+ *
+ *  @param[in] bin Pipeline the element is in, looked up recursively.
+ *  @param[in] name Name of the element downstream of the encoder, the payloader.
+ */
+void gst_frame_force_key_unit(GstElement *bin, const char *name);
+
+/**
+ *  Frame pushed in place of a camera frame that could not be read.
+ */
+enum GstFrameFallback {
+    GST_FRAME_FALLBACK_BLANK,  /**< White frame, allocated once per format and size. */
+    GST_FRAME_FALLBACK_REPEAT, /**< Last frame read, a white frame if there is none yet. */
+};
+
+/**
+ *  Set the frame pushed by the streams set up afterwards when the camera gives none.
+ *
+ *  @param[in] fallback Frame pushed instead.
+ */
+void gst_frame_set_fallback(GstFrameFallback fallback);
+
+/**
+ *  Frames missed by a stream, for gst_frame_fallback().
+ */
+struct GstFrameMisses {
+    guint count = 0; /**< Reads in a row that gave no frame. */
+};
+
+/**
+ *  Record a frame read from the camera, ends a run of missed frames.
+ *
+ *  @param[in,out] misses Misses of the stream.
+ */
+void gst_frame_read(GstFrameMisses *misses);
+
+/**
+ *  Get the frame to push when the camera gave none. The image data is shared, nothing is
+ *  allocated or filled per frame: blank frames are kept per format and size of the appsrc caps,
+ *  the last frame of the hub is wrapped again, see FrameHub::getRepeatFrame(). Runs of misses are
+ *  logged at every power of two.
+ *
+ *  @param[in,out] misses Misses of the stream.
+ *  @param[in] frameHub Hub the stream reads, null if none.
+ *  @param[in] appsrc Appsrc the buffer is pushed from, its caps give the frame layout.
+ *
+ *  @return Buffer to push, timestamped now, null if the appsrc has no raw video caps.
+ */
+GstBuffer *gst_frame_fallback(GstFrameMisses *misses, FrameHub *frameHub, GstElement *appsrc);
+
+/**
+ *  Region of interest of the frames going into an encoder, shared with the pipelines so that it
+ *  can be moved while they run.
+ */
+struct GstFrameRoi {
+    std::mutex lock;
+    VideoRoi roi; /**< Region, of no width while there is none. */
+};
+
+/**
+ *  Attach the region of interest to the frames going into an element, as a
+ *  GstVideoRegionOfInterestMeta carrying the quantizer offset for the VA-API and Media SDK
+ *  encoders. Only the metadata of the buffers is written, the image data stays shared. Encoders
+ *  without ROI support ignore the meta.
+ *
+ *  @param[in] bin Pipeline the element is in, looked up recursively.
+ *  @param[in] name Name of the encoder, nothing is done if it is not there.
+ *  @param[in] roi Region of interest, referenced by the pipeline.
+ */
+void gst_frame_add_roi(GstElement *bin, const char *name, const std::shared_ptr<GstFrameRoi> &roi);
+
+/**
+ *  Overlay text on the frames going through a textoverlay element. The text is asked for on every
+ *  frame but the element is only updated when it changes, its layout is set once. The text is
+ *  blended by textoverlay, or attached as a GstVideoOverlayCompositionMeta when the elements
+ *  downstream take the meta.
+ *
+ *  @param[in] bin Pipeline the element is in, looked up recursively.
+ *  @param[in] name Name of the textoverlay element, nothing is done if it is not there.
+ *  @param[in] text Gives the text to show, empty for none. Called from the streaming thread.
+ */
+void gst_frame_add_text_overlay(GstElement *bin, const char *name,
+                                std::function<std::string()> text);
+
+/**
+ *  Apply the thread policy of a camera to the streaming thread going through a pad of an element,
+ *  see ThreadPolicy. The thread is named and placed on the first buffer, and again whenever
+ *  another thread of the task pool takes over the pad, after a restart of the pipeline.
+ *
+ *  @param[in] bin Pipeline the element is in, looked up recursively.
+ *  @param[in] name Name of the element, nothing is done if it is not there.
+ *  @param[in] pad Name of the static pad of the element.
+ *  @param[in] camera Device Id of the camera.
+ *  @param[in] role Short name of the thread.
+ */
+void gst_frame_add_thread_policy(GstElement *bin, const char *name, const char *pad,
+                                 const std::string &camera, const char *role);
@@ -0,0 +1,107 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <string.h>
+#include <time.h>
+
+#include "latency_stamp.h"
+#include "util.h"
+
+#define MAX_BLOCK_SIZE 16
+#define LUMA_BLACK 16
+#define LUMA_WHITE 235
+
+static uint8_t check_of(uint32_t value)
+{
+    return ~((value >> 24) ^ (value >> 16) ^ (value >> 8) ^ value) & 0xff;
+}
+
+int latency_stamp_block_size(int width)
+{
+    /* blocks of 4 pixels at least */
+    if (width < LATENCY_STAMP_MIN_WIDTH)
+        return 0;
+
+    int block = (width / LATENCY_STAMP_BITS) & ~3;
+    return block < MAX_BLOCK_SIZE ? block : MAX_BLOCK_SIZE;
+}
+
+static uint64_t realtime_usec()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * USEC_PER_SEC + ts.tv_nsec / NSEC_PER_USEC;
+}
+
+uint32_t latency_stamp_from_monotonic(uint64_t timestamp)
+{
+    uint64_t now = now_usec();
+    uint64_t age = now > timestamp / NSEC_PER_USEC ? now - timestamp / NSEC_PER_USEC : 0;
+
+    return (uint32_t)(realtime_usec() - age);
+}
+
+uint32_t latency_stamp_now()
+{
+    return (uint32_t)realtime_usec();
+}
+
+int latency_stamp_write(uint8_t *luma, int stride, int width, int height, uint32_t value)
+{
+    int block = latency_stamp_block_size(width);
+    if (!block || height < block)
+        return -1;
+
+    uint64_t bits = ((uint64_t)value << 8) | check_of(value);
+    for (int row = 0; row < block; row++) {
+        uint8_t *line = luma + row * stride;
+        for (int i = 0; i < LATENCY_STAMP_BITS; i++) {
+            bool one = (bits >> (LATENCY_STAMP_BITS - 1 - i)) & 1;
+            memset(line + i * block, one ? LUMA_WHITE : LUMA_BLACK, block);
+        }
+    }
+
+    return 0;
+}
+
+/* the center of each block is averaged, its edges are blurred by the encoder */
+int latency_stamp_read(const uint8_t *luma, int stride, int width, int height, uint32_t *value)
+{
+    int block = latency_stamp_block_size(width);
+    if (!block || height < block)
+        return -1;
+
+    int margin = block / 4;
+    uint64_t bits = 0;
+    for (int i = 0; i < LATENCY_STAMP_BITS; i++) {
+        unsigned int sum = 0, count = 0;
+        for (int row = margin; row < block - margin; row++) {
+            const uint8_t *p = luma + row * stride + i * block;
+            for (int x = margin; x < block - margin; x++, count++)
+                sum += p[x];
+        }
+        bits = (bits << 1) | (sum / count > (LUMA_BLACK + LUMA_WHITE) / 2);
+    }
+
+    uint32_t v = bits >> 8;
+    if ((bits & 0xff) != check_of(v))
+        return -1;
+
+    *value = v;
+    return 0;
+}
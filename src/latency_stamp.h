@@ -0,0 +1,81 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#include <stdint.h>
+
+/*
+ * Glass-to-glass latency stamp: the capture time of a frame written into its image as a row of
+ * black and white blocks, on the luma plane before the encoder, so it survives any transport
+ * and is read back from the decoded frame by the receiver.
+ *
+ * The stamp is the low 32 bits of the capture time in micro sec on CLOCK_REALTIME, followed by
+ * an 8 bits check. Sender and receiver on different hosts need their clocks synchronized.
+ */
+
+#define LATENCY_STAMP_BITS 40
+#define LATENCY_STAMP_MIN_WIDTH (LATENCY_STAMP_BITS * 4)
+
+/**
+ *  Get the size of the blocks of the stamp. Blocks are as large as fit the width, up to 16 pixels
+ *  so they do not straddle more macroblocks than needed.
+ *
+ *  @param[in] width Width of the image.
+ *
+ *  @return Size in pixels, 0 if the image is too small for a stamp.
+ */
+int latency_stamp_block_size(int width);
+
+/**
+ *  Convert a monotonic capture time to the value of the stamp.
+ *
+ *  @param[in] timestamp Monotonic capture time in nano sec.
+ *
+ *  @return Low 32 bits of the capture time in micro sec on CLOCK_REALTIME.
+ */
+uint32_t latency_stamp_from_monotonic(uint64_t timestamp);
+
+/**
+ *  Get the value a stamp written now would have.
+ */
+uint32_t latency_stamp_now();
+
+/**
+ *  Write a stamp at the top of an 8 bits luma plane.
+ *
+ *  @param[in,out] luma Luma plane.
+ *  @param[in] stride Bytes per line of the plane.
+ *  @param[in] width Width of the image.
+ *  @param[in] height Height of the image.
+ *  @param[in] value Value of the stamp.
+ *
+ *  @return 0 on success, -1 if the image is too small.
+ */
+int latency_stamp_write(uint8_t *luma, int stride, int width, int height, uint32_t value);
+
+/**
+ *  Read a stamp from the top of an 8 bits luma plane.
+ *
+ *  @param[in] luma Luma plane.
+ *  @param[in] stride Bytes per line of the plane.
+ *  @param[in] width Width of the image.
+ *  @param[in] height Height of the image.
+ *  @param[out] value Value of the stamp.
+ *
+ *  @return 0 on success, -1 if there is no valid stamp.
+ */
+int latency_stamp_read(const uint8_t *luma, int stride, int width, int height, uint32_t *value);
@@ -18,11 +18,16 @@
 #include "log.h"
 
 #include <assert.h>
+#include <condition_variable>
 #include <limits.h>
-#include <unistd.h>
+#include <mutex>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/uio.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
 
 #define COLOR_RED          "\033[31m"
 #define COLOR_ORANGE       "\033[33m"
@@ -30,9 +35,48 @@
 #define COLOR_GREEN        "\033[32m"
 #define COLOR_RESET        "\033[0m"
 
+/* Ring of formatted messages, longer ones are cut */
+#define RING_SLOTS 128
+#define SLOT_SIZE 512
+/* Flusher wakes up at least this often, a missed notification only delays it */
+#define FLUSH_INTERVAL_MS 50
+/* Messages let through per call site and interval */
+#define RATELIMIT_BURST 10
+#define RATELIMIT_INTERVAL_USEC 1000000ULL
+
 Log::Level Log::_max_level = Level::INFO;
 int Log::_target_fd = -1;
 bool Log::_show_colors;
+std::atomic<bool> Log::_async(false);
+std::atomic<uint64_t> Log::_dropped(0);
+
+/*
+ * Bounded multi-producer queue: a slot is free for position pos when its sequence is pos, and
+ * holds the message of pos when it is pos + 1. The single consumer frees it for pos + RING_SLOTS.
+ */
+struct LogSlot {
+    std::atomic<uint64_t> seq;
+    Log::Level level;
+    uint16_t len;
+    char msg[SLOT_SIZE];
+};
+
+static LogSlot ring[RING_SLOTS];
+static std::atomic<uint64_t> ring_tail(0); /* Next position to write */
+static uint64_t ring_head;                 /* Next position to flush, flusher only */
+static std::thread flusher;
+static std::mutex flush_lock;
+static std::condition_variable flush_cond;
+static bool flush_stop;
+static bool exit_registered;
+
+static uint64_t now_usec_raw()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
 
 const char *Log::_get_color(Level level)
 {
@@ -53,6 +97,12 @@ const char *Log::_get_color(Level level)
     return nullptr;
 }
 
+/* programs leaving through exit() or main() without close() still flush the ring and join */
+static void close_at_exit()
+{
+    Log::close();
+}
+
 int Log::open()
 {
     assert_or_return(_target_fd < 0, -1);
@@ -63,11 +113,33 @@ int Log::open()
     if (isatty(_target_fd))
         _show_colors = true;
 
+    for (uint64_t i = 0; i < RING_SLOTS; i++)
+        ring[i].seq.store(i, std::memory_order_relaxed);
+    ring_tail = 0;
+    ring_head = 0;
+    _dropped = 0;
+    flush_stop = false;
+    flusher = std::thread(_flush_thread);
+    _async = true;
+    if (!exit_registered)
+        exit_registered = atexit(close_at_exit) == 0;
+
     return 0;
 }
 
 int Log::close()
 {
+    if (_async.exchange(false)) {
+        {
+            std::lock_guard<std::mutex> locker(flush_lock);
+            flush_stop = true;
+        }
+        flush_cond.notify_one();
+        flusher.join();
+        /* messages pushed while the flusher was stopping */
+        _drain();
+    }
+
     /* see _target_fd on open() */
     fflush(stderr);
 
@@ -79,43 +151,147 @@ void Log::set_max_level(Level level)
     _max_level = level;
 }
 
-void Log::logv(Level level, const char *format, va_list ap)
+void Log::_write(Level level, const char *msg)
 {
-    struct iovec iovec[6] = { };
+    struct iovec iovec[4] = { };
     const char *color;
     int n = 0;
-    char buffer[LINE_MAX];
-    int save_errno;
-
-    if (_max_level < level)
-        return;
-
-    /* so %m works as expected */
-    save_errno = errno;
 
     color = _get_color(level);
 
     if (color)
         IOVEC_SET_STRING(iovec[n++], color);
 
-    errno = save_errno;
-    vsnprintf(buffer, sizeof(buffer), format, ap);
-
-    IOVEC_SET_STRING(iovec[n++], buffer);
+    IOVEC_SET_STRING(iovec[n++], msg);
 
     if (color)
         IOVEC_SET_STRING(iovec[n++], COLOR_RESET);
 
     IOVEC_SET_STRING(iovec[n++], "\n");
 
-    (void)writev(_target_fd, iovec, n);
+    (void)writev(_target_fd < 0 ? STDERR_FILENO : _target_fd, iovec, n);
+}
+
+/* Never blocks, the message is dropped if the ring is full */
+bool Log::_push(Level level, const char *msg, size_t len)
+{
+    uint64_t pos = ring_tail.load(std::memory_order_relaxed);
+    LogSlot *slot;
+
+    while (true) {
+        slot = &ring[pos % RING_SLOTS];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        int64_t dif = (int64_t)seq - (int64_t)pos;
+        if (dif == 0) {
+            if (ring_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = ring_tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    if (len >= SLOT_SIZE)
+        len = SLOT_SIZE - 1;
+    memcpy(slot->msg, msg, len);
+    slot->msg[len] = '\0';
+    slot->len = len;
+    slot->level = level;
+    slot->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+/* Write the messages in the ring, flusher thread or once it is gone */
+void Log::_drain()
+{
+    while (true) {
+        LogSlot *slot = &ring[ring_head % RING_SLOTS];
+        if (slot->seq.load(std::memory_order_acquire) != ring_head + 1)
+            break;
+        _write(slot->level, slot->msg);
+        slot->seq.store(ring_head + RING_SLOTS, std::memory_order_release);
+        ring_head++;
+    }
+}
+
+void Log::_flush_thread()
+{
+    uint64_t reported = 0;
+
+    while (true) {
+        _drain();
+
+        uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+        if (dropped != reported) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "%llu log messages dropped",
+                     (unsigned long long)(dropped - reported));
+            _write(Level::WARNING, msg);
+            reported = dropped;
+        }
+
+        std::unique_lock<std::mutex> locker(flush_lock);
+        if (flush_stop)
+            break;
+        flush_cond.wait_for(locker, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+    }
+}
+
+void Log::logv(Level level, const char *format, va_list ap)
+{
+    char buffer[LINE_MAX];
+
+    if (_max_level < level)
+        return;
+
+    /* %m works as expected, errno is untouched since the caller */
+    int len = vsnprintf(buffer, sizeof(buffer), format, ap);
+    if (len < 0)
+        return;
+    if ((size_t)len >= sizeof(buffer))
+        len = sizeof(buffer) - 1;
+
+    if (!_async || !_push(level, buffer, len)) {
+        if (!_async)
+            _write(level, buffer);
+        return;
+    }
+
+    flush_cond.notify_one();
 }
 
 void Log::log(Level level, const char *format, ...)
 {
     va_list ap;
+    int save_errno = errno;
 
     va_start(ap, format);
+    errno = save_errno;
     logv(level, format, ap);
     va_end(ap);
+
+    errno = save_errno;
+}
+
+bool Log::RateLimit::allow(Level level)
+{
+    uint64_t now = now_usec_raw();
+    uint64_t begin = start.load(std::memory_order_relaxed);
+
+    if (now - begin >= RATELIMIT_INTERVAL_USEC
+        && start.compare_exchange_strong(begin, now, std::memory_order_relaxed)) {
+        count = 0;
+        unsigned int n = suppressed.exchange(0);
+        if (n)
+            Log::log(level, "%u similar messages suppressed", n);
+    }
+
+    if (count.fetch_add(1, std::memory_order_relaxed) < RATELIMIT_BURST)
+        return true;
+
+    suppressed++;
+    return false;
 }
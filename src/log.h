@@ -17,8 +17,10 @@
  */
 #pragma once
 
+#include <atomic>
 #include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "macro.h"
@@ -41,18 +43,47 @@ public:
     static void logv(Level level, const char *format, va_list ap);
     static void log(Level level, const char *format, ...) _printf_format_(2, 3);
 
+    /* Messages of a call site, a burst is let through per interval and the rest counted */
+    struct RateLimit {
+        std::atomic<uint64_t> start; /* Start of the interval, in usec */
+        std::atomic<unsigned int> count;
+        std::atomic<unsigned int> suppressed;
+
+        bool allow(Level level);
+    };
+
+    /* Messages lost because the ring was full, since open() */
+    static uint64_t get_dropped() { return _dropped; }
+
 protected:
     static const char *_get_color(Level level);
+    static void _write(Level level, const char *msg);
+    static bool _push(Level level, const char *msg, size_t len);
+    static void _drain();
+    static void _flush_thread();
 
     static int _target_fd;
     static Level _max_level;
     static bool _show_colors;
+    static std::atomic<bool> _async; /* Messages go through the ring to the flusher thread */
+    static std::atomic<uint64_t> _dropped;
 };
 
-#define log_debug(...) Log::log(Log::Level::DEBUG, __VA_ARGS__)
-#define log_info(...) Log::log(Log::Level::INFO, __VA_ARGS__)
-#define log_warning(...) Log::log(Log::Level::WARNING, __VA_ARGS__)
-#define log_error(...) Log::log(Log::Level::ERROR, __VA_ARGS__)
+/*
+ * Messages are formatted by the caller and written by a flusher thread, so that a slow console
+ * does not block streaming threads or the mainloop. Each call site is rate limited.
+ */
+#define _log_ratelimited(level, ...)                                                            \
+    do {                                                                                         \
+        static Log::RateLimit _log_rl;                                                           \
+        if (Log::get_max_level() >= (level) && _log_rl.allow(level))                             \
+            Log::log((level), __VA_ARGS__);                                                      \
+    } while (0)
+
+#define log_debug(...) _log_ratelimited(Log::Level::DEBUG, __VA_ARGS__)
+#define log_info(...) _log_ratelimited(Log::Level::INFO, __VA_ARGS__)
+#define log_warning(...) _log_ratelimited(Log::Level::WARNING, __VA_ARGS__)
+#define log_error(...) _log_ratelimited(Log::Level::ERROR, __VA_ARGS__)
 
 #define assert_or_return(exp, ...)                              \
     do {                                                        \
@@ -19,17 +19,19 @@
 #include <assert.h>
 #include <dirent.h>
 #include <getopt.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include "conf_file.h"
-#include "glib_mainloop.h"
+#include "epoll_mainloop.h"
 #include "log.h"
 #include "settings.h"
 #include "util.h"
 #include "CameraServer.h"
+#include "ThreadPolicy.h"
 
 #define DEFAULT_CONFFILE "/etc/dcm/main.conf"
 #define DEFAULT_CONF_DIR "/etc/dcm/config.d"
@@ -158,6 +160,33 @@ fail:
     return ret;
 }
 
+struct reload_data {
+    struct options *opt;
+    ConfFile **conf;
+    CameraServer *server;
+};
+
+static bool reload_conf_files(void *data)
+{
+    struct reload_data *reload = (struct reload_data *)data;
+
+    log_info("Reloading conf files");
+
+    // the running conf is kept if the new one does not parse
+    ConfFile *conf = new ConfFile();
+    if (parse_conf_files(*conf, reload->opt) < 0) {
+        log_error("Error in conf files, settings not reloaded");
+        delete conf;
+        return true;
+    }
+
+    reload->server->reload(*conf);
+    delete *reload->conf;
+    *reload->conf = conf;
+
+    return true;
+}
+
 static int log_level_from_str(const char *str)
 {
     if (strcaseeq(str, "error"))
@@ -236,7 +265,7 @@ int main(int argc, char *argv[])
     Log::open();
 
     ConfFile *conf;
-    GlibMainloop mainloop;
+    EpollMainloop mainloop;
 
     if (parse_argv(argc, argv, &opt) != 2) {
         Log::close();
@@ -250,14 +279,24 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    CameraServer camServer(*conf);
-    camServer.start();
+    {
+        // the conf file is kept for cameras plugged in while running
+        CameraServer camServer(*conf);
+        camServer.start();
 
-    delete conf;
-    log_debug("Starting Dronecode Camera Manager");
+        // the settings of the cameras are reloaded on SIGHUP
+        struct reload_data reload = {&opt, &conf, &camServer};
+        mainloop.add_signal(SIGHUP, reload_conf_files, &reload);
 
-    mainloop.loop();
+        log_debug("Starting Dronecode Camera Manager");
 
+        // the threads of the cameras and the workers started from now on place themselves
+        ThreadPolicy::apply("mainloop", nullptr);
+
+        mainloop.loop();
+    }
+
+    delete conf;
     Log::close();
 
     return 0;
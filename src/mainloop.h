@@ -32,6 +32,8 @@ public:
     virtual unsigned int add_timeout(unsigned int timeout_msec, bool (*cb)(void *),
                                      const void *data) = 0;
     virtual void del_timeout(unsigned int timeout_handler) = 0;
+    /* cb runs on the mainloop when the signal is received, until it returns false */
+    virtual unsigned int add_signal(int signum, bool (*cb)(void *), const void *data) = 0;
     virtual int add_fd(int fd, int flags, bool (*cb)(const void *data, int flags), const void *data) = 0;
     virtual void remove_fd(int handler) = 0;
     virtual void quit() = 0;
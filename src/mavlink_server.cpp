@@ -15,11 +15,17 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <algorithm>
+#include <arpa/inet.h>
 #include <assert.h>
 #include <cmath>
 #include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <mavlink.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "log.h"
@@ -34,6 +40,22 @@ using namespace std::placeholders;
 #define DEFAULT_RTSP_SERVER_ADDR "0.0.0.0"
 #define MAX_MAVLINK_MESSAGE_SIZE 1024
 #define DEFAULT_SYSTEM_ID 1
+/* PARAM_EXT_VALUE sent back to back, the rest of the list follows a window per interval */
+#define DEFAULT_PARAM_BURST 10
+#define DEFAULT_PARAM_INTERVAL_MS 20
+/* Storage space also changes while recording, its response is encoded again at least this often */
+#define STORAGE_CACHE_MS 1000
+/* Ground stations not heard of for this long are no longer sent status */
+#define DEFAULT_GCS_TIMEOUT_MS 5000
+/* No more subscribers are taken, the rest of the peers only get replies */
+#define MAX_SUBSCRIBERS 16
+/* GLOBAL_POSITION_INT and ATTITUDE asked from the autopilot at 20Hz, again when they stop */
+#define POSE_INTERVAL_US 50000
+#define POSE_TIMEOUT_US (2 * USEC_PER_SEC)
+/* Camera tracking commands, newer than the MAVLink headers the build may use */
+#define CMD_CAMERA_TRACK_POINT 2004
+#define CMD_CAMERA_TRACK_RECTANGLE 2005
+#define CMD_CAMERA_STOP_TRACKING 2010
 
 static const float epsilon = std::numeric_limits<float>::epsilon();
 
@@ -44,6 +66,12 @@ MavlinkServer::MavlinkServer(const ConfFile &conf)
     , _is_sys_id_found(false)
     , _system_id(DEFAULT_SYSTEM_ID)
     , _comp_id(MAV_COMP_ID_CAMERA)
+    , _rtsp_server_addr(DEFAULT_RTSP_SERVER_ADDR)
+    , _param_burst(DEFAULT_PARAM_BURST)
+    , _param_interval_ms(DEFAULT_PARAM_INTERVAL_MS)
+    , _gcs_timeout_us(DEFAULT_GCS_TIMEOUT_MS * USEC_PER_MSEC)
+    , _is_autopilot_found(false)
+    , _rcvbuf_size(0)
 {
     struct options {
         unsigned long int port;
@@ -51,15 +79,41 @@ MavlinkServer::MavlinkServer(const ConfFile &conf)
         int compid;
         char *rtsp_server_addr;
         char broadcast[17];
+        int param_burst;
+        int param_interval_ms;
+        int gcs_timeout_ms;
+        int rcvbuf_size;
     } opt = {};
     static const ConfFile::OptionsTable option_table[] = {
         {"port", false, ConfFile::parse_ul, OPTIONS_TABLE_STRUCT_FIELD(options, port)},
         {"system_id", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, sysid)},
         {"rtsp_server_addr", false, ConfFile::parse_str_dup, OPTIONS_TABLE_STRUCT_FIELD(options, rtsp_server_addr)},
         {"broadcast_addr", false, ConfFile::parse_str_buf, OPTIONS_TABLE_STRUCT_FIELD(options, broadcast)},
+        {"param_burst", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, param_burst)},
+        {"param_interval_ms", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, param_interval_ms)},
+        {"gcs_timeout_ms", false, ConfFile::parse_i,
+         OPTIONS_TABLE_STRUCT_FIELD(options, gcs_timeout_ms)},
+        {"rcvbuf_size", false, ConfFile::parse_i, OPTIONS_TABLE_STRUCT_FIELD(options, rcvbuf_size)},
     };
+    opt.param_burst = -1;
+    opt.param_interval_ms = -1;
     conf.extract_options("mavlink", option_table, ARRAY_SIZE(option_table), (void *)&opt);
 
+    if (opt.rtsp_server_addr) {
+        _rtsp_server_addr = opt.rtsp_server_addr;
+        free(opt.rtsp_server_addr);
+    }
+
+    if (opt.param_burst >= 0)
+        _param_burst = opt.param_burst;
+    if (opt.param_interval_ms > 0)
+        _param_interval_ms = opt.param_interval_ms;
+    if (opt.gcs_timeout_ms > 0)
+        _gcs_timeout_us = (usec_t)opt.gcs_timeout_ms * USEC_PER_MSEC;
+    if (opt.rcvbuf_size > 0)
+        _rcvbuf_size = opt.rcvbuf_size;
+
     if (opt.port)
         _broadcast_addr.sin_port = htons(opt.port);
     else
@@ -90,15 +144,24 @@ MavlinkServer::MavlinkServer(const ConfFile &conf)
 MavlinkServer::~MavlinkServer()
 {
     stop();
+
+    for (auto &x : _param_lists)
+        delete x.second;
 }
 
 void MavlinkServer::_send_ack(const struct sockaddr_in &addr, int cmd, int comp_id, bool success)
+{
+    _send_ack_result(addr, cmd, comp_id, success ? MAV_RESULT_ACCEPTED : MAV_RESULT_FAILED);
+}
+
+void MavlinkServer::_send_ack_result(const struct sockaddr_in &addr, int cmd, int comp_id,
+                                     uint8_t result)
 {
     mavlink_message_t msg;
 
     mavlink_msg_command_ack_pack(
         _system_id /*system_id*/, comp_id /*component_id*/, &msg /*msg*/, cmd /*command*/,
-        success /*result*/ ? MAV_RESULT_ACCEPTED : MAV_RESULT_FAILED, 0 /*progress*/,
+        result /*result*/, 0 /*progress*/,
         0 /*result_param2*/, 0 /*target_system*/, 255 /*target_component*/);
 
     if (!_send_mavlink_message(&addr, msg)) {
@@ -107,6 +170,42 @@ void MavlinkServer::_send_ack(const struct sockaddr_in &addr, int cmd, int comp_
     }
 }
 
+/*
+ * Run a command that blocks on the camera in the worker of the component. The GCS is told at once
+ * that the command is in progress and gets the final result once work returned. done, if given, is
+ * run on the mainloop instead of sending the final ack.
+ */
+void MavlinkServer::_run_in_worker(const struct sockaddr_in &addr, mavlink_command_long_t &cmd,
+                                   std::function<int()> work, std::function<void(bool)> done)
+{
+    _send_ack_result(addr, cmd.command, cmd.target_component, MAV_RESULT_IN_PROGRESS);
+
+    struct sockaddr_in to = addr;
+    mavlink_command_long_t command = cmd;
+    _executor.submit(cmd.target_component, work, [this, to, command, done](int ret) {
+        if (done)
+            done(!ret);
+        else
+            _send_ack(to, command.command, command.target_component, !ret);
+    });
+}
+
+static bool _is_cached(const cached_msg_t &cache, uint32_t generation, usec_t max_age)
+{
+    if (!cache.valid || cache.generation != generation)
+        return false;
+
+    return max_age == USEC_INFINITY || now_usec() - cache.time < max_age;
+}
+
+static void _cache_message(cached_msg_t &cache, uint32_t generation, mavlink_message_t &msg)
+{
+    cache.msg = msg;
+    cache.generation = generation;
+    cache.time = now_usec();
+    cache.valid = true;
+}
+
 void MavlinkServer::_handle_request_camera_information(const struct sockaddr_in &addr,
                                                        mavlink_command_long_t &cmd)
 {
@@ -124,15 +223,20 @@ void MavlinkServer::_handle_request_camera_information(const struct sockaddr_in
 
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
     if (tgtComp) {
-        const CameraInfo &camInfo = tgtComp->getCameraInfo();
-        mavlink_msg_camera_information_pack(
-            _system_id, cmd.target_component, &msg, 0, (const uint8_t *)camInfo.vendorName,
-            (const uint8_t *)camInfo.modelName, camInfo.firmware_version, camInfo.focal_length,
-            camInfo.sensor_size_h, camInfo.sensor_size_v, camInfo.resolution_h,
-            camInfo.resolution_v, camInfo.lens_id, camInfo.flags, camInfo.cam_definition_version,
-            (const char *)camInfo.cam_definition_uri);
+        // the camera information does not change once the component is created
+        cached_msg_t &cache = _response_cache[cmd.target_component].info;
+        if (!_is_cached(cache, 0, USEC_INFINITY)) {
+            const CameraInfo &camInfo = tgtComp->getCameraInfo();
+            mavlink_msg_camera_information_pack(
+                _system_id, cmd.target_component, &msg, 0, (const uint8_t *)camInfo.vendorName,
+                (const uint8_t *)camInfo.modelName, camInfo.firmware_version,
+                camInfo.focal_length, camInfo.sensor_size_h, camInfo.sensor_size_v,
+                camInfo.resolution_h, camInfo.resolution_v, camInfo.lens_id, camInfo.flags,
+                camInfo.cam_definition_version, (const char *)camInfo.cam_definition_uri);
+            _cache_message(cache, 0, msg);
+        }
 
-        if (!_send_mavlink_message(&addr, msg)) {
+        if (!_send_cached_message(addr, cache)) {
             log_error("Sending camera information failed for camera %d.", cmd.target_component);
             return;
         }
@@ -160,11 +264,16 @@ void MavlinkServer::_handle_request_camera_settings(const struct sockaddr_in &ad
 
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
     if (tgtComp) {
-        mavlink_msg_camera_settings_pack(_system_id, cmd.target_component, &msg, 0,
-                                         dcm2mavCameraMode(tgtComp->getCameraMode()),
-                                         NAN, NAN); // zoom level is unknown
+        cached_msg_t &cache = _response_cache[cmd.target_component].settings;
+        uint32_t generation = tgtComp->getSettingsGeneration();
+        if (!_is_cached(cache, generation, USEC_INFINITY)) {
+            mavlink_msg_camera_settings_pack(_system_id, cmd.target_component, &msg, 0,
+                                             dcm2mavCameraMode(tgtComp->getCameraMode()),
+                                             NAN, NAN); // zoom level is unknown
+            _cache_message(cache, generation, msg);
+        }
 
-        if (!_send_mavlink_message(&addr, msg)) {
+        if (!_send_cached_message(addr, cache)) {
             log_error("Sending camera setting failed for camera %d.", cmd.target_component);
             return;
         }
@@ -192,15 +301,20 @@ void MavlinkServer::_handle_request_storage_information(const struct sockaddr_in
 
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
     if (tgtComp) {
-        // TODO:: Fill with appropriate value
-        const StorageInfo &storeInfo = tgtComp->getStorageInfo();
-        mavlink_msg_storage_information_pack(_system_id, cmd.target_component, &msg, 0,
-                                             storeInfo.storage_id, storeInfo.storage_count,
-                                             storeInfo.status, storeInfo.total_capacity,
-                                             storeInfo.used_capacity, storeInfo.available_capacity,
-                                             storeInfo.read_speed, storeInfo.write_speed);
+        cached_msg_t &cache = _response_cache[cmd.target_component].storage;
+        uint32_t generation = tgtComp->getStorageGeneration();
+        if (!_is_cached(cache, generation, STORAGE_CACHE_MS * USEC_PER_MSEC)) {
+            // TODO:: Fill with appropriate value
+            const StorageInfo &storeInfo = tgtComp->getStorageInfo();
+            mavlink_msg_storage_information_pack(
+                _system_id, cmd.target_component, &msg, 0, storeInfo.storage_id,
+                storeInfo.storage_count, storeInfo.status, storeInfo.total_capacity,
+                storeInfo.used_capacity, storeInfo.available_capacity, storeInfo.read_speed,
+                storeInfo.write_speed);
+            _cache_message(cache, generation, msg);
+        }
 
-        if (!_send_mavlink_message(&addr, msg)) {
+        if (!_send_cached_message(addr, cache)) {
             log_error("Sending storage information failed for camera %d.", cmd.target_component);
             return;
         }
@@ -216,36 +330,38 @@ void MavlinkServer::_handle_set_camera_mode(const struct sockaddr_in &addr,
 {
     log_debug("%s", __func__);
 
-    bool success = false;
-
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
-    if (tgtComp) {
-        if (!tgtComp->setCameraMode(mav2dcmCameraMode((uint32_t)cmd.param2)))
-            success = true;
+    if (!tgtComp) {
+        _send_ack(addr, cmd.command, cmd.target_component, false);
+        return;
     }
 
-    _send_ack(addr, cmd.command, cmd.target_component, success);
-
+    CameraParameters::Mode mode = mav2dcmCameraMode((uint32_t)cmd.param2);
+    _run_in_worker(addr, cmd, [tgtComp, mode]() { return tgtComp->setCameraMode(mode); });
 }
 
 void MavlinkServer::_handle_image_start_capture(const struct sockaddr_in &addr,
                                                 mavlink_command_long_t &cmd)
 {
     log_debug("%s", __func__);
-    bool success = false;
     image_callback_t cb_data;
 
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
-    if (tgtComp) {
-        cb_data.comp_id = cmd.target_component;
-        cb_data.addr = addr;
-        if (!tgtComp->startImageCapture(
-                (uint32_t)cmd.param2 /*interval*/, (uint32_t)cmd.param3 /*count*/,
-                std::bind(&MavlinkServer::_image_captured_cb, this, cb_data, _1, _2)))
-            success = true;
+    if (!tgtComp) {
+        _send_ack(addr, cmd.command, cmd.target_component, false);
+        return;
     }
 
-    _send_ack(addr, cmd.command, cmd.target_component, success);
+    cb_data.comp_id = cmd.target_component;
+    cb_data.addr = addr;
+    // interval is in seconds, sub-second intervals are kept to the ms
+    int interval = (int)lroundf(cmd.param2 * 1000);
+    uint32_t count = (uint32_t)cmd.param3;
+    _run_in_worker(addr, cmd, [this, tgtComp, cb_data, interval, count]() {
+        return tgtComp->startImageCapture(
+            interval, count,
+            std::bind(&MavlinkServer::_image_captured_cb, this, cb_data, _1, _2, _3));
+    });
 }
 
 void MavlinkServer::_handle_image_stop_capture(const struct sockaddr_in &addr,
@@ -264,17 +380,63 @@ void MavlinkServer::_handle_image_stop_capture(const struct sockaddr_in &addr,
     _send_ack(addr, cmd.command, cmd.target_component, success);
 }
 
-void MavlinkServer::_image_captured_cb(image_callback_t cb_data, int result, int seq_num)
+bool _image_captured_timeout_cb(void *data)
+{
+    assert(data);
+    image_captured_t *captured = (image_captured_t *)data;
+
+    if (captured->server->_is_running)
+        captured->server->_send_image_captured(*captured);
+    delete captured;
+    return false;
+}
+
+/*
+ * Called from the still encode and file writer threads, the message is built and sent from the
+ * mainloop, where the subscribers and the socket are used.
+ */
+void MavlinkServer::_image_captured_cb(image_callback_t cb_data, int result, int seq_num,
+                                       uint64_t timestamp)
 {
     log_debug("%s result:%d seq:%d", __func__, result, seq_num);
+
+    image_captured_t *captured = new image_captured_t{this, cb_data, result, seq_num, timestamp};
+    Mainloop::get_mainloop()->add_timeout(0, _image_captured_timeout_cb, captured);
+}
+
+void MavlinkServer::_send_image_captured(const image_captured_t &captured)
+{
+    const image_callback_t &cb_data = captured.cb_data;
+    int seq_num = captured.seq_num;
+    uint64_t timestamp = captured.timestamp;
+
     log_debug("Comp Id:%d", cb_data.comp_id);
-    // TODO :: Fill MAVLINK message with correct info including geo location etc
-    bool success = !result;
+    // TODO :: Fill MAVLINK message with the file url
+    bool success = !captured.result;
     mavlink_message_t msg;
     float q[4] = {0}; // Quaternion of camera orientation
+    uint32_t time_boot_ms = 0;
+    uint64_t time_utc = 0;
+    Pose pose;
+
+    // tagged with the pose at the capture time of the frame, not the time it was written
+    if (timestamp) {
+        usec_t capture = timestamp / NSEC_PER_USEC;
+        _poses.getPose(capture, pose);
+        if (!_poses.getBootTime(capture, time_boot_ms))
+            time_boot_ms = capture / USEC_PER_MSEC;
+
+        struct timespec ts;
+        usec_t now = now_usec();
+        if (!clock_gettime(CLOCK_REALTIME, &ts) && now >= capture)
+            time_utc = ts_usec(&ts) - (now - capture);
+    }
+    if (pose.hasAttitude)
+        pose.toQuaternion(q);
+
     mavlink_msg_camera_image_captured_pack(
-        _system_id, cb_data.comp_id, &msg, 0 /*time_boot_ms*/, 0 /*time_utc*/, 1 /*camera_id*/,
-        0 /*lat*/, 0 /*lon*/, 0 /*alt*/, 0 /*relative_alt*/, q, seq_num /*image_index*/,
+        _system_id, cb_data.comp_id, &msg, time_boot_ms, time_utc, 1 /*camera_id*/, pose.lat,
+        pose.lon, pose.alt, pose.relativeAlt, q, seq_num /*image_index*/,
         success /*capture_result*/, 0 /*file_url*/);
 
     if (!_send_mavlink_message(&cb_data.addr, msg)) {
@@ -282,25 +444,34 @@ void MavlinkServer::_image_captured_cb(image_callback_t cb_data, int result, int
         return;
     }
 
-    _send_camera_capture_status(cb_data.comp_id, cb_data.addr);
+    _send_camera_capture_status(cb_data.comp_id, nullptr);
 }
 
 void MavlinkServer::_handle_video_start_capture(const struct sockaddr_in &addr,
                                                 mavlink_command_long_t &cmd)
 {
     log_debug("%s", __func__);
-    bool success = false;
-    image_callback_t cb_data;
 
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
-    if (tgtComp) {
-        cb_data.comp_id = cmd.target_component;
-        memcpy(&cb_data.addr, &addr, sizeof(struct sockaddr_in));
-        if (!tgtComp->startVideoCapture((uint32_t)cmd.param2 /*camera_Capture_status freq*/))
-            success = true;
+    if (!tgtComp) {
+        _send_ack(addr, cmd.command, cmd.target_component, false);
+        return;
     }
 
-    _send_ack(addr, cmd.command, cmd.target_component, success);
+    struct sockaddr_in to = addr;
+    mavlink_command_long_t command = cmd;
+    _run_in_worker(
+        addr, cmd,
+        [tgtComp, command]() {
+            return tgtComp->startVideoCapture((uint32_t)command.param2 /*status freq*/);
+        },
+        [this, to, command](bool success) {
+            _send_ack(to, command.command, command.target_component, success);
+
+            // param2 is the frequency of the status messages in Hz, 0 for none
+            if (success && command.param2 > epsilon)
+                _start_video_status(command.target_component, to, command.param2);
+        });
 }
 
 void MavlinkServer::_handle_video_stop_capture(const struct sockaddr_in &addr,
@@ -308,17 +479,166 @@ void MavlinkServer::_handle_video_stop_capture(const struct sockaddr_in &addr,
 {
     log_debug("%s", __func__);
 
+    _stop_video_status(cmd.target_component);
+
+    CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
+    if (!tgtComp) {
+        _send_ack(addr, cmd.command, cmd.target_component, false);
+        return;
+    }
+
+    // the file is finalized on EOS, which may take a while
+    _run_in_worker(addr, cmd, [tgtComp]() { return tgtComp->stopVideoCapture(); });
+}
+
+/* address of the interface the peer is reached through, the one its request arrived on */
+static std::string _local_addr(const struct sockaddr_in &peer)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return {};
+
+    /* connecting a datagram socket only picks the route, nothing is sent */
+    struct sockaddr_in local = {};
+    socklen_t len = sizeof(local);
+    bool found = !connect(fd, (const struct sockaddr *)&peer, sizeof(peer))
+        && !getsockname(fd, (struct sockaddr *)&local, &len);
+    close(fd);
+
+    char str[INET_ADDRSTRLEN];
+    if (!found || !inet_ntop(AF_INET, &local.sin_addr, str, sizeof(str)))
+        return {};
+
+    return str;
+}
+
+void MavlinkServer::_handle_request_video_stream_information(const struct sockaddr_in &addr,
+                                                            mavlink_command_long_t &cmd)
+{
+    log_debug("%s", __func__);
+
+    // Take no action if flag not set
+    if (std::abs(cmd.param2) <= epsilon) {
+        log_warning("No Action");
+        _send_ack(addr, cmd.command, cmd.target_component, true);
+        return;
+    }
+
+    mavlink_message_t msg;
     bool success = false;
 
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
     if (tgtComp) {
-        if (!tgtComp->stopVideoCapture())
-            success = true;
+        VideoStreamInfo info;
+        tgtComp->getVideoStreamInfo(info);
+
+        /* the server listens on all the interfaces, the URI names the one the request came in on */
+        std::string host = _rtsp_server_addr;
+        if (host == DEFAULT_RTSP_SERVER_ADDR)
+            host = _local_addr(addr);
+        if (host.empty())
+            host = _rtsp_server_addr;
+
+        char uri[230] = {};
+        if (!info.path.empty())
+            snprintf(uri, sizeof(uri), "rtsp://%s:%d%s", host.c_str(), info.port,
+                     info.path.c_str());
+        else if (!info.address.empty())
+            snprintf(uri, sizeof(uri), "udp://%s:%d", info.address.c_str(), info.port);
+
+        // bitrate is in bits/s, rotation is not known, cameras are numbered from 1
+        int cameraId = cmd.target_component - MAV_COMP_ID_CAMERA + 1;
+        mavlink_msg_video_stream_information_pack(
+            _system_id, cmd.target_component, &msg, cameraId, info.status,
+            info.frameRate, info.width, info.height, info.bitRate * 1000, 0 /*rotation*/, uri);
+
+        if (!_send_mavlink_message(&addr, msg)) {
+            log_error("Sending video stream information failed for camera %d.",
+                      cmd.target_component);
+            return;
+        }
+
+        success = true;
     }
 
     _send_ack(addr, cmd.command, cmd.target_component, success);
 }
 
+void MavlinkServer::_handle_video_start_streaming(const struct sockaddr_in &addr,
+                                                  mavlink_command_long_t &cmd)
+{
+    log_debug("%s", __func__);
+
+    CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
+    if (!tgtComp) {
+        _send_ack(addr, cmd.command, cmd.target_component, false);
+        return;
+    }
+
+    // a running stream is kept for the clients watching it
+    if (tgtComp->getVideoStreamStatus()) {
+        _send_ack(addr, cmd.command, cmd.target_component, true);
+        return;
+    }
+
+    _run_in_worker(addr, cmd, [tgtComp]() { return tgtComp->startVideoStream(false); });
+}
+
+void MavlinkServer::_handle_video_stop_streaming(const struct sockaddr_in &addr,
+                                                 mavlink_command_long_t &cmd)
+{
+    log_debug("%s", __func__);
+
+    CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
+    if (!tgtComp) {
+        _send_ack(addr, cmd.command, cmd.target_component, false);
+        return;
+    }
+
+    // the mount is removed, camera and encoder are released once no client is left
+    _run_in_worker(addr, cmd, [tgtComp]() { return tgtComp->stopVideoStream(); });
+}
+
+/*
+ * The tracked point or rectangle, in fractions of the image, is where the stream encoder spends
+ * its bits. Tracking itself is left to the autopilot or a companion process.
+ */
+void MavlinkServer::_handle_camera_track(const struct sockaddr_in &addr,
+                                         mavlink_command_long_t &cmd)
+{
+    log_debug("%s", __func__);
+
+    CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
+    if (!tgtComp) {
+        _send_ack(addr, cmd.command, cmd.target_component, false);
+        return;
+    }
+
+    VideoRoi roi;
+    if (cmd.command == CMD_CAMERA_TRACK_POINT) {
+        // square around the point, of the radius given
+        roi.x = cmd.param1 - cmd.param3;
+        roi.y = cmd.param2 - cmd.param3;
+        roi.width = roi.height = 2 * cmd.param3;
+    } else if (cmd.command == CMD_CAMERA_TRACK_RECTANGLE) {
+        roi.x = cmd.param1;
+        roi.y = cmd.param2;
+        roi.width = cmd.param3 - cmd.param1;
+        roi.height = cmd.param4 - cmd.param2;
+    }
+    if (roi.x < 0) {
+        roi.width += roi.x;
+        roi.x = 0;
+    }
+    if (roi.y < 0) {
+        roi.height += roi.y;
+        roi.y = 0;
+    }
+
+    // the stream is replaced on the worker, move the region there too
+    _run_in_worker(addr, cmd, [tgtComp, roi]() { return tgtComp->setVideoStreamRoi(roi); });
+}
+
 void MavlinkServer::_handle_request_camera_capture_status(const struct sockaddr_in &addr,
                                                           mavlink_command_long_t &cmd)
 {
@@ -331,132 +651,254 @@ void MavlinkServer::_handle_request_camera_capture_status(const struct sockaddr_
         return;
     }
 
-    bool success = _send_camera_capture_status(cmd.target_component, addr);
+    bool success = _send_camera_capture_status(cmd.target_component, &addr);
 
     _send_ack(addr, cmd.command, cmd.target_component, success);
 }
 
+/*
+ * Parameters are read and set on the worker of the component, in order with the commands that
+ * change its mode or its streams there. Messages are encoded and sent from the mainloop.
+ */
 void MavlinkServer::_handle_param_ext_request_read(const struct sockaddr_in &addr,
                                                    mavlink_message_t *msg)
 {
     log_debug("%s", __func__);
 
-    mavlink_message_t msg2;
     mavlink_param_ext_request_read_t param_ext_read;
-    mavlink_param_ext_value_t param_ext_value;
-    bool ret = false;
     mavlink_msg_param_ext_request_read_decode(msg, &param_ext_read);
     CameraComponent *tgtComp = getCameraComponent(param_ext_read.target_component);
-    if (tgtComp) {
+    if (!tgtComp)
+        return;
+
+    std::shared_ptr<param_reply_t> reply = std::make_shared<param_reply_t>();
+    auto work = [tgtComp, param_ext_read, reply]() mutable {
+        mavlink_param_ext_value_t &param_ext_value = reply->value;
+
+        // Parameters missed from a list are asked for by their index in the list
+        int16_t index = param_ext_read.param_index;
+        if (index >= 0 && (size_t)index < tgtComp->getParamCount()) {
+            int n = index;
+            for (auto &x : tgtComp->getParamList()) {
+                if (x.isSet && !n--) {
+                    mem_cpy(param_ext_read.param_id, sizeof(param_ext_read.param_id), x.name,
+                            sizeof(x.name), sizeof(param_ext_read.param_id));
+                    break;
+                }
+            }
+        } else {
+            index = -1;
+        }
+
         // Null terminate param_id
         // Read parameter value from camera component
-        ret = tgtComp->getParam(param_ext_read.param_id, sizeof(param_ext_read.param_id),
-                                param_ext_value.param_value, sizeof(param_ext_value.param_value));
+        int ret = tgtComp->getParam(param_ext_read.param_id, sizeof(param_ext_read.param_id),
+                                    param_ext_value.param_value,
+                                    sizeof(param_ext_value.param_value));
+        reply->is_value = !ret;
         if (!ret) {
             // Send the param value to GCS
-            param_ext_value.param_count = 1;
-            param_ext_value.param_index = 0;
+            param_ext_value.param_count = index < 0 ? 1 : tgtComp->getParamCount();
+            param_ext_value.param_index = index < 0 ? 0 : index;
             // Copy the param id from req msg to resp msg
             mem_cpy(param_ext_value.param_id, sizeof(param_ext_value.param_id),
                     param_ext_read.param_id, sizeof(param_ext_read.param_id),
                     sizeof(param_ext_value.param_id));
             param_ext_value.param_type
                 = tgtComp->getParamType(param_ext_value.param_id, sizeof(param_ext_value.param_id));
-            mavlink_msg_param_ext_value_encode(_system_id, param_ext_read.target_component, &msg2,
-                                               &param_ext_value);
         } else {
             // Send param ack error to GCS
-            mavlink_param_ext_ack_t param_ext_ack;
+            mavlink_param_ext_ack_t &param_ext_ack = reply->ack;
             // Copy the param id from req msg to resp msg
             mem_cpy(param_ext_ack.param_id, sizeof(param_ext_ack.param_id), param_ext_read.param_id,
                     sizeof(param_ext_read.param_id), sizeof(param_ext_ack.param_id));
             param_ext_ack.param_type
-                = tgtComp->getParamType(param_ext_value.param_id, sizeof(param_ext_value.param_id));
+                = tgtComp->getParamType(param_ext_ack.param_id, sizeof(param_ext_ack.param_id));
             param_ext_ack.param_result = PARAM_ACK_FAILED;
-            mavlink_msg_param_ext_ack_encode(_system_id, param_ext_read.target_component, &msg2,
-                                             &param_ext_ack);
-        }
-        if (!_send_mavlink_message(&addr, msg2)) {
-            log_error("Sending response to param request read failed %d.",
-                      param_ext_read.target_component);
-            return;
         }
-    }
+        return 0;
+    };
+
+    struct sockaddr_in to = addr;
+    int compid = param_ext_read.target_component;
+    _executor.submit(compid, work, [this, to, compid, reply](int) {
+        mavlink_message_t msg2;
+        if (reply->is_value)
+            mavlink_msg_param_ext_value_encode(_system_id, compid, &msg2, &reply->value);
+        else
+            mavlink_msg_param_ext_ack_encode(_system_id, compid, &msg2, &reply->ack);
+        if (!_send_mavlink_message(&to, msg2))
+            log_error("Sending response to param request read failed %d.", compid);
+    });
 }
+
 void MavlinkServer::_handle_param_ext_request_list(const struct sockaddr_in &addr,
                                                    mavlink_message_t *msg)
 {
     log_debug("%s", __func__);
 
-    int idx = 0;
-    mavlink_message_t msg2;
     mavlink_param_ext_request_list_t param_list;
-    mavlink_param_ext_value_t param_ext_value;
     mavlink_msg_param_ext_request_list_decode(msg, &param_list);
     CameraComponent *tgtComp = getCameraComponent(param_list.target_component);
-    if (tgtComp) {
-        // Get the list of parameter from camera component
-        const std::map<std::string, std::string> &paramIdtoValue = tgtComp->getParamList();
-        param_ext_value.param_count = paramIdtoValue.size();
+    if (!tgtComp)
+        return;
 
-        // Send each param,value to GCS
-        for (auto &x : paramIdtoValue) {
-            param_ext_value.param_index = idx++;
+    // Get the list of parameter from camera component
+    auto values = std::make_shared<std::vector<mavlink_param_ext_value_t>>();
+    auto work = [tgtComp, values]() {
+        mavlink_param_ext_value_t param_ext_value;
+        param_ext_value.param_count = tgtComp->getParamCount();
+        for (auto &x : tgtComp->getParamList()) {
+            if (!x.isSet)
+                continue;
+            param_ext_value.param_index = values->size();
             // Copy the param id
-            mem_cpy(param_ext_value.param_id, sizeof(param_ext_value.param_id), x.first.c_str(),
-                    x.first.size() + 1, sizeof(param_ext_value.param_id));
+            mem_cpy(param_ext_value.param_id, sizeof(param_ext_value.param_id), x.name,
+                    sizeof(x.name), sizeof(param_ext_value.param_id));
             // Copy the param value
             mem_cpy(param_ext_value.param_value, sizeof(param_ext_value.param_value),
-                    x.second.data(), x.second.size(), sizeof(param_ext_value.param_id));
-            param_ext_value.param_type = tgtComp->getParamType(x.first.c_str(), x.first.size());
-            mavlink_msg_param_ext_value_encode(_system_id, param_list.target_component, &msg2,
-                                               &param_ext_value);
-            if (!_send_mavlink_message(&addr, msg2)) {
-                log_error("Sending response to param request list failed %d.", idx);
-            }
+                    x.value.bytes, x.len, sizeof(param_ext_value.param_id));
+            param_ext_value.param_type = x.type;
+            values->push_back(param_ext_value);
         }
-    }
+        return 0;
+    };
+
+    struct sockaddr_in to = addr;
+    int compid = param_list.target_component;
+    _executor.submit(compid, work, [this, to, compid, tgtComp, values](int) {
+        // removed meanwhile
+        if (getCameraComponent(compid) != tgtComp)
+            return;
+
+        // A new request of the list restarts it, the buffers of the last one are reused
+        param_list_t *list;
+        auto it = _param_lists.find(compid);
+        if (it != _param_lists.end()) {
+            list = it->second;
+            if (list->timeout_handler)
+                Mainloop::get_mainloop()->del_timeout(list->timeout_handler);
+        } else {
+            list = new param_list_t;
+            list->server = this;
+            list->comp_id = compid;
+            _param_lists[list->comp_id] = list;
+        }
+        list->addr = to;
+        list->next = 0;
+        list->timeout_handler = 0;
+
+        // Encode each param,value for the GCS
+        size_t count = values->size();
+        list->data.resize(count * MAVLINK_MAX_PACKET_LEN);
+        list->bufs.resize(count);
+        for (size_t idx = 0; idx < count; idx++) {
+            mavlink_message_t msg2;
+            mavlink_msg_param_ext_value_encode(_system_id, compid, &msg2, &(*values)[idx]);
+            struct buffer &buf = list->bufs[idx];
+            buf.data = &list->data[idx * MAVLINK_MAX_PACKET_LEN];
+            buf.len = mavlink_msg_to_send_buffer(buf.data, &msg2);
+        }
+
+        // First window now, the others paced so that the radio keeps up
+        if (_send_param_list_window(list))
+            list->timeout_handler
+                = Mainloop::get_mainloop()->add_timeout(_param_interval_ms, _param_list_cb, list);
+    });
 }
 
 void MavlinkServer::_handle_param_ext_set(const struct sockaddr_in &addr, mavlink_message_t *msg)
 {
     log_debug("%s", __func__);
 
-    bool ret = false;
-    mavlink_message_t msg2;
-    mavlink_param_ext_set_t param_set;
-    mavlink_param_ext_ack_t param_ext_ack;
-    mavlink_msg_param_ext_set_decode(msg, &param_set);
-    CameraComponent *tgtComp = getCameraComponent(param_set.target_component);
-    if (tgtComp) {
-        // Set parameter
-        // TODO:: Ensure that param_id is null terminated before passing
-        ret = tgtComp->setParam(param_set.param_id, sizeof(param_set.param_id),
-                                param_set.param_value, sizeof(param_set.param_value),
-                                param_set.param_type);
-        // Copy id from req msg to response msg
-        mem_cpy(param_ext_ack.param_id, sizeof(param_ext_ack.param_id), param_set.param_id,
-                sizeof(param_set.param_id), sizeof(param_ext_ack.param_id));
-        param_ext_ack.param_type = param_set.param_type;
-        if (!ret) {
-            // Send response to GCS
-            mem_cpy(param_ext_ack.param_value, sizeof(param_ext_ack.param_value),
-                    param_set.param_value, sizeof(param_set.param_value),
-                    sizeof(param_ext_ack.param_value));
-            param_ext_ack.param_result = PARAM_ACK_ACCEPTED;
-        } else {
-            // Send error alongwith current value of the param to GCS
-            tgtComp->getParam(param_ext_ack.param_id, sizeof(param_ext_ack.param_id),
-                              param_ext_ack.param_value, sizeof(param_ext_ack.param_value));
-            param_ext_ack.param_result = PARAM_ACK_FAILED;
-        }
+    param_set_req_t req;
+    req.addr = addr;
+    mavlink_msg_param_ext_set_decode(msg, &req.param_set);
+    if (!getCameraComponent(req.param_set.target_component))
+        return;
 
-        mavlink_msg_param_ext_ack_encode(_system_id, param_set.target_component, &msg2,
-                                         &param_ext_ack);
-        if (!_send_mavlink_message(&addr, msg2)) {
-            log_error("Sending response to param set failed %d.", param_set.target_component);
-            return;
-        }
+    // Applied with the other sets of the same datagrams, see _flush_param_sets()
+    _param_sets[req.param_set.target_component].push_back(req);
+}
+
+/* runs on the worker of the component */
+void MavlinkServer::_fill_param_ext_ack(CameraComponent *tgtComp,
+                                        const mavlink_param_ext_set_t &param_set, bool success,
+                                        mavlink_param_ext_ack_t &param_ext_ack)
+{
+    // Copy id from req msg to response msg
+    mem_cpy(param_ext_ack.param_id, sizeof(param_ext_ack.param_id), param_set.param_id,
+            sizeof(param_set.param_id), sizeof(param_ext_ack.param_id));
+    param_ext_ack.param_type = param_set.param_type;
+    if (success) {
+        // Send response to GCS
+        mem_cpy(param_ext_ack.param_value, sizeof(param_ext_ack.param_value),
+                param_set.param_value, sizeof(param_set.param_value),
+                sizeof(param_ext_ack.param_value));
+        param_ext_ack.param_result = PARAM_ACK_ACCEPTED;
+    } else {
+        // Send error alongwith current value of the param to GCS
+        tgtComp->getParam(param_ext_ack.param_id, sizeof(param_ext_ack.param_id),
+                          param_ext_ack.param_value, sizeof(param_ext_ack.param_value));
+        param_ext_ack.param_result = PARAM_ACK_FAILED;
+    }
+}
+
+/*
+ * A GCS applying a preset (white balance, exposure and gain) sends its PARAM_EXT_SET back to
+ * back. Those read in one go are given to the camera as a single batch, so that they land in the
+ * same frame instead of one per ioctl. Every set is still acknowledged on its own.
+ */
+void MavlinkServer::_flush_param_sets()
+{
+    std::map<int, std::vector<param_set_req_t>> pending;
+    pending.swap(_param_sets);
+
+    for (auto &x : pending) {
+        CameraComponent *tgtComp = getCameraComponent(x.first);
+        if (!tgtComp)
+            continue;
+
+        auto reqs = std::make_shared<std::vector<param_set_req_t>>(std::move(x.second));
+        auto acks = std::make_shared<std::vector<mavlink_param_ext_ack_t>>(reqs->size());
+        auto work = [tgtComp, reqs, acks]() {
+            bool batched = false;
+            if (reqs->size() > 1) {
+                std::vector<CameraDevice::ParamValue> params;
+                for (const auto &req : *reqs) {
+                    const char *id = req.param_set.param_id;
+                    CameraDevice::ParamValue p;
+                    p.name = std::string(id, strnlen(id, sizeof(req.param_set.param_id)));
+                    mem_cpy(p.value.bytes, sizeof(p.value.bytes), req.param_set.param_value,
+                            sizeof(req.param_set.param_value), sizeof(p.value.bytes));
+                    p.type = req.param_set.param_type;
+                    params.push_back(p);
+                }
+                batched = !tgtComp->setParams(params);
+                if (!batched)
+                    log_debug("Batch of %zu params rejected, set one at a time", params.size());
+            }
+
+            for (size_t i = 0; i < reqs->size(); i++) {
+                const mavlink_param_ext_set_t &param_set = (*reqs)[i].param_set;
+                bool success = batched
+                    || !tgtComp->setParam(param_set.param_id, sizeof(param_set.param_id),
+                                          param_set.param_value, sizeof(param_set.param_value),
+                                          param_set.param_type);
+                _fill_param_ext_ack(tgtComp, param_set, success, (*acks)[i]);
+            }
+            return 0;
+        };
+
+        int compid = x.first;
+        _executor.submit(compid, work, [this, compid, reqs, acks](int) {
+            for (size_t i = 0; i < reqs->size(); i++) {
+                mavlink_message_t msg2;
+                mavlink_msg_param_ext_ack_encode(_system_id, compid, &msg2, &(*acks)[i]);
+                if (!_send_mavlink_message(&(*reqs)[i].addr, msg2))
+                    log_error("Sending response to param set failed %d.", compid);
+            }
+        });
     }
 }
 
@@ -472,28 +914,131 @@ void MavlinkServer::_handle_reset_camera_settings(const struct sockaddr_in &addr
         return;
     }
 
-    bool success = false;
     CameraComponent *tgtComp = getCameraComponent(cmd.target_component);
-
-    if (tgtComp) {
-        if (!tgtComp->resetCameraSettings())
-            success = true;
+    if (!tgtComp) {
+        _send_ack(addr, cmd.command, cmd.target_component, false);
+        return;
     }
 
-    _send_ack(addr, cmd.command, cmd.target_component, success);
+    _run_in_worker(addr, cmd, [tgtComp]() { return tgtComp->resetCameraSettings(); });
 }
 void MavlinkServer::_handle_heartbeat(const struct sockaddr_in &addr, mavlink_message_t *msg)
 {
     mavlink_heartbeat_t heartbeat;
     mavlink_msg_heartbeat_decode(msg, &heartbeat);
 
-    if (heartbeat.autopilot == MAV_AUTOPILOT_PX4) {
+    if (!_is_sys_id_found && heartbeat.autopilot == MAV_AUTOPILOT_PX4) {
         if (msg->sysid > 0 && msg->sysid < 255) {
             log_info("Heartbeat received, System ID = %d", msg->sysid);
             _system_id = msg->sysid;
             _is_sys_id_found = true;
         }
     }
+
+    if (heartbeat.autopilot != MAV_AUTOPILOT_INVALID && msg->sysid == _system_id
+        && msg->compid == MAV_COMP_ID_AUTOPILOT1) {
+        if (!_is_autopilot_found)
+            log_info("Autopilot found at %s:%d", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+        _autopilot_addr = addr;
+        _is_autopilot_found = true;
+    }
+}
+
+void MavlinkServer::_handle_pose(mavlink_message_t *msg)
+{
+    if (msg->sysid != _system_id || msg->compid != MAV_COMP_ID_AUTOPILOT1)
+        return;
+
+    if (msg->msgid == MAVLINK_MSG_ID_GLOBAL_POSITION_INT) {
+        mavlink_global_position_int_t pos;
+        mavlink_msg_global_position_int_decode(msg, &pos);
+        _poses.addPosition(pos.time_boot_ms, pos.lat, pos.lon, pos.alt, pos.relative_alt);
+    } else {
+        mavlink_attitude_t att;
+        mavlink_msg_attitude_decode(msg, &att);
+        _poses.addAttitude(att.time_boot_ms, att.roll, att.pitch, att.yaw);
+    }
+}
+
+/* Ask the autopilot for the messages it does not stream, or no longer streams, to us */
+void MavlinkServer::_request_pose_stream()
+{
+    if (!_is_autopilot_found || now_usec() - _poses.getLastUpdate() < POSE_TIMEOUT_US)
+        return;
+
+    mavlink_message_t msg;
+    const uint32_t ids[] = {MAVLINK_MSG_ID_GLOBAL_POSITION_INT, MAVLINK_MSG_ID_ATTITUDE};
+    for (uint32_t id : ids) {
+        mavlink_msg_command_long_pack(_system_id, _comp_id, &msg, _system_id,
+                                      MAV_COMP_ID_AUTOPILOT1, MAV_CMD_SET_MESSAGE_INTERVAL, 0, id,
+                                      POSE_INTERVAL_US, 0, 0, 0, 0, 0);
+        if (!_send_mavlink_message(&_autopilot_addr, msg))
+            log_error("Requesting message %u from autopilot failed.", id);
+    }
+}
+
+void MavlinkServer::_run_command(const struct sockaddr_in &addr, mavlink_command_long_t &cmd)
+{
+    switch (cmd.command) {
+    case MAV_CMD_REQUEST_CAMERA_INFORMATION:
+        this->_handle_request_camera_information(addr, cmd);
+        break;
+    case MAV_CMD_REQUEST_VIDEO_STREAM_INFORMATION:
+        this->_handle_request_video_stream_information(addr, cmd);
+        break;
+    case MAV_CMD_REQUEST_CAMERA_SETTINGS:
+        this->_handle_request_camera_settings(addr, cmd);
+        break;
+    case MAV_CMD_REQUEST_CAMERA_CAPTURE_STATUS:
+        this->_handle_request_camera_capture_status(addr, cmd);
+        break;
+    case MAV_CMD_RESET_CAMERA_SETTINGS:
+        this->_handle_reset_camera_settings(addr, cmd);
+        break;
+    case MAV_CMD_REQUEST_STORAGE_INFORMATION:
+        this->_handle_request_storage_information(addr, cmd);
+        break;
+    case MAV_CMD_STORAGE_FORMAT:
+        log_debug("MAV_CMD_STORAGE_FORMAT");
+        break;
+    case MAV_CMD_SET_CAMERA_MODE:
+        this->_handle_set_camera_mode(addr, cmd);
+        break;
+    case MAV_CMD_IMAGE_START_CAPTURE:
+        log_debug("MAV_CMD_IMAGE_START_CAPTURE");
+        this->_handle_image_start_capture(addr, cmd);
+        break;
+    case MAV_CMD_IMAGE_STOP_CAPTURE:
+        log_debug("MAV_CMD_IMAGE_STOP_CAPTURE");
+        this->_handle_image_stop_capture(addr, cmd);
+        break;
+    case MAV_CMD_VIDEO_START_CAPTURE:
+        log_debug("MAV_CMD_VIDEO_START_CAPTURE");
+        this->_handle_video_start_capture(addr, cmd);
+        break;
+    case MAV_CMD_VIDEO_STOP_CAPTURE:
+        log_debug("MAV_CMD_VIDEO_STOP_CAPTURE");
+        this->_handle_video_stop_capture(addr, cmd);
+        break;
+    case MAV_CMD_VIDEO_START_STREAMING:
+        log_debug("MAV_CMD_VIDEO_START_STREAMING");
+        this->_handle_video_start_streaming(addr, cmd);
+        break;
+    case MAV_CMD_VIDEO_STOP_STREAMING:
+        log_debug("MAV_CMD_VIDEO_STOP_STREAMING");
+        this->_handle_video_stop_streaming(addr, cmd);
+        break;
+    case CMD_CAMERA_TRACK_POINT:
+    case CMD_CAMERA_TRACK_RECTANGLE:
+    case CMD_CAMERA_STOP_TRACKING:
+        this->_handle_camera_track(addr, cmd);
+        break;
+    case MAV_CMD_REQUEST_CAMERA_IMAGE_CAPTURE:
+    case MAV_CMD_DO_TRIGGER_CONTROL:
+    default:
+        log_debug("Command %d unhandled. Discarding.", cmd.command);
+        break;
+    }
 }
 
 void MavlinkServer::_handle_mavlink_message(const struct sockaddr_in &addr, mavlink_message_t *msg)
@@ -501,6 +1046,15 @@ void MavlinkServer::_handle_mavlink_message(const struct sockaddr_in &addr, mavl
     // log_debug("Message received: (sysid: %d compid: %d msgid: %d)", msg->sysid, msg->compid,
     //          msg->msgid);
 
+    _update_subscriber(addr, msg);
+    _msg_counts[msg->msgid]++;
+
+    // anything but telemetry and more sets may depend on the parameters set so far
+    if (!_param_sets.empty() && msg->msgid != MAVLINK_MSG_ID_PARAM_EXT_SET
+        && msg->msgid != MAVLINK_MSG_ID_HEARTBEAT && msg->msgid != MAVLINK_MSG_ID_ATTITUDE
+        && msg->msgid != MAVLINK_MSG_ID_GLOBAL_POSITION_INT)
+        _flush_param_sets();
+
     if (msg->msgid == MAVLINK_MSG_ID_COMMAND_LONG) {
         mavlink_command_long_t cmd;
         mavlink_msg_command_long_decode(msg, &cmd);
@@ -514,59 +1068,23 @@ void MavlinkServer::_handle_mavlink_message(const struct sockaddr_in &addr, mavl
         if (compIdToObj.find(cmd.target_component) == compIdToObj.end())
             return;
 
-        switch (cmd.command) {
-        case MAV_CMD_REQUEST_CAMERA_INFORMATION:
-            this->_handle_request_camera_information(addr, cmd);
-            break;
-        case MAV_CMD_REQUEST_VIDEO_STREAM_INFORMATION:
-            break;
-        case MAV_CMD_REQUEST_CAMERA_SETTINGS:
-            this->_handle_request_camera_settings(addr, cmd);
-            break;
-        case MAV_CMD_REQUEST_CAMERA_CAPTURE_STATUS:
-            this->_handle_request_camera_capture_status(addr, cmd);
-            break;
-        case MAV_CMD_RESET_CAMERA_SETTINGS:
-            this->_handle_reset_camera_settings(addr, cmd);
-            break;
-        case MAV_CMD_REQUEST_STORAGE_INFORMATION:
-            this->_handle_request_storage_information(addr, cmd);
-            break;
-        case MAV_CMD_STORAGE_FORMAT:
-            log_debug("MAV_CMD_STORAGE_FORMAT");
-            break;
-        case MAV_CMD_SET_CAMERA_MODE:
-            this->_handle_set_camera_mode(addr, cmd);
-            break;
-        case MAV_CMD_IMAGE_START_CAPTURE:
-            log_debug("MAV_CMD_IMAGE_START_CAPTURE");
-            this->_handle_image_start_capture(addr, cmd);
-            break;
-        case MAV_CMD_IMAGE_STOP_CAPTURE:
-            log_debug("MAV_CMD_IMAGE_STOP_CAPTURE");
-            this->_handle_image_stop_capture(addr, cmd);
-            break;
-        case MAV_CMD_VIDEO_START_CAPTURE:
-            log_debug("MAV_CMD_VIDEO_START_CAPTURE");
-            this->_handle_video_start_capture(addr, cmd);
-            break;
-        case MAV_CMD_VIDEO_STOP_CAPTURE:
-            log_debug("MAV_CMD_VIDEO_STOP_CAPTURE");
-            this->_handle_video_stop_capture(addr, cmd);
-            break;
-        case MAV_CMD_REQUEST_CAMERA_IMAGE_CAPTURE:
-        case MAV_CMD_DO_TRIGGER_CONTROL:
-        case MAV_CMD_VIDEO_START_STREAMING:
-        case MAV_CMD_VIDEO_STOP_STREAMING:
-        default:
-            log_debug("Command %d unhandled. Discarding.", cmd.command);
-            break;
+        // answers must not overtake those of commands still running on the camera
+        if (_executor.isBusy(cmd.target_component)) {
+            struct sockaddr_in to = addr;
+            _executor.submit(cmd.target_component, nullptr,
+                             [this, to, cmd](int) mutable { _run_command(to, cmd); });
+            return;
         }
+
+        _run_command(addr, cmd);
     } else {
         switch (msg->msgid) {
         case MAVLINK_MSG_ID_HEARTBEAT:
-            if (!_is_sys_id_found)
-                this->_handle_heartbeat(addr, msg);
+            this->_handle_heartbeat(addr, msg);
+            break;
+        case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+        case MAVLINK_MSG_ID_ATTITUDE:
+            this->_handle_pose(msg);
             break;
         case MAVLINK_MSG_ID_PARAM_EXT_REQUEST_READ:
             this->_handle_param_ext_request_read(addr, msg);
@@ -584,19 +1102,202 @@ void MavlinkServer::_handle_mavlink_message(const struct sockaddr_in &addr, mavl
     }
 }
 
+/*
+ * Parse the MAVLink v1 or v2 frame at the start of data in one go.
+ * Returns the size of the frame if msg was filled, 0 if the frame does not end within data and -1
+ * if data does not start with a valid frame of a known message.
+ */
+static int _parse_frame(const uint8_t *data, size_t len, mavlink_message_t *msg)
+{
+    size_t hdr_len;
+    uint8_t incompat_flags = 0;
+    uint8_t compat_flags = 0;
+    uint8_t seq, sysid, compid;
+    uint32_t msgid;
+
+    if (!len)
+        return 0;
+
+    if (data[0] == MAVLINK_STX)
+        hdr_len = MAVLINK_CORE_HEADER_LEN + 1;
+    else if (data[0] == MAVLINK_STX_MAVLINK1)
+        hdr_len = MAVLINK_CORE_HEADER_MAVLINK1_LEN + 1;
+    else
+        return -1;
+
+    if (len < hdr_len)
+        return 0;
+
+    uint8_t payload_len = data[1];
+    size_t frame_len = hdr_len + payload_len + MAVLINK_NUM_CHECKSUM_BYTES;
+    if (data[0] == MAVLINK_STX) {
+        incompat_flags = data[2];
+        if (incompat_flags & ~MAVLINK_IFLAG_SIGNED)
+            return -1;
+        if (incompat_flags & MAVLINK_IFLAG_SIGNED)
+            frame_len += MAVLINK_SIGNATURE_BLOCK_LEN;
+        compat_flags = data[3];
+        seq = data[4];
+        sysid = data[5];
+        compid = data[6];
+        msgid = data[7] | (data[8] << 8) | (data[9] << 16);
+    } else {
+        seq = data[2];
+        sysid = data[3];
+        compid = data[4];
+        msgid = data[5];
+    }
+
+    if (len < frame_len)
+        return 0;
+
+    // the CRC of unknown messages can not be checked
+    const mavlink_msg_entry_t *entry = mavlink_get_msg_entry(msgid);
+    if (!entry)
+        return -1;
+
+    const uint8_t *ck = data + hdr_len + payload_len;
+    uint16_t crc = crc_calculate(data + 1, hdr_len - 1 + payload_len);
+    crc_accumulate(entry->crc_extra, &crc);
+    if (ck[0] != (crc & 0xFF) || ck[1] != (crc >> 8))
+        return -1;
+
+    msg->magic = data[0];
+    msg->len = payload_len;
+    msg->incompat_flags = incompat_flags;
+    msg->compat_flags = compat_flags;
+    msg->seq = seq;
+    msg->sysid = sysid;
+    msg->compid = compid;
+    msg->msgid = msgid;
+    msg->checksum = crc;
+    msg->ck[0] = ck[0];
+    msg->ck[1] = ck[1];
+
+    // MAVLink 2 drops trailing zeros of the payload
+    uint8_t *payload = (uint8_t *)_MAV_PAYLOAD_NON_CONST(msg);
+    memcpy(payload, data + hdr_len, payload_len);
+    if (payload_len < entry->max_msg_len)
+        memset(payload + payload_len, 0, entry->max_msg_len - payload_len);
+
+    if (incompat_flags & MAVLINK_IFLAG_SIGNED)
+        memcpy(msg->signature, ck + MAVLINK_NUM_CHECKSUM_BYTES, MAVLINK_SIGNATURE_BLOCK_LEN);
+
+    return frame_len;
+}
+
+static uint64_t _peer_key(const struct sockaddr_in &addr)
+{
+    return ((uint64_t)addr.sin_addr.s_addr << 16) | addr.sin_port;
+}
+
+uint8_t MavlinkServer::_get_peer_channel(const struct sockaddr_in &addr)
+{
+    uint64_t key = _peer_key(addr);
+    usec_t now = now_usec();
+
+    auto it = _peer_channels.find(key);
+    if (it != _peer_channels.end()) {
+        it->second.last_seen = now;
+        return it->second.chan;
+    }
+
+    uint8_t chan = _peer_channels.size();
+    if (_peer_channels.size() >= MAVLINK_COMM_NUM_BUFFERS) {
+        // more peers than parser channels, take the one of the peer not heard of for longest
+        auto oldest = _peer_channels.begin();
+        for (auto p = _peer_channels.begin(); p != _peer_channels.end(); ++p) {
+            if (p->second.last_seen < oldest->second.last_seen)
+                oldest = p;
+        }
+        chan = oldest->second.chan;
+        _peer_channels.erase(oldest);
+        mavlink_reset_channel_status(chan);
+    }
+
+    _peer_channels[key] = {chan, now};
+    return chan;
+}
+
+void MavlinkServer::_update_subscriber(const struct sockaddr_in &addr, mavlink_message_t *msg)
+{
+    // our own heartbeats come back when broadcast
+    if (msg->sysid == _system_id && compIdToObj.find(msg->compid) != compIdToObj.end())
+        return;
+
+    uint64_t key = _peer_key(addr);
+    usec_t now = now_usec();
+
+    auto it = _subscribers.find(key);
+    if (it != _subscribers.end()) {
+        it->second.last_seen = now;
+        return;
+    }
+
+    _expire_subscribers();
+    if (_subscribers.size() >= MAX_SUBSCRIBERS) {
+        log_warning("Too many ground stations, %s:%d not subscribed", inet_ntoa(addr.sin_addr),
+                    ntohs(addr.sin_port));
+        return;
+    }
+
+    log_info("Ground station %s:%d (System ID %d) subscribed", inet_ntoa(addr.sin_addr),
+             ntohs(addr.sin_port), msg->sysid);
+    _subscribers[key] = {addr, msg->sysid, now};
+}
+
+void MavlinkServer::_expire_subscribers()
+{
+    usec_t now = now_usec();
+
+    for (auto it = _subscribers.begin(); it != _subscribers.end();) {
+        if (now - it->second.last_seen < _gcs_timeout_us) {
+            ++it;
+            continue;
+        }
+        log_info("Ground station %s:%d (System ID %d) timed out",
+                 inet_ntoa(it->second.addr.sin_addr), ntohs(it->second.addr.sin_port),
+                 it->second.sysid);
+        it = _subscribers.erase(it);
+    }
+}
+
 void MavlinkServer::_message_received(const struct sockaddr_in &sockaddr, const struct buffer &buf)
 {
     mavlink_message_t msg;
     mavlink_status_t status;
+    uint8_t chan = _get_peer_channel(sockaddr);
+    mavlink_status_t *chan_status = mavlink_get_channel_status(chan);
+    unsigned int i = 0;
 
-    for (unsigned int i = 0; i < buf.len; ++i) {
-        //TOOD: Parse mavlink message all at once, instead of using mavlink_parse_char
-        if (mavlink_parse_char(MAVLINK_COMM_0, buf.data[i], &msg, &status))
+    // end of a frame split over datagrams of this peer
+    while (i < buf.len && chan_status->parse_state != MAVLINK_PARSE_STATE_IDLE) {
+        if (mavlink_parse_char(chan, buf.data[i++], &msg, &status))
+            _handle_mavlink_message(sockaddr, &msg);
+    }
+
+    // whole frames, as sent in a datagram each
+    while (i < buf.len) {
+        int ret = _parse_frame(buf.data + i, buf.len - i, &msg);
+        if (ret > 0) {
+            _handle_mavlink_message(sockaddr, &msg);
+            i += ret;
+        } else if (ret < 0) {
+            // resync on the next start byte
+            i++;
+        } else {
+            break;
+        }
+    }
+
+    // start of a frame continued in the next datagram
+    for (; i < buf.len; ++i) {
+        if (mavlink_parse_char(chan, buf.data[i], &msg, &status))
             _handle_mavlink_message(sockaddr, &msg);
     }
 }
 
-bool MavlinkServer::_send_camera_capture_status(int compid, const struct sockaddr_in &addr)
+bool MavlinkServer::_send_camera_capture_status(int compid, const struct sockaddr_in *addr)
 {
     log_debug("%s", __func__);
 
@@ -607,18 +1308,22 @@ bool MavlinkServer::_send_camera_capture_status(int compid, const struct sockadd
     uint8_t video_status = 0;
     int image_interval = 0;
     uint32_t recording_time_ms = 0;
-    int available_capacity = 50; // in MiB
+    float available_capacity = 0; // in MiB
     CameraComponent *tgtComp = getCameraComponent(compid);
     if (tgtComp) {
         // Get image capture status
         tgtComp->getImageCaptureStatus(image_status, image_interval);
         // Get video capture status
         video_status = tgtComp->getVideoCaptureStatus();
+        VideoCaptureStats stats;
+        if (video_status && !tgtComp->getVideoCaptureStats(stats))
+            recording_time_ms = stats.elapsedMs;
+        available_capacity = tgtComp->getStorageInfo().available_capacity;
         mavlink_msg_camera_capture_status_pack(_system_id, compid, &msg, time_boot_ms, image_status,
-                                               video_status, static_cast<float>(image_interval),
+                                               video_status, image_interval / 1000.0f,
                                                recording_time_ms,
-                                               static_cast<float>(available_capacity));
-        if (!_send_mavlink_message(&addr, msg)) {
+                                               available_capacity);
+        if (!_send_mavlink_message(addr, msg)) {
             log_error("Sending camera setting failed for camera %d.", compid);
             return false;
         }
@@ -629,6 +1334,128 @@ bool MavlinkServer::_send_camera_capture_status(int compid, const struct sockadd
     return success;
 }
 
+/* Throughput of the recording, where operators see when storage or the encoder falls behind */
+bool MavlinkServer::_send_video_capture_stats(int compid, const struct sockaddr_in &addr)
+{
+    CameraComponent *tgtComp = getCameraComponent(compid);
+    VideoCaptureStats stats;
+    if (!tgtComp || tgtComp->getVideoCaptureStats(stats))
+        return false;
+
+    log_debug("Recording %ums %lluB %ukbps (avg %ukbps) %.1ffps, %llu frames dropped",
+              stats.elapsedMs, (unsigned long long)stats.bytes, stats.bitRate, stats.avgBitRate,
+              stats.frameRate, (unsigned long long)stats.dropped);
+
+    const struct {
+        const char *name;
+        float value;
+    } values[] = {
+        {"REC_KBPS", (float)stats.bitRate},
+        {"REC_AVGKB", (float)stats.avgBitRate},
+        {"REC_FPS", stats.frameRate},
+        {"REC_DROP", (float)stats.dropped},
+        {"REC_MB", stats.bytes / (1024.0f * 1024.0f)},
+    };
+
+    mavlink_message_t msg;
+    for (const auto &v : values) {
+        mavlink_msg_named_value_float_pack(_system_id, compid, &msg, stats.elapsedMs, v.name,
+                                           v.value);
+        if (!_send_mavlink_message(&addr, msg)) {
+            log_error("Sending recording stats failed for camera %d.", compid);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool _video_status_cb(void *data)
+{
+    assert(data);
+    video_status_t *status = (video_status_t *)data;
+    MavlinkServer *server = status->server;
+
+    // every ground station follows the recording, not only the one that started it
+    server->_send_camera_capture_status(status->comp_id, nullptr);
+
+    // recording ended without a stop command, e.g. on error
+    if (!server->_send_video_capture_stats(status->comp_id, status->addr)) {
+        server->_video_status.erase(status->comp_id);
+        delete status;
+        return false;
+    }
+
+    return true;
+}
+
+void MavlinkServer::_start_video_status(int compid, const struct sockaddr_in &addr, float freq)
+{
+    _stop_video_status(compid);
+
+    unsigned int interval = std::max(1, (int)lroundf(1000.0f / freq));
+    video_status_t *status = new video_status_t;
+    status->server = this;
+    status->comp_id = compid;
+    memcpy(&status->addr, &addr, sizeof(struct sockaddr_in));
+    status->timeout_handler
+        = Mainloop::get_mainloop()->add_timeout(interval, _video_status_cb, status);
+    _video_status[compid] = status;
+}
+
+void MavlinkServer::_stop_video_status(int compid)
+{
+    auto it = _video_status.find(compid);
+    if (it == _video_status.end())
+        return;
+
+    Mainloop::get_mainloop()->del_timeout(it->second->timeout_handler);
+    delete it->second;
+    _video_status.erase(it);
+}
+
+bool _param_list_cb(void *data)
+{
+    assert(data);
+    param_list_t *list = (param_list_t *)data;
+
+    if (list->server->_send_param_list_window(list))
+        return true;
+
+    list->timeout_handler = 0;
+    return false;
+}
+
+/* Returns true if messages of the list are left to send */
+bool MavlinkServer::_send_param_list_window(param_list_t *list)
+{
+    unsigned int count = list->bufs.size() - list->next;
+    if (_param_burst && count > _param_burst)
+        count = _param_burst;
+
+    if (count) {
+        int r = _udp.write_batch(&list->bufs[list->next], count, list->addr);
+        if (r < 0) {
+            log_error("Sending response to param request list failed %u.", list->next);
+            return false;
+        }
+        // what did not fit in the socket buffer goes with the next window
+        list->next += r;
+    }
+
+    return list->next < list->bufs.size();
+}
+
+void MavlinkServer::_stop_param_list(int compid)
+{
+    auto it = _param_lists.find(compid);
+    if (it == _param_lists.end() || !it->second->timeout_handler)
+        return;
+
+    Mainloop::get_mainloop()->del_timeout(it->second->timeout_handler);
+    it->second->timeout_handler = 0;
+}
+
 bool MavlinkServer::_send_mavlink_message(const struct sockaddr_in *addr, mavlink_message_t &msg)
 {
     uint8_t buffer[MAX_MAVLINK_MESSAGE_SIZE];
@@ -636,9 +1463,35 @@ bool MavlinkServer::_send_mavlink_message(const struct sockaddr_in *addr, mavlin
 
     buf.len = mavlink_msg_to_send_buffer(buf.data, &msg);
 
+    if (buf.len == 0)
+        return false;
     if (addr)
-        return buf.len > 0 && _udp.write(buf, *addr) > 0;
-    return buf.len > 0 && _udp.write(buf, _broadcast_addr) > 0;
+        return _udp.write(buf, *addr) > 0;
+    // nobody to unicast to yet, announce ourselves on the LAN
+    if (_subscribers.empty())
+        return _udp.write(buf, _broadcast_addr) > 0;
+
+    bool success = true;
+    for (const auto &sub : _subscribers) {
+        if (_udp.write(buf, sub.second.addr) <= 0)
+            success = false;
+    }
+    return success;
+}
+
+/* the receivers track the sequence of the component, a replayed one would read as lost packets */
+bool MavlinkServer::_send_cached_message(const struct sockaddr_in &addr, cached_msg_t &cache)
+{
+    if (!cache.valid)
+        return false;
+
+    const mavlink_msg_entry_t *entry = mavlink_get_msg_entry(cache.msg.msgid);
+    if (!entry)
+        return false;
+
+    mavlink_finalize_message_chan(&cache.msg, cache.msg.sysid, cache.msg.compid, MAVLINK_COMM_0,
+                                  entry->min_msg_len, entry->max_msg_len, entry->crc_extra);
+    return _send_mavlink_message(&addr, cache.msg);
 }
 
 bool _heartbeat_cb(void *data)
@@ -652,6 +1505,9 @@ bool _heartbeat_cb(void *data)
         return false;
     }
 
+    server->_expire_subscribers();
+    server->_request_pose_stream();
+
     for (std::map<int, CameraComponent *>::iterator it = server->compIdToObj.begin();
          it != server->compIdToObj.end(); it++) {
         /* log_debug("Sending heartbeat for component :%d system_id:%d", it->first,
@@ -672,9 +1528,14 @@ void MavlinkServer::start()
     _is_running = true;
 
     _udp.open(true);
-    _udp.set_read_callback([this](const struct buffer &buf, const struct sockaddr_in &sockaddr) {
-        this->_message_received(sockaddr, buf);
-    });
+    if (_rcvbuf_size)
+        _udp.set_rcvbuf(_rcvbuf_size);
+    _udp.set_read_batch_callback(
+        [this](const struct buffer *bufs, const struct sockaddr_in *sockaddrs, unsigned int count) {
+            for (unsigned int i = 0; i < count; i++)
+                this->_message_received(sockaddrs[i], bufs[i]);
+            this->_flush_param_sets();
+        });
     _timeout_handler = Mainloop::get_mainloop()->add_timeout(1000, _heartbeat_cb, this);
 }
 
@@ -686,6 +1547,16 @@ void MavlinkServer::stop()
 
     if (_timeout_handler > 0)
         Mainloop::get_mainloop()->del_timeout(_timeout_handler);
+
+    while (!_video_status.empty())
+        _stop_video_status(_video_status.begin()->first);
+
+    for (auto &x : _param_lists)
+        _stop_param_list(x.first);
+    _param_sets.clear();
+
+    // commands still running on a camera complete, their replies are dropped
+    _executor.stop();
 }
 
 int MavlinkServer::addCameraComponent(CameraComponent *camComp)
@@ -712,22 +1583,37 @@ int MavlinkServer::addCameraComponent(CameraComponent *camComp)
     return ret;
 }
 
-void MavlinkServer::removeCameraComponent(CameraComponent *camComp)
+void MavlinkServer::removeCameraComponent(CameraComponent *camComp,
+                                          std::function<void()> released)
 {
     log_debug("%s", __func__);
 
     if (!camComp)
         return;
 
+    int compid = -1;
     for (std::map<int, CameraComponent *>::iterator it = compIdToObj.begin();
          it != compIdToObj.end(); it++) {
         if ((it->second) == camComp) {
+            compid = it->first;
+            _response_cache.erase(it->first);
             compIdToObj.erase(it);
             break;
         }
     }
 
-    return;
+    if (compid < 0 || !_is_running) {
+        if (released)
+            released();
+        return;
+    }
+
+    _stop_video_status(compid);
+    _stop_param_list(compid);
+
+    // queued behind the commands still running on the camera, at once if nothing runs anymore
+    if (released && !_executor.submit(compid, nullptr, [released](int) { released(); }))
+        released();
 }
 
 CameraComponent *MavlinkServer::getCameraComponent(int compID)
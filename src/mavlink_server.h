@@ -17,20 +17,95 @@
  */
 #pragma once
 
+#include <functional>
 #include <map>
 #include <mavlink.h>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "CameraComponent.h"
+#include "CommandExecutor.h"
+#include "PoseHistory.h"
 #include "conf_file.h"
 #include "socket.h"
+#include "util.h"
 
 typedef struct image_callback {
     int comp_id;             /* Component ID */
     struct sockaddr_in addr; /* Requester address */
 } image_callback_t;
 
+class MavlinkServer;
+
+/* Result of an image capture, handed from the capture threads to the mainloop */
+typedef struct image_captured {
+    MavlinkServer *server;
+    image_callback_t cb_data;
+    int result;
+    int seq_num;
+    uint64_t timestamp; /* Capture time of the frame */
+} image_captured_t;
+
+/* CAMERA_CAPTURE_STATUS sent periodically while recording */
+typedef struct video_status {
+    MavlinkServer *server;
+    int comp_id;                  /* Component ID */
+    struct sockaddr_in addr;      /* Requester address */
+    unsigned int timeout_handler; /* Timer sending the status */
+} video_status_t;
+
+/* Response packed once and sent again while the component state it was made of holds */
+typedef struct cached_msg {
+    bool valid;
+    uint32_t generation;   /* Change count of the component when packed */
+    usec_t time;           /* Time of packing */
+    mavlink_message_t msg; /* Stamped with a new sequence number on each send */
+} cached_msg_t;
+
+typedef struct response_cache {
+    cached_msg_t info;     /* CAMERA_INFORMATION */
+    cached_msg_t settings; /* CAMERA_SETTINGS */
+    cached_msg_t storage;  /* STORAGE_INFORMATION */
+} response_cache_t;
+
+/* PARAM_EXT_VALUE list being sent to a GCS, a window at a time */
+typedef struct param_list {
+    MavlinkServer *server;
+    int comp_id;                     /* Component ID */
+    struct sockaddr_in addr;         /* Requester address */
+    std::vector<uint8_t> data;       /* Encoded messages, kept for the next list */
+    std::vector<struct buffer> bufs; /* One per message, pointing into data */
+    unsigned int next;               /* Index of the first message not sent yet */
+    unsigned int timeout_handler;    /* Timer sending the next window */
+} param_list_t;
+
+/* Answer to PARAM_EXT_REQUEST_READ, read on the worker of the component */
+typedef struct param_reply {
+    bool is_value; /* Value read, else the ack of the error */
+    mavlink_param_ext_value_t value;
+    mavlink_param_ext_ack_t ack;
+} param_reply_t;
+
+/* PARAM_EXT_SET waiting for the others of the same datagrams */
+typedef struct param_set_req {
+    struct sockaddr_in addr; /* Requester address */
+    mavlink_param_ext_set_t param_set;
+} param_set_req_t;
+
+/* MAVLink parser channel of a peer, for frames split over datagrams */
+typedef struct peer_channel {
+    uint8_t chan;     /* Channel of mavlink_parse_char() */
+    usec_t last_seen; /* Time of the last datagram */
+} peer_channel_t;
+
+/* Ground station heard from, sent heartbeats and capture status */
+typedef struct gcs_subscriber {
+    struct sockaddr_in addr; /* Address and port messages came from */
+    int sysid;               /* System ID of the peer */
+    usec_t last_seen;        /* Time of the last message */
+} gcs_subscriber_t;
+
 class MavlinkServer {
 public:
     MavlinkServer(const ConfFile &conf);
@@ -38,8 +113,11 @@ public:
     void start();
     void stop();
     int addCameraComponent(CameraComponent *camComp);
-    void removeCameraComponent(CameraComponent *camComp);
+    /* released runs on the mainloop once no command of the component runs anymore */
+    void removeCameraComponent(CameraComponent *camComp, std::function<void()> released = nullptr);
     CameraComponent *getCameraComponent(int compID);
+    /* Messages received by message ID, read on the mainloop only */
+    const std::map<uint32_t, uint64_t> &getMessageCounts() const { return _msg_counts; }
 
 private:
     bool _is_running;
@@ -49,9 +127,28 @@ private:
     bool _is_sys_id_found;
     int _system_id;
     int _comp_id;
+    std::string _rtsp_server_addr; /* Address of the RTSP server in stream URIs */
     std::map<int, CameraComponent *> compIdToObj;
+    std::map<int, video_status_t *> _video_status; /* By component ID */
+    std::map<uint64_t, peer_channel_t> _peer_channels; /* By peer address and port */
+    std::map<uint64_t, gcs_subscriber_t> _subscribers; /* By peer address and port */
+    std::map<uint32_t, uint64_t> _msg_counts;          /* Received, by message ID */
+    usec_t _gcs_timeout_us; /* Time without a message before a subscriber is dropped */
+    PoseHistory _poses;     /* Of the autopilot, to geotag images */
+    bool _is_autopilot_found;
+    struct sockaddr_in _autopilot_addr = {}; /* Where the pose stream is requested from */
+    int _rcvbuf_size; /* Socket receive buffer in bytes, 0 for the system default */
+    std::map<int, param_list_t *> _param_lists;        /* By component ID */
+    std::map<int, response_cache_t> _response_cache;   /* By component ID */
+    std::map<int, std::vector<param_set_req_t>> _param_sets; /* Pending, by component ID */
+    CommandExecutor _executor; /* Commands that block, serialized per component ID */
+    unsigned int _param_burst;       /* PARAM_EXT_VALUE per window, 0 for all at once */
+    unsigned int _param_interval_ms; /* Time between windows */
 
     void _message_received(const struct sockaddr_in &sockaddr, const struct buffer &buf);
+    uint8_t _get_peer_channel(const struct sockaddr_in &addr);
+    void _update_subscriber(const struct sockaddr_in &addr, mavlink_message_t *msg);
+    void _expire_subscribers();
     void _handle_mavlink_message(const struct sockaddr_in &addr, mavlink_message_t *msg);
     void _handle_request_camera_information(const struct sockaddr_in &addr,
                                             mavlink_command_long_t &cmd);
@@ -65,21 +162,48 @@ private:
     void _handle_image_stop_capture(const struct sockaddr_in &addr, mavlink_command_long_t &cmd);
     void _handle_video_start_capture(const struct sockaddr_in &addr, mavlink_command_long_t &cmd);
     void _handle_video_stop_capture(const struct sockaddr_in &addr, mavlink_command_long_t &cmd);
-    void _image_captured_cb(image_callback_t cb_data, int result, int seq_num);
+    void _handle_request_video_stream_information(const struct sockaddr_in &addr,
+                                                  mavlink_command_long_t &cmd);
+    void _handle_video_start_streaming(const struct sockaddr_in &addr,
+                                       mavlink_command_long_t &cmd);
+    void _handle_video_stop_streaming(const struct sockaddr_in &addr, mavlink_command_long_t &cmd);
+    void _handle_camera_track(const struct sockaddr_in &addr, mavlink_command_long_t &cmd);
+    void _image_captured_cb(image_callback_t cb_data, int result, int seq_num,
+                            uint64_t timestamp);
+    void _send_image_captured(const image_captured_t &captured);
     void _handle_request_camera_capture_status(const struct sockaddr_in &addr,
                                                mavlink_command_long_t &cmd);
     void _handle_param_ext_request_read(const struct sockaddr_in &addr, mavlink_message_t *msg);
     void _handle_param_ext_request_list(const struct sockaddr_in &addr, mavlink_message_t *msg);
     void _handle_param_ext_set(const struct sockaddr_in &addr, mavlink_message_t *msg);
+    static void _fill_param_ext_ack(CameraComponent *tgtComp,
+                                    const mavlink_param_ext_set_t &param_set, bool success,
+                                    mavlink_param_ext_ack_t &param_ext_ack);
+    void _flush_param_sets();
     void _handle_reset_camera_settings(const struct sockaddr_in &addr, mavlink_command_long_t &cmd);
     void _handle_heartbeat(const struct sockaddr_in &addr, mavlink_message_t *msg);
-    bool _send_camera_capture_status(int compid, const struct sockaddr_in &addr);
+    void _handle_pose(mavlink_message_t *msg);
+    void _request_pose_stream();
+    bool _send_camera_capture_status(int compid, const struct sockaddr_in *addr);
+    bool _send_video_capture_stats(int compid, const struct sockaddr_in &addr);
+    void _start_video_status(int compid, const struct sockaddr_in &addr, float freq);
+    void _stop_video_status(int compid);
+    bool _send_param_list_window(param_list_t *list);
+    void _stop_param_list(int compid);
     bool _send_mavlink_message(const struct sockaddr_in *addr, mavlink_message_t &msg);
+    bool _send_cached_message(const struct sockaddr_in &addr, cached_msg_t &cache);
     void _send_ack(const struct sockaddr_in &addr, int cmd, int comp_id, bool success);
+    void _send_ack_result(const struct sockaddr_in &addr, int cmd, int comp_id, uint8_t result);
+    void _run_command(const struct sockaddr_in &addr, mavlink_command_long_t &cmd);
+    void _run_in_worker(const struct sockaddr_in &addr, mavlink_command_long_t &cmd,
+                        std::function<int()> work, std::function<void(bool)> done = nullptr);
 #if 0
     const Stream::FrameSize *_find_best_frame_size(Stream &s, uint32_t w, uint32_t v);
 #endif
     friend bool _heartbeat_cb(void *data);
+    friend bool _video_status_cb(void *data);
+    friend bool _param_list_cb(void *data);
+    friend bool _image_captured_timeout_cb(void *data);
 
     CameraParameters::Mode mav2dcmCameraMode(uint32_t mode);
     uint32_t dcm2mavCameraMode(CameraParameters::Mode mode);
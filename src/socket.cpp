@@ -18,25 +18,31 @@
 
 #include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <vector>
 
 #include "log.h"
 #include "socket.h"
 
 #define DEFAULT_BUF_SIZE 1024
+/* Datagrams read per recvmmsg() */
+#define RECV_BATCH 32
 
 Socket::Socket()
     : _read_cb([](const struct buffer &buf, const struct sockaddr_in &sockaddr) {})
     , _write_buf{0, nullptr}
+    , _read_buf{DEFAULT_BUF_SIZE, new uint8_t[DEFAULT_BUF_SIZE]}
 {
 }
 
 Socket::~Socket()
 {
-    free(_write_buf.data);
+    delete[] _write_buf.data;
+    delete[] _read_buf.data;
 }
 
 int Socket::write(const struct buffer &buf, const struct sockaddr_in &sockaddr)
@@ -65,31 +71,25 @@ void Socket::set_read_callback(
     _read_cb = cb;
 }
 
+/* Watched edge-triggered, the socket is read until empty */
 bool Socket::_can_read()
 {
-    struct buffer read_buf {
-        DEFAULT_BUF_SIZE, new uint8_t[DEFAULT_BUF_SIZE]
-    };
     struct sockaddr_in sockaddr = {};
-    int r = _do_read(read_buf, sockaddr);
 
-    if (r == -EAGAIN) {
-        log_debug("Read packet failed. Trying again.");
-        goto end;
-    }
-    if (r < 0) {
-        log_debug("Read failed. Droping packet.");
-        delete[] read_buf.data;
-        return false;
-    }
-    if (r > 0) {
-        read_buf.len = (unsigned int)r;
-        _read_cb(read_buf, sockaddr);
-    }
+    while (true) {
+        int r = _do_read(_read_buf, sockaddr);
+        if (r == -EAGAIN)
+            return true;
+        if (r == -EINTR)
+            continue;
+        if (r < 0) {
+            log_debug("Read failed. Droping packet.");
+            return false;
+        }
 
-end:
-    delete[] read_buf.data;
-    return true;
+        struct buffer buf = {(unsigned int)r, _read_buf.data};
+        _read_cb(buf, sockaddr);
+    }
 }
 
 bool Socket::_can_write()
@@ -113,7 +113,20 @@ bool Socket::_can_write()
 }
 
 UDPSocket::UDPSocket()
+    : _rx_data(RECV_BATCH * DEFAULT_BUF_SIZE)
+    , _rx_bufs(RECV_BATCH)
+    , _rx_addrs(RECV_BATCH)
+    , _rx_iov(RECV_BATCH)
+    , _rx_msgs(RECV_BATCH)
 {
+    for (unsigned int i = 0; i < RECV_BATCH; i++) {
+        _rx_bufs[i].data = &_rx_data[i * DEFAULT_BUF_SIZE];
+        _rx_iov[i].iov_base = _rx_bufs[i].data;
+        _rx_msgs[i].msg_hdr = {};
+        _rx_msgs[i].msg_hdr.msg_name = &_rx_addrs[i];
+        _rx_msgs[i].msg_hdr.msg_iov = &_rx_iov[i];
+        _rx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
 }
 
 UDPSocket::~UDPSocket()
@@ -194,6 +207,70 @@ int UDPSocket::bind(const char *ip, unsigned long port)
     return 0;
 }
 
+/* Size of the kernel receive buffer in bytes, to hold bursts of the autopilot telemetry */
+int UDPSocket::set_rcvbuf(int size)
+{
+    if (_fd < 0) {
+        log_error("Trying to set receive buffer of an invalid _fd");
+        return -EINVAL;
+    }
+
+    if (setsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size))) {
+        log_error("Error setting socket receive buffer (%m)");
+        return -1;
+    }
+
+    // the kernel doubles the value and caps it at net.core.rmem_max
+    int actual = 0;
+    socklen_t len = sizeof(actual);
+    if (!getsockopt(_fd, SOL_SOCKET, SO_RCVBUF, &actual, &len))
+        log_info("UDP [%d] receive buffer %d bytes", _fd, actual);
+
+    return 0;
+}
+
+void UDPSocket::set_read_batch_callback(
+    std::function<void(const struct buffer *bufs, const struct sockaddr_in *sockaddrs,
+                       unsigned int count)>
+        cb)
+{
+    _read_batch_cb = cb;
+}
+
+/* Watched edge-triggered, a short batch means the socket is empty */
+bool UDPSocket::_can_read()
+{
+    while (true) {
+        for (unsigned int i = 0; i < RECV_BATCH; i++) {
+            _rx_iov[i].iov_len = DEFAULT_BUF_SIZE;
+            _rx_msgs[i].msg_hdr.msg_namelen = sizeof(_rx_addrs[i]);
+        }
+
+        int r = ::recvmmsg(_fd, _rx_msgs.data(), RECV_BATCH, MSG_DONTWAIT, nullptr);
+        if (r == -1) {
+            if (errno == EAGAIN)
+                return true;
+            if (errno == EINTR)
+                continue;
+            log_error("Error reading udp packets (%m)");
+            return false;
+        }
+
+        for (int i = 0; i < r; i++)
+            _rx_bufs[i].len = _rx_msgs[i].msg_len;
+
+        if (_read_batch_cb) {
+            _read_batch_cb(_rx_bufs.data(), _rx_addrs.data(), r);
+        } else {
+            for (int i = 0; i < r; i++)
+                _read_cb(_rx_bufs[i], _rx_addrs[i]);
+        }
+
+        if (r < RECV_BATCH)
+            return true;
+    }
+}
+
 int UDPSocket::_do_write(const struct buffer &buf, const struct sockaddr_in &sockaddr)
 {
     if (_fd < 0) {
@@ -223,6 +300,46 @@ int UDPSocket::_do_write(const struct buffer &buf, const struct sockaddr_in &soc
     return r;
 }
 
+/* Returns the number of datagrams sent, the rest is to be sent again later */
+int UDPSocket::write_batch(const struct buffer *bufs, unsigned int count,
+                           const struct sockaddr_in &sockaddr)
+{
+    if (_fd < 0) {
+        log_error("Trying to write to an invalid _fd");
+        return -EINVAL;
+    }
+
+    if (!sockaddr.sin_port) {
+        log_debug("No one ever connected to %d. No one to write for", _fd);
+        return -EDESTADDRREQ;
+    }
+
+    std::vector<struct mmsghdr> msgs(count);
+    std::vector<struct iovec> iov(count);
+    for (unsigned int i = 0; i < count; i++) {
+        iov[i].iov_base = bufs[i].data;
+        iov[i].iov_len = bufs[i].len;
+        msgs[i].msg_hdr = {};
+        msgs[i].msg_hdr.msg_name = (void *)&sockaddr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int r = ::sendmmsg(_fd, msgs.data(), count, 0);
+    if (r == -1) {
+        if (errno == EAGAIN)
+            return 0;
+        if (errno != ECONNREFUSED && errno != ENETUNREACH)
+            log_error("Error sending udp packets (%m)");
+        return -errno;
+    }
+
+    log_debug("UDP: [%d] wrote %d packets", _fd, r);
+
+    return r;
+}
+
 int UDPSocket::_do_read(const struct buffer &buf, struct sockaddr_in &sockaddr)
 {
     socklen_t addrlen = sizeof(sockaddr);
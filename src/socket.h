@@ -18,6 +18,8 @@
 #pragma once
 
 #include <arpa/inet.h>
+#include <sys/socket.h>
+#include <vector>
 
 #include "pollable.h"
 
@@ -40,10 +42,11 @@ protected:
     bool _can_write() override;
     virtual int _do_write(const struct buffer &buf, const struct sockaddr_in &sockaddr) = 0;
     virtual int _do_read(const struct buffer &buf, struct sockaddr_in &sockaddr) = 0;
+    std::function<void(const struct buffer &buf, const struct sockaddr_in &sockaddr)> _read_cb;
 
 private:
-    std::function<void(const struct buffer &buf, const struct sockaddr_in &sockaddr)> _read_cb;
     struct buffer _write_buf;
+    struct buffer _read_buf; /* Reused for every datagram read */
     struct sockaddr_in sockaddr_buf {};
 };
 
@@ -55,8 +58,26 @@ public:
     int open(bool broadcast);
     void close();
     int bind(const char *addr, unsigned long port);
+    int write_batch(const struct buffer *bufs, unsigned int count,
+                    const struct sockaddr_in &sockaddr);
+    int set_rcvbuf(int size);
+    /* Datagrams read with one recvmmsg(), instead of one at a time with the read callback */
+    void set_read_batch_callback(std::function<void(const struct buffer *bufs,
+                                                    const struct sockaddr_in *sockaddrs,
+                                                    unsigned int count)> cb);
 
 protected:
+    bool _can_read() override;
     int _do_write(const struct buffer &buf, const struct sockaddr_in &sockaddr) override;
     int _do_read(const struct buffer &buf, struct sockaddr_in &sockaddr) override;
+
+private:
+    std::function<void(const struct buffer *bufs, const struct sockaddr_in *sockaddrs,
+                       unsigned int count)> _read_batch_cb;
+    /* Receive batch, allocated once */
+    std::vector<uint8_t> _rx_data;
+    std::vector<struct buffer> _rx_bufs;
+    std::vector<struct sockaddr_in> _rx_addrs;
+    std::vector<struct iovec> _rx_iov;
+    std::vector<struct mmsghdr> _rx_msgs;
 };
@@ -22,6 +22,7 @@
 #include <fcntl.h>
 #include <linux/videodev2.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 #include "log.h"
@@ -119,67 +120,22 @@ int v4l2_query_cap(int fd, struct v4l2_capability &vcap)
     return 0;
 }
 
-int v4l2_query_control(int fd)
+int v4l2_query_control(int fd, std::vector<struct v4l2_queryctrl> &ctrls)
 {
     int ret = -1;
     if (fd < 1)
         return ret;
 
     const unsigned next_fl = V4L2_CTRL_FLAG_NEXT_CTRL | V4L2_CTRL_FLAG_NEXT_COMPOUND;
-    struct v4l2_control ctrl = {0};
     struct v4l2_queryctrl qctrl = {0};
     qctrl.id = next_fl;
     while (v4l2_ioctl(fd, VIDIOC_QUERYCTRL, &qctrl) == 0) {
-        if ((qctrl.flags & V4L2_CTRL_TYPE_BOOLEAN) || (qctrl.type & V4L2_CTRL_TYPE_INTEGER)) {
-            log_debug("Ctrl: %s Min:%d Max:%d Step:%d dflt:%d", qctrl.name, qctrl.minimum,
-                      qctrl.maximum, qctrl.step, qctrl.default_value);
-            ctrl.id = qctrl.id;
-            if (v4l2_ioctl(fd, VIDIOC_G_CTRL, &ctrl) == 0) {
-                log_debug("Ctrl: %s Id:%x Value:%d\n", qctrl.name, ctrl.id, ctrl.value);
-            }
-        }
+        log_debug("Ctrl: %s Id:%x Type:%d Min:%d Max:%d Step:%d dflt:%d", qctrl.name, qctrl.id,
+                  qctrl.type, qctrl.minimum, qctrl.maximum, qctrl.step, qctrl.default_value);
+        ctrls.push_back(qctrl);
         qctrl.id |= next_fl;
     }
-    // TODO:: Return the list of controls
-    return 0;
-}
-
-int v4l2_query_framesizes(int fd)
-{
-    int ret = -1;
-    if (fd < 1)
-        return ret;
-
-    struct v4l2_fmtdesc fmt = {};
-    struct v4l2_frmsizeenum frame_size = {};
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.index = 0;
-    while (v4l2_ioctl(fd, VIDIOC_ENUM_FMT, &fmt) != -1) {
-        // TODO:: Save the format in some DS
-        log_debug("Pixel Format: %u", fmt.pixelformat);
-        log_debug("Name : %s\n", fmt.description);
-        frame_size.index = 0;
-        frame_size.pixel_format = fmt.pixelformat;
-        while (v4l2_ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &frame_size) != -1) {
-            switch (frame_size.type) {
-            case V4L2_FRMSIZE_TYPE_DISCRETE:
-                log_debug(" FrameSize: %ux%u\n", frame_size.discrete.width,
-                          frame_size.discrete.height);
-                break;
-            case V4L2_FRMSIZE_TYPE_CONTINUOUS:
-            case V4L2_FRMSIZE_TYPE_STEPWISE:
-                log_debug(" FrameSize: %ux%u -> %ux%u\n", frame_size.stepwise.min_width,
-                          frame_size.stepwise.min_height, frame_size.stepwise.max_width,
-                          frame_size.stepwise.max_height);
-                break;
-            }
-            // TODO::Save the framesizes against format in some DS
-        }
-
-        fmt.index++;
-    }
 
-    // TODO::Return the list of pixformats & framesizes
     return 0;
 }
 
@@ -221,6 +177,12 @@ int v4l2_set_capturemode(int fd, uint32_t mode)
 }
 
 int v4l2_set_pixformat(int fd, uint32_t w, uint32_t h, uint32_t pf)
+{
+    uint32_t stride;
+    return v4l2_set_pixformat(fd, w, h, pf, stride);
+}
+
+int v4l2_set_pixformat(int fd, uint32_t w, uint32_t h, uint32_t pf, uint32_t &stride)
 {
     int ret = -1;
 
@@ -236,6 +198,8 @@ int v4l2_set_pixformat(int fd, uint32_t w, uint32_t h, uint32_t pf)
     if (ret) {
         log_error("Setting pixel format: %s", strerror(errno));
     }
+    // lines may be padded by the driver
+    stride = ret ? 0 : fmt.fmt.pix.bytesperline;
 
     return ret;
 }
@@ -267,23 +231,84 @@ int v4l2_streamoff(int fd)
 }
 
 int v4l2_buf_req(int fd, uint32_t count)
+{
+    return v4l2_buf_req(fd, count, V4L2_MEMORY_USERPTR);
+}
+
+int v4l2_buf_req(int fd, uint32_t &count, uint32_t memory)
 {
     int ret = -1;
 
-    // Initiate I/O
+    // Initiate I/O, driver may adjust the count
     struct v4l2_requestbuffers req;
     memset(&req, 0, sizeof(struct v4l2_requestbuffers));
     req.count = count;
     req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    req.memory = V4L2_MEMORY_USERPTR;
+    req.memory = memory;
     ret = v4l2_ioctl(fd, VIDIOC_REQBUFS, &req);
     if (ret) {
-        log_error("Error in REQBUFS %s", strerror(errno));
+        ret = -errno;
+        log_error("Error in REQBUFS %s", strerror(-ret));
+        return ret;
     }
 
+    count = req.count;
     return ret;
 }
 
+int v4l2_query_buf(int fd, uint32_t i, uint32_t memory, struct v4l2_buffer &buf)
+{
+    int ret = -1;
+
+    memset(&buf, 0, sizeof(struct v4l2_buffer));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = memory;
+    buf.index = i;
+    ret = v4l2_ioctl(fd, VIDIOC_QUERYBUF, &buf);
+    if (ret) {
+        log_error("Error in QUERYBUF: %s | i=%i", strerror(errno), i);
+    }
+
+    return ret;
+}
+
+void *v4l2_buf_mmap(int fd, struct v4l2_buffer &buf)
+{
+    void *addr = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buf.m.offset);
+    if (addr == MAP_FAILED) {
+        log_error("Error mapping buffer: %s | i=%i", strerror(errno), buf.index);
+        return nullptr;
+    }
+
+    return addr;
+}
+
+int v4l2_buf_munmap(void *addr, size_t length)
+{
+    if (!addr)
+        return -1;
+
+    return munmap(addr, length);
+}
+
+int v4l2_buf_export(int fd, uint32_t i)
+{
+    int ret = -1;
+
+    struct v4l2_exportbuffer expbuf;
+    memset(&expbuf, 0, sizeof(struct v4l2_exportbuffer));
+    expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    expbuf.index = i;
+    expbuf.flags = O_CLOEXEC | O_RDONLY;
+    ret = v4l2_ioctl(fd, VIDIOC_EXPBUF, &expbuf);
+    if (ret) {
+        log_debug("Buffer export not supported: %s | i=%i", strerror(errno), i);
+        return -1;
+    }
+
+    return expbuf.fd;
+}
+
 int v4l2_buf_q(int fd, uint32_t i, unsigned long bufptr, uint32_t buflen)
 {
     int ret = -1;
@@ -303,6 +328,23 @@ int v4l2_buf_q(int fd, uint32_t i, unsigned long bufptr, uint32_t buflen)
     return ret;
 }
 
+int v4l2_buf_q(int fd, uint32_t i, uint32_t memory)
+{
+    int ret = -1;
+
+    struct v4l2_buffer buf;
+    memset(&buf, 0, sizeof(struct v4l2_buffer));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = memory;
+    buf.index = i;
+    ret = v4l2_ioctl(fd, VIDIOC_QBUF, &buf);
+    if (ret) {
+        log_error("Error giving buffers to backend: %s | i=%i", strerror(errno), i);
+    }
+
+    return ret;
+}
+
 int v4l2_buf_q(int fd, struct v4l2_buffer *pbuf)
 {
     int ret = -1;
@@ -372,3 +414,42 @@ int v4l2_set_control(int fd, int ctrl_id, int value)
 
     return ret;
 }
+
+static int v4l2_ext_controls_ioctl(int fd, int request,
+                                   std::vector<struct v4l2_ext_control> &ctrls)
+{
+    if (fd < 1 || ctrls.empty())
+        return -1;
+
+    struct v4l2_ext_controls ext_ctrls;
+    memset(&ext_ctrls, 0, sizeof(struct v4l2_ext_controls));
+    ext_ctrls.ctrl_class = 0;
+    ext_ctrls.count = ctrls.size();
+    ext_ctrls.controls = ctrls.data();
+    int ret = v4l2_ioctl(fd, request, &ext_ctrls);
+    if (ret) {
+        // error_idx is count if the failing control is not known
+        if (ext_ctrls.error_idx < ctrls.size())
+            log_debug("Error in control %x: %s", ctrls[ext_ctrls.error_idx].id, strerror(errno));
+        else
+            log_debug("Error in controls: %s", strerror(errno));
+    }
+
+    return ret;
+}
+
+int v4l2_try_controls(int fd, std::vector<struct v4l2_ext_control> &ctrls)
+{
+    return v4l2_ext_controls_ioctl(fd, VIDIOC_TRY_EXT_CTRLS, ctrls);
+}
+
+int v4l2_set_controls(int fd, std::vector<struct v4l2_ext_control> &ctrls)
+{
+    return v4l2_ext_controls_ioctl(fd, VIDIOC_S_EXT_CTRLS, ctrls);
+}
+
+int v4l2_get_controls(int fd, std::vector<struct v4l2_ext_control> &ctrls)
+{
+    // All controls in a single ioctl, of any control class
+    return v4l2_ext_controls_ioctl(fd, VIDIOC_G_EXT_CTRLS, ctrls);
+}
@@ -28,18 +28,27 @@ int v4l2_open(std::string deviceID);
 // int v4l2_open(const char *devicepath);
 int v4l2_close(int fd);
 int v4l2_query_cap(int fd, struct v4l2_capability &vcap);
-int v4l2_query_control(int fd);
-int v4l2_query_framesizes(int fd);
+int v4l2_query_control(int fd, std::vector<struct v4l2_queryctrl> &ctrls);
 int v4l2_set_input(int fd, int id);
 int v4l2_get_input(int fd);
 int v4l2_set_capturemode(int fd, uint32_t mode);
 int v4l2_set_pixformat(int fd, uint32_t w, uint32_t h, uint32_t pf);
+int v4l2_set_pixformat(int fd, uint32_t w, uint32_t h, uint32_t pf, uint32_t &stride);
 int v4l2_streamon(int fd);
 int v4l2_streamoff(int fd);
 int v4l2_buf_req(int fd, uint32_t count);
+int v4l2_buf_req(int fd, uint32_t &count, uint32_t memory);
+int v4l2_query_buf(int fd, uint32_t i, uint32_t memory, struct v4l2_buffer &buf);
+void *v4l2_buf_mmap(int fd, struct v4l2_buffer &buf);
+int v4l2_buf_munmap(void *addr, size_t length);
+int v4l2_buf_export(int fd, uint32_t i);
 int v4l2_buf_q(int fd, struct v4l2_buffer *pbuf);
 int v4l2_buf_q(int fd, uint32_t i, unsigned long bufptr, uint32_t buflen);
+int v4l2_buf_q(int fd, uint32_t i, uint32_t memory);
 int v4l2_buf_dq(int fd, struct v4l2_buffer *pbuf);
 int v4l2_buf_dq(int fd);
 int v4l2_get_control(int fd, int ctrl_id);
 int v4l2_set_control(int fd, int ctrl_id, int value);
+int v4l2_get_controls(int fd, std::vector<struct v4l2_ext_control> &ctrls);
+int v4l2_try_controls(int fd, std::vector<struct v4l2_ext_control> &ctrls);
+int v4l2_set_controls(int fd, std::vector<struct v4l2_ext_control> &ctrls);
@@ -0,0 +1,256 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/**
+ *
+ * @brief  This is a test application to measure the glass to glass latency of the streams of the
+ * Dronecode Camera Manager.
+ *
+ * The camera manager is run with latency_stamp = true in [trace], so every frame carries its
+ * capture time. This application receives the RTSP or UDP stream, decodes it, reads the stamp of
+ * every frame and reports the latency distribution, tagged with a label naming the pipeline
+ * configuration under test.
+ *
+ *   test-glass-to-glass -u rtsp://192.168.8.1:8554/video0 -l "x264 zerolatency" -d 30
+ *   test-glass-to-glass -p 5600 -l "udp low_latency"
+ */
+
+#include <atomic>
+#include <getopt.h>
+#include <gst/app/gstappsink.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "StageStats.h"
+#include "latency_stamp.h"
+#include "log.h"
+#include "util.h"
+
+#define DEFAULT_DURATION_S 10
+#define REPORT_INTERVAL_S 5
+/* Stamps older than this come from a clock out of sync, not from the stream */
+#define MAX_LATENCY_US (10 * USEC_PER_SEC)
+
+struct Receiver {
+    GMainLoop *loop;
+    LatencyHistogram latency;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> unstamped;
+    std::string label;
+};
+
+static void help(FILE *fp)
+{
+    fprintf(fp,
+            "%s [OPTIONS...]\n\n"
+            "  -u --uri <uri>         RTSP stream to receive\n"
+            "  -p --port <port>       UDP port the H.264 RTP stream is received on\n"
+            "  -d --duration <sec>    Time to measure, default %d\n"
+            "  -l --label <text>      Pipeline configuration the results are tagged with\n"
+            "  -h --help              Print this message\n",
+            program_invocation_short_name, DEFAULT_DURATION_S);
+}
+
+static void report(Receiver &rx, const char *when)
+{
+    LatencyHistogram::Summary s;
+    rx.latency.summarize(s);
+
+    printf("%s [%s] frames=%llu unstamped=%llu latency_ms p50=%.1f p90=%.1f p99=%.1f max=%.1f "
+           "mean=%.1f\n",
+           when, rx.label.c_str(), (unsigned long long)rx.frames.load(),
+           (unsigned long long)rx.unstamped.load(), s.p50 / 1000.0, s.p90 / 1000.0, s.p99 / 1000.0,
+           s.max / 1000.0, s.mean / 1000.0);
+    fflush(stdout);
+}
+
+/* streaming thread of the receiver */
+static GstFlowReturn new_sample_cb(GstAppSink *sink, gpointer user_data)
+{
+    Receiver *rx = (Receiver *)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (!sample)
+        return GST_FLOW_ERROR;
+
+    uint32_t now = latency_stamp_now();
+    GstVideoInfo vinfo;
+    GstVideoFrame frame;
+    uint32_t stamp;
+
+    rx->frames++;
+    if (gst_video_info_from_caps(&vinfo, gst_sample_get_caps(sample))
+        && gst_video_frame_map(&frame, &vinfo, gst_sample_get_buffer(sample), GST_MAP_READ)) {
+        int ret = latency_stamp_read((const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0),
+                                     GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0),
+                                     GST_VIDEO_FRAME_WIDTH(&frame), GST_VIDEO_FRAME_HEIGHT(&frame),
+                                     &stamp);
+        gst_video_frame_unmap(&frame);
+
+        /* stamps wrap every 71 minutes, the difference is taken modulo 2^32 */
+        uint32_t latency = now - stamp;
+        if (!ret && latency < MAX_LATENCY_US)
+            rx->latency.record(latency);
+        else
+            rx->unstamped++;
+    } else {
+        rx->unstamped++;
+    }
+
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+static gboolean bus_cb(GstBus *bus, GstMessage *msg, gpointer user_data)
+{
+    Receiver *rx = (Receiver *)user_data;
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+    case GST_MESSAGE_ERROR: {
+        GError *err = nullptr;
+        gchar *debug = nullptr;
+        gst_message_parse_error(msg, &err, &debug);
+        log_error("Receiver error: %s (%s)", err->message, debug ? debug : "");
+        g_error_free(err);
+        g_free(debug);
+        g_main_loop_quit(rx->loop);
+        break;
+    }
+    case GST_MESSAGE_EOS:
+        g_main_loop_quit(rx->loop);
+        break;
+    default:
+        break;
+    }
+
+    return TRUE;
+}
+
+static gboolean report_cb(gpointer user_data)
+{
+    report(*(Receiver *)user_data, "running");
+    return TRUE;
+}
+
+static gboolean quit_cb(gpointer user_data)
+{
+    g_main_loop_quit(((Receiver *)user_data)->loop);
+    return FALSE;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option options[] = {{"uri", required_argument, NULL, 'u'},
+                                            {"port", required_argument, NULL, 'p'},
+                                            {"duration", required_argument, NULL, 'd'},
+                                            {"label", required_argument, NULL, 'l'},
+                                            {"help", no_argument, NULL, 'h'},
+                                            {}};
+    std::string uri;
+    int port = 0;
+    unsigned int duration = DEFAULT_DURATION_S;
+    Receiver rx;
+    rx.frames = 0;
+    rx.unstamped = 0;
+    int c;
+
+    Log::open();
+    Log::set_max_level(Log::Level::INFO);
+    gst_init(&argc, &argv);
+
+    while ((c = getopt_long(argc, argv, "u:p:d:l:h", options, NULL)) >= 0) {
+        switch (c) {
+        case 'u':
+            uri = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'l':
+            rx.label = optarg;
+            break;
+        case 'h':
+            help(stdout);
+            Log::close();
+            return EXIT_SUCCESS;
+        default:
+            help(stderr);
+            Log::close();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (uri.empty() == (port <= 0)) {
+        log_error("Either an RTSP uri or a UDP port is needed");
+        help(stderr);
+        Log::close();
+        return EXIT_FAILURE;
+    }
+
+    /* frames are decoded to a format with a luma plane, as stamped */
+    std::string launch = uri.empty()
+        ? "udpsrc port=" + std::to_string(port)
+            + " caps=\"application/x-rtp,media=video,encoding-name=H264,payload=96\""
+            + " ! rtph264depay ! decodebin"
+        : "rtspsrc location=" + uri + " latency=0 ! decodebin";
+    launch += " ! videoconvert ! video/x-raw,format=I420 ! appsink name=sink sync=false";
+
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(launch.c_str(), &error);
+    if (!pipeline) {
+        log_error("Error in creating receiver: %s", error ? error->message : "unknown");
+        if (error)
+            g_error_free(error);
+        Log::close();
+        return EXIT_FAILURE;
+    }
+    if (error)
+        g_error_free(error);
+
+    if (rx.label.empty())
+        rx.label = uri.empty() ? "udp:" + std::to_string(port) : uri;
+
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstAppSinkCallbacks cbs = {};
+    cbs.new_sample = new_sample_cb;
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &cbs, &rx, nullptr);
+    gst_object_unref(sink);
+
+    rx.loop = g_main_loop_new(NULL, FALSE);
+    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    gst_bus_add_watch(bus, bus_cb, &rx);
+    gst_object_unref(bus);
+    g_timeout_add_seconds(REPORT_INTERVAL_S, report_cb, &rx);
+    g_timeout_add_seconds(duration, quit_cb, &rx);
+
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    g_main_loop_run(rx.loop);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+
+    report(rx, "result");
+
+    gst_object_unref(pipeline);
+    g_main_loop_unref(rx.loop);
+    Log::close();
+
+    return rx.latency.getCount() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
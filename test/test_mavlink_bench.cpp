@@ -0,0 +1,711 @@
+/*
+ * This file is part of the Dronecode Camera Manager
+ *
+ * Copyright (C) 2018  Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ *
+ * @brief  This is a benchmark of the MAVLink protocol handling of the Dronecode Camera Manager.
+ *
+ * Like test-mavlink-protocol, this application finds the camera components from their heartbeats
+ * and talks to them as a ground control station. It then runs several GCS at once, each from its
+ * own UDP port, flooding the camera manager with mixed traffic: heartbeats, telemetry at a high
+ * rate and storms of parameter list, read and set requests and of commands. It reports the rate
+ * of messages sent and received, the time to complete a parameter list and the latency of
+ * parameter reads and sets and of command acknowledgements.
+ *
+ * When the metrics endpoint of the camera manager is given, the messages it handled are also
+ * taken from dcm_mavlink_messages_received_total, to tell the rate handled from the rate sent.
+ *
+ *   test-mavlink-bench -g 3 -r 200 -d 30 -m 127.0.0.1:9100
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <errno.h>
+#include <getopt.h>
+#include <mavlink.h>
+#include <memory>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "StageStats.h"
+#include "log.h"
+#include "util.h"
+
+#define BUF_LEN 2048
+#define GCS_SYSID 255
+#define DEFAULT_MAVLINK_PORT 14550
+#define DEFAULT_GCS 3
+#define DEFAULT_TELEMETRY_RATE 100
+#define DEFAULT_DURATION_S 10
+#define DISCOVERY_TIMEOUT_S 10
+#define HEARTBEAT_INTERVAL_US USEC_PER_SEC
+/* Commands are sent back to back, a new one as soon as the last is acknowledged or lost */
+#define COMMAND_TIMEOUT_US (1 * USEC_PER_SEC)
+/* A list not complete by then has its missing parameters asked for one by one */
+#define PARAM_LIST_TIMEOUT_US (2 * USEC_PER_SEC)
+#define PARAM_TIMEOUT_US (1 * USEC_PER_SEC)
+
+struct Stats {
+    std::atomic<uint64_t> sent;
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> lists;
+    std::atomic<uint64_t> commandTimeouts;
+    std::atomic<uint64_t> paramTimeouts;
+    LatencyHistogram commandAck;
+    LatencyHistogram paramList;
+    LatencyHistogram paramRead;
+    LatencyHistogram paramSet;
+};
+
+struct Target {
+    struct sockaddr_in addr;
+    uint8_t sysid;
+    uint8_t compid;
+};
+
+/**
+ *  A ground control station of its own UDP port and MAVLink channel, run in its own thread.
+ *
+ *  The parameters are cycled through three phases: the list is requested, each parameter is then
+ *  read by its index and then set again to the value read. A single parameter request and a single
+ *  command are outstanding at any time.
+ */
+class Gcs {
+public:
+    Gcs(mavlink_channel_t chan, const Target &target, unsigned int telemetryRate, Stats &stats);
+    ~Gcs();
+    int open();
+    void run(const std::atomic<bool> &running);
+
+private:
+    enum Phase { LIST, READ, SET };
+    struct Param {
+        bool known = false;
+        char id[MAVLINK_MSG_PARAM_EXT_VALUE_FIELD_PARAM_ID_LEN];
+        char value[MAVLINK_MSG_PARAM_EXT_VALUE_FIELD_PARAM_VALUE_LEN];
+        uint8_t type;
+    };
+
+    void send(mavlink_message_t &msg);
+    void sendHeartbeat();
+    void sendTelemetry();
+    void sendCommand();
+    void sendParamRequest();
+    void received(const mavlink_message_t &msg);
+    void handleParamValue(const mavlink_param_ext_value_t &value);
+    void handleParamAck(const mavlink_param_ext_ack_t &ack);
+    void nextParam();
+    void checkTimeouts(usec_t now);
+
+    mavlink_channel_t mChan;
+    Target mTarget;
+    unsigned int mTelemetryRate;
+    Stats &mStats;
+    int mFd;
+    uint32_t mTelemetrySeq;
+
+    usec_t mNextHeartbeat;
+    usec_t mNextTelemetry;
+    usec_t mCommandSent; /* 0 if no command outstanding */
+
+    Phase mPhase;
+    usec_t mListStart;
+    bool mListRecovering; /* Reading the parameters the list missed */
+    usec_t mParamSent;    /* 0 if no read or set outstanding */
+    size_t mParamIndex;
+    std::vector<Param> mParams;
+};
+
+static struct {
+    unsigned int gcs = DEFAULT_GCS;
+    unsigned int telemetryRate = DEFAULT_TELEMETRY_RATE;
+    unsigned int duration = DEFAULT_DURATION_S;
+    int port = DEFAULT_MAVLINK_PORT;
+    std::string metrics;
+} opts;
+
+static void help(FILE *fp)
+{
+    fprintf(fp,
+            "%s [OPTIONS...]\n\n"
+            "  -g --gcs <count>          Ground control stations run at once, default %d, max %d\n"
+            "  -r --rate <msgs/sec>      Telemetry rate of each GCS, default %d\n"
+            "  -d --duration <sec>       Time to run, default %d\n"
+            "  -p --port <port>          Port the heartbeats are broadcast to, default %d\n"
+            "  -m --metrics <host:port>  Metrics endpoint of the camera manager\n"
+            "  -h --help                 Print this message\n",
+            program_invocation_short_name, DEFAULT_GCS, MAVLINK_COMM_NUM_BUFFERS,
+            DEFAULT_TELEMETRY_RATE, DEFAULT_DURATION_S, DEFAULT_MAVLINK_PORT);
+}
+
+static int parse_argv(int argc, char *argv[])
+{
+    static const struct option options[] = {{"gcs", required_argument, NULL, 'g'},
+                                            {"rate", required_argument, NULL, 'r'},
+                                            {"duration", required_argument, NULL, 'd'},
+                                            {"port", required_argument, NULL, 'p'},
+                                            {"metrics", required_argument, NULL, 'm'},
+                                            {"help", no_argument, NULL, 'h'},
+                                            {}};
+    int c;
+
+    while ((c = getopt_long(argc, argv, "g:r:d:p:m:h", options, NULL)) >= 0) {
+        switch (c) {
+        case 'g':
+            opts.gcs = atoi(optarg);
+            break;
+        case 'r':
+            opts.telemetryRate = atoi(optarg);
+            break;
+        case 'd':
+            opts.duration = atoi(optarg);
+            break;
+        case 'p':
+            opts.port = atoi(optarg);
+            break;
+        case 'm':
+            opts.metrics = optarg;
+            break;
+        case 'h':
+            help(stdout);
+            return 1;
+        default:
+            help(stderr);
+            return -EINVAL;
+        }
+    }
+
+    if (opts.gcs < 1 || opts.gcs > MAVLINK_COMM_NUM_BUFFERS || opts.duration < 1) {
+        help(stderr);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int open_socket(int port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_error("Could not create socket (%m)");
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_error("Error binding socket to port %d (%m)", port);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Wait for the heartbeat of a camera component, it tells where the camera manager is */
+static int discover(Target &target)
+{
+    int fd = open_socket(opts.port);
+    if (fd < 0)
+        return -1;
+
+    uint8_t buf[BUF_LEN];
+    mavlink_message_t msg;
+    mavlink_status_t status;
+    usec_t deadline = now_usec() + DISCOVERY_TIMEOUT_S * USEC_PER_SEC;
+    int ret = -1;
+
+    while (ret < 0 && now_usec() < deadline) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+        ssize_t r = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr, &addrlen);
+        for (ssize_t i = 0; i < r; i++) {
+            if (!mavlink_parse_char(MAVLINK_COMM_0, buf[i], &msg, &status))
+                continue;
+            if (msg.msgid != MAVLINK_MSG_ID_HEARTBEAT || msg.compid < MAV_COMP_ID_CAMERA
+                || msg.compid > MAV_COMP_ID_CAMERA6)
+                continue;
+            target.addr = addr;
+            target.sysid = msg.sysid;
+            target.compid = msg.compid;
+            ret = 0;
+            break;
+        }
+    }
+
+    close(fd);
+    mavlink_reset_channel_status(MAVLINK_COMM_0);
+    return ret;
+}
+
+/* Sum of the MAVLink messages the camera manager handled, -1 on error */
+static int64_t scrape_messages(const std::string &endpoint)
+{
+    size_t colon = endpoint.rfind(':');
+    if (colon == std::string::npos)
+        return -1;
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(endpoint.c_str() + colon + 1));
+    if (!inet_aton(endpoint.substr(0, colon).c_str(), &addr.sin_addr))
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        log_error("Could not connect to metrics endpoint %s (%m)", endpoint.c_str());
+        close(fd);
+        return -1;
+    }
+
+    static const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+    if (write(fd, request, sizeof(request) - 1) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    std::string body;
+    char buf[BUF_LEN];
+    ssize_t r;
+    while ((r = read(fd, buf, sizeof(buf))) > 0)
+        body.append(buf, r);
+    close(fd);
+
+    static const char name[] = "dcm_mavlink_messages_received_total{";
+    int64_t total = 0;
+    size_t pos = 0;
+    while ((pos = body.find(name, pos)) != std::string::npos) {
+        size_t value = body.find("} ", pos);
+        if (value == std::string::npos)
+            break;
+        total += strtoull(body.c_str() + value + 2, NULL, 10);
+        pos = value;
+    }
+
+    return total;
+}
+
+Gcs::Gcs(mavlink_channel_t chan, const Target &target, unsigned int telemetryRate, Stats &stats)
+    : mChan(chan)
+    , mTarget(target)
+    , mTelemetryRate(telemetryRate)
+    , mStats(stats)
+    , mFd(-1)
+    , mTelemetrySeq(0)
+    , mNextHeartbeat(0)
+    , mNextTelemetry(0)
+    , mCommandSent(0)
+    , mPhase(LIST)
+    , mListStart(0)
+    , mListRecovering(false)
+    , mParamSent(0)
+    , mParamIndex(0)
+{
+}
+
+Gcs::~Gcs()
+{
+    if (mFd >= 0)
+        close(mFd);
+}
+
+int Gcs::open()
+{
+    /* an ephemeral port, so that the camera manager sees a peer of its own */
+    mFd = open_socket(0);
+    return mFd < 0 ? -1 : 0;
+}
+
+void Gcs::send(mavlink_message_t &msg)
+{
+    uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+    uint16_t len = mavlink_msg_to_send_buffer(buf, &msg);
+
+    if (sendto(mFd, buf, len, 0, (struct sockaddr *)&mTarget.addr, sizeof(mTarget.addr)) < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            log_error("Sending message %u failed (%m)", msg.msgid);
+        return;
+    }
+    mStats.sent++;
+}
+
+void Gcs::sendHeartbeat()
+{
+    mavlink_message_t msg;
+    mavlink_msg_heartbeat_pack_chan(GCS_SYSID, MAV_COMP_ID_MISSIONPLANNER, mChan, &msg,
+                                    MAV_TYPE_GCS, MAV_AUTOPILOT_INVALID, 0, 0, MAV_STATE_ACTIVE);
+    send(msg);
+}
+
+void Gcs::sendTelemetry()
+{
+    /* what an autopilot would stream, only the camera pose is of interest to the camera */
+    mavlink_message_t msg;
+    uint32_t t = now_usec() / USEC_PER_MSEC;
+
+    switch (mTelemetrySeq++ % 3) {
+    case 0:
+        mavlink_msg_attitude_pack_chan(GCS_SYSID, MAV_COMP_ID_AUTOPILOT1, mChan, &msg, t, 0.1f,
+                                       0.2f, 0.3f, 0, 0, 0);
+        break;
+    case 1:
+        mavlink_msg_global_position_int_pack_chan(GCS_SYSID, MAV_COMP_ID_AUTOPILOT1, mChan, &msg,
+                                                  t, 473977418, 85455939, 500000, 10000, 0, 0,
+                                                  0, 9000);
+        break;
+    default:
+        mavlink_msg_vfr_hud_pack_chan(GCS_SYSID, MAV_COMP_ID_AUTOPILOT1, mChan, &msg, 10.0f, 10.0f,
+                                      90, 50, 50.0f, 0.5f);
+        break;
+    }
+    send(msg);
+}
+
+void Gcs::sendCommand()
+{
+    mavlink_message_t msg;
+    mavlink_msg_command_long_pack_chan(GCS_SYSID, MAV_COMP_ID_MISSIONPLANNER, mChan, &msg,
+                                       mTarget.sysid, mTarget.compid,
+                                       MAV_CMD_REQUEST_CAMERA_INFORMATION, 0, 1, 0, 0, 0, 0, 0, 0);
+    send(msg);
+    mCommandSent = now_usec();
+}
+
+void Gcs::sendParamRequest()
+{
+    mavlink_message_t msg;
+
+    if (mPhase == LIST && !mListRecovering) {
+        mavlink_msg_param_ext_request_list_pack_chan(GCS_SYSID, MAV_COMP_ID_MISSIONPLANNER, mChan,
+                                                     &msg, mTarget.sysid, mTarget.compid);
+        send(msg);
+        mListStart = now_usec();
+        mParamSent = 0;
+        return;
+    }
+
+    if (mPhase == SET) {
+        const Param &p = mParams[mParamIndex];
+        mavlink_msg_param_ext_set_pack_chan(GCS_SYSID, MAV_COMP_ID_MISSIONPLANNER, mChan, &msg,
+                                            mTarget.sysid, mTarget.compid, p.id, p.value, p.type);
+    } else {
+        const char id[MAVLINK_MSG_PARAM_EXT_REQUEST_READ_FIELD_PARAM_ID_LEN] = {};
+        mavlink_msg_param_ext_request_read_pack_chan(GCS_SYSID, MAV_COMP_ID_MISSIONPLANNER, mChan,
+                                                     &msg, mTarget.sysid, mTarget.compid, id,
+                                                     mParamIndex);
+    }
+    send(msg);
+    mParamSent = now_usec();
+}
+
+/* Move to the next parameter to be read or set, or to the next phase */
+void Gcs::nextParam()
+{
+    mParamIndex++;
+    if (mPhase == LIST) {
+        /* the parameters the list missed are read one by one */
+        while (mParamIndex < mParams.size() && mParams[mParamIndex].known)
+            mParamIndex++;
+        if (mParamIndex < mParams.size()) {
+            sendParamRequest();
+            return;
+        }
+        mStats.paramList.record(now_usec() - mListStart);
+        mStats.lists++;
+        mListRecovering = false;
+        mPhase = READ;
+        mParamIndex = 0;
+    } else if (mParamIndex >= mParams.size()) {
+        mPhase = mPhase == READ ? SET : LIST;
+        mParamIndex = 0;
+    }
+
+    if (mPhase == LIST) {
+        for (auto &p : mParams)
+            p.known = false;
+    }
+    sendParamRequest();
+}
+
+void Gcs::handleParamValue(const mavlink_param_ext_value_t &value)
+{
+    if (value.param_index >= value.param_count)
+        return;
+    if (mParams.size() != value.param_count)
+        mParams.resize(value.param_count);
+
+    Param &p = mParams[value.param_index];
+    p.known = true;
+    memcpy(p.id, value.param_id, sizeof(p.id));
+    memcpy(p.value, value.param_value, sizeof(p.value));
+    p.type = value.param_type;
+
+    switch (mPhase) {
+    case LIST:
+        /* answers to reads of the parameters the list missed come in one at a time */
+        if (mListRecovering) {
+            if (!mParamSent || value.param_index != mParamIndex)
+                return;
+            mParamSent = 0;
+            nextParam();
+            return;
+        }
+        for (const auto &q : mParams)
+            if (!q.known)
+                return;
+        mStats.paramList.record(now_usec() - mListStart);
+        mStats.lists++;
+        mPhase = READ;
+        mParamIndex = 0;
+        sendParamRequest();
+        break;
+    case READ:
+        if (!mParamSent || value.param_index != mParamIndex)
+            return;
+        mStats.paramRead.record(now_usec() - mParamSent);
+        mParamSent = 0;
+        nextParam();
+        break;
+    case SET:
+        break;
+    }
+}
+
+void Gcs::handleParamAck(const mavlink_param_ext_ack_t &ack)
+{
+    if (mPhase != SET || !mParamSent)
+        return;
+    if (strncmp(ack.param_id, mParams[mParamIndex].id, sizeof(ack.param_id)))
+        return;
+
+    mStats.paramSet.record(now_usec() - mParamSent);
+    mParamSent = 0;
+    nextParam();
+}
+
+void Gcs::received(const mavlink_message_t &msg)
+{
+    mStats.received++;
+    if (msg.compid != mTarget.compid)
+        return;
+
+    switch (msg.msgid) {
+    case MAVLINK_MSG_ID_COMMAND_ACK: {
+        mavlink_command_ack_t ack;
+        mavlink_msg_command_ack_decode(&msg, &ack);
+        if (ack.command != MAV_CMD_REQUEST_CAMERA_INFORMATION || !mCommandSent)
+            return;
+        mStats.commandAck.record(now_usec() - mCommandSent);
+        sendCommand();
+        break;
+    }
+    case MAVLINK_MSG_ID_PARAM_EXT_VALUE: {
+        mavlink_param_ext_value_t value;
+        mavlink_msg_param_ext_value_decode(&msg, &value);
+        handleParamValue(value);
+        break;
+    }
+    case MAVLINK_MSG_ID_PARAM_EXT_ACK: {
+        mavlink_param_ext_ack_t ack;
+        mavlink_msg_param_ext_ack_decode(&msg, &ack);
+        handleParamAck(ack);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void Gcs::checkTimeouts(usec_t now)
+{
+    if (mCommandSent && now - mCommandSent > COMMAND_TIMEOUT_US) {
+        mStats.commandTimeouts++;
+        sendCommand();
+    }
+
+    if (mPhase == LIST && !mListRecovering) {
+        if (now - mListStart <= PARAM_LIST_TIMEOUT_US)
+            return;
+        if (mParams.empty()) {
+            /* not a single value came back, ask again */
+            mStats.paramTimeouts++;
+            sendParamRequest();
+            return;
+        }
+        /* a list restarted by another GCS, or values lost: read what is missing */
+        mListRecovering = true;
+        mParamIndex = (size_t)-1;
+        nextParam();
+        return;
+    }
+
+    if (mParamSent && now - mParamSent > PARAM_TIMEOUT_US) {
+        mStats.paramTimeouts++;
+        sendParamRequest();
+    }
+}
+
+void Gcs::run(const std::atomic<bool> &running)
+{
+    uint8_t buf[BUF_LEN];
+    mavlink_message_t msg;
+    mavlink_status_t status;
+    usec_t telemetryInterval = mTelemetryRate ? USEC_PER_SEC / mTelemetryRate : 0;
+
+    sendHeartbeat();
+    mNextHeartbeat = now_usec() + HEARTBEAT_INTERVAL_US;
+    mNextTelemetry = now_usec();
+    sendCommand();
+    sendParamRequest();
+
+    while (running) {
+        usec_t now = now_usec();
+        if (now >= mNextHeartbeat) {
+            sendHeartbeat();
+            mNextHeartbeat += HEARTBEAT_INTERVAL_US;
+        }
+        /* telemetry bursts catch up if the thread fell behind */
+        while (telemetryInterval && now >= mNextTelemetry) {
+            sendTelemetry();
+            mNextTelemetry += telemetryInterval;
+        }
+        checkTimeouts(now);
+
+        usec_t next = telemetryInterval ? std::min(mNextHeartbeat, mNextTelemetry) : mNextHeartbeat;
+        int timeout = next > now ? (next - now + USEC_PER_MSEC - 1) / USEC_PER_MSEC : 0;
+        struct pollfd pfd = {mFd, POLLIN, 0};
+        if (poll(&pfd, 1, std::min(timeout, 100)) <= 0)
+            continue;
+
+        ssize_t r;
+        while ((r = recv(mFd, buf, sizeof(buf), 0)) > 0) {
+            for (ssize_t i = 0; i < r; i++)
+                if (mavlink_parse_char(mChan, buf[i], &msg, &status))
+                    received(msg);
+        }
+    }
+}
+
+static void report(Stats &stats, double secs, int64_t handled)
+{
+    LatencyHistogram::Summary s;
+
+    printf("gcs=%u telemetry_rate=%u duration=%.1fs\n", opts.gcs, opts.telemetryRate, secs);
+    printf("  sent      %10llu msgs  %10.0f msgs/sec\n", (unsigned long long)stats.sent.load(),
+           stats.sent / secs);
+    printf("  received  %10llu msgs  %10.0f msgs/sec\n",
+           (unsigned long long)stats.received.load(), stats.received / secs);
+    if (handled >= 0)
+        printf("  handled   %10lld msgs  %10.0f msgs/sec\n", (long long)handled, handled / secs);
+    printf("  timeouts  commands=%llu params=%llu\n",
+           (unsigned long long)stats.commandTimeouts.load(),
+           (unsigned long long)stats.paramTimeouts.load());
+
+    struct {
+        const char *name;
+        LatencyHistogram &hist;
+    } latencies[] = {{"command_ack", stats.commandAck},
+                     {"param_list", stats.paramList},
+                     {"param_read", stats.paramRead},
+                     {"param_set", stats.paramSet}};
+    for (auto &l : latencies) {
+        l.hist.summarize(s);
+        printf("  %-12s n=%-8llu ms p50=%.2f p90=%.2f p99=%.2f max=%.2f\n", l.name,
+               (unsigned long long)s.count, s.p50 / 1000.0, s.p90 / 1000.0, s.p99 / 1000.0,
+               s.max / 1000.0);
+    }
+}
+
+/* The benchmark, main() opens and closes the log around it */
+static int run()
+{
+    Target target;
+    if (discover(target) < 0) {
+        log_error("No camera component found in %d seconds", DISCOVERY_TIMEOUT_S);
+        return EXIT_FAILURE;
+    }
+    printf("Camera component sysid: %d comp_id: %d at %s:%d\n", target.sysid, target.compid,
+           inet_ntoa(target.addr.sin_addr), ntohs(target.addr.sin_port));
+
+    Stats stats;
+    std::vector<std::unique_ptr<Gcs>> gcs;
+    for (unsigned int i = 0; i < opts.gcs; i++) {
+        gcs.emplace_back(new Gcs((mavlink_channel_t)i, target, opts.telemetryRate, stats));
+        if (gcs.back()->open() < 0)
+            return EXIT_FAILURE;
+    }
+
+    int64_t handledStart = opts.metrics.empty() ? -1 : scrape_messages(opts.metrics);
+
+    std::atomic<bool> running(true);
+    std::vector<std::thread> threads;
+    usec_t start = now_usec();
+    for (auto &g : gcs)
+        threads.push_back(std::thread(&Gcs::run, g.get(), std::cref(running)));
+
+    sleep(opts.duration);
+    running = false;
+    for (auto &t : threads)
+        t.join();
+    double secs = (now_usec() - start) / (double)USEC_PER_SEC;
+
+    int64_t handled = -1;
+    if (handledStart >= 0) {
+        int64_t handledEnd = scrape_messages(opts.metrics);
+        if (handledEnd >= handledStart)
+            handled = handledEnd - handledStart;
+    }
+
+    report(stats, secs, handled);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    Log::open();
+    Log::set_max_level(Log::Level::WARNING);
+
+    int r = parse_argv(argc, argv);
+    if (r != 0)
+        r = r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    else
+        r = run();
+
+    Log::close();
+    return r;
+}